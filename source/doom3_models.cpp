@@ -13,6 +13,13 @@
 
 #include "framework/gl_utils.hpp"
 #include "framework/doom3md5.hpp"
+#include "framework/compressed_anim.hpp"
+#include "framework/frustum.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <thread>
 
 // App constants:
 constexpr int initialWinWidth  = 1024;
@@ -22,6 +29,10 @@ const std::string baseWindowTitle   { "DOOM 3 MD5 Models demo"   };
 const std::string lightCookieFile   { "assets/cookie0"           };
 const std::string floorTileFile     { "assets/floor_tile"        };
 const std::string animBasePath      { "assets/hellknight/anims/" };
+const std::string modelFile         { "assets/hellknight/hellknight.md5mesh" };
+const std::string layerAnimFile     { "assets/hellknight/anims/head_pain.md5anim" };
+const std::string layerMaskJoint    { "neck" };
+constexpr double animFadeSeconds    { 0.25 };
 
 // ========================================================
 // class Doom3ModelsApp:
@@ -29,7 +40,7 @@ const std::string animBasePath      { "assets/hellknight/anims/" };
 
 //
 // User interaction keys:
-//  [N] -> Cycles the model animation.
+//  [N] -> Cycles the model animation, crossfading from the current one.
 //  [H] -> Return the model to bind/home pose.
 //  [I] -> Back to idle animation.
 //  [P] -> Pause/resume the current animation.
@@ -38,6 +49,25 @@ const std::string animBasePath      { "assets/hellknight/anims/" };
 //  [R] -> Toggle auto rotation of the scene.
 //  [F] -> Toggle the flashlight on/off.
 //  [X] -> Toggle shadow rendering.
+//  [C] -> Compress all animations and report memory, accuracy and sampling cost.
+//  [K] -> Benchmark the scalar vs SIMD CPU skinning and check they match.
+//  [M] -> Toggle the SIMD CPU skinning (on by default).
+//  [B] -> Benchmark the multi-threaded crowd update with 1, 100 and 1000 instances (not drawn).
+//  [G] -> Toggle the GPU skinning (off by default).
+//  [U] -> Check the GPU skinning against the CPU and report the per-frame CPU time and upload size.
+//  [E] -> Spawn entities of the model from files and report the spawn time and memory per entity.
+//  [V] -> Toggle a crowd of instances around the model, drawn in groups that share a pose.
+//  [Y] -> Toggle the pose sharing of the crowd (every instance skinned and drawn on its own).
+//  [A] -> Benchmark the per-frame tangent basis update and check it against the reference.
+//  [D] -> Toggle between derived and skinned tangent basis on the CPU skinning path.
+//  [L] -> Report the accuracy and CPU time of each animation LOD level.
+//  [O] -> Toggle frustum culling of the model and the crowd with the animation bounds (on by default).
+//  [Z] -> Toggle playing the animations from baked vertex caches (off by default, bakes on first use).
+//  [J] -> Compare the memory and CPU time of the baked vertex caches with live CPU skinning.
+//  [Q] -> Benchmark batched stateless clip sampling on 1 to N threads and check the frame catch-up.
+//  [W] -> Toggle an additive head pain layer, masked to the neck and head.
+//  [1] -> Benchmark the pose blending kernels in joints per microsecond and check them against the scalar reference.
+//  [2] -> Compare the memory and draw calls of 32-bit indexes and meshlets for meshes too big for 16-bit indexes.
 //
 // Mouse buttons:
 //  [RIGHT BTN]    -> Toggle the flashlight on/off.
@@ -72,7 +102,7 @@ private:
     };
 
     // Model and misc switches:
-    DOOM3::AnimatedEntity entity       { *this, "assets/hellknight/hellknight.md5mesh", animFiles };
+    DOOM3::AnimatedEntity entity       { *this, modelFile, animFiles };
     int   currAnimNum                  { 0       };
     bool  pauseAnim                    { false   };
     bool  showSkeleton                 { false   };
@@ -80,9 +110,20 @@ private:
     bool  autoRotate                   { true    };
     bool  drawShadow                   { true    };
     bool  flashlightOn                 { false   };
+    bool  cullAnimated                 { true    };
+    bool  entityPoseStale              { false   }; // Culled while the animation played.
     float modelZoom                    { -7.0f   };
     float modelRotationDegreesY        {  180.0f };
 
+    // Crowd of instances of the model, grouped by pose for instanced drawing.
+    // Poses are shared within 1/60th of a second of playback time.
+    bool  showCrowd                    { false   };
+    int   crowdReportFrames            { 0       };
+    DOOM3::InstancedCrowd instancedCrowd { *this, 1.0 / 60.0 };
+    std::vector<std::unique_ptr<DOOM3::AnimatedEntity>> crowdInstances;
+    std::vector<DOOM3::AnimatedEntity *> crowdInstancePtrs;
+    std::vector<Mat4> crowdInstanceMatrices;
+
     // Floor plane (made of several small triangular tiles):
     GLVertexArray floorPlane           { *this };
     GLTexture floorBaseTexture         { *this };
@@ -129,6 +170,33 @@ public:
     void onMouseMotion(int x, int y) override;
     void onMouseScroll(double xOffset, double yOffset) override;
     void onKeyChar(unsigned int chr) override;
+    void runCompressionReport();
+    void runSkinningBenchmark();
+    void runCrowdBenchmark();
+    void runGpuSkinningReport();
+    void runEntitySpawnReport();
+    void runTangentBenchmark();
+    void runAnimLodReport();
+    void runVertexCacheReport();
+    void runSamplingBenchmark();
+    void runBlendBenchmark();
+    void runLargeMeshReport();
+
+    // Fixtures shared by the benchmarks:
+    struct SyntheticMesh
+    {
+        DOOM3::Mesh                mesh;
+        std::vector<GLDrawVertex>  bindPoseVerts;
+        std::vector<GLDrawVertex>  posedVerts;
+        std::vector<GLDrawIndex32> indexes;
+    };
+    const DOOM3::AnimInstance * findWalkAnimation(const char * benchmarkName);
+    SyntheticMesh makeSyntheticMesh(const DOOM3::Mesh & source, int numCopies, const DOOM3::Pose * pose) const;
+    static void makeFixedPose(const DOOM3::AnimInstance & anim, DOOM3::Pose & poseOut);
+    static std::vector<int> getBenchmarkThreadCounts();
+    void spawnCrowd();
+    void updateAndDrawCrowd(double elapsedTimeSeconds, const Mat4 & mvpMatrix, const Frustum * frustum,
+                            const Point3 & eyePosModelSpace, const DOOM3::LightBase ** lights, int numLights);
 };
 
 // ========================================================
@@ -292,14 +360,38 @@ void Doom3ModelsApp::onFrameRender(std::int64_t /* currentTimeMillis */, const s
     // DOOM3 model drawing / anim update:
     //
 
+    // Frustum in the model space of the scene. If the animation bounds of the model
+    // are outside it, only the playback time moves, the pose is updated once visible.
+    const Frustum viewFrustum{ viewMatrix * modelToWorldMatrix, projMatrix };
+
     if (!pauseAnim)
     {
-        entity.updateAnimation(elapsedTimeSeconds);
+        entity.advanceAnimation(elapsedTimeSeconds);
+    }
+
+    const bool entityVisible = !cullAnimated || entity.isInFrustum(viewFrustum, Mat4::identity());
+    if (entityVisible && (!pauseAnim || entityPoseStale))
+    {
+        entity.sampleCurrentPose();
         entity.updateModelPose();
+        entityPoseStale = false;
+    }
+    else if (!entityVisible && !pauseAnim)
+    {
+        entityPoseStale = true;
     }
 
     const Mat4 mvpMatrix = projMatrix * viewMatrix * modelToWorldMatrix; // In OGL layout p*v*m
-    entity.drawWholeModel(GL_TRIANGLES, mvpMatrix, eyePosModelSpace, nullptr, lights, (flashlightOn ? 2 : 1));
+    if (entityVisible)
+    {
+        entity.drawWholeModel(GL_TRIANGLES, mvpMatrix, eyePosModelSpace, nullptr, lights, (flashlightOn ? 2 : 1));
+    }
+
+    if (showCrowd)
+    {
+        updateAndDrawCrowd((pauseAnim ? 0.0 : elapsedTimeSeconds), mvpMatrix, (cullAnimated ? &viewFrustum : nullptr),
+                           eyePosModelSpace, lights, (flashlightOn ? 2 : 1));
+    }
 
     //
     // Floor plane drawing:
@@ -317,7 +409,8 @@ void Doom3ModelsApp::onFrameRender(std::int64_t /* currentTimeMillis */, const s
     // Simple plane-projected shadow for the point light:
     //
 
-    if (drawShadow)
+    // The shadow is skipped with the culled model, since its pose is stale.
+    if (drawShadow && entityVisible)
     {
         const auto shadowLightPos = toPoint3(Mat4::rotationY(degToRad(-modelRotationDegreesY)) * pointLight.positionWorldSpace);
         const Mat4 shadowOffset   = Mat4::translation(Vec3{ 0.0f, 0.1f, 0.0f });
@@ -358,6 +451,1338 @@ void Doom3ModelsApp::onFrameRender(std::int64_t /* currentTimeMillis */, const s
     }
 }
 
+void Doom3ModelsApp::runCompressionReport()
+{
+    using Clock = std::chrono::high_resolution_clock;
+    constexpr int SamplesPerClip = 2000;
+
+    const DOOM3::AnimCompressionSettings settings;
+    printF("---- Animation compression (max joint space error %.3f, error distance %.1f) ----",
+           settings.maxError, settings.errorDistance);
+
+    std::size_t totalRawBytes        = 0;
+    std::size_t totalCompressedBytes = 0;
+    double totalRawUs                = 0.0;
+    double totalCompressedUs         = 0.0;
+    int sharedSkeletons              = 0;
+    int numClips                     = 0;
+
+    for (const auto & animFile : animFiles)
+    {
+        const DOOM3::AnimInstance * anim = entity.findAnimation(animFile);
+        if (anim == nullptr || anim->getNumFrames() <= 0)
+        {
+            continue;
+        }
+
+        // Interned skeletons: a compatible animation points to the model's own.
+        if (&anim->getSkeleton() == &entity.getModelInstance().getSkeleton())
+        {
+            ++sharedSkeletons;
+        }
+
+        const auto compressStart = Clock::now();
+        const DOOM3::CompressedAnim clip{ *anim, settings };
+        const double compressMs = std::chrono::duration<double, std::milli>(Clock::now() - compressStart).count();
+
+        // Sample both at the same fractional frames, spread over the clip.
+        DOOM3::Pose pose;
+        pose.resize(anim->getNumJoints());
+        const int lastFrame = anim->getNumFrames() - 1;
+
+        const auto rawStart = Clock::now();
+        for (int s = 0; s < SamplesPerClip; ++s)
+        {
+            const float frame = static_cast<float>(s) * lastFrame / SamplesPerClip;
+            const int   f0    = static_cast<int>(frame);
+            const int   f1    = std::min(f0 + 1, lastFrame);
+            DOOM3::AnimatedEntity::interpolatePoses(anim->getFrameRotations(f0), anim->getFramePositions(f0),
+                                                    anim->getFrameRotations(f1), anim->getFramePositions(f1),
+                                                    anim->getNumJoints(), frame - f0, pose);
+        }
+        const double rawUs = std::chrono::duration<double, std::micro>(Clock::now() - rawStart).count() / SamplesPerClip;
+
+        // Sequential playback, so the per-track cursors skip the key search.
+        DOOM3::CompressedAnim::Cursor cursor;
+        const auto compressedStart = Clock::now();
+        for (int s = 0; s < SamplesPerClip; ++s)
+        {
+            clip.sample(static_cast<float>(s) * lastFrame / SamplesPerClip, pose, &cursor);
+        }
+        const double compressedUs = std::chrono::duration<double, std::micro>(Clock::now() - compressedStart).count() / SamplesPerClip;
+
+        const int maxKeys = anim->getNumFrames() * anim->getNumJoints();
+        printF("%-45s %6.1f KB -> %5.1f KB (%5.1fx), keys R %5.1f%% T %5.1f%%, "
+               "max error joint %.4f model %.4f, sample %.2fus -> %.2fus, compressed in %.1fms",
+               animFile.c_str(), anim->getMemoryBytes() / 1024.0, clip.getMemoryBytes() / 1024.0,
+               static_cast<double>(anim->getMemoryBytes()) / clip.getMemoryBytes(),
+               100.0 * clip.getNumRotationKeys() / maxKeys, 100.0 * clip.getNumTranslationKeys() / maxKeys,
+               clip.getMaxJointSpaceError(), clip.getMaxModelSpaceError(), rawUs, compressedUs, compressMs);
+
+        totalRawBytes        += anim->getMemoryBytes();
+        totalCompressedBytes += clip.getMemoryBytes();
+        totalRawUs           += rawUs;
+        totalCompressedUs    += compressedUs;
+        ++numClips;
+    }
+
+    if (numClips == 0)
+    {
+        printF("No animations to compress!");
+        return;
+    }
+
+    printF("Total: %.1f KB -> %.1f KB (%.1fx). Average sample cost %.2fus -> %.2fus.",
+           totalRawBytes / 1024.0, totalCompressedBytes / 1024.0,
+           static_cast<double>(totalRawBytes) / std::max<std::size_t>(totalCompressedBytes, 1),
+           totalRawUs / numClips, totalCompressedUs / numClips);
+
+    const auto & skeleton = entity.getModelInstance().getSkeleton();
+    printF("Skeleton: %d joints, %.1f KB, shared by the model and %d of %d animations.",
+           skeleton.getNumJoints(), skeleton.getMemoryBytes() / 1024.0, sharedSkeletons, numClips);
+}
+
+void Doom3ModelsApp::runSkinningBenchmark()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    const DOOM3::AnimInstance * anim = findWalkAnimation("Skinning benchmark");
+    if (anim == nullptr)
+    {
+        return;
+    }
+
+    DOOM3::Pose pose;
+    makeFixedPose(*anim, pose);
+
+    // The synthetic mesh repeats the hellknight, with its weights, up to 100k vertexes.
+    const DOOM3::Mesh & hellknight = entity.getModelInstance().getMeshes().front();
+    const int numCopies = (100000 + static_cast<int>(hellknight.vertexes.size()) - 1) / static_cast<int>(hellknight.vertexes.size());
+    const DOOM3::Mesh synthetic = makeSyntheticMesh(hellknight, numCopies, nullptr).mesh;
+
+    struct TestMesh
+    {
+        const char        * name;
+        const DOOM3::Mesh * mesh;
+        int                 iterations;
+    } const testMeshes[] = {
+        { "hellknight",   &hellknight, 500 },
+        { "synthetic100k", &synthetic, 20  }
+    };
+
+#if defined(__AVX__)
+    const char * simdName = "AVX";
+#elif defined(__SSE__)
+    const char * simdName = "SSE";
+#else
+    const char * simdName = "scalar fallback";
+#endif
+    printF("---- CPU skinning benchmark (%s, %d-vertex batches) ----", simdName, DOOM3::SkinningBatches::BatchSize);
+
+    std::vector<float> matrices(pose.getNumJoints() * DOOM3::SkinningMatrixFloats);
+    for (const auto & test : testMeshes)
+    {
+        const DOOM3::Mesh & mesh = *test.mesh;
+        const DOOM3::SkinningBatches batches{ mesh };
+
+        std::vector<GLDrawVertex> scalarVerts;
+        std::vector<GLDrawVertex> simdVerts(mesh.vertexes.size());
+
+        const auto scalarStart = Clock::now();
+        for (int i = 0; i < test.iterations; ++i)
+        {
+            DOOM3::AnimatedEntity::animateMesh(mesh, pose, &scalarVerts, nullptr);
+        }
+        const double scalarSec = std::chrono::duration<double>(Clock::now() - scalarStart).count();
+
+        // Matrix setup is part of the SIMD cost, since it happens once per pose.
+        const auto simdStart = Clock::now();
+        for (int i = 0; i < test.iterations; ++i)
+        {
+            DOOM3::buildSkinningMatrices(pose, DOOM3::AnimatedEntity::ModelScale, matrices.data());
+            batches.skin(matrices.data(), simdVerts.data());
+        }
+        const double simdSec = std::chrono::duration<double>(Clock::now() - simdStart).count();
+
+        float maxError = 0.0f;
+        for (std::size_t v = 0; v < mesh.vertexes.size(); ++v)
+        {
+            maxError = std::max(maxError, std::fabs(scalarVerts[v].px - simdVerts[v].px));
+            maxError = std::max(maxError, std::fabs(scalarVerts[v].py - simdVerts[v].py));
+            maxError = std::max(maxError, std::fabs(scalarVerts[v].pz - simdVerts[v].pz));
+        }
+
+        const double numVerts = static_cast<double>(mesh.vertexes.size()) * test.iterations;
+        printF("%-14s %6zu verts, %6d weights (+%.1f%% padding): scalar %6.1f Mverts/s, SIMD %6.1f Mverts/s (%.1fx), max error %.6f",
+               test.name, mesh.vertexes.size(), batches.getNumWeights(),
+               100.0 * (batches.getNumSlotLanes() - batches.getNumWeights()) / std::max(batches.getNumWeights(), 1),
+               numVerts / scalarSec / 1e6, numVerts / simdSec / 1e6, scalarSec / simdSec, maxError);
+    }
+}
+
+void Doom3ModelsApp::runCrowdBenchmark()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr int    crowdSizes[]  = { 1, 100, 1000 };
+    constexpr int    maxCrowdSize  = 1000;
+    constexpr int    framesPerRun  = 20;
+    constexpr double frameTimeSec  = 1.0 / 60.0;
+
+    const DOOM3::AnimInstance * anim = findWalkAnimation("Crowd benchmark");
+    if (anim == nullptr)
+    {
+        return;
+    }
+
+    // Instances of the demo entity, each starting at a different frame of the walk
+    // cycle, so they don't all sample the same poses.
+    const auto spawnStart = Clock::now();
+    std::vector<std::unique_ptr<DOOM3::AnimatedEntity>> crowd;
+    std::vector<DOOM3::AnimatedEntity *> crowdPtrs;
+    crowd.reserve(maxCrowdSize);
+    crowdPtrs.reserve(maxCrowdSize);
+
+    for (int i = 0; i < maxCrowdSize; ++i)
+    {
+        crowd.emplace_back(new DOOM3::AnimatedEntity{ *this, entity });
+        crowdPtrs.push_back(crowd.back().get());
+
+        crowd.back()->setAnimation(anim);
+        crowd.back()->updateAnimation((i % anim->getNumFrames()) * anim->getDurationSeconds());
+    }
+    const double spawnMs = std::chrono::duration<double, std::milli>(Clock::now() - spawnStart).count();
+
+    const std::vector<int> threadCounts = getBenchmarkThreadCounts();
+    const int numCores = threadCounts.back();
+
+    printF("---- Crowd update benchmark (%d cores, %d instances spawned in %.1fms, %d frames per run) ----",
+           numCores, maxCrowdSize, spawnMs, framesPerRun);
+
+    double singleThreadMs[arrayLength(crowdSizes)] = {};
+    for (const int numThreads : threadCounts)
+    {
+        WorkerPool pool{ numThreads - 1 };
+        for (int s = 0; s < arrayLength(crowdSizes); ++s)
+        {
+            const int crowdSize = crowdSizes[s];
+            DOOM3::updateCrowd(crowdPtrs.data(), crowdSize, frameTimeSec, pool); // Warm up.
+
+            DOOM3::CrowdUpdateTimes total;
+            for (int f = 0; f < framesPerRun; ++f)
+            {
+                const auto times = DOOM3::updateCrowd(crowdPtrs.data(), crowdSize, frameTimeSec, pool);
+                total.animateMs += times.animateMs;
+                total.uploadMs  += times.uploadMs;
+            }
+
+            const double animateMs = total.animateMs / framesPerRun;
+            const double uploadMs  = total.uploadMs  / framesPerRun;
+            if (numThreads == 1)
+            {
+                singleThreadMs[s] = animateMs;
+            }
+
+            // Scaling is for the parallel stage only. The upload is always on this thread.
+            const double speedup = singleThreadMs[s] / animateMs;
+            printF("%4d instances, %2d thread(s): %8.3f ms/frame (animate+skin %8.3fms, upload %7.3fms), "
+                   "%5.2fx speedup, %3.0f%% efficiency",
+                   crowdSize, numThreads, animateMs + uploadMs, animateMs, uploadMs,
+                   speedup, 100.0 * speedup / numThreads);
+        }
+    }
+
+    // The whole crowd again with animation LOD, spread on a grid in front of the camera
+    // and wider than the view, so there's a mix of levels. Shared pool.
+    const DOOM3::AnimLodPolicy policy;
+    std::vector<DOOM3::AnimLod> lods(maxCrowdSize);
+    int lodCounts[static_cast<int>(DOOM3::AnimLod::Count)] = {};
+
+    constexpr int gridColumns = 50;
+    std::vector<Mat4> gridMatrices;
+    gridMatrices.reserve(maxCrowdSize);
+    for (int i = 0; i < maxCrowdSize; ++i)
+    {
+        const float x = ((i % gridColumns) - gridColumns / 2) * 4.0f;
+        const float z = -2.0f - (i / gridColumns) * 8.0f;
+        gridMatrices.push_back(Mat4::translation(Vec3{ x, 0.0f, z }));
+
+        lods[i] = policy.select(viewMatrix * gridMatrices[i], projMatrix, entity.getBoundsCenter(), entity.getBoundsRadius());
+        ++lodCounts[static_cast<int>(lods[i])];
+    }
+
+    WorkerPool & pool = getWorkerPool();
+    for (const bool useLod : { false, true })
+    {
+        DOOM3::CrowdUpdateTimes total;
+        for (int f = 0; f < framesPerRun; ++f)
+        {
+            const auto times = useLod ?
+                DOOM3::updateCrowd(crowdPtrs.data(), lods.data(), maxCrowdSize, frameTimeSec, policy, pool) :
+                DOOM3::updateCrowd(crowdPtrs.data(), maxCrowdSize, frameTimeSec, pool);
+            total.animateMs  += times.animateMs;
+            total.uploadMs   += times.uploadMs;
+            total.numUpdated += times.numUpdated;
+        }
+
+        printF("%4d instances, %2d thread(s), LOD %-3s: %8.3f ms/frame (animate+skin %8.3fms, upload %7.3fms), "
+               "%4d updates/frame. Full %d, Reduced %d, Low %d, Frozen %d",
+               maxCrowdSize, pool.getNumThreads(), (useLod ? "on" : "off"),
+               (total.animateMs + total.uploadMs) / framesPerRun, total.animateMs / framesPerRun,
+               total.uploadMs / framesPerRun, total.numUpdated / framesPerRun,
+               (useLod ? lodCounts[0] : maxCrowdSize), (useLod ? lodCounts[1] : 0),
+               (useLod ? lodCounts[2] : 0), (useLod ? lodCounts[3] : 0));
+    }
+
+    // Same grid, culled every frame with the bounds of the current animation frame.
+    // Entities in view get a full update, the others the Frozen level: playback time
+    // only. The bounds tests are timed too, since they run every frame.
+    const Frustum viewFrustum{ viewMatrix, projMatrix };
+    double fullUpdateMs = 0.0;
+    for (const bool useCulling : { false, true })
+    {
+        DOOM3::CrowdUpdateTimes total;
+        double cullMs = 0.0;
+        int numCulled = 0;
+
+        for (int f = 0; f < framesPerRun; ++f)
+        {
+            const auto cullStart = Clock::now();
+            for (int i = 0; i < maxCrowdSize; ++i)
+            {
+                const bool visible = !useCulling || crowdPtrs[i]->isInFrustum(viewFrustum, gridMatrices[i]);
+                lods[i] = (visible ? DOOM3::AnimLod::Full : DOOM3::AnimLod::Frozen);
+                numCulled += !visible;
+            }
+            cullMs += std::chrono::duration<double, std::milli>(Clock::now() - cullStart).count();
+
+            const auto times = DOOM3::updateCrowd(crowdPtrs.data(), lods.data(), maxCrowdSize, frameTimeSec, policy, pool);
+            total.animateMs  += times.animateMs;
+            total.uploadMs   += times.uploadMs;
+            total.numUpdated += times.numUpdated;
+        }
+
+        const double frameMs = (cullMs + total.animateMs + total.uploadMs) / framesPerRun;
+        if (!useCulling)
+        {
+            fullUpdateMs = frameMs;
+        }
+
+        printF("%4d instances, %2d thread(s), culling %-3s: %8.3f ms/frame (bounds test %6.3fms, animate+skin %8.3fms, "
+               "upload %7.3fms), %4d culled/frame, %8.3fms saved",
+               maxCrowdSize, pool.getNumThreads(), (useCulling ? "on" : "off"), frameMs,
+               cullMs / framesPerRun, total.animateMs / framesPerRun, total.uploadMs / framesPerRun,
+               numCulled / framesPerRun, fullUpdateMs - frameMs);
+    }
+}
+
+void Doom3ModelsApp::runGpuSkinningReport()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr int    framesPerMode = 300;
+    constexpr double frameTimeSec  = 1.0 / 60.0;
+
+    const DOOM3::AnimInstance * anim = findWalkAnimation("GPU skinning report");
+    if (anim == nullptr)
+    {
+        return;
+    }
+
+    // A separate instance, so the demo entity keeps its animation state.
+    // Checked halfway between two frames, to include the interpolation.
+    DOOM3::AnimatedEntity instance{ *this, entity };
+    instance.setAnimation(anim);
+    instance.updateAnimation((anim->getNumFrames() / 2 + 0.5) * anim->getDurationSeconds());
+
+    const float maxError = instance.measureGpuSkinningError();
+    if (maxError < 0.0f)
+    {
+        printF("GPU skinning is not available for this model!");
+        return;
+    }
+
+    printF("---- GPU skinning report (%d frames per mode) ----", framesPerMode);
+    printF("GPU vs CPU reference skinning: max vertex position error %.6f", maxError);
+
+    const bool gpuSkinningWasOn = DOOM3::g_bGpuSkinning;
+    for (const bool gpuSkinning : { false, true })
+    {
+        DOOM3::g_bGpuSkinning = gpuSkinning;
+        instance.updateAnimation(frameTimeSec); // Warm up.
+        instance.updateModelPose();
+
+        double animateSec = 0.0;
+        double uploadSec  = 0.0;
+        for (int f = 0; f < framesPerMode; ++f)
+        {
+            const auto animateStart = Clock::now();
+            instance.updateAnimation(frameTimeSec);
+            instance.skinModelPose();
+
+            const auto uploadStart = Clock::now();
+            instance.uploadModelPose();
+            const auto uploadEnd = Clock::now();
+
+            animateSec += std::chrono::duration<double>(uploadStart - animateStart).count();
+            uploadSec  += std::chrono::duration<double>(uploadEnd - uploadStart).count();
+        }
+
+        const char * modeName = gpuSkinning ? "GPU skinning" : (DOOM3::g_bSimdSkinning ? "CPU skinning (SIMD)" : "CPU skinning (scalar)");
+        printF("%-21s: %7.3f ms CPU per frame (animate+skin %7.3fms, upload %7.3fms), %6zu bytes uploaded per frame",
+               modeName, (animateSec + uploadSec) * 1000.0 / framesPerMode, animateSec * 1000.0 / framesPerMode,
+               uploadSec * 1000.0 / framesPerMode, instance.getPoseUploadBytes());
+    }
+    DOOM3::g_bGpuSkinning = gpuSkinningWasOn;
+}
+
+void Doom3ModelsApp::runTangentBenchmark()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    const DOOM3::AnimInstance * anim = findWalkAnimation("Tangent benchmark");
+    if (anim == nullptr)
+    {
+        return;
+    }
+
+    // Skinned vertexes of the same fixed pose as the skinning benchmark.
+    DOOM3::Pose pose;
+    makeFixedPose(*anim, pose);
+
+    // The synthetic mesh repeats the hellknight as many times as 16-bit indexes allow.
+    const DOOM3::Mesh & hellknight = entity.getModelInstance().getMeshes().back();
+    const int numCopies = 65536 / static_cast<int>(hellknight.vertexes.size());
+    const SyntheticMesh single    = makeSyntheticMesh(hellknight, 1, &pose);
+    const SyntheticMesh synthetic = makeSyntheticMesh(hellknight, numCopies, &pose);
+
+    struct TestMesh
+    {
+        const char                       * name;
+        const DOOM3::Mesh                * mesh;
+        const std::vector<GLDrawVertex>  * bindPoseVerts;
+        const std::vector<GLDrawVertex>  * posedVerts;
+        const std::vector<GLDrawIndex32> * indexes;
+        int                                iterations;
+    } const testMeshes[] = {
+        { "hellknight",   &hellknight,     &single.bindPoseVerts,    &single.posedVerts,    &single.indexes,    500 },
+        { "synthetic64k", &synthetic.mesh, &synthetic.bindPoseVerts, &synthetic.posedVerts, &synthetic.indexes, 20  }
+    };
+
+    DOOM3::Pose bindPose;
+    bindPose.setFromJoints(entity.getModelInstance().getJoints());
+    std::vector<float> normalMatrices(pose.getNumJoints() * DOOM3::SkinningMatrixFloats);
+    DOOM3::buildSkinningNormalMatrices(pose, bindPose, normalMatrices.data());
+
+    WorkerPool & pool = getWorkerPool();
+    printF("---- Tangent basis benchmark (%d threads for the parallel derive) ----", pool.getNumThreads());
+
+    for (const auto & test : testMeshes)
+    {
+        const int numVerts   = static_cast<int>(test.posedVerts->size());
+        const int numIndexes = static_cast<int>(test.indexes->size());
+        const DOOM3::TangentSpaceSolver solver{ *test.mesh, test.bindPoseVerts->data(), test.indexes->data(), numIndexes };
+        DOOM3::TangentSpaceSolver::Scratch scratch;
+
+        std::vector<GLDrawVertex> reference = *test.posedVerts;
+        std::vector<GLDrawVertex> derived   = *test.posedVerts;
+        std::vector<GLDrawVertex> skinned   = *test.posedVerts;
+
+        const auto referenceStart = Clock::now();
+        for (int i = 0; i < test.iterations; ++i)
+        {
+            deriveNormalsAndTangents(reference.data(), numVerts, test.indexes->data(), numIndexes, reference.data());
+        }
+        const double referenceMs = std::chrono::duration<double, std::milli>(Clock::now() - referenceStart).count() / test.iterations;
+
+        const auto deriveStart = Clock::now();
+        for (int i = 0; i < test.iterations; ++i)
+        {
+            solver.derive(derived.data(), scratch);
+        }
+        const double deriveMs = std::chrono::duration<double, std::milli>(Clock::now() - deriveStart).count() / test.iterations;
+
+        const auto parallelStart = Clock::now();
+        for (int i = 0; i < test.iterations; ++i)
+        {
+            solver.derive(derived.data(), scratch, &pool);
+        }
+        const double parallelMs = std::chrono::duration<double, std::milli>(Clock::now() - parallelStart).count() / test.iterations;
+
+        const auto skinnedStart = Clock::now();
+        for (int i = 0; i < test.iterations; ++i)
+        {
+            solver.skinBindPose(normalMatrices.data(), skinned.data());
+        }
+        const double skinnedMs = std::chrono::duration<double, std::milli>(Clock::now() - skinnedStart).count() / test.iterations;
+
+        // Largest component difference, and how far the skinned normals turned from the derived ones.
+        float  deriveError  = 0.0f;
+        float  skinnedError = 0.0f;
+        float  maxAngle     = 0.0f;
+        double sumAngles    = 0.0;
+        for (int v = 0; v < numVerts; ++v)
+        {
+            const GLDrawVertex & r = reference[v];
+            const GLDrawVertex & d = derived[v];
+            const GLDrawVertex & k = skinned[v];
+            const float ref[9] { r.nx, r.ny, r.nz, r.tx, r.ty, r.tz, r.bx, r.by, r.bz };
+            const float der[9] { d.nx, d.ny, d.nz, d.tx, d.ty, d.tz, d.bx, d.by, d.bz };
+            const float ski[9] { k.nx, k.ny, k.nz, k.tx, k.ty, k.tz, k.bx, k.by, k.bz };
+            for (int i = 0; i < 9; ++i)
+            {
+                deriveError  = std::max(deriveError,  std::fabs(ref[i] - der[i]));
+                skinnedError = std::max(skinnedError, std::fabs(ref[i] - ski[i]));
+            }
+            const float angle = radToDeg(std::acos(clamp((ref[0] * ski[0]) + (ref[1] * ski[1]) + (ref[2] * ski[2]), -1.0f, 1.0f)));
+            maxAngle   = std::max(maxAngle, angle);
+            sumAngles += angle;
+        }
+
+        printF("%-13s %6d verts, %6d tris: reference %7.3fms, solver %7.3fms (%.1fx), parallel %7.3fms (%.1fx), "
+               "skinned %7.3fms (%.1fx). Max error derived %.6f, skinned %.4f (normals %.1f degrees off on average, %.1f max)",
+               test.name, numVerts, numIndexes / 3, referenceMs, deriveMs, referenceMs / deriveMs,
+               parallelMs, referenceMs / parallelMs, skinnedMs, referenceMs / skinnedMs,
+               deriveError, skinnedError, sumAngles / numVerts, maxAngle);
+    }
+}
+
+void Doom3ModelsApp::runAnimLodReport()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr int    framesPerLevel = 240;
+    constexpr int    warmUpFrames   = 8; // Past the staggered first update of each entity.
+    constexpr double frameTimeSec   = 1.0 / 60.0;
+
+    const DOOM3::AnimInstance * anim = findWalkAnimation("Animation LOD report");
+    if (anim == nullptr)
+    {
+        return;
+    }
+
+    printF("---- Animation LOD report (%d frames of the walk per level) ----", framesPerLevel);
+
+    // slerp vs nlerp, halfway between each pair of frames, where they differ the most.
+    const int numJoints = anim->getNumJoints();
+    DOOM3::Pose slerpPose;
+    DOOM3::Pose nlerpPose;
+    slerpPose.resize(numJoints);
+    nlerpPose.resize(numJoints);
+
+    double slerpSec = 0.0;
+    double nlerpSec = 0.0;
+    float maxAngle  = 0.0f;
+    for (int f = 0; f + 1 < anim->getNumFrames(); ++f)
+    {
+        const auto slerpStart = Clock::now();
+        DOOM3::AnimatedEntity::interpolatePoses(anim->getFrameRotations(f), anim->getFramePositions(f),
+                                                anim->getFrameRotations(f + 1), anim->getFramePositions(f + 1),
+                                                numJoints, 0.5f, slerpPose, false);
+        const auto nlerpStart = Clock::now();
+        DOOM3::AnimatedEntity::interpolatePoses(anim->getFrameRotations(f), anim->getFramePositions(f),
+                                                anim->getFrameRotations(f + 1), anim->getFramePositions(f + 1),
+                                                numJoints, 0.5f, nlerpPose, true);
+        const auto nlerpEnd = Clock::now();
+
+        slerpSec += std::chrono::duration<double>(nlerpStart - slerpStart).count();
+        nlerpSec += std::chrono::duration<double>(nlerpEnd - nlerpStart).count();
+
+        for (int j = 0; j < numJoints; ++j)
+        {
+            const float * a = &slerpPose.rotations[j * 4];
+            const float * b = &nlerpPose.rotations[j * 4];
+            const float cosHalfAngle = std::fabs((a[0] * b[0]) + (a[1] * b[1]) + (a[2] * b[2]) + (a[3] * b[3]));
+            maxAngle = std::max(maxAngle, radToDeg(2.0f * std::acos(std::min(cosHalfAngle, 1.0f))));
+        }
+    }
+
+    const int numPoses = anim->getNumFrames() - 1;
+    printF("Rotation blending: slerp %.2fus, nlerp %.2fus per pose (%.1fx), max difference %.4f degrees",
+           slerpSec * 1e6 / numPoses, nlerpSec * 1e6 / numPoses, slerpSec / nlerpSec, maxAngle);
+
+    // Each level against a Full entity playing the same frames. CPU skinning,
+    // so the skinned vertexes can be compared.
+    const bool gpuSkinningWasOn = DOOM3::g_bGpuSkinning;
+    DOOM3::g_bGpuSkinning = false;
+
+    static const char * const levelNames[] = { "Full", "Reduced", "Low", "Frozen" };
+    const DOOM3::AnimLodPolicy policy;
+    double fullMs = 0.0;
+
+    for (int l = 0; l < static_cast<int>(DOOM3::AnimLod::Count); ++l)
+    {
+        const auto lod = static_cast<DOOM3::AnimLod>(l);
+        DOOM3::AnimatedEntity reference{ *this, entity };
+        DOOM3::AnimatedEntity instance{ *this, entity };
+        reference.setAnimation(anim);
+        instance.setAnimation(anim);
+
+        double cpuSec      = 0.0;
+        double sumError    = 0.0;
+        double sumAngle    = 0.0;
+        float  maxError    = 0.0f;
+        int    numUpdates  = 0;
+        std::size_t numSamples = 0;
+
+        for (int f = 0; f < warmUpFrames; ++f)
+        {
+            reference.updateWithLod(frameTimeSec, DOOM3::AnimLod::Full, policy);
+            instance.updateWithLod(frameTimeSec, lod, policy);
+        }
+
+        for (int f = 0; f < framesPerLevel; ++f)
+        {
+            reference.updateWithLod(frameTimeSec, DOOM3::AnimLod::Full, policy);
+
+            const auto updateStart = Clock::now();
+            if (instance.updateWithLod(frameTimeSec, lod, policy))
+            {
+                instance.uploadModelPose();
+                ++numUpdates;
+            }
+            cpuSec += std::chrono::duration<double>(Clock::now() - updateStart).count();
+
+            const auto & refVerts = reference.getSkinnedVertexes();
+            const auto & lodVerts = instance.getSkinnedVertexes();
+            for (std::size_t v = 0; v < refVerts.size(); ++v)
+            {
+                const GLDrawVertex & a = refVerts[v];
+                const GLDrawVertex & b = lodVerts[v];
+                const float error = length(Vec3{ a.px - b.px, a.py - b.py, a.pz - b.pz });
+                const float cosine = (a.nx * b.nx) + (a.ny * b.ny) + (a.nz * b.nz);
+                maxError  = std::max(maxError, error);
+                sumError += error;
+                sumAngle += radToDeg(std::acos(clamp(cosine, -1.0f, 1.0f)));
+            }
+            numSamples += refVerts.size();
+        }
+
+        const double cpuMs = cpuSec * 1000.0 / framesPerLevel;
+        if (lod == DOOM3::AnimLod::Full)
+        {
+            fullMs = cpuMs;
+        }
+
+        const auto & level = policy.levels[l];
+        printF("%-7s (update interval %d, %s, tangents %s): %6.3f ms/frame CPU (%5.1fx less), %3d updates. "
+               "Position error mean %.4f max %.4f, normals %.2f degrees off on average",
+               levelNames[l], level.updateInterval, (level.nlerp ? "nlerp" : "slerp"),
+               (level.deriveTangents ? "derived" : "skinned"), cpuMs, fullMs / std::max(cpuMs, 1e-6),
+               numUpdates, sumError / numSamples, maxError, sumAngle / numSamples);
+    }
+
+    DOOM3::g_bGpuSkinning = gpuSkinningWasOn;
+    printF("Error is against a Full entity on the same frame. The max is where the walk loops back and the held "
+           "pose is still at the end of the cycle. Frozen entities are off screen, so theirs is not visible.");
+}
+
+void Doom3ModelsApp::runVertexCacheReport()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr int    framesPerClip = 240;
+    constexpr double frameTimeSec  = 1.0 / 60.0;
+
+    // Separate instances, so the demo entity keeps its state. Both on the CPU skinning path.
+    const bool gpuSkinningWasOn = DOOM3::g_bGpuSkinning;
+    DOOM3::g_bGpuSkinning = false;
+
+    DOOM3::AnimatedEntity live{ *this, entity };
+    DOOM3::AnimatedEntity cached{ *this, entity };
+
+    // Only the first call of the model bakes, so this is zero after [Z].
+    const auto bakeStart = Clock::now();
+    cached.setVertexAnimCache(true);
+    const double bakeMs = std::chrono::duration<double, std::milli>(Clock::now() - bakeStart).count();
+
+    printF("---- Baked vertex animation vs live skinning (%d frames per clip, baked in %.1fms, tangents %s) ----",
+           framesPerClip, bakeMs, (DOOM3::g_bSkinnedTangents ? "skinned" : "derived"));
+
+    std::size_t totalCacheBytes = 0;
+    for (const auto & animFile : animFiles)
+    {
+        const DOOM3::AnimInstance * anim = entity.findAnimation(animFile);
+        const DOOM3::VertexAnimCache * cache = cached.findVertexAnimCache(anim);
+        if (cache == nullptr)
+        {
+            continue;
+        }
+
+        // Timed on their own first, then again side by side for the error.
+        double liveSec   = 0.0;
+        double cachedSec = 0.0;
+        for (DOOM3::AnimatedEntity * instance : { &live, &cached })
+        {
+            instance->setAnimation(anim);
+            const auto updateStart = Clock::now();
+            for (int f = 0; f < framesPerClip; ++f)
+            {
+                instance->updateAnimation(frameTimeSec);
+                instance->skinModelPose();
+            }
+            (instance == &live ? liveSec : cachedSec) = std::chrono::duration<double>(Clock::now() - updateStart).count();
+        }
+
+        live.setAnimation(anim);
+        cached.setAnimation(anim);
+
+        double sumAngle = 0.0;
+        float  maxError = 0.0f;
+        float  maxAngle = 0.0f;
+        std::size_t numSamples = 0;
+
+        for (int f = 0; f < framesPerClip; ++f)
+        {
+            live.updateAnimation(frameTimeSec);
+            live.skinModelPose();
+            cached.updateAnimation(frameTimeSec);
+            cached.skinModelPose();
+
+            const auto & liveVerts   = live.getSkinnedVertexes();
+            const auto & cachedVerts = cached.getSkinnedVertexes();
+            for (std::size_t v = 0; v < liveVerts.size(); ++v)
+            {
+                const GLDrawVertex & a = liveVerts[v];
+                const GLDrawVertex & b = cachedVerts[v];
+                const float cosine = (a.nx * b.nx) + (a.ny * b.ny) + (a.nz * b.nz);
+                const float angle  = radToDeg(std::acos(clamp(cosine, -1.0f, 1.0f)));
+                maxError  = std::max(maxError, static_cast<float>(length(Vec3{ a.px - b.px, a.py - b.py, a.pz - b.pz })));
+                maxAngle  = std::max(maxAngle, angle);
+                sumAngle += angle;
+            }
+            numSamples += liveVerts.size();
+        }
+
+        // The float vertexes the cache replaces: a whole GLDrawVertex per vertex per frame.
+        const std::size_t floatBytes = static_cast<std::size_t>(cache->getNumFrames()) *
+                                       cache->getNumVertexes() * sizeof(GLDrawVertex);
+        totalCacheBytes += cache->getMemoryBytes();
+
+        printF("%-18s %3d frames: cache %7.1fKB (%5.1fKB/frame, %.0f%% of float vertexes), clip %6.1fKB. "
+               "CPU %.3f ms/frame live, %.3f ms/frame cached (%.1fx). Max position error %.5f, normals %.3f degrees "
+               "off on average, %.2f max",
+               animFile.substr(animBasePath.length()).c_str(), cache->getNumFrames(),
+               cache->getMemoryBytes() / 1024.0, cache->getMemoryBytes() / 1024.0 / cache->getNumFrames(),
+               100.0 * cache->getMemoryBytes() / floatBytes, anim->getMemoryBytes() / 1024.0,
+               liveSec * 1000.0 / framesPerClip, cachedSec * 1000.0 / framesPerClip, liveSec / cachedSec,
+               maxError, sumAngle / numSamples, maxAngle);
+    }
+
+    // The cached entity skipped its pose samples. Asking for the pose must sample it on demand.
+    const DOOM3::Pose & livePose   = live.getCurrentPose();
+    const DOOM3::Pose & cachedPose = cached.getCurrentPose();
+    const bool posesMatch = (livePose.rotations == cachedPose.rotations && livePose.positions == cachedPose.positions);
+    printF("Pose of the cached entity, sampled on demand: %s", (posesMatch ? "same as live. OK." : "MISMATCH!"));
+
+    // Stopping the animation must give back the bind pose, not a baked frame of the last clip.
+    live.setAnimation(nullptr);
+    cached.setAnimation(nullptr);
+    float bindPoseError = 0.0f;
+    const auto & liveBindVerts   = live.getSkinnedVertexes();
+    const auto & cachedBindVerts = cached.getSkinnedVertexes();
+    for (std::size_t v = 0; v < liveBindVerts.size(); ++v)
+    {
+        const GLDrawVertex & a = liveBindVerts[v];
+        const GLDrawVertex & b = cachedBindVerts[v];
+        bindPoseError = std::max(bindPoseError, static_cast<float>(length(Vec3{ a.px - b.px, a.py - b.py, a.pz - b.pz })));
+    }
+    printF("Bind pose restored with caching on: max position difference to live skinning %.5f. %s",
+           bindPoseError, (bindPoseError == 0.0f ? "OK." : "MISMATCH!"));
+
+    DOOM3::g_bGpuSkinning = gpuSkinningWasOn;
+    printF("All caches of the model: %.1fKB. Cached CPU time is the vertex blend alone: the joint pose is only sampled "
+           "if something asks for it, like the skeleton view. The max errors "
+           "are midway between frames of fast swings, where the cache blends the vertexes in a straight line while the "
+           "live joints rotate, and on vertexes whose derived normal is unstable.", totalCacheBytes / 1024.0);
+}
+
+void Doom3ModelsApp::runSamplingBenchmark()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr int batchSizes[]  = { 64, 1024, 8192 };
+    constexpr int maxBatchSize  = 8192;
+    constexpr int runsPerBatch  = 4;
+    constexpr int shortSteps    = 100;
+    constexpr double shortStepSec = 0.013; // Off the frame boundaries, so rounding can't pick a neighbor frame.
+
+    std::vector<const DOOM3::AnimInstance *> clips;
+    for (const auto & animFile : animFiles)
+    {
+        if (const DOOM3::AnimInstance * anim = entity.findAnimation(animFile))
+        {
+            clips.push_back(anim);
+        }
+    }
+    if (clips.empty())
+    {
+        printF("Sampling benchmark needs some animations!");
+        return;
+    }
+
+    printF("---- Stateless clip sampling benchmark (%zu clips, %d runs per batch) ----", clips.size(), runsPerBatch);
+
+    // Catch-up: one long step must land where many short ones do.
+    DOOM3::AnimatedEntity stepped{ *this, entity };
+    DOOM3::AnimatedEntity skipped{ *this, entity };
+    stepped.setAnimation(clips.front());
+    skipped.setAnimation(clips.front());
+    for (int s = 0; s < shortSteps; ++s)
+    {
+        stepped.advanceAnimation(shortStepSec);
+    }
+    skipped.advanceAnimation(shortSteps * shortStepSec);
+    printF("Catch-up (%d frames clip): %d steps of %.1fms -> frame %d loop %d, one step of %.0fms -> frame %d loop %d "
+           "(cursor difference %.2gs)", clips.front()->getNumFrames(), shortSteps, shortStepSec * 1000.0, stepped.getCurrentAnimFrame(), stepped.getAnimLoopCount(),
+           shortSteps * shortStepSec * 1000.0, skipped.getCurrentAnimFrame(), skipped.getAnimLoopCount(),
+           std::fabs(stepped.getAnimCursorSeconds() - skipped.getAnimCursorSeconds()));
+
+    // A batch of requests across all clips at scattered times, a few loops in,
+    // like a crowd at random phases. Each request writes only its own pose.
+    struct SampleRequest
+    {
+        const DOOM3::AnimInstance * clip;
+        double timeSeconds;
+    };
+    std::vector<SampleRequest> requests;
+    std::vector<DOOM3::Pose> poses(maxBatchSize);
+    std::vector<DOOM3::Pose> serialPoses(maxBatchSize);
+    for (int i = 0; i < maxBatchSize; ++i)
+    {
+        const DOOM3::AnimInstance * clip = clips[i % clips.size()];
+        requests.push_back({ clip, std::fmod(i * 0.7371, 3.0 * clip->getPlaybackSeconds()) });
+        poses[i].resize(clip->getNumJoints());
+        serialPoses[i].resize(clip->getNumJoints());
+    }
+    for (int i = 0; i < maxBatchSize; ++i)
+    {
+        requests[i].clip->sample(requests[i].timeSeconds, DOOM3::AnimLoopMode::Loop, serialPoses[i]);
+    }
+
+    const std::vector<int> threadCounts = getBenchmarkThreadCounts();
+    double singleThreadMs[arrayLength(batchSizes)] = {};
+    for (const int numThreads : threadCounts)
+    {
+        WorkerPool pool{ numThreads - 1 };
+        for (int b = 0; b < arrayLength(batchSizes); ++b)
+        {
+            const int batchSize = batchSizes[b];
+            const auto sampleStart = Clock::now();
+            for (int r = 0; r < runsPerBatch; ++r)
+            {
+                pool.parallelFor(batchSize, [&requests, &poses](const int i)
+                {
+                    requests[i].clip->sample(requests[i].timeSeconds, DOOM3::AnimLoopMode::Loop, poses[i]);
+                });
+            }
+            const double batchMs = std::chrono::duration<double, std::milli>(Clock::now() - sampleStart).count() / runsPerBatch;
+            if (numThreads == 1)
+            {
+                singleThreadMs[b] = batchMs;
+            }
+
+            bool matches = true;
+            double numJoints = 0.0;
+            for (int i = 0; i < batchSize; ++i)
+            {
+                matches = matches && poses[i].rotations == serialPoses[i].rotations &&
+                                     poses[i].positions == serialPoses[i].positions;
+                numJoints += poses[i].getNumJoints();
+            }
+
+            const double speedup = singleThreadMs[b] / batchMs;
+            printF("%5d poses, %2d thread(s): %8.3f ms/batch, %6.2f Mjoints/s, %5.2fx speedup, %3.0f%% efficiency, %s",
+                   batchSize, numThreads, batchMs, numJoints / (batchMs * 1000.0),
+                   speedup, 100.0 * speedup / numThreads, (matches ? "same as serial" : "MISMATCH!"));
+        }
+    }
+}
+
+void Doom3ModelsApp::runBlendBenchmark()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr int numPoses   = 64; // Small enough for all the poses to stay in the cache.
+    constexpr int iterations = 200;
+
+    const DOOM3::AnimInstance * walk  = entity.findAnimation(animBasePath + "walk.md5anim");
+    const DOOM3::AnimInstance * roar  = entity.findAnimation(animBasePath + "roar.md5anim");
+    const DOOM3::AnimInstance * layer = entity.findAnimation(layerAnimFile);
+    if (walk == nullptr || roar == nullptr || layer == nullptr)
+    {
+        printF("Blend benchmark needs the walk, roar and head_pain animations!");
+        return;
+    }
+
+    const DOOM3::Skeleton & skeleton = entity.getModelInstance().getSkeleton();
+    const int numJoints = skeleton.getNumJoints();
+    const std::vector<float> mask = DOOM3::buildJointMask(skeleton, layerMaskJoint);
+
+    // Joint space poses of the clips at scattered times, and the additive deltas of the layer.
+    std::vector<DOOM3::Pose> modelPoses(numPoses);
+    std::vector<DOOM3::BlendPose> posesA(numPoses);
+    std::vector<DOOM3::BlendPose> posesB(numPoses);
+    std::vector<DOOM3::BlendPose> deltas(numPoses);
+    std::vector<DOOM3::BlendPose> results(numPoses);
+    std::vector<DOOM3::BlendPose> references(numPoses);
+
+    DOOM3::Pose scratchPose;
+    DOOM3::BlendPose layerReference;
+    scratchPose.resize(numJoints);
+    layer->sample(0.0, DOOM3::AnimLoopMode::Clamp, scratchPose);
+    DOOM3::poseToJointSpace(scratchPose, skeleton, layerReference);
+
+    for (int i = 0; i < numPoses; ++i)
+    {
+        modelPoses[i].resize(numJoints);
+        walk->sample(i * 0.0371, DOOM3::AnimLoopMode::Loop, modelPoses[i]);
+        DOOM3::poseToJointSpace(modelPoses[i], skeleton, posesA[i]);
+
+        roar->sample(i * 0.0529, DOOM3::AnimLoopMode::Loop, scratchPose);
+        DOOM3::poseToJointSpace(scratchPose, skeleton, posesB[i]);
+
+        layer->sample(i * 0.0213, DOOM3::AnimLoopMode::Loop, scratchPose);
+        DOOM3::poseToJointSpace(scratchPose, skeleton, deltas[i]);
+        DOOM3::makeAdditivePose(deltas[i], layerReference, deltas[i]);
+
+        results[i].resize(numJoints);
+        references[i].resize(numJoints);
+    }
+
+    // Largest difference of the real joints (not the padding) of two sets of poses.
+    // q and -q are the same rotation, so rotations are compared both ways.
+    const auto maxDifference = [numJoints](const std::vector<DOOM3::BlendPose> & a, const std::vector<DOOM3::BlendPose> & b,
+                                           const bool rotations)
+    {
+        const int firstComponent = (rotations ? DOOM3::BlendPose::RotX : DOOM3::BlendPose::PosX);
+        const int lastComponent  = (rotations ? DOOM3::BlendPose::RotW : DOOM3::BlendPose::PosZ);
+        float maxDiff = 0.0f;
+        for (std::size_t i = 0; i < a.size(); ++i)
+        {
+            for (int j = 0; j < numJoints; ++j)
+            {
+                float diff = 0.0f, flippedDiff = 0.0f;
+                for (int c = firstComponent; c <= lastComponent; ++c)
+                {
+                    const float ca = a[i].component(static_cast<DOOM3::BlendPose::Component>(c))[j];
+                    const float cb = b[i].component(static_cast<DOOM3::BlendPose::Component>(c))[j];
+                    diff        = std::max(diff, std::fabs(ca - cb));
+                    flippedDiff = std::max(flippedDiff, std::fabs(ca + cb));
+                }
+                maxDiff = std::max(maxDiff, (rotations ? std::min(diff, flippedDiff) : diff));
+            }
+        }
+        return maxDiff;
+    };
+
+    // Milliseconds per pass over all the poses.
+    const auto timePasses = [](const std::function<void(int)> & kernel)
+    {
+        const auto start = Clock::now();
+        for (int n = 0; n < iterations; ++n)
+        {
+            for (int i = 0; i < numPoses; ++i)
+            {
+                kernel(i);
+            }
+        }
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+    };
+
+    struct KernelTest
+    {
+        const char * name;
+        std::function<void(int)> kernel;
+        std::function<void(int)> reference;
+    };
+    const float * maskWeights = mask.data();
+    const KernelTest tests[] = {
+        { "crossfade",
+          [&](const int i) { DOOM3::blendPoses(posesA[i], posesB[i], 0.35f, nullptr, results[i]); },
+          [&](const int i) { DOOM3::blendPosesReference(posesA[i], posesB[i], 0.35f, nullptr, references[i]); } },
+        { "masked crossfade",
+          [&](const int i) { DOOM3::blendPoses(posesA[i], posesB[i], 0.35f, maskWeights, results[i]); },
+          [&](const int i) { DOOM3::blendPosesReference(posesA[i], posesB[i], 0.35f, maskWeights, references[i]); } },
+        { "additive delta",
+          [&](const int i) { DOOM3::makeAdditivePose(posesB[i], layerReference, results[i]); },
+          [&](const int i) { DOOM3::makeAdditivePoseReference(posesB[i], layerReference, references[i]); } },
+        { "additive layer",
+          [&](const int i) { DOOM3::addPoseLayer(posesA[i], deltas[i], 0.8f, maskWeights, results[i]); },
+          [&](const int i) { DOOM3::addPoseLayerReference(posesA[i], deltas[i], 0.8f, maskWeights, references[i]); } }
+    };
+
+    const double jointsPerPass = static_cast<double>(numPoses) * numJoints;
+    printF("---- Pose blending benchmark (%d poses of %d joints, %d passes, mask of %s) ----",
+           numPoses, numJoints, iterations, layerMaskJoint.c_str());
+
+    bool allMatch = true;
+    for (const KernelTest & test : tests)
+    {
+        const double kernelMs    = timePasses(test.kernel);
+        const double referenceMs = timePasses(test.reference);
+
+        const float rotationDiff = maxDifference(results, references, true);
+        const float positionDiff = maxDifference(results, references, false);
+        const bool  matches      = rotationDiff < 1e-5f && positionDiff < 1e-3f;
+        allMatch = allMatch && matches;
+
+        printF("%-17s SoA %7.1f joints/us, scalar %6.1f joints/us (%4.1fx), max difference rotation %.2g, position %.2g %s",
+               test.name, jointsPerPass / (kernelMs * 1000.0), jointsPerPass / (referenceMs * 1000.0),
+               referenceMs / kernelMs, rotationDiff, positionDiff, (matches ? "" : "MISMATCH!"));
+    }
+
+    // The conversions around the kernels, and their round trip back to the original pose.
+    std::vector<DOOM3::Pose> roundTrip(numPoses);
+    const double toJointMs = timePasses([&](const int i) { DOOM3::poseToJointSpace(modelPoses[i], skeleton, results[i]); });
+    const double toModelMs = timePasses([&](const int i) { DOOM3::poseToModelSpace(results[i], skeleton, roundTrip[i]); });
+
+    // The source rotations are only approximately unit length, and come back normalized.
+    float roundTripRotationDiff = 0.0f;
+    float roundTripPositionDiff = 0.0f;
+    for (int i = 0; i < numPoses; ++i)
+    {
+        for (int j = 0; j < numJoints; ++j)
+        {
+            const float * source = &modelPoses[i].rotations[j * 4];
+            const float invLength = 1.0f / std::sqrt(source[0] * source[0] + source[1] * source[1] + source[2] * source[2] + source[3] * source[3]);
+            for (int c = 0; c < 4; ++c)
+            {
+                roundTripRotationDiff = std::max(roundTripRotationDiff, std::fabs(roundTrip[i].rotations[j * 4 + c] - source[c] * invLength));
+            }
+            for (int c = 0; c < 3; ++c)
+            {
+                roundTripPositionDiff = std::max(roundTripPositionDiff, std::fabs(roundTrip[i].positions[j * 3 + c] - modelPoses[i].positions[j * 3 + c]));
+            }
+        }
+    }
+    printF("Model to joint space %.1f joints/us, joint to model space %.1f joints/us (scalar hierarchy walk), "
+           "round trip max difference rotation %.2g, position %.2g", jointsPerPass / (toJointMs * 1000.0),
+           jointsPerPass / (toModelMs * 1000.0), roundTripRotationDiff, roundTripPositionDiff);
+
+    // A full weight delta on its own reference gives back the source pose.
+    for (int i = 0; i < numPoses; ++i)
+    {
+        DOOM3::makeAdditivePose(posesB[i], posesA[i], references[i]);
+        DOOM3::addPoseLayer(posesA[i], references[i], 1.0f, nullptr, results[i]);
+    }
+    printF("Additive identity (delta of B from A, added to A at full weight): max difference to B rotation %.2g, position %.2g",
+           maxDifference(results, posesB, true), maxDifference(results, posesB, false));
+
+    // Whole entity: sampling plus the blends, per sampleCurrentPose().
+    DOOM3::AnimatedEntity blended{ *this, entity };
+    blended.setAnimation(walk);
+    const auto timeSampling = [&blended]()
+    {
+        const auto start = Clock::now();
+        for (int n = 0; n < numPoses; ++n)
+        {
+            blended.sampleCurrentPose();
+        }
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / numPoses;
+    };
+
+    const double plainUs = timeSampling();
+    blended.crossfadeToAnimation(roar, 10.0);
+    blended.advanceAnimation(1.0);
+    const double crossfadeUs = timeSampling();
+    blended.setAdditiveLayer(layer, 1.0f, mask);
+    const double layeredUs = timeSampling();
+    printF("Per entity sampleCurrentPose(): %.1fus plain, %.1fus crossfading, %.1fus crossfading + additive layer. %s",
+           plainUs, crossfadeUs, layeredUs, (allMatch ? "All kernels match the scalar reference." : "MISMATCH!"));
+}
+
+void Doom3ModelsApp::runLargeMeshReport()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    // Many unconnected hellknights, the kind of mesh a crowd or a level merges together.
+    const DOOM3::Mesh & hellknight = entity.getModelInstance().getMeshes().back();
+    const SyntheticMesh single = makeSyntheticMesh(hellknight, 1, nullptr);
+    const SyntheticMesh crowd  = makeSyntheticMesh(hellknight, 120, nullptr);
+
+    // A welded grid, like a terrain or world mesh: every vertex shared by up to six triangles.
+    constexpr int gridSize = 400;
+    std::vector<GLDrawVertex>  gridVerts;
+    std::vector<GLDrawIndex32> gridIndexes;
+    for (int z = 0; z <= gridSize; ++z)
+    {
+        for (int x = 0; x <= gridSize; ++x)
+        {
+            GLDrawVertex vert{};
+            vert.px = static_cast<float>(x);
+            vert.pz = static_cast<float>(z);
+            vert.ny = 1.0f;
+            vert.u  = static_cast<float>(x) / gridSize;
+            vert.v  = static_cast<float>(z) / gridSize;
+            vert.r  = vert.g = vert.b = vert.a = 1.0f;
+            gridVerts.push_back(vert);
+        }
+    }
+    for (int z = 0; z < gridSize; ++z)
+    {
+        for (int x = 0; x < gridSize; ++x)
+        {
+            const GLDrawIndex32 i0 = z * (gridSize + 1) + x;
+            const GLDrawIndex32 i1 = i0 + 1;
+            const GLDrawIndex32 i2 = i0 + (gridSize + 1);
+            const GLDrawIndex32 i3 = i2 + 1;
+            const GLDrawIndex32 quad[]{ i0, i2, i1, i1, i2, i3 };
+            gridIndexes.insert(std::end(gridIndexes), std::begin(quad), std::end(quad));
+        }
+    }
+
+    // Every triangle, in order, must reference the same vertexes as the source.
+    const auto countMismatches = [](const GLIndexedMesh & mesh, const std::vector<GLDrawVertex> & verts,
+                                    const std::vector<GLDrawIndex32> & indexes)
+    {
+        int mismatches = 0;
+        const GLMeshlet whole{ 0, mesh.getIndexCount(), 0 };
+        const std::vector<GLMeshlet> ranges = mesh.meshlets.empty() ? std::vector<GLMeshlet>{ whole } : mesh.meshlets;
+        for (const GLMeshlet & range : ranges)
+        {
+            for (int i = range.firstIndex; i < range.firstIndex + range.indexCount; ++i)
+            {
+                const int index = range.baseVertex + (mesh.isUsing32BitIndexes() ?
+                                  static_cast<int>(mesh.indexes32[i]) : static_cast<int>(mesh.indexes16[i]));
+                if (std::memcmp(&mesh.vertexes[index], &verts[indexes[i]], sizeof(GLDrawVertex)) != 0)
+                {
+                    ++mismatches;
+                }
+            }
+        }
+        return mismatches;
+    };
+
+    struct TestMesh
+    {
+        const char                       * name;
+        const std::vector<GLDrawVertex>  * verts;
+        const std::vector<GLDrawIndex32> * indexes;
+    } const testMeshes[] = {
+        { "hellknight",      &single.bindPoseVerts, &single.indexes },
+        { "hellknight x120", &crowd.bindPoseVerts,  &crowd.indexes  },
+        { "grid 400x400",    &gridVerts,            &gridIndexes    }
+    };
+
+    const struct
+    {
+        const char             * name;
+        GLLargeMeshPolicy        policy;
+    } policies[] = {
+        { "32-bit indexes", GLLargeMeshPolicy::Index32  },
+        { "meshlets",       GLLargeMeshPolicy::Meshlets }
+    };
+
+    printF("---- Large mesh report (16-bit indexes address up to %d vertexes) ----", GLMaxIndex16Vertexes);
+
+    bool allMatch = true;
+    for (const auto & test : testMeshes)
+    {
+        const int numVerts   = static_cast<int>(test.verts->size());
+        const int numIndexes = static_cast<int>(test.indexes->size());
+
+        for (const auto & choice : policies)
+        {
+            GLIndexedMesh mesh;
+            const auto buildStart = Clock::now();
+            buildIndexedMesh(test.verts->data(), numVerts, test.indexes->data(), numIndexes, choice.policy, &mesh);
+            const double buildMs = std::chrono::duration<double, std::milli>(Clock::now() - buildStart).count();
+
+            const int mismatches = countMismatches(mesh, *test.verts, *test.indexes);
+            allMatch = allMatch && (mismatches == 0);
+
+            // Upload once to check the GL side takes it.
+            GLVertexArray vertArray{ *this };
+            vertArray.initFromMesh(mesh, GL_STATIC_DRAW, GLVertexLayout::Triangles);
+            CHECK_GL_ERRORS(this);
+            const int glIndexBits = vertArray.getIndexSizeBytes() * 8;
+            vertArray.cleanup();
+
+            const char * layout = (numVerts <= GLMaxIndex16Vertexes) ? "16-bit indexes" : choice.name;
+            printF("%-16s %6d verts, %7d indexes, %-14s: %6d verts (+%d duplicated), %7.1f KB vertexes + %6.1f KB indexes "
+                   "(%d-bit in GL), %2d draw(s), built in %.2f ms. %s",
+                   test.name, numVerts, numIndexes, layout, static_cast<int>(mesh.vertexes.size()),
+                   static_cast<int>(mesh.vertexes.size()) - numVerts, mesh.getVertexBytes() / 1024.0,
+                   mesh.getIndexBytes() / 1024.0, glIndexBits, mesh.getDrawCount(), buildMs,
+                   (mismatches == 0 ? "Triangles match." : "TRIANGLES DIFFER!"));
+
+            // Fits in 16 bits either way, so both policies give the same mesh.
+            if (numVerts <= GLMaxIndex16Vertexes)
+            {
+                break;
+            }
+        }
+    }
+    printF("%s", (allMatch ? "All layouts draw the source triangles." : "MISMATCH!"));
+}
+
+void Doom3ModelsApp::runEntitySpawnReport()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr int numSpawns = 10;
+    constexpr double megabyte = 1024.0 * 1024.0;
+
+    // Same files as the demo entity, loaded through the constructor that takes file
+    // names, so everything heavy should come out of the resource cache.
+    const auto statsBefore = DOOM3::getResourceCache().getStats();
+    std::vector<std::unique_ptr<DOOM3::AnimatedEntity>> spawned;
+
+    const auto spawnStart = Clock::now();
+    for (int i = 0; i < numSpawns; ++i)
+    {
+        spawned.emplace_back(new DOOM3::AnimatedEntity{ *this, modelFile, animFiles });
+    }
+    const double spawnMs = std::chrono::duration<double, std::milli>(Clock::now() - spawnStart).count();
+
+    const auto statsAfter = DOOM3::getResourceCache().getStats();
+    const std::size_t instanceBytes = spawned.back()->getInstanceMemoryBytes();
+
+    printF("---- Entity spawn report (%d entities from files) ----", numSpawns);
+    printF("Resource cache: %d model(s), %d animation(s), %d material(s) resident, %.2f MB. "
+           "Requests while spawning: %d loads, %d hits, %d wasted loads (lost races).",
+           statsAfter.numModels, statsAfter.numAnimations, statsAfter.numMaterials,
+           statsAfter.residentBytes / megabyte, statsAfter.numLoads - statsBefore.numLoads,
+           statsAfter.numHits - statsBefore.numHits, statsAfter.numWastedLoads - statsBefore.numWastedLoads);
+    printF("Spawn time: %.3f ms per entity. Shared memory grew by %.2f MB.", spawnMs / numSpawns,
+           (static_cast<double>(statsAfter.residentBytes) - static_cast<double>(statsBefore.residentBytes)) / megabyte);
+    printF("Memory per additional entity: %.1f KB (%.2f MB without sharing the models, animations and textures).",
+           instanceBytes / 1024.0, (instanceBytes + statsAfter.residentBytes) / megabyte);
+}
+
+const DOOM3::AnimInstance * Doom3ModelsApp::findWalkAnimation(const char * benchmarkName)
+{
+    const DOOM3::AnimInstance * anim = entity.findAnimation(animBasePath + "walk.md5anim");
+    if (anim == nullptr || anim->getNumFrames() < 2)
+    {
+        printF("%s needs the walk animation!", benchmarkName);
+        return nullptr;
+    }
+    return anim;
+}
+
+Doom3ModelsApp::SyntheticMesh Doom3ModelsApp::makeSyntheticMesh(const DOOM3::Mesh & source, const int numCopies,
+                                                                const DOOM3::Pose * pose) const
+{
+    // 'numCopies' unconnected copies of 'source', sharing its weights, skinned in the bind
+    // pose and optionally in 'pose'. Each copy indexes its own range of vertexes.
+    std::vector<GLDrawVertex>  bindPoseVerts;
+    std::vector<GLDrawVertex>  posedVerts;
+    std::vector<GLDrawIndex32> indexes;
+    DOOM3::Pose bindPose;
+    bindPose.setFromJoints(entity.getModelInstance().getJoints());
+    DOOM3::AnimatedEntity::animateMesh(source, bindPose, &bindPoseVerts, &indexes);
+    if (pose != nullptr)
+    {
+        DOOM3::AnimatedEntity::animateMesh(source, *pose, &posedVerts, nullptr);
+    }
+
+    SyntheticMesh synthetic{ { source.material, {}, {}, source.weights }, {}, {}, {} };
+    for (int c = 0; c < numCopies; ++c)
+    {
+        const GLDrawIndex32 base = static_cast<GLDrawIndex32>(synthetic.bindPoseVerts.size());
+        synthetic.mesh.vertexes.insert(std::end(synthetic.mesh.vertexes), std::begin(source.vertexes), std::end(source.vertexes));
+        synthetic.bindPoseVerts.insert(std::end(synthetic.bindPoseVerts), std::begin(bindPoseVerts), std::end(bindPoseVerts));
+        synthetic.posedVerts.insert(std::end(synthetic.posedVerts), std::begin(posedVerts), std::end(posedVerts));
+        for (const GLDrawIndex32 index : indexes)
+        {
+            synthetic.indexes.push_back(index + base);
+        }
+    }
+    return synthetic;
+}
+
+void Doom3ModelsApp::makeFixedPose(const DOOM3::AnimInstance & anim, DOOM3::Pose & poseOut)
+{
+    // Halfway into the first frames of the clip, so runs are comparable.
+    poseOut.resize(anim.getNumJoints());
+    DOOM3::AnimatedEntity::interpolatePoses(anim.getFrameRotations(0), anim.getFramePositions(0),
+                                            anim.getFrameRotations(1), anim.getFramePositions(1),
+                                            anim.getNumJoints(), 0.5f, poseOut);
+}
+
+std::vector<int> Doom3ModelsApp::getBenchmarkThreadCounts()
+{
+    // Powers of two up to the number of cores, plus the core count itself.
+    const int numCores = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    std::vector<int> threadCounts;
+    for (int t = 1; t < numCores; t *= 2)
+    {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(numCores);
+    return threadCounts;
+}
+
+void Doom3ModelsApp::spawnCrowd()
+{
+    constexpr int crowdRows      = 12;
+    constexpr int crowdCols      = 12;
+    constexpr int phasesPerClip  = 8;
+    constexpr float crowdSpacing = 4.0f;
+
+    const std::string crowdClips[] =
+    {
+        animBasePath + "walk.md5anim",
+        animBasePath + "idle.md5anim",
+        animBasePath + "stand.md5anim"
+    };
+
+    // A grid behind the demo model, in its model space. Each instance plays one of
+    // the clips starting at one of a few phases, like a crowd of synced extras.
+    for (int row = 0; row < crowdRows; ++row)
+    {
+        for (int col = 0; col < crowdCols; ++col)
+        {
+            const int i = row * crowdCols + col;
+            const DOOM3::AnimInstance * anim = entity.findAnimation(crowdClips[i % arrayLength(crowdClips)]);
+
+            crowdInstances.emplace_back(new DOOM3::AnimatedEntity{ *this, entity });
+            crowdInstances.back()->setVertexAnimCache(entity.isUsingVertexAnimCache());
+            crowdInstances.back()->setAnimation(anim);
+            if (anim != nullptr)
+            {
+                const int startFrame = ((i / arrayLength(crowdClips)) % phasesPerClip) * anim->getNumFrames() / phasesPerClip;
+                crowdInstances.back()->seekAnimation(startFrame * anim->getDurationSeconds());
+            }
+            crowdInstancePtrs.push_back(crowdInstances.back().get());
+
+            const float x = (col - (crowdCols - 1) * 0.5f) * crowdSpacing;
+            const float z = -(row + 2) * crowdSpacing;
+            crowdInstanceMatrices.push_back(Mat4::translation(Vec3{ x, 0.0f, z }) * Mat4::rotationY(degToRad(i * 37.0f)));
+        }
+    }
+
+    printF("Spawned a crowd of %zu instances.", crowdInstances.size());
+}
+
+void Doom3ModelsApp::updateAndDrawCrowd(const double elapsedTimeSeconds, const Mat4 & mvpMatrix,
+                                        const Frustum * frustum, const Point3 & eyePosModelSpace,
+                                        const DOOM3::LightBase ** lights, const int numLights)
+{
+    using Clock = std::chrono::high_resolution_clock;
+    constexpr int reportIntervalFrames = 300;
+
+    const auto & stats = instancedCrowd.update(crowdInstancePtrs.data(), crowdInstanceMatrices.data(), static_cast<int>(crowdInstancePtrs.size()),
+                                               elapsedTimeSeconds, getWorkerPool(), frustum);
+
+    const auto drawStart = Clock::now();
+    instancedCrowd.draw(mvpMatrix, eyePosModelSpace, lights, numLights);
+    const double drawMs = std::chrono::duration<double, std::milli>(Clock::now() - drawStart).count();
+
+    if (crowdReportFrames++ % reportIntervalFrames == 0)
+    {
+        printF("Crowd (pose sharing %s, culling %s): %d instances, %d culled, %d skinned (%d saved), %d draws (%d saved). "
+               "CPU: animate+skin %.3fms, upload %.3fms, draw %.3fms.",
+               (instancedCrowd.isGrouping() ? "on" : "off"), (frustum != nullptr ? "on" : "off"),
+               stats.numEntities, stats.numCulled,
+               stats.numGroups, stats.numEntities - stats.numCulled - stats.numGroups,
+               stats.numDraws,  stats.numEntities - stats.numCulled - stats.numDraws,
+               stats.animateMs, stats.uploadMs, drawMs);
+    }
+}
+
 void Doom3ModelsApp::onMouseButton(const MouseButton button, const bool pressed)
 {
     if (button == MouseButton::Right) // Toggle flashlight on/of
@@ -418,7 +1843,7 @@ void Doom3ModelsApp::onKeyChar(const unsigned int chr)
         printF("Switching to animation: %s", animFiles[currAnimNum].c_str());
         setWindowTitle(baseWindowTitle + " => " + animFiles[currAnimNum]);
 
-        entity.setAnimation(entity.findAnimation(animFiles[currAnimNum]));
+        entity.crossfadeToAnimation(entity.findAnimation(animFiles[currAnimNum]), animFadeSeconds);
         currAnimNum = (currAnimNum + 1) % animFiles.size();
     }
     else if (chr == 'h') // Back to bind/home pose
@@ -434,7 +1859,7 @@ void Doom3ModelsApp::onKeyChar(const unsigned int chr)
         printF("Switching to animation: %s", animFiles[0].c_str());
         setWindowTitle(baseWindowTitle + " => " + animFiles[0]);
 
-        entity.setAnimation(entity.findAnimation(animFiles[0]));
+        entity.crossfadeToAnimation(entity.findAnimation(animFiles[0]), animFadeSeconds);
         currAnimNum = 0;
     }
     else if (chr == 'p') // Pause/resume the current animation
@@ -461,6 +1886,112 @@ void Doom3ModelsApp::onKeyChar(const unsigned int chr)
     {
         drawShadow = !drawShadow;
     }
+    else if (chr == 'c') // Animation compression report
+    {
+        runCompressionReport();
+    }
+    else if (chr == 'k') // CPU skinning benchmark
+    {
+        runSkinningBenchmark();
+    }
+    else if (chr == 'm') // Toggle SIMD CPU skinning
+    {
+        DOOM3::g_bSimdSkinning = !DOOM3::g_bSimdSkinning;
+        printF("SIMD CPU skinning %s.", (DOOM3::g_bSimdSkinning ? "on" : "off"));
+    }
+    else if (chr == 'b') // Crowd update benchmark
+    {
+        runCrowdBenchmark();
+    }
+    else if (chr == 'g') // Toggle GPU skinning
+    {
+        DOOM3::g_bGpuSkinning = !DOOM3::g_bGpuSkinning;
+        printF("GPU skinning %s.", (DOOM3::g_bGpuSkinning ? "on" : "off"));
+    }
+    else if (chr == 'u') // GPU skinning check and costs
+    {
+        runGpuSkinningReport();
+    }
+    else if (chr == 'e') // Shared resources and entity spawn costs
+    {
+        runEntitySpawnReport();
+    }
+    else if (chr == 'v') // Toggle the instanced crowd
+    {
+        showCrowd = !showCrowd;
+        if (showCrowd && crowdInstances.empty())
+        {
+            spawnCrowd();
+        }
+        crowdReportFrames = 0;
+    }
+    else if (chr == 'y') // Toggle the crowd pose sharing
+    {
+        instancedCrowd.setGrouping(!instancedCrowd.isGrouping());
+        printF("Crowd pose sharing %s.", (instancedCrowd.isGrouping() ? "on" : "off"));
+        crowdReportFrames = 0;
+    }
+    else if (chr == 'a') // Tangent basis update benchmark
+    {
+        runTangentBenchmark();
+    }
+    else if (chr == 'l') // Animation LOD accuracy and costs
+    {
+        runAnimLodReport();
+    }
+    else if (chr == 'd') // Toggle derived/skinned tangent basis
+    {
+        DOOM3::g_bSkinnedTangents = !DOOM3::g_bSkinnedTangents;
+        printF("Skinned tangent basis %s.", (DOOM3::g_bSkinnedTangents ? "on" : "off (derived every frame)"));
+    }
+    else if (chr == 'z') // Toggle the baked vertex animation
+    {
+        const bool enable = !entity.isUsingVertexAnimCache();
+        const auto bakeStart = std::chrono::high_resolution_clock::now();
+        entity.setVertexAnimCache(enable);
+        for (const auto & instance : crowdInstances)
+        {
+            instance->setVertexAnimCache(enable);
+        }
+        const double bakeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - bakeStart).count();
+        printF("Baked vertex animation %s (%.1fms).", (enable ? "on" : "off"), bakeMs);
+        crowdReportFrames = 0;
+    }
+    else if (chr == 'j') // Baked vertex animation memory and CPU costs
+    {
+        runVertexCacheReport();
+    }
+    else if (chr == 'q') // Batched clip sampling benchmark
+    {
+        runSamplingBenchmark();
+    }
+    else if (chr == 'w') // Toggle the additive head pain layer
+    {
+        if (entity.getAdditiveLayer() == nullptr)
+        {
+            entity.setAdditiveLayer(entity.findAnimation(layerAnimFile), 1.0f,
+                                    DOOM3::buildJointMask(entity.getModelInstance().getSkeleton(), layerMaskJoint));
+        }
+        else
+        {
+            entity.setAdditiveLayer(nullptr, 0.0f);
+        }
+        printF("Additive head pain layer %s.", (entity.getAdditiveLayer() != nullptr ? "on" : "off"));
+    }
+    else if (chr == '1') // Pose blending benchmark
+    {
+        runBlendBenchmark();
+    }
+    else if (chr == '2') // Large mesh indexing report
+    {
+        runLargeMeshReport();
+    }
+    else if (chr == 'o') // Toggle frustum culling of the animated entities
+    {
+        cullAnimated = !cullAnimated;
+        printF("Animated entity frustum culling %s.", (cullAnimated ? "on" : "off"));
+        crowdReportFrames = 0;
+    }
 }
 
 // ========================================================
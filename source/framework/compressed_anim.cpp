@@ -0,0 +1,741 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: compressed_anim.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Compressed storage for DOOM 3 MD5 animation clips.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "compressed_anim.hpp"
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif // __SSE2__
+
+namespace DOOM3
+{
+
+// ========================================================
+// Quantization helpers:
+// ========================================================
+
+// The three smallest components of a unit quaternion are within +/- 1/sqrt(2).
+static constexpr float SmallestThreeRange  = 0.707106781f;
+static constexpr float RotationKeyScale    = 32767.0f; // 15 bits.
+static constexpr float TranslationKeyScale = 65535.0f; // 16 bits.
+
+// Decoded component = lane value * RotationDecodeScale - SmallestThreeRange.
+static constexpr float RotationDecodeScale = 2.0f * SmallestThreeRange / RotationKeyScale;
+static constexpr int   RotationValueMask   = 0x7FFF;
+
+static void encodeRotationKey(const Quat & quat, std::uint16_t * keyOut)
+{
+    int largest = 0;
+    for (int i = 1; i < 4; ++i)
+    {
+        if (std::fabs(quat[i]) > std::fabs(quat[largest]))
+        {
+            largest = i;
+        }
+    }
+
+    // q and -q are the same rotation, so flip it to make the dropped component positive.
+    const float sign = (quat[largest] < 0.0f) ? -1.0f : 1.0f;
+
+    // The three smallest in 15 bits each, in order. Bit 15 of the
+    // first two lanes holds the index of the dropped component.
+    int lane = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (i == largest)
+        {
+            continue;
+        }
+        const float normalized = clamp((quat[i] * sign / SmallestThreeRange) * 0.5f + 0.5f, 0.0f, 1.0f);
+        keyOut[lane++] = static_cast<std::uint16_t>(std::lround(normalized * RotationKeyScale));
+    }
+
+    keyOut[0] = static_cast<std::uint16_t>(keyOut[0] | ((largest & 1) << 15));
+    keyOut[1] = static_cast<std::uint16_t>(keyOut[1] | ((largest >> 1) << 15));
+}
+
+static Quat decodeRotationLanes(const int lane0, const int lane1, const int lane2)
+{
+    const int largest = (lane0 >> 15) | ((lane1 >> 15) << 1);
+    const int lanes[3]{ lane0, lane1, lane2 };
+    float components[4];
+    float sumSq = 0.0f;
+    int lane    = 0;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        if (i == largest)
+        {
+            continue;
+        }
+        components[i] = static_cast<float>(lanes[lane++] & RotationValueMask) * RotationDecodeScale - SmallestThreeRange;
+        sumSq += components[i] * components[i];
+    }
+
+    components[largest] = std::sqrt(std::max(1.0f - sumSq, 0.0f));
+    return { components[0], components[1], components[2], components[3] };
+}
+
+static Quat decodeRotationKey(const std::uint16_t * key)
+{
+    return decodeRotationLanes(key[0], key[1], key[2]);
+}
+
+static void encodeTranslationKey(const Point3 & pos, const float * mins, const float * extents, std::uint16_t * keyOut)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        const float normalized = (extents[i] > 0.0f) ? clamp((pos[i] - mins[i]) / extents[i], 0.0f, 1.0f) : 0.0f;
+        keyOut[i] = static_cast<std::uint16_t>(std::lround(normalized * TranslationKeyScale));
+    }
+}
+
+static Point3 decodeTranslationKey(const std::uint16_t * key, const float * mins, const float * extents)
+{
+    return { mins[0] + key[0] * (extents[0] / TranslationKeyScale),
+             mins[1] + key[1] * (extents[1] / TranslationKeyScale),
+             mins[2] + key[2] * (extents[2] / TranslationKeyScale) };
+}
+
+// The vectormath normalize() uses an approximate reciprocal square root (about 12 bits),
+// which alone is more error than the quantization, so the codec normalizes with a real sqrt.
+static Quat normalizeExact(const float x, const float y, const float z, const float w)
+{
+    const float invLen = 1.0f / std::sqrt(x * x + y * y + z * z + w * w);
+    return { x * invLen, y * invLen, z * invLen, w * invLen };
+}
+
+static Quat mulQuat(const Quat & a, const Quat & b)
+{
+    return { a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1],
+             a[3] * b[1] + a[1] * b[3] + a[2] * b[0] - a[0] * b[2],
+             a[3] * b[2] + a[2] * b[3] + a[0] * b[1] - a[1] * b[0],
+             a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2] };
+}
+
+// Rotates by a unit quaternion: p + 2w(q x p) + 2q x (q x p).
+static Point3 rotatePoint(const Quat & q, const Point3 & p)
+{
+    const float tx = 2.0f * (q[1] * p[2] - q[2] * p[1]);
+    const float ty = 2.0f * (q[2] * p[0] - q[0] * p[2]);
+    const float tz = 2.0f * (q[0] * p[1] - q[1] * p[0]);
+    return { p[0] + q[3] * tx + (q[1] * tz - q[2] * ty),
+             p[1] + q[3] * ty + (q[2] * tx - q[0] * tz),
+             p[2] + q[3] * tz + (q[0] * ty - q[1] * tx) };
+}
+
+// Normalized lerp along the shortest path. Close enough to slerp between nearby keys, and a lot cheaper.
+static Quat nlerpShortest(const Quat & a, const Quat & b, const float t)
+{
+    const float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    const float tb  = (dot < 0.0f) ? -t : t;
+    const float ta  = 1.0f - t;
+    return normalizeExact(a[0] * ta + b[0] * tb,
+                          a[1] * ta + b[1] * tb,
+                          a[2] * ta + b[2] * tb,
+                          a[3] * ta + b[3] * tb);
+}
+
+static Point3 lerpPoint(const Point3 & a, const Point3 & b, const float t)
+{
+    return { a[0] + (b[0] - a[0]) * t,
+             a[1] + (b[1] - a[1]) * t,
+             a[2] + (b[2] - a[2]) * t };
+}
+
+// Displacement of a point 'distance' units away from the joint when rotated by
+// 'a' instead of 'b', in the worst case (point perpendicular to the rotation axis).
+// That is 2*sin(angle/2)*distance. Computed from the chord between the quaternions,
+// since 1-dot^2 loses all precision in floats for the small angles we care about.
+static float rotationError(const Quat & a, const Quat & b, const float distance)
+{
+    const float sign = (a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3] < 0.0f) ? -1.0f : 1.0f;
+    const float dx = a[0] - b[0] * sign;
+    const float dy = a[1] - b[1] * sign;
+    const float dz = a[2] - b[2] * sign;
+    const float dw = a[3] - b[3] * sign;
+    const float chordSq = dx * dx + dy * dy + dz * dz + dw * dw;
+
+    // sin(angle/2) = chord * sqrt(1 - chord^2 / 4)
+    return 2.0f * distance * std::sqrt(chordSq * std::max(1.0f - chordSq * 0.25f, 0.0f));
+}
+
+static float translationError(const Point3 & a, const Point3 & b)
+{
+    const float dx = a[0] - b[0];
+    const float dy = a[1] - b[1];
+    const float dz = a[2] - b[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+#if defined(__SSE2__)
+
+static inline __m128 select4(const __m128 mask, const __m128 a, const __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 loadLanes4(const std::int32_t * lanes)
+{
+    return _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes)));
+}
+
+// decodeRotationLanes() of four keys, from three lane arrays 'stride' apart.
+static inline void decodeRotationKeys4(const std::int32_t * lanes, const int stride, __m128 * q)
+{
+    const __m128i lane0 = _mm_castps_si128(loadLanes4(lanes));
+    const __m128i lane1 = _mm_castps_si128(loadLanes4(lanes + stride));
+    const __m128i lane2 = _mm_castps_si128(loadLanes4(lanes + stride * 2));
+    const __m128i valueMask = _mm_set1_epi32(RotationValueMask);
+    const __m128i largest   = _mm_or_si128(_mm_srli_epi32(lane0, 15), _mm_slli_epi32(_mm_srli_epi32(lane1, 15), 1));
+
+    const __m128 scale = _mm_set1_ps(RotationDecodeScale);
+    const __m128 range = _mm_set1_ps(SmallestThreeRange);
+    const __m128 s0 = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(lane0, valueMask)), scale), range);
+    const __m128 s1 = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(lane1, valueMask)), scale), range);
+    const __m128 s2 = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(lane2, valueMask)), scale), range);
+
+    const __m128 sumSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s0, s0), _mm_mul_ps(s1, s1)), _mm_mul_ps(s2, s2));
+    const __m128 big   = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.0f), sumSq), _mm_setzero_ps()));
+
+    // Component c is the dropped one if c == largest, else smallest[c] before it and smallest[c - 1] after.
+    const __m128 is0 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(0)));
+    const __m128 is1 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(1)));
+    const __m128 is2 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(2)));
+    const __m128 is3 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(3)));
+
+    q[0] = select4(is0, big, s0);
+    q[1] = select4(is0, s0, select4(is1, big, s1));
+    q[2] = select4(is3, s2, select4(is2, big, s1));
+    q[3] = select4(is3, big, s2);
+}
+
+// nlerpShortest() of four quaternion pairs. Normalized with the approximate
+// reciprocal square root plus a Newton-Raphson step, which is about as exact as a sqrt.
+static inline void nlerpShortest4(const __m128 * a, const __m128 * b, const __m128 t, __m128 * out)
+{
+    const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])),
+                                  _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+    const __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+    const __m128 tb   = _mm_xor_ps(t, flip);
+    const __m128 ta   = _mm_sub_ps(_mm_set1_ps(1.0f), t);
+
+    __m128 q[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        q[i] = _mm_add_ps(_mm_mul_ps(a[i], ta), _mm_mul_ps(b[i], tb));
+    }
+
+    const __m128 lengthSqr = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(q[0], q[0]), _mm_mul_ps(q[1], q[1])),
+                                                   _mm_add_ps(_mm_mul_ps(q[2], q[2]), _mm_mul_ps(q[3], q[3]))),
+                                        _mm_set1_ps(1e-20f));
+    const __m128 r = _mm_rsqrt_ps(lengthSqr);
+    const __m128 invLength = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r),
+                                        _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(lengthSqr, r), r)));
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = _mm_mul_ps(q[i], invLength);
+    }
+}
+
+#endif // __SSE2__
+
+//
+// Greedy keyframe reduction of a single track. 'exact' are the source values
+// and 'quantized' the same values after a round trip through the key encoding.
+// Each segment is extended for as long as all the frames it covers can be
+// interpolated from its end keys within 'maxError'. Fills 'keysOut' with the
+// frame numbers to keep, always including the first and the last.
+//
+template<typename T, typename LerpFunc, typename ErrorFunc>
+static void reduceKeys(const std::vector<T> & exact, const std::vector<T> & quantized, const float maxError,
+                       LerpFunc lerpFunc, ErrorFunc errorFunc, std::vector<int> & keysOut)
+{
+    const int count = static_cast<int>(exact.size());
+    keysOut.clear();
+    keysOut.push_back(0);
+
+    // A track that doesn't move only needs one key.
+    bool constant = true;
+    for (int f = 1; f < count && constant; ++f)
+    {
+        constant = errorFunc(quantized[0], exact[f]) <= maxError;
+    }
+    if (constant)
+    {
+        return;
+    }
+
+    auto segmentFits = [&](const int first, const int last)
+    {
+        for (int f = first + 1; f < last; ++f)
+        {
+            const float t = static_cast<float>(f - first) / static_cast<float>(last - first);
+            if (errorFunc(lerpFunc(quantized[first], quantized[last], t), exact[f]) > maxError)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    int first = 0;
+    while (first < count - 1)
+    {
+        int last = first + 1;
+        while (last + 1 < count && segmentFits(first, last + 1))
+        {
+            ++last;
+        }
+        keysOut.push_back(last);
+        first = last;
+    }
+}
+
+// ========================================================
+// CompressedAnim implementation:
+// ========================================================
+
+CompressedAnim::CompressedAnim(const AnimInstance & anim, const AnimCompressionSettings & settings)
+    : numFrames          { anim.getNumFrames() }
+    , numJoints          { anim.getNumJoints() }
+    , frameRate          { anim.getFrameRate() }
+    , parents            { }
+    , rotationTracks     { }
+    , translationTracks  { }
+    , translationMins    { }
+    , translationScales  { }
+    , rotationFrames     { }
+    , translationFrames  { }
+    , rotationKeys       { }
+    , translationKeys    { }
+    , maxJointSpaceError { 0.0f }
+    , maxModelSpaceError { 0.0f }
+{
+    if (numFrames <= 0 || numJoints <= 0)
+    {
+        throw std::runtime_error{ "Can't compress an empty animation!" };
+    }
+    if (numFrames > UINT16_MAX)
+    {
+        throw std::runtime_error{ "Too many frames to compress animation: " + std::to_string(numFrames) };
+    }
+
+    // The hierarchy is the same in every frame. The Skeleton already
+    // validated that parents always come before their children.
+    parents = anim.getSkeleton().getParents();
+
+    // The AnimInstance frames are in model space. Go back to joint space, which
+    // changes a lot less from frame to frame (and is where the error is measured).
+    // Stored as [frame][joint].
+    std::vector<Quat>   rotations(numFrames * numJoints);
+    std::vector<Point3> positions(numFrames * numJoints);
+
+    for (int f = 0; f < numFrames; ++f)
+    {
+        const float * frameRotations = anim.getFrameRotations(f);
+        const float * framePositions = anim.getFramePositions(f);
+        for (int j = 0; j < numJoints; ++j)
+        {
+            const int index = f * numJoints + j;
+            const float * rot = frameRotations + j * 4;
+            const float * pos = framePositions + j * 3;
+            if (parents[j] < 0)
+            {
+                rotations[index] = Quat{ rot[0], rot[1], rot[2], rot[3] };
+                positions[index] = Point3{ pos[0], pos[1], pos[2] };
+            }
+            else
+            {
+                const float * parentRot = frameRotations + parents[j] * 4;
+                const float * parentPos = framePositions + parents[j] * 3;
+                const Quat invOrient    = Quat{ -parentRot[0], -parentRot[1], -parentRot[2], parentRot[3] };
+                const Point3 relative   = { pos[0] - parentPos[0],
+                                            pos[1] - parentPos[1],
+                                            pos[2] - parentPos[2] };
+
+                const Quat local = mulQuat(invOrient, Quat{ rot[0], rot[1], rot[2], rot[3] });
+                rotations[index] = normalizeExact(local[0], local[1], local[2], local[3]);
+                positions[index] = rotatePoint(invOrient, relative);
+            }
+        }
+    }
+
+    compressRotations(rotations, settings);
+    compressTranslations(positions, settings);
+
+    rotationFrames.shrink_to_fit();
+    translationFrames.shrink_to_fit();
+    rotationKeys.shrink_to_fit();
+    translationKeys.shrink_to_fit();
+
+    validate(anim, rotations, positions, settings);
+}
+
+void CompressedAnim::compressRotations(const std::vector<Quat> & rotations, const AnimCompressionSettings & settings)
+{
+    std::vector<Quat> exact(numFrames);
+    std::vector<Quat> quantized(numFrames);
+    std::vector<int>  keys;
+    std::uint16_t     key[3];
+
+    const float distance = settings.errorDistance;
+    auto errorFunc = [distance](const Quat & a, const Quat & b) { return rotationError(a, b, distance); };
+
+    rotationTracks.resize(numJoints);
+    for (int j = 0; j < numJoints; ++j)
+    {
+        for (int f = 0; f < numFrames; ++f)
+        {
+            exact[f] = rotations[f * numJoints + j];
+            encodeRotationKey(exact[f], key);
+            quantized[f] = decodeRotationKey(key);
+        }
+
+        reduceKeys(exact, quantized, settings.maxError, nlerpShortest, errorFunc, keys);
+
+        rotationTracks[j].firstKey = static_cast<std::uint32_t>(rotationFrames.size());
+        rotationTracks[j].numKeys  = static_cast<std::uint32_t>(keys.size());
+
+        for (const int f : keys)
+        {
+            encodeRotationKey(exact[f], key);
+            rotationFrames.push_back(static_cast<std::uint16_t>(f));
+            rotationKeys.insert(std::end(rotationKeys), key, key + 3);
+        }
+    }
+}
+
+void CompressedAnim::compressTranslations(const std::vector<Point3> & positions, const AnimCompressionSettings & settings)
+{
+    std::vector<Point3> exact(numFrames);
+    std::vector<Point3> quantized(numFrames);
+    std::vector<int>    keys;
+    std::uint16_t       key[3];
+
+    // The padding joints get an empty range, so they decode to zero.
+    const int stride = getPaddedJoints();
+    translationTracks.resize(numJoints);
+    translationMins.assign(stride * 3, 0.0f);
+    translationScales.assign(stride * 3, 0.0f);
+
+    for (int j = 0; j < numJoints; ++j)
+    {
+        // Range the track covers in this clip:
+        float mins[3];
+        float maxs[3];
+        float extents[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            mins[i] = maxs[i] = positions[j][i];
+        }
+        for (int f = 0; f < numFrames; ++f)
+        {
+            const Point3 & pos = positions[f * numJoints + j];
+            for (int i = 0; i < 3; ++i)
+            {
+                mins[i] = std::min<float>(mins[i], pos[i]);
+                maxs[i] = std::max<float>(maxs[i], pos[i]);
+            }
+            exact[f] = pos;
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            extents[i] = maxs[i] - mins[i];
+            translationMins[i * stride + j]   = mins[i];
+            translationScales[i * stride + j] = extents[i] / TranslationKeyScale;
+        }
+
+        for (int f = 0; f < numFrames; ++f)
+        {
+            encodeTranslationKey(exact[f], mins, extents, key);
+            quantized[f] = decodeTranslationKey(key, mins, extents);
+        }
+
+        reduceKeys(exact, quantized, settings.maxError, lerpPoint, translationError, keys);
+
+        translationTracks[j].firstKey = static_cast<std::uint32_t>(translationFrames.size());
+        translationTracks[j].numKeys  = static_cast<std::uint32_t>(keys.size());
+
+        for (const int f : keys)
+        {
+            encodeTranslationKey(exact[f], mins, extents, key);
+            translationFrames.push_back(static_cast<std::uint16_t>(f));
+            translationKeys.insert(std::end(translationKeys), key, key + 3);
+        }
+    }
+}
+
+void CompressedAnim::validate(const AnimInstance & anim, const std::vector<Quat> & rotations,
+                              const std::vector<Point3> & positions, const AnimCompressionSettings & settings)
+{
+    // Errors are sampled at the original frames, where the source data is known.
+    // Joint space errors are what the compression bounds, model space errors also
+    // include what accumulates down the hierarchy.
+    std::vector<Quat>   sampledRotations(numJoints);
+    std::vector<Point3> sampledPositions(numJoints);
+    Pose sampledPose;
+    sampledPose.resize(numJoints);
+
+    for (int f = 0; f < numFrames; ++f)
+    {
+        sampleJointSpace(static_cast<float>(f), sampledRotations.data(), sampledPositions.data());
+        sample(static_cast<float>(f), sampledPose);
+
+        const float * framePositions = anim.getFramePositions(f);
+        for (int j = 0; j < numJoints; ++j)
+        {
+            const int index = f * numJoints + j;
+            const float * sampledPos = &sampledPose.positions[j * 3];
+            const float * sourcePos  = framePositions + j * 3;
+
+            maxJointSpaceError = std::max(maxJointSpaceError, translationError(sampledPositions[j], positions[index]));
+            maxJointSpaceError = std::max(maxJointSpaceError, rotationError(sampledRotations[j], rotations[index], settings.errorDistance));
+            maxModelSpaceError = std::max(maxModelSpaceError, translationError(Point3{ sampledPos[0], sampledPos[1], sampledPos[2] },
+                                                                               Point3{ sourcePos[0], sourcePos[1], sourcePos[2] }));
+        }
+    }
+}
+
+int CompressedAnim::findKey(const Track & track, const std::uint16_t * frames, const float frame, std::uint16_t * cursorKey)
+{
+    // Last key with a frame number <= 'frame'.
+    constexpr int MaxCursorSteps = 4;
+    const std::uint16_t * keyFrames = frames + track.firstKey;
+    const int numKeys = static_cast<int>(track.numKeys);
+
+    if (cursorKey != nullptr && *cursorKey < numKeys && keyFrames[*cursorKey] <= frame)
+    {
+        // Playing forward: usually the same key or the next one.
+        int k = *cursorKey;
+        for (int step = 0; step < MaxCursorSteps && k + 1 < numKeys && keyFrames[k + 1] <= frame; ++step)
+        {
+            ++k;
+        }
+        if (k + 1 >= numKeys || frame < keyFrames[k + 1])
+        {
+            *cursorKey = static_cast<std::uint16_t>(k);
+            return k;
+        }
+    }
+
+    const std::uint16_t * iter = std::upper_bound(keyFrames + 1, keyFrames + numKeys, frame,
+                                                  [](const float value, const std::uint16_t key) { return value < key; });
+    const int k = static_cast<int>((iter - keyFrames) - 1);
+    if (cursorKey != nullptr)
+    {
+        *cursorKey = static_cast<std::uint16_t>(k);
+    }
+    return k;
+}
+
+void CompressedAnim::decodeJointSpace(float frame, Cursor * cursor, float * rotationsOut, float * positionsOut) const
+{
+    frame = clamp(frame, 0.0f, static_cast<float>(numFrames - 1));
+
+    if (cursor != nullptr && static_cast<int>(cursor->rotationKeys.size()) != numJoints)
+    {
+        cursor->rotationKeys.assign(numJoints, 0);
+        cursor->translationKeys.assign(numJoints, 0);
+    }
+
+    //
+    // Gather pass: the two keys around 'frame' of every track, as six arrays
+    // of lanes (three for each key), plus the interpolation fraction. The
+    // padding joints stay zeroed, which decodes to finite garbage nobody reads.
+    //
+    const int stride = getPaddedJoints();
+    FrameArenaScope scope;
+    FrameArena & arena = scope.getArena();
+    std::int32_t * rotationLanes    = arena.allocArray<std::int32_t>(stride * 6);
+    std::int32_t * translationLanes = arena.allocArray<std::int32_t>(stride * 6);
+    float * rotationFractions       = arena.allocArray<float>(stride);
+    float * translationFractions    = arena.allocArray<float>(stride);
+
+    for (int j = numJoints; j < stride; ++j)
+    {
+        for (int l = 0; l < 6; ++l)
+        {
+            rotationLanes[l * stride + j]    = 0;
+            translationLanes[l * stride + j] = 0;
+        }
+        rotationFractions[j]    = 0.0f;
+        translationFractions[j] = 0.0f;
+    }
+
+    for (int j = 0; j < numJoints; ++j)
+    {
+        const Track & rotTrack = rotationTracks[j];
+        const int rk = findKey(rotTrack, rotationFrames.data(), frame, (cursor != nullptr ? &cursor->rotationKeys[j] : nullptr));
+        const std::uint32_t rotA = rotTrack.firstKey + rk;
+        const std::uint32_t rotB = (static_cast<std::uint32_t>(rk + 1) < rotTrack.numKeys) ? rotA + 1 : rotA;
+
+        const Track & posTrack = translationTracks[j];
+        const int tk = findKey(posTrack, translationFrames.data(), frame, (cursor != nullptr ? &cursor->translationKeys[j] : nullptr));
+        const std::uint32_t posA = posTrack.firstKey + tk;
+        const std::uint32_t posB = (static_cast<std::uint32_t>(tk + 1) < posTrack.numKeys) ? posA + 1 : posA;
+
+        for (int l = 0; l < 3; ++l)
+        {
+            rotationLanes[l * stride + j]          = rotationKeys[rotA * 3 + l];
+            rotationLanes[(l + 3) * stride + j]    = rotationKeys[rotB * 3 + l];
+            translationLanes[l * stride + j]       = translationKeys[posA * 3 + l];
+            translationLanes[(l + 3) * stride + j] = translationKeys[posB * 3 + l];
+        }
+
+        rotationFractions[j] = (rotB != rotA) ?
+            (frame - rotationFrames[rotA]) / static_cast<float>(rotationFrames[rotB] - rotationFrames[rotA]) : 0.0f;
+        translationFractions[j] = (posB != posA) ?
+            (frame - translationFrames[posA]) / static_cast<float>(translationFrames[posB] - translationFrames[posA]) : 0.0f;
+    }
+
+    //
+    // Decode pass: smallest three decode and nlerp of the rotations, dequantize
+    // and lerp of the translations. Four joints at a time with SSE2.
+    //
+    const float * mins   = translationMins.data();
+    const float * scales = translationScales.data();
+    int j = 0;
+
+    #if defined(__SSE2__)
+    for (; j < stride; j += 4)
+    {
+        __m128 a[4], b[4], q[4];
+        decodeRotationKeys4(rotationLanes + j, stride, a);
+        decodeRotationKeys4(rotationLanes + stride * 3 + j, stride, b);
+        nlerpShortest4(a, b, _mm_loadu_ps(rotationFractions + j), q);
+        for (int i = 0; i < 4; ++i)
+        {
+            _mm_storeu_ps(rotationsOut + i * stride + j, q[i]);
+        }
+
+        const __m128 t = _mm_loadu_ps(translationFractions + j);
+        for (int i = 0; i < 3; ++i)
+        {
+            const __m128 minimum = _mm_loadu_ps(mins + i * stride + j);
+            const __m128 scale   = _mm_loadu_ps(scales + i * stride + j);
+            const __m128 posA    = _mm_add_ps(minimum, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(loadLanes4(translationLanes + i * stride + j))), scale));
+            const __m128 posB    = _mm_add_ps(minimum, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(loadLanes4(translationLanes + (i + 3) * stride + j))), scale));
+            _mm_storeu_ps(positionsOut + i * stride + j, _mm_add_ps(posA, _mm_mul_ps(_mm_sub_ps(posB, posA), t)));
+        }
+    }
+    #endif // __SSE2__
+
+    for (; j < numJoints; ++j)
+    {
+        const Quat a = decodeRotationLanes(rotationLanes[j], rotationLanes[stride + j], rotationLanes[stride * 2 + j]);
+        const Quat b = decodeRotationLanes(rotationLanes[stride * 3 + j], rotationLanes[stride * 4 + j], rotationLanes[stride * 5 + j]);
+        const Quat q = nlerpShortest(a, b, rotationFractions[j]);
+        for (int i = 0; i < 4; ++i)
+        {
+            rotationsOut[i * stride + j] = q[i];
+        }
+
+        for (int i = 0; i < 3; ++i)
+        {
+            const float posA = mins[i * stride + j] + translationLanes[i * stride + j] * scales[i * stride + j];
+            const float posB = mins[i * stride + j] + translationLanes[(i + 3) * stride + j] * scales[i * stride + j];
+            positionsOut[i * stride + j] = posA + (posB - posA) * translationFractions[j];
+        }
+    }
+}
+
+void CompressedAnim::sampleJointSpace(const float frame, Quat * rotationsOut, Point3 * positionsOut, Cursor * cursor) const
+{
+    assert(rotationsOut != nullptr);
+    assert(positionsOut != nullptr);
+
+    const int stride = getPaddedJoints();
+    FrameArenaScope scope;
+    float * rotations = scope.getArena().allocArray<float>(stride * 4);
+    float * positions = scope.getArena().allocArray<float>(stride * 3);
+    decodeJointSpace(frame, cursor, rotations, positions);
+
+    for (int j = 0; j < numJoints; ++j)
+    {
+        rotationsOut[j] = Quat{ rotations[j], rotations[stride + j], rotations[stride * 2 + j], rotations[stride * 3 + j] };
+        positionsOut[j] = Point3{ positions[j], positions[stride + j], positions[stride * 2 + j] };
+    }
+}
+
+void CompressedAnim::sample(const float frame, Pose & poseOut, Cursor * cursor) const
+{
+    assert(poseOut.getNumJoints() == numJoints);
+
+    const int stride = getPaddedJoints();
+    FrameArenaScope scope;
+    float * rotations = scope.getArena().allocArray<float>(stride * 4);
+    float * positions = scope.getArena().allocArray<float>(stride * 3);
+    decodeJointSpace(frame, cursor, rotations, positions);
+
+    // Same as AnimInstance::buildFramePose(): parents always come before their children,
+    // so they are already in model space when a child is converted. The joint rotations
+    // are unit length to float precision, and so are their products, so no renormalizing.
+    float * rotationsOut = poseOut.rotations.data();
+    float * positionsOut = poseOut.positions.data();
+
+    for (int j = 0; j < numJoints; ++j)
+    {
+        const float q[4]{ rotations[j], rotations[stride + j], rotations[stride * 2 + j], rotations[stride * 3 + j] };
+        const float p[3]{ positions[j], positions[stride + j], positions[stride * 2 + j] };
+        float * rotOut = rotationsOut + j * 4;
+        float * posOut = positionsOut + j * 3;
+
+        const int parent = parents[j];
+        if (parent < 0)
+        {
+            std::copy_n(q, 4, rotOut);
+            std::copy_n(p, 3, posOut);
+            continue;
+        }
+
+        // Parent rotation applied to the position, p + 2w(r x p) + 2r x (r x p), then to the rotation.
+        const float * r  = rotationsOut + parent * 4;
+        const float * rp = positionsOut + parent * 3;
+        const float tx = 2.0f * (r[1] * p[2] - r[2] * p[1]);
+        const float ty = 2.0f * (r[2] * p[0] - r[0] * p[2]);
+        const float tz = 2.0f * (r[0] * p[1] - r[1] * p[0]);
+
+        posOut[0] = p[0] + r[3] * tx + (r[1] * tz - r[2] * ty) + rp[0];
+        posOut[1] = p[1] + r[3] * ty + (r[2] * tx - r[0] * tz) + rp[1];
+        posOut[2] = p[2] + r[3] * tz + (r[0] * ty - r[1] * tx) + rp[2];
+
+        rotOut[0] = r[3] * q[0] + r[0] * q[3] + r[1] * q[2] - r[2] * q[1];
+        rotOut[1] = r[3] * q[1] + r[1] * q[3] + r[2] * q[0] - r[0] * q[2];
+        rotOut[2] = r[3] * q[2] + r[2] * q[3] + r[0] * q[1] - r[1] * q[0];
+        rotOut[3] = r[3] * q[3] - r[0] * q[0] - r[1] * q[1] - r[2] * q[2];
+    }
+}
+
+std::size_t CompressedAnim::getMemoryBytes() const noexcept
+{
+    return sizeof(*this) +
+           parents.capacity()           * sizeof(int)              +
+           rotationTracks.capacity()    * sizeof(Track)            +
+           translationTracks.capacity() * sizeof(Track)            +
+           translationMins.capacity()   * sizeof(float)            +
+           translationScales.capacity() * sizeof(float)            +
+           rotationFrames.capacity()    * sizeof(std::uint16_t)    +
+           translationFrames.capacity() * sizeof(std::uint16_t)    +
+           rotationKeys.capacity()      * sizeof(std::uint16_t)    +
+           translationKeys.capacity()   * sizeof(std::uint16_t);
+}
+
+} // namespace DOOM3 {}
@@ -0,0 +1,157 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: compressed_anim.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Compressed storage for DOOM 3 MD5 animation clips.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef COMPRESSED_ANIM_HPP
+#define COMPRESSED_ANIM_HPP
+
+#include "framework/doom3md5.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace DOOM3
+{
+
+// ========================================================
+// class CompressedAnim:
+// ========================================================
+
+//
+// Error tolerance used when building a CompressedAnim.
+//
+// Rotation errors are converted to a distance by rotating a virtual point
+// 'errorDistance' units away from the joint, so a single 'maxError' bounds
+// both the translations and the rotations. Errors are measured in joint space
+// (relative to the parent), in the same units as the md5anim file.
+//
+struct AnimCompressionSettings
+{
+    float maxError      = 0.01f;
+    float errorDistance = 10.0f;
+};
+
+//
+// Compressed copy of an AnimInstance.
+//
+// The poses are converted back to joint space and each joint gets a
+// rotation track and a translation track:
+//
+//  - Rotations use "smallest three" quantization: the largest quaternion
+//    component is dropped (it can be recomputed from the other three, since
+//    the quaternion is unit length) and the remaining three are stored in
+//    15 bits each, plus 2 bits for the index of the dropped one. 48 bits per key:
+//    three 16-bit lanes, with the index in the top bit of the first two, so each
+//    lane decodes on its own with a mask and a shift.
+//
+//  - Translations are stored as 16 bits per component, normalized to the
+//    range the track covers in the clip.
+//
+//  - Keyframes that can be linearly interpolated from their neighbors within
+//    the error tolerance are removed. Tracks that don't move keep a single key.
+//
+// Sampling runs in two passes over all the joints. The first finds the two keys
+// around the frame in each track and gathers their lanes into structure-of-arrays
+// scratch, one array per lane. The second decodes and interpolates the keys from
+// there four joints at a time with SSE2 (a scalar loop for other targets). With
+// a Cursor, sequential playback steps from the keys of the previous sample
+// instead of searching for them. sample() then rebuilds the model space pose
+// from the joints, which AnimInstance stores precomputed, so a compressed clip
+// still costs more to sample than an uncompressed one: smaller, not faster.
+//
+class CompressedAnim final
+{
+public:
+
+    explicit CompressedAnim(const AnimInstance & anim, const AnimCompressionSettings & settings = AnimCompressionSettings{});
+
+    // Copy/assignment is disabled.
+    CompressedAnim(const CompressedAnim &) = delete;
+    CompressedAnim & operator = (const CompressedAnim &) = delete;
+
+    //
+    // Playback position of a caller of sample(): the current key of each track.
+    // Sampling at or after the previous frame, like normal playback, steps the
+    // keys forward from there. Seeking back or far ahead falls back to a binary
+    // search. Each caller needs its own. Sized on first use.
+    //
+    struct Cursor
+    {
+        std::vector<std::uint16_t> rotationKeys;
+        std::vector<std::uint16_t> translationKeys;
+    };
+
+    //
+    // Decompresses the pose at 'frame', which may be fractional, into model space,
+    // like AnimInstance::getFrameRotations/Positions(). 'poseOut' must already be
+    // sized for getNumJoints(). Frames outside [0, numFrames-1] are clamped.
+    // Without a cursor each track does a binary search for its keys.
+    //
+    void sample(float frame, Pose & poseOut, Cursor * cursor = nullptr) const;
+
+    // Same as above but outputs joint space (parent relative) rotations and positions.
+    void sampleJointSpace(float frame, Quat * rotationsOut, Point3 * positionsOut, Cursor * cursor = nullptr) const;
+
+    // Read-only accessors:
+    int getNumFrames() const noexcept { return numFrames; }
+    int getNumJoints() const noexcept { return numJoints; }
+    int getFrameRate() const noexcept { return frameRate; }
+
+    // Compression stats:
+    std::size_t getMemoryBytes()  const noexcept;
+    int getNumRotationKeys()      const noexcept { return static_cast<int>(rotationKeys.size() / 3);    }
+    int getNumTranslationKeys()   const noexcept { return static_cast<int>(translationKeys.size() / 3); }
+    float getMaxJointSpaceError() const noexcept { return maxJointSpaceError; }
+    float getMaxModelSpaceError() const noexcept { return maxModelSpaceError; }
+
+private:
+
+    struct Track
+    {
+        std::uint32_t firstKey; // Index into the key arrays (in keys, not in uint16s).
+        std::uint32_t numKeys;  // At least 1.
+    };
+
+    void compressRotations(const std::vector<Quat> & rotations, const AnimCompressionSettings & settings);
+    void compressTranslations(const std::vector<Point3> & positions, const AnimCompressionSettings & settings);
+    void validate(const AnimInstance & anim, const std::vector<Quat> & rotations,
+                  const std::vector<Point3> & positions, const AnimCompressionSettings & settings);
+
+    // Joint space pose in 'rotationsOut' (4 arrays of getPaddedJoints() floats: x, y, z, w)
+    // and 'positionsOut' (3 arrays: x, y, z).
+    void decodeJointSpace(float frame, Cursor * cursor, float * rotationsOut, float * positionsOut) const;
+    static int findKey(const Track & track, const std::uint16_t * frames, float frame, std::uint16_t * cursorKey);
+
+    int getPaddedJoints() const noexcept { return (numJoints + 3) & ~3; }
+
+    int numFrames;
+    int numJoints;
+    int frameRate;
+
+    std::vector<int>              parents;         // Parent joint index or -1 for roots.
+    std::vector<Track>            rotationTracks;  // One per joint.
+    std::vector<Track>            translationTracks;
+    std::vector<float>            translationMins;   // Range of each track: 3 arrays of getPaddedJoints(), x, y, z.
+    std::vector<float>            translationScales; // Extents of the range / 65535, same layout.
+    std::vector<std::uint16_t>    rotationFrames;  // Frame number of each key, for all tracks.
+    std::vector<std::uint16_t>    translationFrames;
+    std::vector<std::uint16_t>    rotationKeys;    // 3 x 16 bits per key (smallest three).
+    std::vector<std::uint16_t>    translationKeys; // 3 x 16 bits per key.
+
+    // Worst error against the uncompressed poses, at the original frames.
+    float maxJointSpaceError;
+    float maxModelSpaceError;
+};
+
+} // namespace DOOM3 {}
+
+#endif // COMPRESSED_ANIM_HPP
@@ -0,0 +1,539 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: concurrent_pool.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Thread-safe variant of the generic pool allocator with per-thread caches.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef CONCURRENT_POOL_HPP
+#define CONCURRENT_POOL_HPP
+
+#include "framework/pool.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+// ========================================================
+// Thread cache slots shared by all ConcurrentPools:
+// ========================================================
+
+namespace ConcurrentPoolDetail
+{
+
+// Max number of threads that can have a cache in a pool at the same time.
+// Threads past this limit still work, but go straight to the central lists.
+constexpr int MaxThreadSlots = 64;
+
+// Padding size used to keep per-thread data on separate cache lines.
+constexpr int CacheLineSize = 64;
+
+class ThreadSlotRegistry final
+{
+public:
+
+    static ThreadSlotRegistry & getInstance()
+    {
+        static ThreadSlotRegistry registry;
+        return registry;
+    }
+
+    int acquireSlot()
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        for (int i = 0; i < MaxThreadSlots; ++i)
+        {
+            if (!slotsInUse[i])
+            {
+                slotsInUse[i] = true;
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void releaseSlot(const int slot)
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        assert(slot >= 0 && slot < MaxThreadSlots);
+        slotsInUse[slot] = false;
+    }
+
+private:
+
+    std::mutex mutex;
+    bool slotsInUse[MaxThreadSlots] = {};
+};
+
+// Slot index of a thread, released when the thread exits. A slot can be reused
+// by a newer thread, which then inherits the free objects cached by the old one
+// (the objects belong to the pool, not to the thread, so nothing is leaked).
+struct ThreadSlot final
+{
+    const int index;
+
+    ThreadSlot()
+        : index{ ThreadSlotRegistry::getInstance().acquireSlot() }
+    { }
+
+    ~ThreadSlot()
+    {
+        if (index >= 0)
+        {
+            ThreadSlotRegistry::getInstance().releaseSlot(index);
+        }
+    }
+};
+
+inline int getThreadSlot()
+{
+    thread_local ThreadSlot slot;
+    return slot.index;
+}
+
+} // namespace ConcurrentPoolDetail {}
+
+// ========================================================
+// template class ConcurrentPool<T, Granularity, BatchSize>:
+// ========================================================
+
+//
+// Thread-safe pool of fixed-size memory blocks, with the same interface as Pool.
+//
+// Each thread allocates from and frees into its own small cache of free objects,
+// with no locking. When the cache runs empty it is refilled with 'BatchSize' objects
+// taken from a set of central free lists, and when it gets over twice that size,
+// a batch is given back. The central lists are striped, each thread having a home
+// stripe and only looking at the others when it runs dry, so threads seldom contend
+// on the same lock. New pool blocks are allocated under a separate lock.
+//
+// Objects can be freed by a different thread than the one that allocated them.
+// drain() is not thread-safe and must only be called when no other thread is using the pool.
+//
+template
+<
+    typename T,
+    int Granularity,
+    int BatchSize = 32
+>
+class ConcurrentPool final
+{
+public:
+
+     ConcurrentPool(); // Empty pool; no allocation until first use.
+    ~ConcurrentPool(); // Drains the pool.
+
+    // Not copyable.
+    ConcurrentPool(const ConcurrentPool &) = delete;
+    ConcurrentPool & operator = (const ConcurrentPool &) = delete;
+
+    // Allocates a single memory block of size 'T' and
+    // returns an uninitialized pointer to it.
+    T * allocate();
+
+    // Deallocates a memory block previously allocated by 'allocate()'.
+    // Pointer may be null, in which case this is a no-op. NOTE: Class destructor NOT called!
+    void deallocate(void * ptr);
+
+    // Gives the free objects cached by the calling thread back to the central lists,
+    // so other threads can use them. Useful before a worker thread goes idle for long.
+    void flushThreadCache();
+
+    // Frees all blocks, reseting the pool allocator to its initial state.
+    // WARNING: Calling this method will invalidate any memory block still
+    // alive that was previously allocated from this pool. Not thread-safe.
+    void drain();
+
+    // Miscellaneous stats queries. The counters are kept per thread and
+    // summed on read, so they are only exact when the pool is not in use.
+    int getTotalAllocs()  const noexcept;
+    int getTotalFrees()   const noexcept;
+    int getObjectsAlive() const noexcept;
+    int getSize()         const noexcept;
+
+    static std::size_t getGranularity() noexcept;
+    static std::size_t getObjectSize()  noexcept;
+    static std::size_t getBatchSize()   noexcept;
+
+private:
+
+    static_assert(Granularity > 0, "Invalid pool granularity!");
+    static_assert(BatchSize   > 0, "Invalid pool batch size!");
+
+    static constexpr int StripeCount   = 8;
+    static constexpr int CacheCapacity = BatchSize * 2;
+
+    // Fill patterns for debug allocations.
+    #if DEBUG
+    static constexpr int AllocFillVal = 0xAA;
+    static constexpr int FreeFillVal  = 0xFE;
+    #endif // DEBUG
+
+    union PoolObj
+    {
+        alignas(T)
+        unsigned char userData[sizeof(T)];
+
+        PoolObj * next;
+    };
+
+    struct PoolBlock
+    {
+        PoolObj objects[Granularity];
+        PoolBlock * next;
+    };
+
+    // Only touched by the thread owning the slot, except for the
+    // counters, which any thread can read to aggregate the stats.
+    struct ThreadCache
+    {
+        PoolObj * freeList = nullptr;
+        int count = 0;
+        std::atomic<int> allocCount{ 0 };
+        std::atomic<int> freeCount{ 0 };
+        char padding[ConcurrentPoolDetail::CacheLineSize];
+    };
+
+    struct CentralStripe
+    {
+        std::mutex mutex;
+        PoolObj * freeList = nullptr;
+        std::atomic<int> count{ 0 }; // Written under the lock; read without it as a hint.
+        char padding[ConcurrentPoolDetail::CacheLineSize];
+    };
+
+    PoolObj * fetchObjects(int homeStripe, int maxCount, int * outCount);
+    void returnObjects(int stripe, PoolObj * first, PoolObj * last, int count);
+    PoolObj * allocateBlock();
+
+    static void bumpCounter(std::atomic<int> & counter) noexcept
+    {
+        // Single writer, so no need for an atomic read-modify-write.
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    ThreadCache   threadCaches[ConcurrentPoolDetail::MaxThreadSlots];
+    CentralStripe stripes[StripeCount];
+
+    std::mutex  blockListMutex;
+    PoolBlock * blockList;             // List of all blocks/pools. Guarded by 'blockListMutex'.
+    std::atomic<int> poolBlockCount;   // Size in blocks of the 'blockList'.
+    std::atomic<int> uncachedAllocs;   // Allocs/frees from threads without a cache slot.
+    std::atomic<int> uncachedFrees;
+};
+
+// ========================================================
+// ConcurrentPool<T> inline implementation:
+// ========================================================
+
+template<typename T, int Granularity, int BatchSize>
+ConcurrentPool<T, Granularity, BatchSize>::ConcurrentPool()
+    : blockList      { nullptr }
+    , poolBlockCount { 0 }
+    , uncachedAllocs { 0 }
+    , uncachedFrees  { 0 }
+{
+    // Allocates memory when the first object is requested.
+}
+
+template<typename T, int Granularity, int BatchSize>
+ConcurrentPool<T, Granularity, BatchSize>::~ConcurrentPool()
+{
+    drain();
+}
+
+template<typename T, int Granularity, int BatchSize>
+T * ConcurrentPool<T, Granularity, BatchSize>::allocate()
+{
+    const int slot = ConcurrentPoolDetail::getThreadSlot();
+    PoolObj * object;
+
+    if (slot >= 0)
+    {
+        ThreadCache & cache = threadCaches[slot];
+        if (cache.freeList == nullptr)
+        {
+            cache.freeList = fetchObjects(slot % StripeCount, BatchSize, &cache.count);
+        }
+
+        // Fetch one from the cache's head:
+        object = cache.freeList;
+        cache.freeList = object->next;
+        --cache.count;
+        bumpCounter(cache.allocCount);
+    }
+    else
+    {
+        int count = 0;
+        object = fetchObjects(StripeCount - 1, 1, &count);
+        uncachedAllocs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Initializing the object with a known pattern
+    // to help detecting memory errors.
+    #if DEBUG
+    std::memset(object, AllocFillVal, sizeof(PoolObj));
+    #endif // DEBUG
+
+    return reinterpret_cast<T *>(object);
+}
+
+template<typename T, int Granularity, int BatchSize>
+void ConcurrentPool<T, Granularity, BatchSize>::deallocate(void * ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    // Fill user portion with a known pattern to help
+    // detecting post-deallocation usage attempts.
+    #if DEBUG
+    std::memset(ptr, FreeFillVal, sizeof(PoolObj));
+    #endif // DEBUG
+
+    auto object = static_cast<PoolObj *>(ptr);
+    const int slot = ConcurrentPoolDetail::getThreadSlot();
+
+    if (slot >= 0)
+    {
+        // Add back to the cache's head. Memory not actually freed now.
+        ThreadCache & cache = threadCaches[slot];
+        object->next   = cache.freeList;
+        cache.freeList = object;
+        ++cache.count;
+        bumpCounter(cache.freeCount);
+
+        // Cache full? Give the most recently freed batch back to the home stripe
+        // and keep the older ones, so the next refill can be skipped for a while.
+        if (cache.count >= CacheCapacity)
+        {
+            PoolObj * first = cache.freeList;
+            PoolObj * last  = first;
+            for (int i = 1; i < BatchSize; ++i)
+            {
+                last = last->next;
+            }
+            cache.freeList = last->next;
+            cache.count   -= BatchSize;
+            returnObjects(slot % StripeCount, first, last, BatchSize);
+        }
+    }
+    else
+    {
+        returnObjects(StripeCount - 1, object, object, 1);
+        uncachedFrees.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template<typename T, int Granularity, int BatchSize>
+void ConcurrentPool<T, Granularity, BatchSize>::flushThreadCache()
+{
+    const int slot = ConcurrentPoolDetail::getThreadSlot();
+    if (slot < 0)
+    {
+        return;
+    }
+
+    ThreadCache & cache = threadCaches[slot];
+    if (cache.freeList == nullptr)
+    {
+        return;
+    }
+
+    PoolObj * last = cache.freeList;
+    while (last->next != nullptr)
+    {
+        last = last->next;
+    }
+
+    returnObjects(slot % StripeCount, cache.freeList, last, cache.count);
+    cache.freeList = nullptr;
+    cache.count    = 0;
+}
+
+template<typename T, int Granularity, int BatchSize>
+typename ConcurrentPool<T, Granularity, BatchSize>::PoolObj *
+ConcurrentPool<T, Granularity, BatchSize>::fetchObjects(const int homeStripe, const int maxCount, int * outCount)
+{
+    assert(maxCount > 0);
+    assert(outCount != nullptr);
+
+    // Try the home stripe first, then steal from the others.
+    for (int s = 0; s < StripeCount; ++s)
+    {
+        CentralStripe & stripe = stripes[(homeStripe + s) % StripeCount];
+        if (stripe.count.load(std::memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock{ stripe.mutex };
+        if (stripe.freeList == nullptr)
+        {
+            continue;
+        }
+
+        PoolObj * first = stripe.freeList;
+        PoolObj * last  = first;
+        int count = 1;
+        while (count < maxCount && last->next != nullptr)
+        {
+            last = last->next;
+            ++count;
+        }
+
+        stripe.freeList = last->next;
+        stripe.count.store(stripe.count.load(std::memory_order_relaxed) - count, std::memory_order_relaxed);
+
+        last->next = nullptr;
+        (*outCount) = count;
+        return first;
+    }
+
+    // All central lists are empty. Allocate a new block, keep up to
+    // 'maxCount' objects for the caller and hand the rest to the home stripe.
+    PoolObj * first = allocateBlock();
+    const int count = (maxCount < Granularity) ? maxCount : Granularity;
+
+    PoolObj * last = &first[count - 1];
+    if (count < Granularity)
+    {
+        returnObjects(homeStripe, last->next, &first[Granularity - 1], Granularity - count);
+    }
+
+    last->next  = nullptr;
+    (*outCount) = count;
+    return first;
+}
+
+template<typename T, int Granularity, int BatchSize>
+void ConcurrentPool<T, Granularity, BatchSize>::returnObjects(const int stripeIndex, PoolObj * first, PoolObj * last, const int count)
+{
+    assert(first != nullptr && last != nullptr);
+
+    CentralStripe & stripe = stripes[stripeIndex];
+    std::lock_guard<std::mutex> lock{ stripe.mutex };
+
+    last->next = stripe.freeList;
+    stripe.freeList = first;
+    stripe.count.store(stripe.count.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+template<typename T, int Granularity, int BatchSize>
+typename ConcurrentPool<T, Granularity, BatchSize>::PoolObj *
+ConcurrentPool<T, Granularity, BatchSize>::allocateBlock()
+{
+    // Raw storage, like Pool::allocBlockMemory(). Only the links are written,
+    // the object memory is left uninitialized until allocate() hands it out.
+    auto newBlock = static_cast<PoolBlock *>(::operator new(sizeof(PoolBlock)));
+
+    // Objects are chained in address order, so the caller can split the list by index.
+    for (int i = 0; i < Granularity - 1; ++i)
+    {
+        newBlock->objects[i].next = &newBlock->objects[i + 1];
+    }
+    newBlock->objects[Granularity - 1].next = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock{ blockListMutex };
+        newBlock->next = blockList;
+        blockList      = newBlock;
+    }
+
+    poolBlockCount.fetch_add(1, std::memory_order_relaxed);
+    return newBlock->objects;
+}
+
+template<typename T, int Granularity, int BatchSize>
+void ConcurrentPool<T, Granularity, BatchSize>::drain()
+{
+    while (blockList != nullptr)
+    {
+        PoolBlock * block = blockList;
+        blockList = blockList->next;
+        ::operator delete(block);
+    }
+
+    for (auto & cache : threadCaches)
+    {
+        cache.freeList = nullptr;
+        cache.count    = 0;
+        cache.allocCount.store(0, std::memory_order_relaxed);
+        cache.freeCount.store(0, std::memory_order_relaxed);
+    }
+
+    for (auto & stripe : stripes)
+    {
+        stripe.freeList = nullptr;
+        stripe.count.store(0, std::memory_order_relaxed);
+    }
+
+    blockList = nullptr;
+    poolBlockCount.store(0, std::memory_order_relaxed);
+    uncachedAllocs.store(0, std::memory_order_relaxed);
+    uncachedFrees.store(0, std::memory_order_relaxed);
+}
+
+template<typename T, int Granularity, int BatchSize>
+int ConcurrentPool<T, Granularity, BatchSize>::getTotalAllocs() const noexcept
+{
+    int total = uncachedAllocs.load(std::memory_order_relaxed);
+    for (const auto & cache : threadCaches)
+    {
+        total += cache.allocCount.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template<typename T, int Granularity, int BatchSize>
+int ConcurrentPool<T, Granularity, BatchSize>::getTotalFrees() const noexcept
+{
+    int total = uncachedFrees.load(std::memory_order_relaxed);
+    for (const auto & cache : threadCaches)
+    {
+        total += cache.freeCount.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template<typename T, int Granularity, int BatchSize>
+int ConcurrentPool<T, Granularity, BatchSize>::getObjectsAlive() const noexcept
+{
+    return getTotalAllocs() - getTotalFrees();
+}
+
+template<typename T, int Granularity, int BatchSize>
+int ConcurrentPool<T, Granularity, BatchSize>::getSize() const noexcept
+{
+    return poolBlockCount.load(std::memory_order_relaxed);
+}
+
+template<typename T, int Granularity, int BatchSize>
+std::size_t ConcurrentPool<T, Granularity, BatchSize>::getGranularity() noexcept
+{
+    return Granularity;
+}
+
+template<typename T, int Granularity, int BatchSize>
+std::size_t ConcurrentPool<T, Granularity, BatchSize>::getObjectSize() noexcept
+{
+    return sizeof(T);
+}
+
+template<typename T, int Granularity, int BatchSize>
+std::size_t ConcurrentPool<T, Granularity, BatchSize>::getBatchSize() noexcept
+{
+    return BatchSize;
+}
+
+#endif // CONCURRENT_POOL_HPP
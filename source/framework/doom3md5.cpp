@@ -12,10 +12,25 @@
 // ================================================================================================
 
 #include "doom3md5.hpp"
+#include "frame_arena.hpp"
+#include "frustum.hpp"
+#include "mapped_file.hpp"
+#include "worker_pool.hpp"
 
+#include <algorithm>
 #include <array>
-#include <cstring>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
 
 //
 // Two relevant sources of information about the MD5Mesh and MD5Anim formats:
@@ -43,6 +58,186 @@ static void swapYZ(Point3 & p)
     p[2] = y;
 }
 
+// Heap memory owned by a string. Short strings are stored inside
+// the std::string object itself (small string optimization).
+static std::size_t stringHeapBytes(const std::string & str) noexcept
+{
+    const char * chars = str.data();
+    const bool isLocal = chars >= reinterpret_cast<const char *>(&str) &&
+                         chars <  reinterpret_cast<const char *>(&str + 1);
+    return isLocal ? 0 : str.capacity() + 1;
+}
+
+// ========================================================
+// class Skeleton:
+// ========================================================
+
+Skeleton::Ptr Skeleton::intern(std::vector<std::string> names, std::vector<int> parents)
+{
+    if (names.size() != parents.size() || names.size() > INT_MAX)
+    {
+        throw std::runtime_error{ "Skeleton joint names and parents don't match!" };
+    }
+
+    // Hash of the whole skeleton, FNV-1a 64 over the names and parents.
+    std::uint64_t sig = 14695981039346656037ull;
+    const auto hashBytes = [&sig](const void * data, const std::size_t sizeBytes)
+    {
+        const auto bytes = static_cast<const unsigned char *>(data);
+        for (std::size_t b = 0; b < sizeBytes; ++b)
+        {
+            sig = (sig ^ bytes[b]) * 1099511628211ull;
+        }
+    };
+
+    for (std::size_t j = 0; j < parents.size(); ++j)
+    {
+        // Poses are built and skinned front to back, so parents must come first.
+        if (parents[j] < -1 || parents[j] >= static_cast<int>(j))
+        {
+            throw std::runtime_error{ "Bad parent index for joint \"" + names[j] + "\"!" };
+        }
+
+        hashBytes(names[j].data(), names[j].size() + 1); // Include the '\0' as separator.
+        hashBytes(&parents[j], sizeof(parents[j]));
+    }
+
+    // Entries are weak, so a skeleton is freed with the last model/animation using it.
+    static std::mutex registryMutex;
+    static std::unordered_multimap<std::uint64_t, std::weak_ptr<const Skeleton>> registry;
+
+    std::lock_guard<std::mutex> lock{ registryMutex };
+
+    const auto range = registry.equal_range(sig);
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        auto existing = iter->second.lock();
+        if (existing != nullptr && existing->parents == parents && existing->names == names)
+        {
+            return existing;
+        }
+    }
+
+    // Purge the dead entries while we're at it. There are only a handful of skeletons.
+    for (auto iter = std::begin(registry); iter != std::end(registry);)
+    {
+        iter = iter->second.expired() ? registry.erase(iter) : std::next(iter);
+    }
+
+    Ptr newSkeleton{ new Skeleton{ std::move(names), std::move(parents), sig } };
+    registry.emplace(sig, newSkeleton);
+    return newSkeleton;
+}
+
+std::uint32_t Skeleton::hashName(const char * name, const std::size_t length) noexcept
+{
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t c = 0; c < length; ++c)
+    {
+        hash = (hash ^ static_cast<unsigned char>(name[c])) * 16777619u;
+    }
+    return hash;
+}
+
+Skeleton::Skeleton(std::vector<std::string> jointNames, std::vector<int> jointParents, const std::uint64_t sig)
+    : names      { std::move(jointNames)   }
+    , parents    { std::move(jointParents) }
+    , nameHashes { }
+    , hashTable  { }
+    , signature  { sig }
+{
+    // Power of two with at least twice as many slots as joints, so probes stay short.
+    std::size_t tableSize = 1;
+    while (tableSize < names.size() * 2)
+    {
+        tableSize *= 2;
+    }
+
+    hashTable.assign(tableSize, -1);
+    nameHashes.resize(names.size());
+
+    const std::size_t mask = tableSize - 1;
+    for (std::size_t j = 0; j < names.size(); ++j)
+    {
+        nameHashes[j] = hashName(names[j].data(), names[j].size());
+
+        // Linear probing. A duplicated name lands after the first one, which is
+        // then the one findJoint() returns, same as a linear search would.
+        std::size_t slot = nameHashes[j] & mask;
+        while (hashTable[slot] >= 0)
+        {
+            slot = (slot + 1) & mask;
+        }
+        hashTable[slot] = static_cast<int>(j);
+    }
+}
+
+int Skeleton::findJoint(const std::string & jointName) const
+{
+    const std::uint32_t hash = hashName(jointName.data(), jointName.size());
+    const std::size_t   mask = hashTable.size() - 1;
+
+    for (std::size_t slot = hash & mask; hashTable[slot] >= 0; slot = (slot + 1) & mask)
+    {
+        const int index = hashTable[slot];
+        if (nameHashes[index] == hash && names[index] == jointName)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
+
+bool Skeleton::isCompatible(const Skeleton & other) const noexcept
+{
+    // Identical skeletons alive at the same time are the same object, so
+    // usually the pointer test is enough. Compare in full otherwise.
+    if (this == &other)
+    {
+        return true;
+    }
+    return signature == other.signature && parents == other.parents && nameHashes == other.nameHashes && names == other.names;
+}
+
+std::size_t Skeleton::getMemoryBytes() const noexcept
+{
+    std::size_t bytes = sizeof(*this) +
+                        names.capacity()      * sizeof(std::string) +
+                        parents.capacity()    * sizeof(int) +
+                        nameHashes.capacity() * sizeof(std::uint32_t) +
+                        hashTable.capacity()  * sizeof(int);
+
+    for (const auto & name : names)
+    {
+        bytes += stringHeapBytes(name);
+    }
+    return bytes;
+}
+
+// ========================================================
+// struct Pose:
+// ========================================================
+
+void Pose::setFromJoints(const std::vector<Joint> & joints)
+{
+    resize(static_cast<int>(joints.size()));
+
+    float * rotation = rotations.data();
+    float * position = positions.data();
+    for (const auto & joint : joints)
+    {
+        rotation[0] = joint.orient.getX();
+        rotation[1] = joint.orient.getY();
+        rotation[2] = joint.orient.getZ();
+        rotation[3] = joint.orient.getW();
+        position[0] = joint.pos.getX();
+        position[1] = joint.pos.getY();
+        position[2] = joint.pos.getZ();
+        rotation += 4;
+        position += 3;
+    }
+}
+
 // ========================================================
 // class MaterialInstance:
 // ========================================================
@@ -77,946 +272,2900 @@ void MaterialInstance::apply() const noexcept
     specularTexture.bind();
 }
 
-// ========================================================
-// class ModelInstance:
-// ========================================================
-
-ModelInstance::ModelInstance(GLFWApp & owner, const std::string & filename)
-    : app{ owner }
+std::size_t MaterialInstance::getMemoryBytes() const noexcept
 {
-    std::ifstream inFile{ filename };
-    if (!inFile.is_open())
+    // A full mipmap chain adds about a third of the base level.
+    std::size_t bytes = sizeof(*this) + stringHeapBytes(name);
+    for (const GLTexture * texture : { &baseTexture, &normalTexture, &specularTexture })
     {
-        throw std::runtime_error{ "Unable to open file \"" + filename + "\"!" };
+        const std::size_t baseLevelBytes = static_cast<std::size_t>(texture->getWidth()) * texture->getHeight() * 4;
+        bytes += baseLevelBytes + baseLevelBytes / 3;
     }
-
-    parseModel(inFile);
-    app.printF("DOOM 3 model instance \"%s\" loaded. Meshes: %zu, joints: %zu, materials: %zu.",
-               filename.c_str(), meshes.size(), joints.size(), materials.size());
+    return bytes;
 }
 
-ModelInstance::ModelInstance(GLFWApp & owner, std::istream & inStr)
-    : app{ owner }
-{
-    parseModel(inStr);
-}
+// ========================================================
+// class MD5Lexer:
+// ========================================================
 
-void ModelInstance::parseModel(std::istream & inStr)
+//
+// Single pass tokenizer for the MD5 text formats. It works directly on the
+// file contents, which are not null terminated, so every scan is bounded by
+// 'end'. Tokens are separated by white space; braces and parenthesis are
+// tokens of their own, names may be quoted and "//" comments run to the end
+// of the line. The read methods return false if the next token doesn't match,
+// and the callers throw the appropriate error.
+//
+class MD5Lexer final
 {
-    int versionNum = 0;
-    int numJoints  = 0;
-    int numMeshes  = 0;
-    int currMesh   = 0;
-    std::array<char, 1024> lineBuffer;
+public:
 
-    while (!inStr.eof())
+    MD5Lexer(const char * text, const std::size_t length) noexcept
+        : cursor { text          }
+        , end    { text + length }
+    { }
+
+    bool atEnd() noexcept
     {
-        inStr.getline(lineBuffer.data(), lineBuffer.size());
+        skipWhiteSpace();
+        return cursor == end;
+    }
 
-        if (std::sscanf(lineBuffer.data(), "MD5Version %i", &versionNum) == 1)
+    // Consumes the next token if it is the single character 'c'.
+    bool expectChar(const char c) noexcept
+    {
+        skipWhiteSpace();
+        if (cursor == end || *cursor != c)
         {
-            // Models from DOOM 3 should have version 10.
-            if (versionNum != 10)
-            {
-                throw std::runtime_error{ "Bad model version! Expected 10, got " + std::to_string(versionNum) };
-            }
+            return false;
         }
-        else if (std::sscanf(lineBuffer.data(), "numJoints %i", &numJoints) == 1)
+        ++cursor;
+        return true;
+    }
+
+    // Consumes the next token if it is the keyword 'word'.
+    bool checkWord(const char * word) noexcept
+    {
+        skipWhiteSpace();
+        const char * p = cursor;
+        for (; *word != '\0'; ++word, ++p)
         {
-            if (numJoints > 0)
+            if (p == end || *p != *word)
             {
-                // Preallocate memory for the base skeleton joints:
-                joints.resize(numJoints);
+                return false;
             }
         }
-        else if (std::sscanf(lineBuffer.data(), "numMeshes %i", &numMeshes) == 1)
+        if (p != end && !isDelimiter(*p))
         {
-            if (numMeshes > 0)
-            {
-                // Preallocate memory for the meshes:
-                meshes.resize(numMeshes);
-            }
+            return false;
         }
-        else if (std::strncmp(lineBuffer.data(), "joints {", 8) == 0)
+        cursor = p;
+        return true;
+    }
+
+    // Bare word or quoted string. The quotes are not included.
+    bool readString(std::string & str)
+    {
+        const char * start;
+        std::size_t length;
+        if (!readStringToken(&start, &length))
         {
-            parseJoints(inStr, numJoints);
+            return false;
         }
-        else if (std::strncmp(lineBuffer.data(), "mesh {", 6) == 0)
+        str.assign(start, length);
+        return true;
+    }
+    bool readString(char * buffer, const std::size_t bufferSize) noexcept
+    {
+        const char * start;
+        std::size_t length;
+        if (!readStringToken(&start, &length) || length >= bufferSize)
         {
-            parseMesh(inStr, currMesh++);
+            return false;
         }
+        std::memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        return true;
     }
-}
 
-void ModelInstance::parseMesh(std::istream & inStr, const std::size_t meshIndex)
-{
-    if (meshIndex >= meshes.size())
+    bool readInt(int * value) noexcept
     {
-        throw std::runtime_error{ "Bad mesh index! " + std::to_string(meshIndex) };
-    }
+        skipWhiteSpace();
+        const char * p = cursor;
 
-    auto & mesh = meshes[meshIndex];
+        const bool negative = (p != end && *p == '-');
+        if (p != end && (*p == '-' || *p == '+'))
+        {
+            ++p;
+        }
 
-    int vertIndex   = 0;
-    int triIndex    = 0;
-    int weightIndex = 0;
-    int numVerts    = 0;
-    int numTris     = 0;
-    int numWeights  = 0;
+        const char * digitsStart = p;
+        long long result = 0;
+        for (; p != end && isDigit(*p); ++p)
+        {
+            result = (result * 10) + (*p - '0');
+            if (result > INT_MAX)
+            {
+                return false;
+            }
+        }
 
-    std::string materialName;
-    std::array<int,   3>    iData;
-    std::array<float, 4>    fData;
-    std::array<char,  1024> lineBuffer;
+        if (p == digitsStart || (p != end && !isDelimiter(*p)))
+        {
+            return false;
+        }
 
-    lineBuffer.fill('\0');
+        *value = static_cast<int>(negative ? -result : result);
+        cursor = p;
+        return true;
+    }
 
-    // Seek the end of the { } block:
-    while (!inStr.eof() && lineBuffer[0] != '}')
+    // Dedicated float parser. The MD5 files only have plain decimal numbers
+    // with a handful of digits, which are converted exactly here with an integer
+    // mantissa and a single power of ten. Anything else, like very long mantissas
+    // or large exponents, goes through strtof() instead.
+    bool readFloat(float * value) noexcept
     {
-        inStr.getline(lineBuffer.data(), lineBuffer.size());
+        skipWhiteSpace();
+        const char * p = cursor;
 
-        // Material/texture available?
-        if (std::strstr(lineBuffer.data(), "shader "))
+        const bool negative = (p != end && *p == '-');
+        if (p != end && (*p == '-' || *p == '+'))
         {
-            int quote = 0;
-            materialName.clear();
+            ++p;
+        }
 
-            // Copy the shader name without the quote marks:
-            for (std::size_t i = 0; i < lineBuffer.size() && quote < 2; ++i)
-            {
-                if (lineBuffer[i] == '\"')
-                {
-                    ++quote;
-                }
-                if (quote == 1 && lineBuffer[i] != '\"')
-                {
-                    materialName += lineBuffer[i];
-                }
-            }
+        std::uint64_t mantissa = 0;
+        int significantDigits  = 0;
+        int exponent           = 0;
+        bool sawDigits         = false;
 
-            mesh.material = findMaterial(materialName);
-            if (mesh.material == nullptr)
-            {
-                mesh.material = createMaterial(materialName);
-            }
+        for (; p != end && isDigit(*p); ++p)
+        {
+            mantissa = (mantissa * 10) + (*p - '0');
+            significantDigits += (mantissa != 0);
+            sawDigits = true;
         }
-        else if (std::sscanf(lineBuffer.data(), " numverts %i", &numVerts) == 1)
+        if (p != end && *p == '.')
         {
-            if (numVerts > 0)
+            for (++p; p != end && isDigit(*p); ++p)
             {
-                // Preallocate memory for the mesh vertexes:
-                mesh.vertexes.resize(numVerts);
+                mantissa = (mantissa * 10) + (*p - '0');
+                significantDigits += (mantissa != 0);
+                --exponent;
+                sawDigits = true;
             }
         }
-        else if (std::sscanf(lineBuffer.data(), " numtris %i", &numTris) == 1)
+        if (!sawDigits)
         {
-            if (numTris > 0)
-            {
-                // Preallocate memory for the triangles:
-                mesh.triangles.resize(numTris);
-            }
+            return false;
         }
-        else if (std::sscanf(lineBuffer.data(), " numweights %i", &numWeights) == 1)
+
+        if (p != end && (*p == 'e' || *p == 'E'))
         {
-            if (numWeights > 0)
+            ++p;
+            const bool negativeExp = (p != end && *p == '-');
+            if (p != end && (*p == '-' || *p == '+'))
             {
-                // Preallocate memory for vertex the weights:
-                mesh.weights.resize(numWeights);
+                ++p;
+            }
+            if (p == end || !isDigit(*p))
+            {
+                return false;
+            }
+
+            int expValue = 0;
+            for (; p != end && isDigit(*p); ++p)
+            {
+                expValue = std::min((expValue * 10) + (*p - '0'), 9999);
             }
+            exponent += (negativeExp ? -expValue : expValue);
         }
-        else if (std::sscanf(lineBuffer.data(), " vert %i ( %f %f ) %d %d", &vertIndex,
-                             &fData[0], &fData[1], &iData[0], &iData[1]) == 5)
+
+        if (p != end && !isDelimiter(*p))
         {
-            mesh.vertexes[vertIndex].u = fData[0];
-            mesh.vertexes[vertIndex].v = fData[1];
-            mesh.vertexes[vertIndex].firstWeight = iData[0];
-            mesh.vertexes[vertIndex].weightCount = iData[1];
+            return false;
         }
-        else if (std::sscanf(lineBuffer.data(), " tri %i %i %i %i", &triIndex,
-                             &iData[0], &iData[1], &iData[2]) == 4)
+
+        // Exact powers of ten in double precision.
+        static const double powersOf10[]{
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        // Up to 15 digits the mantissa is exact in a double, so a single
+        // multiply or divide by an exact power of ten is correctly rounded.
+        double result;
+        if (significantDigits <= 15 && exponent >= -22 && exponent <= 22)
         {
-            mesh.triangles[triIndex].index[0] = iData[0];
-            mesh.triangles[triIndex].index[1] = iData[1];
-            mesh.triangles[triIndex].index[2] = iData[2];
+            result = static_cast<double>(mantissa);
+            result = (exponent < 0) ? (result / powersOf10[-exponent]) : (result * powersOf10[exponent]);
+            if (negative)
+            {
+                result = -result;
+            }
         }
-        else if (std::sscanf(lineBuffer.data(), " weight %i %i %f ( %f %f %f )", &weightIndex,
-                             &iData[0], &fData[3], &fData[0], &fData[1], &fData[2]) == 6)
+        else
         {
-            mesh.weights[weightIndex].pos[0] = fData[0];
-            mesh.weights[weightIndex].pos[1] = fData[1];
-            mesh.weights[weightIndex].pos[2] = fData[2];
-            mesh.weights[weightIndex].bias   = fData[3];
-            mesh.weights[weightIndex].joint  = iData[0];
+            char numberBuffer[128];
+            const std::size_t length = std::min(static_cast<std::size_t>(p - cursor), sizeof(numberBuffer) - 1);
+            std::memcpy(numberBuffer, cursor, length);
+            numberBuffer[length] = '\0';
+            result = std::strtod(numberBuffer, nullptr);
         }
-    }
-}
 
-void ModelInstance::parseJoints(std::istream & inStr, const std::size_t numJoints)
-{
-    int parentIndex;
-    std::array<float, 3>   pos;
-    std::array<float, 4>   quat;
-    std::array<char, 512>  name;
-    std::array<char, 1024> lineBuffer;
+        *value = static_cast<float>(result);
+        cursor = p;
+        return true;
+    }
 
-    for (std::size_t j = 0; j < numJoints; ++j)
+    // Reads a "( x y z ... )" group of 'count' floats.
+    bool readFloatTuple(float * values, const int count) noexcept
     {
-        if (!inStr.getline(lineBuffer.data(), lineBuffer.size()))
+        if (!expectChar('('))
         {
-            throw std::runtime_error{ "Unexpected EOF while parsing model joints!" };
+            return false;
         }
-
-        if (std::sscanf(lineBuffer.data(), "%s %i ( %f %f %f ) ( %f %f %f )",
-                        name.data(), &parentIndex,
-                        &pos[0],  &pos[1],  &pos[2],
-                        &quat[0], &quat[1], &quat[2]) != 8)
+        for (int i = 0; i < count; ++i)
         {
-            throw std::runtime_error{ "Error parsing joint #" + std::to_string(j) };
+            if (!readFloat(&values[i]))
+            {
+                return false;
+            }
         }
+        return expectChar(')');
+    }
 
-        // W component of the quaternion is not stored.
-        quat[3] = quaternionComputeW(quat[0], quat[1], quat[2]);
+    // Skips everything up to the end of the current line.
+    void skipLine() noexcept
+    {
+        const void * newLine = std::memchr(cursor, '\n', end - cursor);
+        cursor = (newLine != nullptr) ? static_cast<const char *>(newLine) + 1 : end;
+    }
 
-        // Strip quotes if needed:
-        char * nameStr = name.data();
-        if (nameStr[0] == '"')
+    // Skips everything up to and including the next closing brace.
+    void skipBlock() noexcept
+    {
+        while (!atEnd())
         {
-            nameStr[std::strlen(nameStr) - 1] = '\0';
-            nameStr++;
+            if (*cursor == '}')
+            {
+                ++cursor;
+                return;
+            }
+            if (isPunctuation(*cursor))
+            {
+                ++cursor;
+                continue;
+            }
+
+            const char * start;
+            std::size_t length;
+            if (!readStringToken(&start, &length))
+            {
+                skipLine(); // Unterminated quote.
+            }
         }
+    }
 
-        // Store:
-        auto & joint = joints[j];
-        joint.orient = Quat{ quat[0], quat[1], quat[2], quat[3] };
-        joint.pos    = Point3{ pos[0], pos[1], pos[2] };
-        joint.parent = parentIndex;
-        joint.name   = nameStr;
+private:
+
+    static bool isDigit(const char c) noexcept
+    {
+        return c >= '0' && c <= '9';
+    }
+    static bool isWhiteSpace(const char c) noexcept
+    {
+        // Anything at or below the space is treated as white space (tabs, line breaks).
+        return static_cast<unsigned char>(c) <= ' ';
+    }
+    static bool isPunctuation(const char c) noexcept
+    {
+        return c == '{' || c == '}' || c == '(' || c == ')';
+    }
+    static bool isDelimiter(const char c) noexcept
+    {
+        return isWhiteSpace(c) || isPunctuation(c);
     }
-}
 
-const Joint * ModelInstance::findJoint(const std::string & jointName) const
-{
-    for (const auto & joint : joints)
+    void skipWhiteSpace() noexcept
     {
-        if (joint.name == jointName)
+        for (;;)
         {
-            return &joint;
+            while (cursor != end && isWhiteSpace(*cursor))
+            {
+                ++cursor;
+            }
+            if ((end - cursor) >= 2 && cursor[0] == '/' && cursor[1] == '/')
+            {
+                skipLine();
+                continue;
+            }
+            break;
         }
     }
-    return nullptr;
-}
 
-const MaterialInstance * ModelInstance::findMaterial(const std::string & matName) const
-{
-    auto iter = materials.find(matName);
-    if (iter == std::end(materials))
+    bool readStringToken(const char ** start, std::size_t * length) noexcept
     {
-        return nullptr;
+        skipWhiteSpace();
+        if (cursor == end)
+        {
+            return false;
+        }
+
+        if (*cursor == '"')
+        {
+            const void * closingQuote = std::memchr(cursor + 1, '"', end - cursor - 1);
+            if (closingQuote == nullptr)
+            {
+                return false;
+            }
+            *start  = cursor + 1;
+            *length = static_cast<const char *>(closingQuote) - (cursor + 1);
+            cursor  = static_cast<const char *>(closingQuote) + 1;
+            return true;
+        }
+
+        const char * p = cursor;
+        while (p != end && !isDelimiter(*p))
+        {
+            ++p;
+        }
+        if (p == cursor)
+        {
+            return false;
+        }
+
+        *start  = cursor;
+        *length = p - cursor;
+        cursor  = p;
+        return true;
     }
-    return iter->second.get();
-}
 
-const MaterialInstance * ModelInstance::createMaterial(const std::string & matName)
+    const char * cursor;
+    const char * const end;
+};
+
+static double millisecondsSince(const std::chrono::high_resolution_clock::time_point start)
 {
-    std::unique_ptr<const MaterialInstance> newMaterial{ new MaterialInstance{ app, matName } };
-    auto result = materials.emplace(matName, std::move(newMaterial));
-    if (result.second == false)
-    {
-        throw std::runtime_error{ "MaterialMap name collision! " + matName };
-    }
-    return result.first->second.get();
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 }
 
 // ========================================================
-// class AnimInstance:
+// Binary baked cache:
 // ========================================================
 
-AnimInstance::AnimInstance(const std::string & filename)
+bool g_bUseBakedCache = true;
+std::string g_strBakedCacheDir;
+
+std::string getBakedCachePath(const std::string & sourceFile)
 {
-    std::ifstream inFile{ filename };
-    if (!inFile.is_open())
+    if (g_strBakedCacheDir.empty())
     {
-        throw std::runtime_error{ "Unable to open file \"" + filename + "\"!" };
+        return sourceFile + ".bin";
     }
 
-    parseAnim(inFile);
+    // Flatten the source path into a single file name inside the cache directory.
+    std::string flatName = sourceFile;
+    std::replace_if(std::begin(flatName), std::end(flatName),
+                    [](const char c) { return c == '/' || c == '\\' || c == ':'; }, '_');
+    return g_strBakedCacheDir + "/" + flatName + ".bin";
 }
 
-AnimInstance::AnimInstance(std::istream & inStr)
+//
+// Baked file layout. Everything is 4-byte aligned and in the native byte order.
+// The header is followed by the sections below, written and read sequentially:
+//
+// Model: u32 numJoints, u32 numMeshes, BakedJoint[numJoints],
+//        then for each mesh: string material, u32 numTris, u32 numVerts,
+//        u32 numWeights, Triangle[numTris], Vertex[numVerts], BakedWeight[numWeights].
+//
+// Anim:  u32 numFrames, u32 numJoints, i32 frameRate,
+//        for each joint: i32 parent, string name,
+//        BakedBounds[numFrames], then the two pose streams of all frames:
+//        float rotations[numFrames * numJoints * 4], float positions[numFrames * numJoints * 3].
+//        The streams are used in place from the mapped file, without copying.
+//
+// Strings are a u32 length followed by the chars, padded to 4 bytes. No '\0'.
+// Any change to the layout must bump BakedFormatVersion.
+//
+static constexpr std::uint32_t BakedFormatVersion = 2;
+static constexpr std::uint32_t BakedByteOrderMark = 0x01020304;
+
+struct BakedHeader
 {
-    parseAnim(inStr);
-}
+    char          magic[4];      // "MD5M" or "MD5A".
+    std::uint32_t version;       // BakedFormatVersion.
+    std::uint32_t byteOrder;     // BakedByteOrderMark. Rejects files from a machine with different endianness.
+    std::uint32_t headerSize;    // sizeof(BakedHeader).
+    std::uint64_t sourceSize;    // Size in bytes of the text file this was baked from.
+    std::int64_t  sourceModTime; // Modification time of the text file.
+    std::uint64_t fileSize;      // Size of the whole baked file. Catches truncated files.
+};
+
+struct BakedJoint
+{
+    float        orient[4];
+    float        pos[3];
+    std::int32_t parent;
+};
 
-void AnimInstance::parseAnim(std::istream & inStr)
+struct BakedWeight
 {
-    // Clear out these members first:
-    numFrames = 0;
-    numJoints = 0;
-    frameRate = 0;
-    duration  = 0;
+    float        pos[3];
+    float        bias;
+    std::int32_t joint;
+};
 
-    // Temporary locals:
-    int versionNum = 0;
-    int frameIndex = 0;
-    int numAnimatedComponents = 0;
+struct BakedBounds
+{
+    float mins[3];
+    float maxs[3];
+};
 
-    std::vector<float> animFrameData;
-    std::vector<HierarchyInfo> hierarchy;
-    std::vector<BaseFrameJointPose> baseFrame;
-    std::array<char, 1024> lineBuffer;
+static_assert(sizeof(BakedHeader) == 40, "Unexpected padding in BakedHeader!");
+static_assert(sizeof(Triangle)    == 12, "Triangle is written as is to the baked cache!");
+static_assert(sizeof(Vertex)      == 16, "Vertex is written as is to the baked cache!");
+
+class BakedWriter final
+{
+public:
 
-    while (!inStr.eof())
+    explicit BakedWriter(const char * magic)
+        : buffer(sizeof(BakedHeader))
+        , header{ }
     {
-        inStr.getline(lineBuffer.data(), lineBuffer.size());
+        std::memcpy(header.magic, magic, sizeof(header.magic));
+        header.version    = BakedFormatVersion;
+        header.byteOrder  = BakedByteOrderMark;
+        header.headerSize = sizeof(BakedHeader);
+    }
 
-        if (std::sscanf(lineBuffer.data(), "MD5Version %i", &versionNum) == 1)
-        {
-            // Models from DOOM 3 should have version 10.
-            if (versionNum != 10)
-            {
-                throw std::runtime_error{ "Bad anim version! Expected 10, got " + std::to_string(versionNum) };
-            }
-        }
-        else if (std::sscanf(lineBuffer.data(), " numFrames %d", &numFrames) == 1)
-        {
-            // Preallocate memory for skeleton frames and bounding boxes:
-            if (numFrames > 0)
-            {
-                bboxes.resize(numFrames);
-                skelFrames.resize(numFrames);
-            }
-        }
-        else if (std::sscanf(lineBuffer.data(), " numJoints %d", &numJoints) == 1)
-        {
-            if (numJoints > 0)
-            {
-                // NOTE: This could be optimized into a single flat allocation!
-                for (int f = 0; f < numFrames; ++f)
-                {
-                    skelFrames[f].reset(new Joint[numJoints]);
-                }
+    template<typename T>
+    void write(const T & value)
+    {
+        writeBytes(&value, sizeof(T));
+    }
 
-                // Allocate temporary memory for building the skeleton frames:
-                hierarchy.resize(numJoints);
-                baseFrame.resize(numJoints);
-            }
-        }
-        else if (std::sscanf(lineBuffer.data(), " numAnimatedComponents %d", &numAnimatedComponents) == 1)
-        {
-            if (numAnimatedComponents > 0)
-            {
-                // Preallocate memory for animation frame data:
-                animFrameData.resize(numAnimatedComponents);
-            }
-        }
-        else if (std::sscanf(lineBuffer.data(), " frameRate %i", &frameRate) == 1)
-        {
-            duration = 1.0 / static_cast<double>(frameRate);
-        }
-        else if (std::strncmp(lineBuffer.data(), "hierarchy {", 11) == 0)
-        {
-            parseHierarchy(inStr, hierarchy, numJoints);
-        }
-        else if (std::strncmp(lineBuffer.data(), "bounds {", 8) == 0)
-        {
-            parseBounds(inStr, numFrames);
-        }
-        else if (std::strncmp(lineBuffer.data(), "baseframe {", 11) == 0)
-        {
-            parseBaseFrame(inStr, baseFrame, numJoints);
-        }
-        else if (std::sscanf(lineBuffer.data(), "frame %i {", &frameIndex) == 1)
-        {
-            parseFrame(inStr, animFrameData, numAnimatedComponents);
-            buildFrameSkeleton(hierarchy, baseFrame, animFrameData,
-                               skelFrames[frameIndex].get(), numJoints);
-        }
+    template<typename T>
+    void writeArray(const std::vector<T> & values)
+    {
+        writeBytes(values.data(), values.size() * sizeof(T));
     }
-}
 
-void AnimInstance::parseBounds(std::istream & inStr, const int numBounds)
-{
-    std::array<float, 3> bbMin;
-    std::array<float, 3> bbMax;
-    std::array<char, 1024> lineBuffer;
+    void writeString(const std::string & str)
+    {
+        write(static_cast<std::uint32_t>(str.size()));
+        writeBytes(str.data(), str.size());
+        buffer.resize((buffer.size() + 3) & ~std::size_t(3), 0);
+    }
 
-    // One bounding-box for each frame of animation.
-    for (int b = 0; b < numBounds; ++b)
+    void writeBytes(const void * data, const std::size_t sizeBytes)
     {
-        if (!inStr.getline(lineBuffer.data(), lineBuffer.size()))
-        {
-            throw std::runtime_error{ "Unexpected EOF while parsing animation frame bounds!" };
-        }
+        const auto bytes = static_cast<const unsigned char *>(data);
+        buffer.insert(std::end(buffer), bytes, bytes + sizeBytes);
+    }
 
-        // ( min ) ( max )
-        if (std::sscanf(lineBuffer.data(), " ( %f %f %f ) ( %f %f %f )",
-                        &bbMin[0], &bbMin[1], &bbMin[2], &bbMax[0], &bbMax[1], &bbMax[2]) != 6)
+    bool saveToFile(const std::string & filename, const FileInfo & sourceInfo)
+    {
+        if (!g_strBakedCacheDir.empty() && !createDirectory(g_strBakedCacheDir))
         {
-            throw std::runtime_error{ "Error parsing bounds entry #" + std::to_string(b) };
+            return false;
         }
 
-        bboxes[b].mins = Point3{ bbMin[0], bbMin[1], bbMin[2] };
-        bboxes[b].maxs = Point3{ bbMax[0], bbMax[1], bbMax[2] };
+        header.sourceSize    = sourceInfo.sizeBytes;
+        header.sourceModTime = sourceInfo.modTime;
+        header.fileSize      = buffer.size();
+        std::memcpy(buffer.data(), &header, sizeof(header));
+
+        return writeFileAtomic(filename, buffer.data(), buffer.size());
     }
-}
 
-void AnimInstance::parseHierarchy(std::istream & inStr, std::vector<HierarchyInfo> & hierarchy, const int numJoints)
+private:
+
+    std::vector<unsigned char> buffer;
+    BakedHeader header;
+};
+
+class BakedReader final
 {
-    std::array<char, 1024> lineBuffer;
+public:
 
-    // There should be one entry for each model joint.
-    for (int j = 0; j < numJoints; ++j)
+    BakedReader(const char * data, const std::size_t sizeBytes)
+        : cursor { data             }
+        , end    { data + sizeBytes }
+    { }
+
+    // False if the file is not a baked file of the expected type or is stale.
+    bool readHeader(const char * magic, const FileInfo & sourceInfo)
+    {
+        BakedHeader header;
+        return read(&header) &&
+               std::memcmp(header.magic, magic, sizeof(header.magic)) == 0 &&
+               header.version       == BakedFormatVersion  &&
+               header.byteOrder     == BakedByteOrderMark  &&
+               header.headerSize    == sizeof(BakedHeader) &&
+               header.sourceSize    == sourceInfo.sizeBytes &&
+               header.sourceModTime == sourceInfo.modTime  &&
+               header.fileSize      == static_cast<std::uint64_t>(end - cursor) + sizeof(BakedHeader);
+    }
+
+    template<typename T>
+    bool read(T * value)
     {
-        if (!inStr.getline(lineBuffer.data(), lineBuffer.size()))
+        const char * bytes = consume(sizeof(T), 1);
+        if (bytes == nullptr)
         {
-            throw std::runtime_error{ "Unexpected EOF while parsing animation hierarchy!" };
+            return false;
         }
+        std::memcpy(value, bytes, sizeof(T));
+        return true;
+    }
 
-        if (std::sscanf(lineBuffer.data(), " %s %i %i %i",
-                        hierarchy[j].name,   &hierarchy[j].parent,
-                        &hierarchy[j].flags, &hierarchy[j].startIndex) != 4)
+    template<typename T>
+    bool readArray(std::vector<T> & values, const std::uint32_t count)
+    {
+        const char * bytes = consume(sizeof(T), count);
+        if (bytes == nullptr)
         {
-            throw std::runtime_error{ "Error parsing hierarchy entry #" + std::to_string(j) };
+            return false;
         }
+        values.resize(count);
+        if (count != 0)
+        {
+            std::memcpy(values.data(), bytes, count * sizeof(T));
+        }
+        return true;
     }
-}
-
-void AnimInstance::parseBaseFrame(std::istream & inStr, std::vector<BaseFrameJointPose> & baseFrame, const int numJoints)
-{
-    std::array<float, 3> pos;
-    std::array<float, 4> quat;
-    std::array<char, 1024> lineBuffer;
 
-    // There should be one entry for each model joint.
-    for (int j = 0; j < numJoints; ++j)
+    bool readString(std::string & str)
     {
-        if (!inStr.getline(lineBuffer.data(), lineBuffer.size()))
+        std::uint32_t length = 0;
+        if (!read(&length))
         {
-            throw std::runtime_error{ "Unexpected EOF while parsing animation baseframe!" };
+            return false;
         }
 
-        // Read base frame joint ( position ) ( quaternion ):
-        if (std::sscanf(lineBuffer.data(), " ( %f %f %f ) ( %f %f %f )",
-                        &pos[0], &pos[1], &pos[2], &quat[0], &quat[1], &quat[2]) != 6)
+        const char * chars = consume(1, (std::uint64_t(length) + 3) & ~std::uint64_t(3));
+        if (chars == nullptr)
         {
-            throw std::runtime_error{ "Error parsing baseframe entry #" + std::to_string(j) };
+            return false;
         }
+        str.assign(chars, length);
+        return true;
+    }
 
-        // Compute the W component of the quaternion (not stored in the file):
-        quat[3] = quaternionComputeW(quat[0], quat[1], quat[2]);
+    // Returns a pointer to the next 'count' elements, or null if the file is too short.
+    // The caller checks the remaining size before allocating, so a corrupted count can't
+    // trigger a huge allocation.
+    const char * consume(const std::size_t elementSize, const std::uint64_t count)
+    {
+        const std::uint64_t remaining = static_cast<std::uint64_t>(end - cursor);
+        if (count > remaining / elementSize)
+        {
+            return nullptr;
+        }
 
-        // Save 'em:
-        baseFrame[j].orient = Quat{ quat[0], quat[1], quat[2], quat[3] };
-        baseFrame[j].pos = Point3{ pos[0], pos[1], pos[2] };
+        const char * bytes = cursor;
+        cursor += count * elementSize;
+        return bytes;
     }
-}
 
-void AnimInstance::parseFrame(std::istream & inStr, std::vector<float> & frameData, const int numAnimatedComponents)
+    bool atEnd() const noexcept { return cursor == end; }
+
+private:
+
+    const char * cursor;
+    const char * const end;
+};
+
+// ========================================================
+// class ModelInstance:
+// ========================================================
+
+ModelInstance::ModelInstance(GLFWApp & owner, const std::string & filename)
+    : app{ owner }
 {
-    std::array<char, 1024> lineBuffer;
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    FileInfo sourceInfo;
+    if (!getFileInfo(filename, &sourceInfo))
+    {
+        throw std::runtime_error{ "Unable to open file \"" + filename + "\"!" };
+    }
+
+    std::vector<std::string> meshMaterials;
+    const std::string bakedFile = g_bUseBakedCache ? getBakedCachePath(filename) : std::string{};
 
-    for (int entry = 0; entry < numAnimatedComponents;)
+    if (g_bUseBakedCache && loadBaked(bakedFile, sourceInfo, meshMaterials))
+    {
+        fromBakedCache = true;
+        loadTimeMs     = millisecondsSince(startTime);
+    }
+    else
     {
-        if (!inStr.getline(lineBuffer.data(), lineBuffer.size()))
+        MappedFile inFile{ filename };
+        if (!inFile.isOpen())
         {
-            throw std::runtime_error{ "Unexpected EOF while parsing animation frame data!" };
+            throw std::runtime_error{ "Unable to open file \"" + filename + "\"!" };
         }
 
-        // Split the string by white spaces, tabs and line terminators.
-        const char * token = std::strtok(lineBuffer.data(), " \t\r\n");
-        while (token != nullptr)
+        MD5Lexer lexer{ inFile.getData(), inFile.getSize() };
+        parseModel(lexer, meshMaterials);
+        loadTimeMs = millisecondsSince(startTime);
+
+        if (g_bUseBakedCache && !writeBaked(bakedFile, sourceInfo, meshMaterials))
         {
-            frameData[entry++] = std::strtof(token, nullptr);
-            token = std::strtok(nullptr, " \t\r\n");
+            app.printF("WARNING! Unable to write baked model cache \"%s\".", bakedFile.c_str());
         }
     }
+
+    sourceSizeBytes = sourceInfo.sizeBytes;
+    createSkeleton();
+    createMeshMaterials(meshMaterials);
+
+    app.printF("DOOM 3 model instance \"%s\" loaded. Meshes: %zu, joints: %zu, materials: %zu. "
+               "%s %.2f KB source in %.2fms.",
+               filename.c_str(), meshes.size(), joints.size(), materials.size(),
+               (fromBakedCache ? "Baked cache for" : "Parsed"), sourceSizeBytes / 1024.0, loadTimeMs);
 }
 
-void AnimInstance::buildFrameSkeleton(const std::vector<HierarchyInfo> & hierarchy,
-                                      const std::vector<BaseFrameJointPose> & baseFrame,
-                                      const std::vector<float> & frameData,
-                                      Joint * skelJointsOut, const int numJoints)
+ModelInstance::ModelInstance(GLFWApp & owner, std::istream & inStr)
+    : app{ owner }
 {
-    for (int i = 0; i < numJoints; ++i)
-    {
-        const auto & baseJoint = baseFrame[i];
-        Point3 animatedPos  = baseJoint.pos;
-        Quat animatedOrient = baseJoint.orient;
-        int j = 0;
+    const std::string text{ std::istreambuf_iterator<char>{ inStr }, std::istreambuf_iterator<char>{} };
 
-        // T x y z
-        if (hierarchy[i].flags & AnimTX)
+    std::vector<std::string> meshMaterials;
+    MD5Lexer lexer{ text.data(), text.size() };
+    parseModel(lexer, meshMaterials);
+    createSkeleton();
+    createMeshMaterials(meshMaterials);
+
+    sourceSizeBytes = text.size();
+}
+
+void ModelInstance::parseModel(MD5Lexer & lexer, std::vector<std::string> & meshMaterials)
+{
+    int versionNum = 0;
+    int numJoints  = 0;
+    int numMeshes  = 0;
+    int currMesh   = 0;
+
+    while (!lexer.atEnd())
+    {
+        if (lexer.checkWord("MD5Version"))
         {
-            animatedPos[0] = frameData[hierarchy[i].startIndex + j];
-            ++j;
+            // Models from DOOM 3 should have version 10.
+            if (lexer.readInt(&versionNum) && versionNum != 10)
+            {
+                throw std::runtime_error{ "Bad model version! Expected 10, got " + std::to_string(versionNum) };
+            }
         }
-        if (hierarchy[i].flags & AnimTY)
+        else if (lexer.checkWord("numJoints"))
         {
-            animatedPos[1] = frameData[hierarchy[i].startIndex + j];
-            ++j;
+            if (lexer.readInt(&numJoints) && numJoints > 0)
+            {
+                // Preallocate memory for the base skeleton joints:
+                joints.resize(numJoints);
+            }
         }
-        if (hierarchy[i].flags & AnimTZ)
+        else if (lexer.checkWord("numMeshes"))
         {
-            animatedPos[2] = frameData[hierarchy[i].startIndex + j];
-            ++j;
+            if (lexer.readInt(&numMeshes) && numMeshes > 0)
+            {
+                // Preallocate memory for the meshes:
+                meshes.resize(numMeshes);
+                meshMaterials.resize(numMeshes);
+            }
         }
-
-        // Q x y z
-        if (hierarchy[i].flags & AnimQX)
+        else if (lexer.checkWord("joints") && lexer.expectChar('{'))
         {
-            animatedOrient[0] = frameData[hierarchy[i].startIndex + j];
-            ++j;
+            parseJoints(lexer, joints.size());
         }
-        if (hierarchy[i].flags & AnimQY)
+        else if (lexer.checkWord("mesh") && lexer.expectChar('{'))
         {
-            animatedOrient[1] = frameData[hierarchy[i].startIndex + j];
-            ++j;
+            const std::size_t meshIndex = currMesh++;
+            if (meshIndex >= meshes.size())
+            {
+                throw std::runtime_error{ "Bad mesh index! " + std::to_string(meshIndex) };
+            }
+            parseMesh(lexer, meshIndex, meshMaterials[meshIndex]);
         }
-        if (hierarchy[i].flags & AnimQZ)
+        else
         {
-            animatedOrient[2] = frameData[hierarchy[i].startIndex + j];
-            ++j;
+            // Command line or something else we don't use.
+            lexer.skipLine();
         }
+    }
+}
 
-        animatedOrient[3] = quaternionComputeW(
-                                animatedOrient[0],
-                                animatedOrient[1],
-                                animatedOrient[2]);
+void ModelInstance::parseMesh(MD5Lexer & lexer, const std::size_t meshIndex, std::string & materialName)
+{
+    auto & mesh = meshes[meshIndex];
 
-        // NOTE: We assume that this joint's parent has
-        // already been calculated, i.e. joint's ID should
-        // never be smaller than its parent ID.
-        auto & thisJoint = skelJointsOut[i];
-        const int parent = hierarchy[i].parent;
-        thisJoint.parent = parent;
+    int index      = 0;
+    int numVerts   = 0;
+    int numTris    = 0;
+    int numWeights = 0;
+
+    std::array<int,   3> iData;
+    std::array<float, 4> fData;
 
-        // Cleanup the quotes. They aren't removed by parseHierarchy().
-        if (hierarchy[i].name[0] == '"')
+    // Up to the end of the { } block:
+    while (!lexer.expectChar('}'))
+    {
+        if (lexer.atEnd())
         {
-            thisJoint.name.assign(hierarchy[i].name, 1, std::strlen(hierarchy[i].name) - 2);
+            throw std::runtime_error{ "Unexpected EOF while parsing mesh #" + std::to_string(meshIndex) };
         }
-        else
+
+        if (lexer.checkWord("vert"))
+        {
+            if (!lexer.readInt(&index) || index < 0 || index >= numVerts ||
+                !lexer.readFloatTuple(fData.data(), 2) || !lexer.readInt(&iData[0]) || !lexer.readInt(&iData[1]))
+            {
+                throw std::runtime_error{ "Error parsing mesh vert #" + std::to_string(index) };
+            }
+
+            mesh.vertexes[index].u = fData[0];
+            mesh.vertexes[index].v = fData[1];
+            mesh.vertexes[index].firstWeight = iData[0];
+            mesh.vertexes[index].weightCount = iData[1];
+        }
+        else if (lexer.checkWord("tri"))
         {
-            thisJoint.name = hierarchy[i].name;
+            if (!lexer.readInt(&index) || index < 0 || index >= numTris ||
+                !lexer.readInt(&iData[0]) || !lexer.readInt(&iData[1]) || !lexer.readInt(&iData[2]))
+            {
+                throw std::runtime_error{ "Error parsing mesh tri #" + std::to_string(index) };
+            }
+
+            mesh.triangles[index].index[0] = iData[0];
+            mesh.triangles[index].index[1] = iData[1];
+            mesh.triangles[index].index[2] = iData[2];
         }
+        else if (lexer.checkWord("weight"))
+        {
+            if (!lexer.readInt(&index) || index < 0 || index >= numWeights ||
+                !lexer.readInt(&iData[0]) || !lexer.readFloat(&fData[3]) || !lexer.readFloatTuple(fData.data(), 3))
+            {
+                throw std::runtime_error{ "Error parsing mesh weight #" + std::to_string(index) };
+            }
 
-        if (thisJoint.parent < 0) // Is this the root (no parent)?
+            mesh.weights[index].pos[0] = fData[0];
+            mesh.weights[index].pos[1] = fData[1];
+            mesh.weights[index].pos[2] = fData[2];
+            mesh.weights[index].bias   = fData[3];
+            mesh.weights[index].joint  = iData[0];
+        }
+        else if (lexer.checkWord("shader"))
         {
-            // Copy stuff unchanged.
-            thisJoint.pos    = animatedPos;
-            thisJoint.orient = animatedOrient;
+            // Material/texture name. Created once the whole file is parsed.
+            if (!lexer.readString(materialName))
+            {
+                throw std::runtime_error{ "Error parsing shader name of mesh #" + std::to_string(meshIndex) };
+            }
+        }
+        else if (lexer.checkWord("numverts"))
+        {
+            if (lexer.readInt(&numVerts) && numVerts > 0)
+            {
+                // Preallocate memory for the mesh vertexes:
+                mesh.vertexes.resize(numVerts);
+            }
+        }
+        else if (lexer.checkWord("numtris"))
+        {
+            if (lexer.readInt(&numTris) && numTris > 0)
+            {
+                // Preallocate memory for the triangles:
+                mesh.triangles.resize(numTris);
+            }
+        }
+        else if (lexer.checkWord("numweights"))
+        {
+            if (lexer.readInt(&numWeights) && numWeights > 0)
+            {
+                // Preallocate memory for vertex the weights:
+                mesh.weights.resize(numWeights);
+            }
         }
         else
         {
-            // If it has a parent we must apply the parent's
-            // rotation/orientation to the position first.
-            auto & parentJoint = skelJointsOut[parent];
-            const Point3 rotatedPos = quaternionRotatePoint(parentJoint.orient, animatedPos);
-
-            // Add positions:
-            thisJoint.pos[0] = rotatedPos[0] + parentJoint.pos[0];
-            thisJoint.pos[1] = rotatedPos[1] + parentJoint.pos[1];
-            thisJoint.pos[2] = rotatedPos[2] + parentJoint.pos[2];
-
-            // Concatenate this rotation with the parent's:
-            thisJoint.orient = parentJoint.orient * animatedOrient;
-            thisJoint.orient = normalize(thisJoint.orient);
+            lexer.skipLine();
         }
     }
 }
 
-// ========================================================
-// class AnimatedEntity:
-// ========================================================
+void ModelInstance::parseJoints(MD5Lexer & lexer, const std::size_t numJoints)
+{
+    int parentIndex;
+    std::array<float, 3> pos;
+    std::array<float, 4> quat;
 
-AnimatedEntity::AnimatedEntity(GLFWApp & owner, const std::string & modelFile,
-                               const std::vector<std::string> & animFiles)
-    : model       { owner, modelFile }
-    , currFrame   { 0 }
-    , loopCount   { 0 }
-    , lastTimeSec { 0 }
-    , currAnim    { nullptr }
-    , vertArray   { owner   }
-    , shaderProg  { owner   }
-    , shadowProg  { owner   }
-{
-    loadShaderProgram(owner);
-    loadAnimations(owner, animFiles);
-    setUpInitialVertexArray();
-}
+    for (std::size_t j = 0; j < numJoints; ++j)
+    {
+        if (lexer.atEnd())
+        {
+            throw std::runtime_error{ "Unexpected EOF while parsing model joints!" };
+        }
+
+        // "name" parent ( pos ) ( quat )
+        auto & joint = joints[j];
+        if (!lexer.readString(joint.name) || !lexer.readInt(&parentIndex) ||
+            !lexer.readFloatTuple(pos.data(), 3) || !lexer.readFloatTuple(quat.data(), 3))
+        {
+            throw std::runtime_error{ "Error parsing joint #" + std::to_string(j) };
+        }
+
+        // W component of the quaternion is not stored.
+        quat[3] = quaternionComputeW(quat[0], quat[1], quat[2]);
+
+        // Store:
+        joint.orient = Quat{ quat[0], quat[1], quat[2], quat[3] };
+        joint.pos    = Point3{ pos[0], pos[1], pos[2] };
+        joint.parent = parentIndex;
+    }
+
+    lexer.skipBlock();
+}
+
+void ModelInstance::createSkeleton()
+{
+    std::vector<std::string> names;
+    std::vector<int> parents;
+    names.reserve(joints.size());
+    parents.reserve(joints.size());
+
+    for (const auto & joint : joints)
+    {
+        names.push_back(joint.name);
+        parents.push_back(joint.parent);
+    }
+
+    skeleton = Skeleton::intern(std::move(names), std::move(parents));
+}
+
+void ModelInstance::createMeshMaterials(const std::vector<std::string> & meshMaterials)
+{
+    for (std::size_t m = 0; m < meshes.size(); ++m)
+    {
+        meshes[m].material = findMaterial(meshMaterials[m]);
+        if (meshes[m].material == nullptr)
+        {
+            meshes[m].material = createMaterial(meshMaterials[m]);
+        }
+    }
+}
+
+bool ModelInstance::loadBaked(const std::string & bakedFile, const FileInfo & sourceInfo,
+                              std::vector<std::string> & meshMaterials)
+{
+    MappedFile inFile{ bakedFile };
+    if (!inFile.isOpen())
+    {
+        return false;
+    }
+
+    BakedReader reader{ inFile.getData(), inFile.getSize() };
+    if (!reader.readHeader("MD5M", sourceInfo))
+    {
+        return false;
+    }
+
+    std::uint32_t numJoints = 0;
+    std::uint32_t numMeshes = 0;
+    if (!reader.read(&numJoints) || !reader.read(&numMeshes))
+    {
+        return false;
+    }
+
+    // Read into temporaries, so a bad file leaves the model untouched
+    // and we can still fall back to the text file.
+    std::vector<BakedJoint> bakedJoints;
+    if (!reader.readArray(bakedJoints, numJoints))
+    {
+        return false;
+    }
+
+    std::vector<Joint> newJoints(numJoints);
+    for (std::uint32_t j = 0; j < numJoints; ++j)
+    {
+        const auto & bj = bakedJoints[j];
+        newJoints[j].orient = Quat{ bj.orient[0], bj.orient[1], bj.orient[2], bj.orient[3] };
+        newJoints[j].pos    = Point3{ bj.pos[0], bj.pos[1], bj.pos[2] };
+        newJoints[j].parent = bj.parent;
+
+        if (bj.parent < -1 || bj.parent >= static_cast<std::int32_t>(j))
+        {
+            return false;
+        }
+    }
+    for (std::uint32_t j = 0; j < numJoints; ++j)
+    {
+        if (!reader.readString(newJoints[j].name))
+        {
+            return false;
+        }
+    }
+
+    std::vector<Mesh> newMeshes;
+    std::vector<std::string> newMaterials;
+    std::vector<BakedWeight> bakedWeights;
+
+    for (std::uint32_t m = 0; m < numMeshes; ++m)
+    {
+        std::string materialName;
+        std::uint32_t counts[3]; // numTris, numVerts, numWeights
+        if (!reader.readString(materialName) || !reader.read(&counts))
+        {
+            return false;
+        }
+
+        Mesh mesh{};
+        if (!reader.readArray(mesh.triangles, counts[0]) ||
+            !reader.readArray(mesh.vertexes,  counts[1]) ||
+            !reader.readArray(bakedWeights,   counts[2]))
+        {
+            return false;
+        }
+
+        mesh.weights.resize(counts[2]);
+        for (std::uint32_t w = 0; w < counts[2]; ++w)
+        {
+            const auto & bw = bakedWeights[w];
+            mesh.weights[w].pos   = Point3{ bw.pos[0], bw.pos[1], bw.pos[2] };
+            mesh.weights[w].bias  = bw.bias;
+            mesh.weights[w].joint = bw.joint;
+        }
+
+        newMeshes.push_back(std::move(mesh));
+        newMaterials.push_back(std::move(materialName));
+    }
+
+    if (!reader.atEnd())
+    {
+        return false;
+    }
+
+    joints        = std::move(newJoints);
+    meshes        = std::move(newMeshes);
+    meshMaterials = std::move(newMaterials);
+    return true;
+}
+
+bool ModelInstance::writeBaked(const std::string & bakedFile, const FileInfo & sourceInfo,
+                               const std::vector<std::string> & meshMaterials) const
+{
+    BakedWriter writer{ "MD5M" };
+    writer.write(static_cast<std::uint32_t>(joints.size()));
+    writer.write(static_cast<std::uint32_t>(meshes.size()));
+
+    for (const auto & joint : joints)
+    {
+        const BakedJoint bj = {
+            { joint.orient[0], joint.orient[1], joint.orient[2], joint.orient[3] },
+            { joint.pos[0], joint.pos[1], joint.pos[2] },
+            joint.parent
+        };
+        writer.write(bj);
+    }
+    for (const auto & joint : joints)
+    {
+        writer.writeString(joint.name);
+    }
+
+    for (std::size_t m = 0; m < meshes.size(); ++m)
+    {
+        const auto & mesh = meshes[m];
+        const std::uint32_t counts[3] = {
+            static_cast<std::uint32_t>(mesh.triangles.size()),
+            static_cast<std::uint32_t>(mesh.vertexes.size()),
+            static_cast<std::uint32_t>(mesh.weights.size())
+        };
+
+        writer.writeString(meshMaterials[m]);
+        writer.write(counts);
+        writer.writeArray(mesh.triangles);
+        writer.writeArray(mesh.vertexes);
+
+        for (const auto & weight : mesh.weights)
+        {
+            const BakedWeight bw = {
+                { weight.pos[0], weight.pos[1], weight.pos[2] },
+                weight.bias,
+                weight.joint
+            };
+            writer.write(bw);
+        }
+    }
+
+    return writer.saveToFile(bakedFile, sourceInfo);
+}
+
+const Joint * ModelInstance::findJoint(const std::string & jointName) const
+{
+    const int index = skeleton->findJoint(jointName);
+    return (index >= 0) ? &joints[index] : nullptr;
+}
+
+const MaterialInstance * ModelInstance::findMaterial(const std::string & matName) const
+{
+    auto iter = materials.find(matName);
+    if (iter == std::end(materials))
+    {
+        return nullptr;
+    }
+    return iter->second.get();
+}
+
+const MaterialInstance * ModelInstance::createMaterial(const std::string & matName)
+{
+    auto result = materials.emplace(matName, getResourceCache().loadMaterial(app, matName));
+    if (result.second == false)
+    {
+        throw std::runtime_error{ "MaterialMap name collision! " + matName };
+    }
+    return result.first->second.get();
+}
+
+std::size_t ModelInstance::getMemoryBytes() const noexcept
+{
+    std::size_t bytes = sizeof(*this) +
+                        meshes.capacity()    * sizeof(Mesh) +
+                        joints.capacity()    * sizeof(Joint) +
+                        materials.size()     * (sizeof(MaterialMap::value_type) + sizeof(void *) * 2);
+
+    for (const auto & mesh : meshes)
+    {
+        bytes += mesh.triangles.capacity() * sizeof(Triangle) +
+                 mesh.vertexes.capacity()  * sizeof(Vertex)   +
+                 mesh.weights.capacity()   * sizeof(Weight);
+    }
+    for (const auto & joint : joints)
+    {
+        bytes += stringHeapBytes(joint.name);
+    }
+    return bytes;
+}
+
+// ========================================================
+// class AnimInstance:
+// ========================================================
+
+AnimInstance::AnimInstance(const std::string & filename)
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    FileInfo sourceInfo;
+    if (!getFileInfo(filename, &sourceInfo))
+    {
+        throw std::runtime_error{ "Unable to open file \"" + filename + "\"!" };
+    }
+
+    const std::string bakedFile = g_bUseBakedCache ? getBakedCachePath(filename) : std::string{};
+
+    if (g_bUseBakedCache && loadBaked(bakedFile, sourceInfo))
+    {
+        fromBakedCache = true;
+        loadTimeMs     = millisecondsSince(startTime);
+    }
+    else
+    {
+        MappedFile inFile{ filename };
+        if (!inFile.isOpen())
+        {
+            throw std::runtime_error{ "Unable to open file \"" + filename + "\"!" };
+        }
+
+        MD5Lexer lexer{ inFile.getData(), inFile.getSize() };
+        parseAnim(lexer);
+        loadTimeMs = millisecondsSince(startTime);
+
+        // Failing to write the cache is not fatal; we'll just parse the text again next time.
+        if (g_bUseBakedCache)
+        {
+            writeBaked(bakedFile, sourceInfo);
+        }
+    }
+
+    sourceSizeBytes = sourceInfo.sizeBytes;
+}
+
+AnimInstance::AnimInstance(std::istream & inStr)
+{
+    const std::string text{ std::istreambuf_iterator<char>{ inStr }, std::istreambuf_iterator<char>{} };
+
+    MD5Lexer lexer{ text.data(), text.size() };
+    parseAnim(lexer);
+
+    sourceSizeBytes = text.size();
+}
+
+void AnimInstance::parseAnim(MD5Lexer & lexer)
+{
+    // Clear out these members first:
+    numFrames = 0;
+    numJoints = 0;
+    frameRate = 0;
+    duration  = 0;
+
+    // Temporary locals:
+    int versionNum = 0;
+    int frameIndex = 0;
+    int numAnimatedComponents = 0;
+
+    std::vector<float> animFrameData;
+    std::vector<HierarchyInfo> hierarchy;
+    std::vector<BaseFrameJointPose> baseFrame;
+
+    // A single allocation for the pose streams of all frames: all rotations, then all positions.
+    const auto allocatePoses = [this]()
+    {
+        if (numFrames > 0 && numJoints > 0)
+        {
+            poseData.assign(std::size_t(numFrames) * numJoints * (4 + 3), 0.0f);
+        }
+    };
+
+    while (!lexer.atEnd())
+    {
+        if (lexer.checkWord("frame"))
+        {
+            if (!lexer.readInt(&frameIndex) || !lexer.expectChar('{'))
+            {
+                throw std::runtime_error{ "Error parsing animation frame header!" };
+            }
+            if (frameIndex < 0 || frameIndex >= numFrames || numJoints <= 0)
+            {
+                throw std::runtime_error{ "Bad animation frame index! " + std::to_string(frameIndex) };
+            }
+
+            parseFrame(lexer, animFrameData, numAnimatedComponents);
+            buildFramePose(hierarchy, baseFrame, animFrameData,
+                           poseData.data() + std::size_t(frameIndex) * numJoints * 4,
+                           poseData.data() + std::size_t(numFrames) * numJoints * 4 + std::size_t(frameIndex) * numJoints * 3,
+                           numJoints);
+        }
+        else if (lexer.checkWord("MD5Version"))
+        {
+            // Models from DOOM 3 should have version 10.
+            if (lexer.readInt(&versionNum) && versionNum != 10)
+            {
+                throw std::runtime_error{ "Bad anim version! Expected 10, got " + std::to_string(versionNum) };
+            }
+        }
+        else if (lexer.checkWord("numFrames"))
+        {
+            // Preallocate memory for the frame poses and bounding boxes:
+            if (lexer.readInt(&numFrames) && numFrames > 0)
+            {
+                bboxes.resize(numFrames);
+                allocatePoses();
+            }
+        }
+        else if (lexer.checkWord("numJoints"))
+        {
+            if (lexer.readInt(&numJoints) && numJoints > 0)
+            {
+                allocatePoses();
+
+                // Allocate temporary memory for building the frame poses:
+                hierarchy.resize(numJoints);
+                baseFrame.resize(numJoints);
+            }
+        }
+        else if (lexer.checkWord("numAnimatedComponents"))
+        {
+            if (lexer.readInt(&numAnimatedComponents) && numAnimatedComponents > 0)
+            {
+                // Preallocate memory for animation frame data:
+                animFrameData.resize(numAnimatedComponents);
+            }
+        }
+        else if (lexer.checkWord("frameRate"))
+        {
+            if (lexer.readInt(&frameRate))
+            {
+                duration = 1.0 / static_cast<double>(frameRate);
+            }
+        }
+        else if (lexer.checkWord("hierarchy") && lexer.expectChar('{'))
+        {
+            parseHierarchy(lexer, hierarchy, numJoints);
+        }
+        else if (lexer.checkWord("bounds") && lexer.expectChar('{'))
+        {
+            parseBounds(lexer, numFrames);
+        }
+        else if (lexer.checkWord("baseframe") && lexer.expectChar('{'))
+        {
+            parseBaseFrame(lexer, baseFrame, numJoints);
+        }
+        else
+        {
+            // Command line or something else we don't use.
+            lexer.skipLine();
+        }
+    }
+
+    rotationStream = poseData.data();
+    positionStream = poseData.data() + std::size_t(numFrames) * numJoints * 4;
+
+    // The names and parents are the same for every frame, so they are stored once, in the skeleton.
+    std::vector<std::string> names(std::max(numJoints, 0));
+    std::vector<int> parents(std::max(numJoints, 0));
+    for (int j = 0; j < numJoints; ++j)
+    {
+        names[j]   = hierarchy[j].name;
+        parents[j] = hierarchy[j].parent;
+    }
+    skeleton = Skeleton::intern(std::move(names), std::move(parents));
+}
+
+void AnimInstance::parseBounds(MD5Lexer & lexer, const int numBounds)
+{
+    std::array<float, 3> bbMin;
+    std::array<float, 3> bbMax;
+
+    // One bounding-box for each frame of animation.
+    for (int b = 0; b < numBounds; ++b)
+    {
+        if (lexer.atEnd())
+        {
+            throw std::runtime_error{ "Unexpected EOF while parsing animation frame bounds!" };
+        }
+
+        // ( min ) ( max )
+        if (!lexer.readFloatTuple(bbMin.data(), 3) || !lexer.readFloatTuple(bbMax.data(), 3))
+        {
+            throw std::runtime_error{ "Error parsing bounds entry #" + std::to_string(b) };
+        }
+
+        bboxes[b].mins = Point3{ bbMin[0], bbMin[1], bbMin[2] };
+        bboxes[b].maxs = Point3{ bbMax[0], bbMax[1], bbMax[2] };
+    }
+
+    lexer.skipBlock();
+}
+
+void AnimInstance::parseHierarchy(MD5Lexer & lexer, std::vector<HierarchyInfo> & hierarchy, const int numJoints)
+{
+    // There should be one entry for each model joint.
+    for (int j = 0; j < numJoints; ++j)
+    {
+        if (lexer.atEnd())
+        {
+            throw std::runtime_error{ "Unexpected EOF while parsing animation hierarchy!" };
+        }
+
+        // "name" parent flags startIndex
+        if (!lexer.readString(hierarchy[j].name, sizeof(hierarchy[j].name)) ||
+            !lexer.readInt(&hierarchy[j].parent) || !lexer.readInt(&hierarchy[j].flags) ||
+            !lexer.readInt(&hierarchy[j].startIndex))
+        {
+            throw std::runtime_error{ "Error parsing hierarchy entry #" + std::to_string(j) };
+        }
+
+        // Poses are built front to back, so parents must come first.
+        if (hierarchy[j].parent < -1 || hierarchy[j].parent >= j)
+        {
+            throw std::runtime_error{ "Bad parent index in hierarchy entry #" + std::to_string(j) };
+        }
+    }
+
+    lexer.skipBlock();
+}
+
+void AnimInstance::parseBaseFrame(MD5Lexer & lexer, std::vector<BaseFrameJointPose> & baseFrame, const int numJoints)
+{
+    std::array<float, 3> pos;
+    std::array<float, 4> quat;
+
+    // There should be one entry for each model joint.
+    for (int j = 0; j < numJoints; ++j)
+    {
+        if (lexer.atEnd())
+        {
+            throw std::runtime_error{ "Unexpected EOF while parsing animation baseframe!" };
+        }
+
+        // Read base frame joint ( position ) ( quaternion ):
+        if (!lexer.readFloatTuple(pos.data(), 3) || !lexer.readFloatTuple(quat.data(), 3))
+        {
+            throw std::runtime_error{ "Error parsing baseframe entry #" + std::to_string(j) };
+        }
+
+        // Compute the W component of the quaternion (not stored in the file):
+        quat[3] = quaternionComputeW(quat[0], quat[1], quat[2]);
+
+        // Save 'em:
+        baseFrame[j].orient = Quat{ quat[0], quat[1], quat[2], quat[3] };
+        baseFrame[j].pos = Point3{ pos[0], pos[1], pos[2] };
+    }
+
+    lexer.skipBlock();
+}
+
+void AnimInstance::parseFrame(MD5Lexer & lexer, std::vector<float> & frameData, const int numAnimatedComponents)
+{
+    for (int entry = 0; entry < numAnimatedComponents; ++entry)
+    {
+        if (lexer.atEnd())
+        {
+            throw std::runtime_error{ "Unexpected EOF while parsing animation frame data!" };
+        }
+        if (!lexer.readFloat(&frameData[entry]))
+        {
+            throw std::runtime_error{ "Error parsing animation frame data entry #" + std::to_string(entry) };
+        }
+    }
+
+    lexer.skipBlock();
+}
+
+bool AnimInstance::loadBaked(const std::string & bakedFile, const FileInfo & sourceInfo)
+{
+    std::unique_ptr<MappedFile> inFile{ new MappedFile{ bakedFile } };
+    if (!inFile->isOpen())
+    {
+        return false;
+    }
+
+    BakedReader reader{ inFile->getData(), inFile->getSize() };
+    if (!reader.readHeader("MD5A", sourceInfo))
+    {
+        return false;
+    }
+
+    std::uint32_t bakedNumFrames = 0;
+    std::uint32_t bakedNumJoints = 0;
+    std::int32_t  bakedFrameRate = 0;
+    if (!reader.read(&bakedNumFrames) || !reader.read(&bakedNumJoints) || !reader.read(&bakedFrameRate) ||
+        bakedNumFrames > INT_MAX || bakedNumJoints > INT_MAX)
+    {
+        return false;
+    }
+
+    // Parent index and name are the same for every frame.
+    std::vector<int> parents(bakedNumJoints);
+    std::vector<std::string> names(bakedNumJoints);
+    for (std::uint32_t j = 0; j < bakedNumJoints; ++j)
+    {
+        std::int32_t parent = 0;
+        if (!reader.read(&parent) || !reader.readString(names[j]) ||
+            parent < -1 || parent >= static_cast<std::int32_t>(j))
+        {
+            return false;
+        }
+        parents[j] = parent;
+    }
+
+    std::vector<BakedBounds> bakedBounds;
+    if (!reader.readArray(bakedBounds, bakedNumFrames))
+    {
+        return false;
+    }
+
+    const std::uint64_t numPoses = std::uint64_t(bakedNumFrames) * bakedNumJoints;
+    const char * rotationData = reader.consume(sizeof(float) * 4, numPoses);
+    const char * positionData = reader.consume(sizeof(float) * 3, numPoses);
+    if (rotationData == nullptr || positionData == nullptr || !reader.atEnd())
+    {
+        return false;
+    }
+
+    // The file checks out, so from here on nothing can fail.
+    numFrames = static_cast<int>(bakedNumFrames);
+    numJoints = static_cast<int>(bakedNumJoints);
+    frameRate = bakedFrameRate;
+    duration  = 1.0 / static_cast<double>(frameRate);
+    skeleton  = Skeleton::intern(std::move(names), std::move(parents));
+
+    bboxes.resize(numFrames);
+    for (int f = 0; f < numFrames; ++f)
+    {
+        const auto & bb = bakedBounds[f];
+        bboxes[f].mins = Point3{ bb.mins[0], bb.mins[1], bb.mins[2] };
+        bboxes[f].maxs = Point3{ bb.maxs[0], bb.maxs[1], bb.maxs[2] };
+    }
+
+    // The mapping is page aligned and every section a multiple of 4 bytes,
+    // so the streams are properly aligned floats. Keep the file mapped and
+    // point straight into it; the pages are loaded on demand by the OS.
+    rotationStream = reinterpret_cast<const float *>(rotationData);
+    positionStream = reinterpret_cast<const float *>(positionData);
+    bakedFileData  = std::move(inFile);
+    return true;
+}
+
+bool AnimInstance::writeBaked(const std::string & bakedFile, const FileInfo & sourceInfo) const
+{
+    BakedWriter writer{ "MD5A" };
+    writer.write(static_cast<std::uint32_t>(numFrames));
+    writer.write(static_cast<std::uint32_t>(numJoints));
+    writer.write(static_cast<std::int32_t>(frameRate));
+
+    for (int j = 0; j < numJoints; ++j)
+    {
+        writer.write(static_cast<std::int32_t>(skeleton->getJointParent(j)));
+        writer.writeString(skeleton->getJointName(j));
+    }
+
+    for (const auto & bbox : bboxes)
+    {
+        const BakedBounds bb = {
+            { bbox.mins[0], bbox.mins[1], bbox.mins[2] },
+            { bbox.maxs[0], bbox.maxs[1], bbox.maxs[2] }
+        };
+        writer.write(bb);
+    }
+
+    // Same layout as in memory, so a single copy for each stream.
+    const std::size_t numPoses = std::size_t(numFrames) * numJoints;
+    writer.writeBytes(rotationStream, numPoses * 4 * sizeof(float));
+    writer.writeBytes(positionStream, numPoses * 3 * sizeof(float));
+
+    return writer.saveToFile(bakedFile, sourceInfo);
+}
+
+AnimSamplePoint AnimInstance::locate(const double timeSeconds, const AnimLoopMode loopMode) const noexcept
+{
+    assert(numFrames > 0);
+    const int lastFrame = numFrames - 1;
+
+    // In frames from the start. Each frame is shown for one frame time, the last one included.
+    double frameTime = std::max(timeSeconds, 0.0) * frameRate;
+    int loopCount = 0;
+
+    if (loopMode == AnimLoopMode::Loop)
+    {
+        const double loops = std::floor(frameTime / numFrames);
+        frameTime -= loops * numFrames;
+        loopCount  = static_cast<int>(std::min(loops, static_cast<double>(INT_MAX)));
+    }
+    else if (frameTime >= lastFrame)
+    {
+        return { lastFrame, lastFrame, 0.0f, 1 };
+    }
+
+    // Rounding can put a time just under a loop at frame numFrames.
+    const int frame = std::min(static_cast<int>(frameTime), lastFrame);
+    const float interp = clamp(static_cast<float>(frameTime - frame), 0.0f, 1.0f);
+    return { frame, std::min(frame + 1, lastFrame), interp, loopCount };
+}
+
+void AnimInstance::sample(const double timeSeconds, const AnimLoopMode loopMode, Pose & poseOut, const bool nlerp) const
+{
+    const AnimSamplePoint point = locate(timeSeconds, loopMode);
+    AnimatedEntity::interpolatePoses(getFrameRotations(point.frameA), getFramePositions(point.frameA),
+                                     getFrameRotations(point.frameB), getFramePositions(point.frameB),
+                                     numJoints, point.interp, poseOut, nlerp);
+}
+
+std::size_t AnimInstance::getMemoryBytes() const noexcept
+{
+    // The pose streams are either in 'poseData' or in the mapped baked file.
+    // The mapping is counted in full, since the whole file is likely to get paged in.
+    return sizeof(*this) +
+           poseData.capacity() * sizeof(float) +
+           bboxes.capacity()   * sizeof(BoundingBox) +
+           (bakedFileData != nullptr ? bakedFileData->getSize() : 0);
+}
+
+void AnimInstance::buildFramePose(const std::vector<HierarchyInfo> & hierarchy,
+                                  const std::vector<BaseFrameJointPose> & baseFrame,
+                                  const std::vector<float> & frameData,
+                                  float * rotationsOut, float * positionsOut, const int numJoints)
+{
+    for (int i = 0; i < numJoints; ++i)
+    {
+        const auto & baseJoint = baseFrame[i];
+        Point3 animatedPos  = baseJoint.pos;
+        Quat animatedOrient = baseJoint.orient;
+        int j = 0;
+
+        // T x y z
+        if (hierarchy[i].flags & AnimTX)
+        {
+            animatedPos[0] = frameData[hierarchy[i].startIndex + j];
+            ++j;
+        }
+        if (hierarchy[i].flags & AnimTY)
+        {
+            animatedPos[1] = frameData[hierarchy[i].startIndex + j];
+            ++j;
+        }
+        if (hierarchy[i].flags & AnimTZ)
+        {
+            animatedPos[2] = frameData[hierarchy[i].startIndex + j];
+            ++j;
+        }
+
+        // Q x y z
+        if (hierarchy[i].flags & AnimQX)
+        {
+            animatedOrient[0] = frameData[hierarchy[i].startIndex + j];
+            ++j;
+        }
+        if (hierarchy[i].flags & AnimQY)
+        {
+            animatedOrient[1] = frameData[hierarchy[i].startIndex + j];
+            ++j;
+        }
+        if (hierarchy[i].flags & AnimQZ)
+        {
+            animatedOrient[2] = frameData[hierarchy[i].startIndex + j];
+            ++j;
+        }
+
+        animatedOrient[3] = quaternionComputeW(
+                                animatedOrient[0],
+                                animatedOrient[1],
+                                animatedOrient[2]);
+
+        // NOTE: We assume that this joint's parent has
+        // already been calculated, i.e. joint's ID should
+        // never be smaller than its parent ID.
+        float * thisOrient = rotationsOut + i * 4;
+        float * thisPos    = positionsOut + i * 3;
+        const int parent   = hierarchy[i].parent;
+
+        if (parent < 0) // Is this the root (no parent)?
+        {
+            // Copy stuff unchanged.
+            thisPos[0]    = animatedPos[0];
+            thisPos[1]    = animatedPos[1];
+            thisPos[2]    = animatedPos[2];
+            thisOrient[0] = animatedOrient[0];
+            thisOrient[1] = animatedOrient[1];
+            thisOrient[2] = animatedOrient[2];
+            thisOrient[3] = animatedOrient[3];
+        }
+        else
+        {
+            // If it has a parent we must apply the parent's
+            // rotation/orientation to the position first.
+            const float * parentOrientData = rotationsOut + parent * 4;
+            const float * parentPos        = positionsOut + parent * 3;
+            const Quat parentOrient{ parentOrientData[0], parentOrientData[1], parentOrientData[2], parentOrientData[3] };
+            const Point3 rotatedPos = quaternionRotatePoint(parentOrient, animatedPos);
+
+            // Add positions:
+            thisPos[0] = rotatedPos[0] + parentPos[0];
+            thisPos[1] = rotatedPos[1] + parentPos[1];
+            thisPos[2] = rotatedPos[2] + parentPos[2];
+
+            // Concatenate this rotation with the parent's:
+            const Quat orient = normalize(parentOrient * animatedOrient);
+            thisOrient[0] = orient[0];
+            thisOrient[1] = orient[1];
+            thisOrient[2] = orient[2];
+            thisOrient[3] = orient[3];
+        }
+    }
+}
+
+// ========================================================
+// class ResourceCache:
+// ========================================================
+
+template<typename T, typename LoadFunc>
+std::shared_ptr<const T> ResourceCache::findOrLoad(Table<T> & table, const std::string & name,
+                                                   bool * wasResident, LoadFunc loadFunc)
+{
+    const std::string key = getCanonicalPath(name);
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        auto resident = table[key].lock();
+        if (resident != nullptr)
+        {
+            ++numHits;
+            if (wasResident != nullptr)
+            {
+                *wasResident = true;
+            }
+            return resident;
+        }
+    }
+
+    // Not locked while loading. Loading a model also requests its materials.
+    std::shared_ptr<const T> loaded{ loadFunc() };
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto & entry = table[key];
+    auto resident = entry.lock();
+    if (resident != nullptr)
+    {
+        // Lost a race with another thread loading the same file.
+        ++numWastedLoads;
+        if (wasResident != nullptr)
+        {
+            *wasResident = true;
+        }
+        return resident;
+    }
+
+    entry = loaded;
+    ++numLoads;
+    if (wasResident != nullptr)
+    {
+        *wasResident = false;
+    }
+
+    // Forget the expired entries now and then, so the tables don't keep
+    // growing with the names of resources that have been freed.
+    if (table.size() > 64 && numLoads % 64 == 0)
+    {
+        for (auto iter = std::begin(table); iter != std::end(table);)
+        {
+            iter = iter->second.expired() ? table.erase(iter) : std::next(iter);
+        }
+    }
+    return loaded;
+}
+
+std::shared_ptr<const ModelInstance> ResourceCache::loadModel(GLFWApp & app, const std::string & filename, bool * wasResident)
+{
+    return findOrLoad(models, filename, wasResident, [&app, &filename]() { return new ModelInstance{ app, filename }; });
+}
+
+std::shared_ptr<const AnimInstance> ResourceCache::loadAnimation(const std::string & filename, bool * wasResident)
+{
+    return findOrLoad(animations, filename, wasResident, [&filename]() { return new AnimInstance{ filename }; });
+}
+
+std::shared_ptr<const MaterialInstance> ResourceCache::loadMaterial(GLFWApp & app, const std::string & matName, bool * wasResident)
+{
+    return findOrLoad(materials, matName, wasResident, [&app, &matName]() { return new MaterialInstance{ app, matName }; });
+}
+
+template<typename T>
+static int countResident(const std::unordered_map<std::string, std::weak_ptr<const T>> & table, std::size_t & bytes)
+{
+    int count = 0;
+    for (const auto & entry : table)
+    {
+        if (const auto resource = entry.second.lock())
+        {
+            bytes += resource->getMemoryBytes();
+            ++count;
+        }
+    }
+    return count;
+}
+
+ResourceCache::Stats ResourceCache::getStats() const
+{
+    Stats stats;
+    std::lock_guard<std::mutex> lock{ mutex };
+    stats.numModels     = countResident(models,     stats.residentBytes);
+    stats.numAnimations = countResident(animations, stats.residentBytes);
+    stats.numMaterials  = countResident(materials,  stats.residentBytes);
+    stats.numLoads       = numLoads;
+    stats.numHits        = numHits;
+    stats.numWastedLoads = numWastedLoads;
+    return stats;
+}
+
+ResourceCache & getResourceCache()
+{
+    static ResourceCache cache;
+    return cache;
+}
+
+// ========================================================
+// struct AnimLodPolicy:
+// ========================================================
+
+AnimLod AnimLodPolicy::select(const Mat4 & modelViewMatrix, const Mat4 & projMatrix,
+                              const Point3 & center, const float radius) const
+{
+    // Frustum planes in model space, from the model-view matrix.
+    const Frustum frustum{ modelViewMatrix, projMatrix };
+    if (!frustum.testSphere(Vec3{ center }, radius))
+    {
+        return AnimLod::Frozen;
+    }
+
+    // Projected diameter over the 2 units of NDC height. Clamped to the radius
+    // in front of the viewer, so a sphere around the eye counts as very big.
+    const float depth = std::max(-static_cast<float>((modelViewMatrix * center)[2]), radius);
+    const float screenSize = radius * projMatrix[1][1] / depth;
+
+    if (screenSize >= minScreenSize[0])
+    {
+        return AnimLod::Full;
+    }
+    if (screenSize >= minScreenSize[1])
+    {
+        return AnimLod::Reduced;
+    }
+    return AnimLod::Low;
+}
+
+// ========================================================
+// class AnimatedEntity:
+// ========================================================
+
+AnimatedEntity::ModelRenderData::ModelRenderData(GLFWApp & owner)
+    : meshSkinning      { }
+    , tangentSolver     { }
+    , bindPoseBounds    { Point3{ 0.0f, 0.0f, 0.0f }, Point3{ 0.0f, 0.0f, 0.0f } }
+    , boundsCenter      { 0.0f, 0.0f, 0.0f }
+    , boundsRadius      { 0.0f }
+    , vertexAnimCaches  { }
+    , shaderProg        { owner }
+    , shadowProg        { owner }
+    , shaderVars        ( )
+    , gpuSkinning       { false }
+    , skinnedVertArray  { owner }
+    , skinnedProg       { owner }
+    , skinnedShadowProg { owner }
+    , skinnedShaderVars ( )
+    , instancedProg              { owner }
+    , skinnedInstancedProg       { owner }
+    , instancedShaderVars        ( )
+    , skinnedInstancedShaderVars ( )
+{ }
+
+AnimatedEntity::AnimatedEntity(GLFWApp & owner, const std::string & modelFile,
+                               const std::vector<std::string> & animFiles)
+    : model          { getResourceCache().loadModel(owner, modelFile) }
+    , animations     { std::make_shared<AnimMap>() }
+    , animTimeSec    { 0.0 }
+    , loopMode       { AnimLoopMode::Loop }
+    , lodFramesSinceUpdate { nextLodPhase() }
+    , currAnim       { nullptr }
+    , currPose       { }
+    , currPoseSkipped { false }
+    , currPoseNlerp   { false }
+    , bindPose       { }
+    , blendState     { }
+    , vertexAnimCaching { false }
+    , currVertexCache   { nullptr }
+    , renderData     { }
+    , tangentScratch { }
+    , vertArray      { owner }
+    , jointsBuffer   { owner }
+    , normalMatrices { }
+{
+    findOrCreateRenderData(owner);
+    loadAnimations(owner, animFiles);
+    setUpInitialVertexArray(owner);
+}
+
+AnimatedEntity::AnimatedEntity(GLFWApp & owner, const AnimatedEntity & prototype)
+    : model          { prototype.model      }
+    , animations     { prototype.animations }
+    , animTimeSec    { 0.0 }
+    , loopMode       { AnimLoopMode::Loop }
+    , lodFramesSinceUpdate { nextLodPhase() }
+    , currAnim       { nullptr }
+    , currPose       { }
+    , currPoseSkipped { false }
+    , currPoseNlerp   { false }
+    , bindPose       { }
+    , blendState     { }
+    , vertexAnimCaching { false }
+    , currVertexCache   { nullptr }
+    , renderData     { prototype.renderData }
+    , tangentScratch { }
+    , vertArray      { owner }
+    , jointsBuffer   { owner }
+    , normalMatrices { }
+{
+    setUpInitialVertexArray(owner);
+}
+
+void AnimatedEntity::findOrCreateRenderData(GLFWApp & app)
+{
+    // Keyed by the model, which the entities keep alive together with the render data,
+    // so a key can't be reused by a new model while its entry is alive. Render thread only.
+    static std::unordered_map<const ModelInstance *, std::weak_ptr<ModelRenderData>> registry;
+
+    auto & entry = registry[model.get()];
+    renderData = entry.lock();
+    if (renderData != nullptr)
+    {
+        return;
+    }
+
+    renderData = std::make_shared<ModelRenderData>(app);
+    for (const auto & mesh : model->getMeshes())
+    {
+        renderData->meshSkinning.emplace_back(mesh);
+    }
+
+    // The joint indexes of the skinned vertexes are bytes and the
+    // shader arrays have a fixed size, so big skeletons stay on the CPU.
+    renderData->gpuSkinning = (model->getSkeleton().getNumJoints() <= GpuSkinningMaxJoints);
+    loadShaderProgram(app);
+    entry = renderData;
+
+    for (auto iter = std::begin(registry); iter != std::end(registry);)
+    {
+        iter = iter->second.expired() ? registry.erase(iter) : std::next(iter);
+    }
+}
 
 void AnimatedEntity::loadShaderProgram(GLFWApp & app)
 {
-#define GET_UNIFORM_LOC(locName, unifName)                                                        \
-    do                                                                                            \
-    {                                                                                             \
-        std::string strName{ (unifName) };                                                        \
-        shaderVars.locName = shaderProg.getUniformLocation(strName);                              \
-        if (shaderVars.locName < 0)                                                               \
-        {                                                                                         \
-            app.printF("WARNING! Failed to get uniform var location for '%s'!", strName.c_str()); \
-        }                                                                                         \
-    } while (0)
+    ModelRenderData & rd = *renderData;
+
+    // Load vert+frag shaders:
+    rd.shaderProg.initFromFiles("source/shaders/normalmap.vert",  "source/shaders/normalmap.frag");
+    rd.shadowProg.initFromFiles("source/shaders/projshadow.vert", "source/shaders/projshadow.frag");
+    loadShaderUniforms(app, rd.shaderProg, rd.shadowProg, rd.shaderVars);
+
+    // Instanced drawing has no shadow variant. The shadow locations are just reloaded.
+    rd.instancedProg.initFromFiles("source/shaders/normalmap_instanced.vert", "source/shaders/normalmap.frag");
+    loadShaderUniforms(app, rd.instancedProg, rd.shadowProg, rd.instancedShaderVars);
+
+    if (!rd.instancedProg.setUniformBlockBinding("InstanceMatrices", InstanceBufferBinding))
+    {
+        app.printF("WARNING! Instanced shader is missing the instance matrices block!");
+    }
+
+    if (!rd.gpuSkinning)
+    {
+        return;
+    }
+
+    // GPU skinning variants, with the same fragment shaders. The skinned position
+    // can be captured with transform feedback, see measureGpuSkinningError().
+    rd.skinnedProg.setFeedbackVaryings({ "v_VertexPosModelSpace" });
+    rd.skinnedProg.initFromFiles("source/shaders/normalmap_skinned.vert",  "source/shaders/normalmap.frag");
+    rd.skinnedShadowProg.initFromFiles("source/shaders/projshadow_skinned.vert", "source/shaders/projshadow.frag");
+    loadShaderUniforms(app, rd.skinnedProg, rd.skinnedShadowProg, rd.skinnedShaderVars);
+
+    rd.skinnedInstancedProg.initFromFiles("source/shaders/normalmap_skinned_instanced.vert", "source/shaders/normalmap.frag");
+    loadShaderUniforms(app, rd.skinnedInstancedProg, rd.skinnedShadowProg, rd.skinnedInstancedShaderVars);
+
+    if (!rd.skinnedProg.setUniformBlockBinding("JointMatrices", JointsBufferBinding) ||
+        !rd.skinnedShadowProg.setUniformBlockBinding("JointMatrices", JointsBufferBinding) ||
+        !rd.skinnedInstancedProg.setUniformBlockBinding("JointMatrices", JointsBufferBinding) ||
+        !rd.skinnedInstancedProg.setUniformBlockBinding("InstanceMatrices", InstanceBufferBinding))
+    {
+        app.printF("WARNING! GPU skinning shaders are missing the joints block. GPU skinning disabled.");
+        rd.gpuSkinning = false;
+    }
+}
+
+void AnimatedEntity::loadShaderUniforms(GLFWApp & app, GLShaderProg & prog, GLShaderProg & shadow, ShaderUniforms & vars)
+{
+#define GET_UNIFORM_LOC(locName, unifName)                                                        \
+    do                                                                                            \
+    {                                                                                             \
+        const char * strName = (unifName);                                                        \
+        vars.locName = prog.getUniformLocation(strName);                                          \
+        if (vars.locName < 0)                                                                     \
+        {                                                                                         \
+            app.printF("WARNING! Failed to get uniform var location for '%s'!", strName);         \
+        }                                                                                         \
+    } while (0)
+
+// Array element names are formatted into a stack buffer, no string allocations.
+#define GET_UNIFORM_ARRAY_LOC(locName, unifName, index)                                           \
+    do                                                                                            \
+    {                                                                                             \
+        char elementName[128];                                                                    \
+        std::snprintf(elementName, sizeof(elementName), "%s[%i]", (unifName), (index));           \
+        GET_UNIFORM_LOC(locName, elementName);                                                    \
+    } while (0)
+
+    // Shadow shader parameters:
+    vars.shadowMvpMatrixLoc = shadow.getUniformLocation("u_MvpMatrix");
+    vars.shadowLightPosLoc  = shadow.getUniformLocation("u_LightPosModelSpace");
+    vars.shadowParamsLoc    = shadow.getUniformLocation("u_ShadowParams");
+
+    // Store the uniform var locations:
+    GET_UNIFORM_LOC(mvpMatrixLoc       , "u_MvpMatrix");
+    GET_UNIFORM_LOC(eyePosModelSpaceLoc, "u_EyePosModelSpace");
+    GET_UNIFORM_LOC(baseTextureLoc     , "u_BaseTexture");
+    GET_UNIFORM_LOC(normalTextureLoc   , "u_NormalTexture");
+    GET_UNIFORM_LOC(specularTextureLoc , "u_SpecularTexture");
+    GET_UNIFORM_LOC(shininessLoc       , "u_MatShininess");
+    GET_UNIFORM_LOC(ambientColorLoc    , "u_MatAmbientColor");
+    GET_UNIFORM_LOC(diffuseColorLoc    , "u_MatDiffuseColor");
+    GET_UNIFORM_LOC(specularColorLoc   , "u_MatSpecularColor");
+    GET_UNIFORM_LOC(emissiveColorLoc   , "u_MatEmissiveColor");
+    GET_UNIFORM_LOC(numOfLightsLoc     , "u_NumOfLights");
+
+    // If not all lights are used by the shader, we should get invalid handles.
+    for (int l = 0; l < MaxLights; ++l)
+    {
+        GET_UNIFORM_ARRAY_LOC(lightTypeLoc[l]             , "u_LightType"             , l);
+        GET_UNIFORM_ARRAY_LOC(lightPosModelSpaceLoc[l]    , "u_LightPosModelSpace"    , l);
+        GET_UNIFORM_ARRAY_LOC(lightAttenConstLoc[l]       , "u_LightAttenConst"       , l);
+        GET_UNIFORM_ARRAY_LOC(lightAttenLinearLoc[l]      , "u_LightAttenLinear"      , l);
+        GET_UNIFORM_ARRAY_LOC(lightAttenQuadraticLoc[l]   , "u_LightAttenQuadratic"   , l);
+        GET_UNIFORM_ARRAY_LOC(lightColorLoc[l]            , "u_LightColor"            , l);
+        GET_UNIFORM_ARRAY_LOC(lightProjectionMatrixLoc[l] , "u_LightProjectionMatrix" , l);
+        GET_UNIFORM_ARRAY_LOC(lightCookieTextureLoc[l]    , "u_LightCookieTexture"    , l);
+    }
+
+    // Set the texture units, these won't change:
+    prog.bind();
+    prog.setUniform1i(vars.numOfLightsLoc,     0); // Set to zero for safety.
+    prog.setUniform1i(vars.baseTextureLoc,     MaterialInstance::TMU_Base);
+    prog.setUniform1i(vars.normalTextureLoc,   MaterialInstance::TMU_Normal);
+    prog.setUniform1i(vars.specularTextureLoc, MaterialInstance::TMU_Specular);
+
+    // Light cookie textures follow the model texture on TMU #3
+    for (int l = 0; l < MaxLights; ++l)
+    {
+        prog.setUniform1i(vars.lightCookieTextureLoc[l], MaterialInstance::TMU_Last + 1);
+    }
+
+    CHECK_GL_ERRORS(&app);
+
+#undef GET_UNIFORM_ARRAY_LOC
+#undef GET_UNIFORM_LOC
+}
+
+bool g_bParallelAnimLoading = true;
+bool g_bSimdSkinning = true;
+bool g_bGpuSkinning  = false;
+bool g_bSkinnedTangents = false;
+
+void AnimatedEntity::loadAnimations(GLFWApp & app, const std::vector<std::string> & animFiles)
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    const int numFiles = static_cast<int>(animFiles.size());
+
+    // Each file is independent, so they are loaded and checked against the model
+    // concurrently. Errors are stored and rethrown here, on the calling thread.
+    // Animations already resident in the ResourceCache are shared, not reloaded.
+    std::vector<std::shared_ptr<const AnimInstance>> loaded(numFiles);
+    std::vector<std::exception_ptr> errors(numFiles);
+    std::vector<char> valid(numFiles, 0);
+    std::vector<char> shared(numFiles, 0);
+
+    auto loadAnim = [this, &animFiles, &loaded, &errors, &valid, &shared](const int i)
+    {
+        try
+        {
+            bool wasResident = false;
+            loaded[i] = getResourceCache().loadAnimation(animFiles[i], &wasResident);
+            valid[i]  = checkAnimationValidity(*loaded[i]);
+            shared[i] = wasResident;
+        }
+        catch (...)
+        {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    WorkerPool & workerPool = getWorkerPool();
+    if (g_bParallelAnimLoading)
+    {
+        workerPool.parallelFor(numFiles, loadAnim);
+    }
+    else
+    {
+        for (int i = 0; i < numFiles; ++i)
+        {
+            loadAnim(i);
+        }
+    }
+
+    // Inserted in the order given, so the result doesn't depend on thread timing.
+    std::size_t totalBytes = 0;
+    std::size_t numBaked   = 0;
+    int numShared          = 0;
+    double totalLoadMs     = 0.0;
+
+    for (int i = 0; i < numFiles; ++i)
+    {
+        if (errors[i])
+        {
+            std::rethrow_exception(errors[i]);
+        }
+
+        const auto & animName = animFiles[i];
+        auto result = animations->emplace(animName, std::move(loaded[i]));
+        const auto anim = result.first->second.get();
+
+        if (result.second == false)
+        {
+            throw std::runtime_error{ "AnimMap name collision! " + animName };
+        }
+        if (!valid[i])
+        {
+            app.printF("WARNING! Animation \"%s\" is not compatible with the entity's model!", animName.c_str());
+            // Allow it to proceed. Will likely crash when attempting to use the animation...
+        }
+        if (shared[i])
+        {
+            ++numShared;
+            continue;
+        }
+
+        app.printF("DOOM 3 animation instance \"%s\" loaded. "
+                   "Frames: %i, joints: %i, fps: %i, playback: %fs, duration: %fs. %s in %.2fms.",
+                   animName.c_str(), anim->getNumFrames(), anim->getNumJoints(),
+                   anim->getFrameRate(), anim->getPlaybackSeconds(), anim->getDurationSeconds(),
+                   (anim->isFromBakedCache() ? "Baked cache" : "Parsed"), anim->getLoadTimeMs());
+
+        totalBytes  += anim->getSourceSizeBytes();
+        totalLoadMs += anim->getLoadTimeMs();
+        numBaked    += anim->isFromBakedCache() ? 1 : 0;
+    }
+
+    if (numShared > 0)
+    {
+        app.printF("%i of %i animations shared from the resource cache.", numShared, numFiles);
+    }
+    if (numFiles > numShared)
+    {
+        const double wallTimeMs = millisecondsSince(startTime);
+        app.printF("Loaded %i animations (%zu from the baked cache), %.2f MB of source text in %.2fms "
+                   "using %i thread(s). Sum of per-file load times: %.2fms.",
+                   numFiles - numShared, numBaked, totalBytes / (1024.0 * 1024.0), wallTimeMs,
+                   (g_bParallelAnimLoading ? workerPool.getNumThreads() : 1), totalLoadMs);
+    }
+}
+
+void AnimatedEntity::setUpInitialVertexArray(GLFWApp & app)
+{
+    const auto & meshes = model->getMeshes();
+    bindPose.setFromJoints(model->getJoints());
+
+    for (const auto & mesh : meshes)
+    {
+        animateMesh(mesh, bindPose, &finalVerts, &finalIndexes);
+    }
+    skinningMatrices.resize(bindPose.getNumJoints() * SkinningMatrixFloats);
+    normalMatrices.resize(bindPose.getNumJoints() * SkinningMatrixFloats);
+
+    assert(!finalVerts.empty());
+    assert(!finalIndexes.empty());
+
+    if (renderData->tangentSolver == nullptr)
+    {
+        renderData->tangentSolver.reset(new TangentSpaceSolver{ meshes.back(), finalVerts.data(),
+                                                                finalIndexes.data(), static_cast<int>(finalIndexes.size()) });
+
+        // Sphere around the center of the bind pose box. Animations stretch the limbs
+        // and move the model around its origin, so the radius gets some slack.
+        Point3 mins{  FLT_MAX,  FLT_MAX,  FLT_MAX };
+        Point3 maxs{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (const auto & vert : finalVerts)
+        {
+            const Point3 pos{ vert.px, vert.py, vert.pz };
+            mins = minPerElem(mins, pos);
+            maxs = maxPerElem(maxs, pos);
+        }
+
+        float radiusSqr = 0.0f;
+        const Point3 center = lerp(0.5f, mins, maxs);
+        for (const auto & vert : finalVerts)
+        {
+            radiusSqr = std::max(radiusSqr, static_cast<float>(distSqr(center, Point3{ vert.px, vert.py, vert.pz })));
+        }
+        renderData->bindPoseBounds = { mins, maxs };
+        renderData->boundsCenter   = center;
+        renderData->boundsRadius   = std::sqrt(radiusSqr) * 1.25f;
+    }
+
+    // Generate the dynamic per-vertex data:
+    renderData->tangentSolver->derive(finalVerts.data(), tangentScratch);
+
+    // We'll use this to store intermediate poses of animation.
+    // The model's skeleton/joint-set remains with the bind pose.
+    currPose = bindPose;
+
+    // Set up the static GL vertex array:
+    vertArray.initFromData(finalVerts.data(),   finalVerts.size(),
+                           finalIndexes.data(), finalIndexes.size(),
+                           GL_DYNAMIC_DRAW, GLVertexLayout::Triangles);
+
+    if (renderData->gpuSkinning)
+    {
+        setUpGpuSkinning(app);
+    }
+}
+
+void AnimatedEntity::setUpGpuSkinning(GLFWApp & app)
+{
+    // The weighted vertexes are set up once, by the first entity of the model.
+    // Like the CPU path, which replaces the vertexes of each mesh, this takes the last one.
+    if (!renderData->skinnedVertArray.isInitialized())
+    {
+        std::vector<GLSkinnedVertex> skinnedVerts;
+        const int numReduced = buildGpuSkinningVertexes(model->getMeshes().back(), bindPose,
+                                                        finalVerts.data(), &skinnedVerts);
+
+        renderData->skinnedVertArray.initFromData(nullptr, 0, finalIndexes.data(), finalIndexes.size(),
+                                       GL_STATIC_DRAW, GLVertexLayout::SkinnedTriangles);
+        renderData->skinnedVertArray.bindVA();
+        renderData->skinnedVertArray.bindVB();
+        renderData->skinnedVertArray.updateRawData(skinnedVerts.data(), skinnedVerts.size(), sizeof(GLSkinnedVertex), nullptr, 0, 0);
+        renderData->skinnedVertArray.bindNull();
+
+        app.printF("GPU skinning vertexes ready: %zu verts, %d with more than %d weights merged.",
+                   skinnedVerts.size(), numReduced, GLSkinnedVertex::MaxWeights);
+    }
+
+    // Joints buffer starts with the bind pose, in case we draw before the first update.
+    buildSkinningMatrices(bindPose, ModelScale, skinningMatrices.data());
+    buildSkinningNormalMatrices(bindPose, bindPose, normalMatrices.data());
+
+    jointsBuffer.initWithSize(JointNormalMatricesOffset * 2, nullptr, GL_DYNAMIC_DRAW);
+    uploadJointMatrices();
+}
+
+void AnimatedEntity::uploadJointMatrices()
+{
+    const int sizeBytes = static_cast<int>(skinningMatrices.size() * sizeof(float));
+
+    jointsBuffer.bind();
+    jointsBuffer.updateRange(0, sizeBytes, skinningMatrices.data());
+    jointsBuffer.updateRange(JointNormalMatricesOffset, sizeBytes, normalMatrices.data());
+    GLUniformBuffer::bindNull();
+}
+
+bool AnimatedEntity::checkAnimationValidity(const AnimInstance & anim) const
+{
+    // md5mesh and md5anim must have the same joints, with the same names and parents.
+    // The skeletons are interned, so for a matching pair this is just a pointer test.
+    return anim.getNumJoints() == model->getSkeleton().getNumJoints() &&
+           model->getSkeleton().isCompatible(anim.getSkeleton());
+}
+
+void AnimatedEntity::animateMesh(const Mesh & mesh,
+                                 const Pose & pose,
+                                 std::vector<GLDrawVertex>  * vertsOut,
+                                 std::vector<GLDrawIndex32> * indexesOut)
+{
+    if (indexesOut != nullptr)
+    {
+        indexesOut->clear();
+        indexesOut->reserve(mesh.triangles.size() * 3);
 
-    // Load vert+frag shaders:
-    shaderProg.initFromFiles("source/shaders/normalmap.vert",  "source/shaders/normalmap.frag");
-    shadowProg.initFromFiles("source/shaders/projshadow.vert", "source/shaders/projshadow.frag");
+        // Triangle indexes are copied as is:
+        for (const auto & tri : mesh.triangles)
+        {
+            indexesOut->push_back(tri.index[0]);
+            indexesOut->push_back(tri.index[1]);
+            indexesOut->push_back(tri.index[2]);
+        }
+    }
 
-    // Shadow shader parameters:
-    shaderVars.shadowMvpMatrixLoc = shadowProg.getUniformLocation("u_MvpMatrix");
-    shaderVars.shadowLightPosLoc  = shadowProg.getUniformLocation("u_LightPosModelSpace");
-    shaderVars.shadowParamsLoc    = shadowProg.getUniformLocation("u_ShadowParams");
+    if (vertsOut != nullptr)
+    {
+        vertsOut->clear();
 
-    // Store the uniform var locations:
-    GET_UNIFORM_LOC(mvpMatrixLoc       , "u_MvpMatrix");
-    GET_UNIFORM_LOC(eyePosModelSpaceLoc, "u_EyePosModelSpace");
-    GET_UNIFORM_LOC(baseTextureLoc     , "u_BaseTexture");
-    GET_UNIFORM_LOC(normalTextureLoc   , "u_NormalTexture");
-    GET_UNIFORM_LOC(specularTextureLoc , "u_SpecularTexture");
-    GET_UNIFORM_LOC(shininessLoc       , "u_MatShininess");
-    GET_UNIFORM_LOC(ambientColorLoc    , "u_MatAmbientColor");
-    GET_UNIFORM_LOC(diffuseColorLoc    , "u_MatDiffuseColor");
-    GET_UNIFORM_LOC(specularColorLoc   , "u_MatSpecularColor");
-    GET_UNIFORM_LOC(emissiveColorLoc   , "u_MatEmissiveColor");
-    GET_UNIFORM_LOC(numOfLightsLoc     , "u_NumOfLights");
+        // Build the final vertex position for the bind pose:
+        for (const auto & vert : mesh.vertexes)
+        {
+            Point3 finalVertexPos{ 0.0f, 0.0f, 0.0f };
 
-    // If not all lights are used by the shader, we should get invalid handles.
-    for (int l = 0; l < MaxLights; ++l)
+            // Calculate final vertex from joint+weights:
+            for (int w = 0; w < vert.weightCount; ++w)
+            {
+                const auto & weight      = mesh.weights[vert.firstWeight + w];
+                const float * jointRot   = &pose.rotations[weight.joint * 4];
+                const float * jointPos   = &pose.positions[weight.joint * 3];
+                const Quat jointOrient{ jointRot[0], jointRot[1], jointRot[2], jointRot[3] };
+
+                // Calculate transformed vertex for this weight:
+                const auto weightedVertexPos = quaternionRotatePoint(jointOrient, weight.pos);
+
+                // The sum of all weight biases should be 1.0!
+                finalVertexPos[0] += (jointPos[0] + weightedVertexPos[0]) * weight.bias;
+                finalVertexPos[1] += (jointPos[1] + weightedVertexPos[1]) * weight.bias;
+                finalVertexPos[2] += (jointPos[2] + weightedVertexPos[2]) * weight.bias;
+            }
+
+            // Swizzle Y-Z.
+            // idSoftware historically used this different axis layout.
+            GLDrawVertex drawVert;
+            drawVert.px = finalVertexPos[0] * ModelScale;
+            drawVert.py = finalVertexPos[2] * ModelScale;
+            drawVert.pz = finalVertexPos[1] * ModelScale;
+
+            // Texture coordinates:
+            drawVert.u = vert.u;
+            drawVert.v = vert.v;
+
+            // Default color:
+            drawVert.r = 1.0f;
+            drawVert.g = 1.0f;
+            drawVert.b = 1.0f;
+            drawVert.a = 1.0f;
+
+            vertsOut->push_back(drawVert);
+        }
+    }
+}
+
+void AnimatedEntity::interpolatePoses(const float * rotationsA, const float * positionsA,
+                                      const float * rotationsB, const float * positionsB,
+                                      const int numJoints, float interp, Pose & poseOut, const bool nlerp)
+{
+    assert(numJoints == poseOut.getNumJoints());
+
+    // Ensure between [0,1]:
+    interp = clamp(interp, 0.0f, 1.0f);
+
+    // Linear interpolation for position. The position stream is a flat
+    // array of floats, so this is a straight loop the compiler can vectorize:
+    float * positionsOut = poseOut.positions.data();
+    for (int i = 0; i < numJoints * 3; ++i)
     {
-        GET_UNIFORM_LOC(lightTypeLoc[l]             , "u_LightType["             + std::to_string(l) + "]");
-        GET_UNIFORM_LOC(lightPosModelSpaceLoc[l]    , "u_LightPosModelSpace["    + std::to_string(l) + "]");
-        GET_UNIFORM_LOC(lightAttenConstLoc[l]       , "u_LightAttenConst["       + std::to_string(l) + "]");
-        GET_UNIFORM_LOC(lightAttenLinearLoc[l]      , "u_LightAttenLinear["      + std::to_string(l) + "]");
-        GET_UNIFORM_LOC(lightAttenQuadraticLoc[l]   , "u_LightAttenQuadratic["   + std::to_string(l) + "]");
-        GET_UNIFORM_LOC(lightColorLoc[l]            , "u_LightColor["            + std::to_string(l) + "]");
-        GET_UNIFORM_LOC(lightProjectionMatrixLoc[l] , "u_LightProjectionMatrix[" + std::to_string(l) + "]");
-        GET_UNIFORM_LOC(lightCookieTextureLoc[l]    , "u_LightCookieTexture["    + std::to_string(l) + "]");
+        positionsOut[i] = positionsA[i] + (positionsB[i] - positionsA[i]) * interp;
     }
 
-    // Set the texture units, these won't change:
-    shaderProg.bind();
-    shaderProg.setUniform1i(shaderVars.numOfLightsLoc,     0); // Set to zero for safety.
-    shaderProg.setUniform1i(shaderVars.baseTextureLoc,     MaterialInstance::TMU_Base);
-    shaderProg.setUniform1i(shaderVars.normalTextureLoc,   MaterialInstance::TMU_Normal);
-    shaderProg.setUniform1i(shaderVars.specularTextureLoc, MaterialInstance::TMU_Specular);
+    float * rotationsOut = poseOut.rotations.data();
+    if (nlerp)
+    {
+        // Normalized linear interpolation: a straight blend along the shortest arc,
+        // renormalized. Not constant speed, but the keyframes are close together,
+        // so the difference to slerp is tiny and there's no trigonometry.
+        for (int j = 0; j < numJoints; ++j)
+        {
+            const float * ra = rotationsA + j * 4;
+            const float * rb = rotationsB + j * 4;
+            float * rotOut   = rotationsOut + j * 4;
+
+            const float sign = (((ra[0] * rb[0]) + (ra[1] * rb[1]) + (ra[2] * rb[2]) + (ra[3] * rb[3])) < 0.0f) ? -1.0f : 1.0f;
+            float q[4];
+            float lengthSqr = 0.0f;
+            for (int i = 0; i < 4; ++i)
+            {
+                q[i] = ra[i] + (rb[i] * sign - ra[i]) * interp;
+                lengthSqr += q[i] * q[i];
+            }
 
-    // Light cookie textures follow the model texture on TMU #3
-    for (int l = 0; l < MaxLights; ++l)
+            const float invLength = 1.0f / std::sqrt(lengthSqr);
+            for (int i = 0; i < 4; ++i)
+            {
+                rotOut[i] = q[i] * invLength;
+            }
+        }
+        return;
+    }
+
+    // Spherical Linear interpolation for orientation:
+    for (int j = 0; j < numJoints; ++j)
     {
-        shaderProg.setUniform1i(shaderVars.lightCookieTextureLoc[l], MaterialInstance::TMU_Last + 1);
+        const float * ra = rotationsA + j * 4;
+        const float * rb = rotationsB + j * 4;
+        float * rotOut   = rotationsOut + j * 4;
+
+#if defined(__SSE__)
+        // Rotations are 4 floats, so they move in and out of the SSE registers in one go.
+        const Quat orient = slerp(interp, Quat{ _mm_loadu_ps(ra) }, Quat{ _mm_loadu_ps(rb) });
+        _mm_storeu_ps(rotOut, orient.get128());
+#else // !__SSE__
+        const Quat orient = slerp(interp, Quat{ ra[0], ra[1], ra[2], ra[3] }, Quat{ rb[0], rb[1], rb[2], rb[3] });
+        rotOut[0] = orient.getX();
+        rotOut[1] = orient.getY();
+        rotOut[2] = orient.getZ();
+        rotOut[3] = orient.getW();
+#endif // __SSE__
     }
+}
 
-    CHECK_GL_ERRORS(&app);
+const AnimInstance * AnimatedEntity::findAnimation(const std::string & animName) const
+{
+    auto iter = animations->find(animName);
+    if (iter == std::end(*animations))
+    {
+        return nullptr;
+    }
+    return iter->second.get();
+}
 
-#undef GET_UNIFORM_LOC
+void AnimatedEntity::setAnimation(const std::string & animName)
+{
+    const auto anim = findAnimation(animName);
+    if (anim == nullptr)
+    {
+        throw std::runtime_error{ "Animation \"" + animName + "\" doesn't belong to this entity!" };
+    }
+    setAnimation(anim);
 }
 
-void AnimatedEntity::loadAnimations(GLFWApp & app, const std::vector<std::string> & animFiles)
+void AnimatedEntity::setAnimation(const AnimInstance * anim)
 {
-    for (const auto & animName : animFiles)
+    // Snaps, so any crossfade is dropped. The additive layer stays.
+    if (blendState != nullptr)
     {
-        std::unique_ptr<const AnimInstance> newAnim{ new AnimInstance{ animName } };
-        auto result = animations.emplace(animName, std::move(newAnim));
-        const auto anim = result.first->second.get();
+        blendState->fadeAnim = nullptr;
+    }
 
-        if (result.second == false)
+    animTimeSec = 0.0;
+    currAnim    = anim;
+    currVertexCache = (vertexAnimCaching ? findVertexAnimCache(anim) : nullptr);
+
+    // Passing a null animation implicitly restores the bind-pose. Done last, so the
+    // skinning can't take the vertex cache of the previous animation. Skinned directly,
+    // since updateModelPose() is a no-op without an animation.
+    if (anim == nullptr)
+    {
+        currPose = bindPose;
+        currPoseSkipped = false;
+        skinModelPose();
+        uploadModelPose();
+    }
+}
+
+void AnimatedEntity::crossfadeToAnimation(const AnimInstance * anim, const double fadeSeconds)
+{
+    if (currAnim == nullptr || anim == nullptr || fadeSeconds <= 0.0)
+    {
+        setAnimation(anim);
+        return;
+    }
+
+    BlendState & blend    = getBlendState();
+    blend.fadeAnim        = currAnim;
+    blend.fadeTimeSec     = animTimeSec;
+    blend.fadeElapsedSec  = 0.0;
+    blend.fadeDurationSec = fadeSeconds;
+
+    animTimeSec = 0.0;
+    currAnim    = anim;
+    currVertexCache = (vertexAnimCaching ? findVertexAnimCache(anim) : nullptr);
+}
+
+void AnimatedEntity::setAdditiveLayer(const AnimInstance * anim, const float weight, std::vector<float> jointMask)
+{
+    if (anim == nullptr)
+    {
+        if (blendState != nullptr)
         {
-            throw std::runtime_error{ "AnimMap name collision! " + animName };
+            blendState->layerAnim = nullptr;
+            blendState->layerMask.clear();
         }
+        return;
+    }
 
-        app.printF("DOOM 3 animation instance \"%s\" loaded. "
-                   "Frames: %i, joints: %i, fps: %i, playback: %fs, duration: %fs.",
-                   animName.c_str(), anim->getNumFrames(), anim->getNumJoints(),
-                   anim->getFrameRate(), anim->getPlaybackSeconds(), anim->getDurationSeconds());
+    BlendState & blend = getBlendState();
+    blend.layerAnim    = anim;
+    blend.layerTimeSec = 0.0;
+    blend.layerWeight  = weight;
+    blend.layerMask    = std::move(jointMask);
+    assert(blend.layerMask.empty() || static_cast<int>(blend.layerMask.size()) >= blend.layerReference.stride);
+
+    // The deltas are relative to the first frame of the layer.
+    anim->sample(0.0, AnimLoopMode::Clamp, blend.sourcePose);
+    poseToJointSpace(blend.sourcePose, model->getSkeleton(), blend.layerReference);
+}
+
+AnimatedEntity::BlendState & AnimatedEntity::getBlendState()
+{
+    if (blendState == nullptr)
+    {
+        blendState.reset(new BlendState{});
+        blendState->sourcePose.resize(model->getSkeleton().getNumJoints());
+        blendState->layerReference.resize(model->getSkeleton().getNumJoints());
+    }
+    return *blendState;
+}
+
+void AnimatedEntity::blendCurrentPose(const bool nlerp)
+{
+    BlendState & blend = *blendState;
+    const Skeleton & skeleton = model->getSkeleton();
+
+    poseToJointSpace(currPose, skeleton, blend.blendedJoints);
+
+    if (blend.fadeAnim != nullptr)
+    {
+        // Linear weight from the outgoing animation to the current one.
+        const float weight = static_cast<float>(blend.fadeElapsedSec / blend.fadeDurationSec);
+        blend.fadeAnim->sample(blend.fadeTimeSec, loopMode, blend.sourcePose, nlerp);
+        poseToJointSpace(blend.sourcePose, skeleton, blend.sourceJoints);
+        blendPoses(blend.sourceJoints, blend.blendedJoints, weight, nullptr, blend.blendedJoints);
+    }
 
-        if (!checkAnimationValidity(*anim))
+    if (blend.layerAnim != nullptr)
+    {
+        const float * mask = blend.layerMask.empty() ? nullptr : blend.layerMask.data();
+        blend.layerAnim->sample(blend.layerTimeSec, AnimLoopMode::Loop, blend.sourcePose, nlerp);
+        poseToJointSpace(blend.sourcePose, skeleton, blend.sourceJoints);
+        makeAdditivePose(blend.sourceJoints, blend.layerReference, blend.sourceJoints);
+        addPoseLayer(blend.blendedJoints, blend.sourceJoints, blend.layerWeight, mask, blend.blendedJoints);
+    }
+
+    poseToModelSpace(blend.blendedJoints, skeleton, currPose);
+}
+
+void AnimatedEntity::setVertexAnimCache(const bool enable)
+{
+    vertexAnimCaching = enable;
+    if (enable)
+    {
+        // Drop the caches of the clips freed since the last bake.
+        auto & caches = renderData->vertexAnimCaches;
+        for (auto iter = std::begin(caches); iter != std::end(caches);)
         {
-            app.printF("WARNING! Animation \"%s\" is not compatible with the entity's model!", animName.c_str());
-            // Allow it to proceed. Will likely crash when attempting to use the animation...
+            iter = (iter->second.anim.expired() ? caches.erase(iter) : std::next(iter));
+        }
+
+        for (const auto & entry : *animations)
+        {
+            if (findVertexAnimCache(entry.second.get()) == nullptr && checkAnimationValidity(*entry.second))
+            {
+                bakeVertexAnimCache(entry.second);
+            }
+        }
+    }
+    currVertexCache = (enable ? findVertexAnimCache(currAnim) : nullptr);
+}
+
+const VertexAnimCache * AnimatedEntity::findVertexAnimCache(const AnimInstance * anim) const
+{
+    // An expired entry belongs to a freed clip, not to one allocated at the same address since.
+    const auto iter = renderData->vertexAnimCaches.find(anim);
+    if (iter == std::end(renderData->vertexAnimCaches) || iter->second.anim.expired())
+    {
+        return nullptr;
+    }
+    return iter->second.cache.get();
+}
+
+void AnimatedEntity::bakeVertexAnimCache(const std::shared_ptr<const AnimInstance> & animRef)
+{
+    const AnimInstance & anim = *animRef;
+
+    // Each frame exactly as the live skinning would show it, with the derived tangent basis.
+    // The skinning and tangent data of the last mesh, like the TangentSpaceSolver.
+    const SkinningBatches & skinning = renderData->meshSkinning.back();
+    const TangentSpaceSolver & solver = *renderData->tangentSolver;
+
+    const int numFrames   = anim.getNumFrames();
+    const int numJoints   = anim.getNumJoints();
+    const int numVertexes = solver.getNumVertexes();
+
+    Pose framePose;
+    framePose.resize(numJoints);
+    std::vector<float> matrices(numJoints * SkinningMatrixFloats);
+    std::vector<GLDrawVertex> frameVerts(static_cast<std::size_t>(numFrames) * numVertexes, finalVerts.back());
+    TangentSpaceSolver::Scratch scratch;
+
+    for (int f = 0; f < numFrames; ++f)
+    {
+        GLDrawVertex * verts = frameVerts.data() + static_cast<std::size_t>(f) * numVertexes;
+        std::copy_n(anim.getFrameRotations(f), numJoints * 4, framePose.rotations.data());
+        std::copy_n(anim.getFramePositions(f), numJoints * 3, framePose.positions.data());
+
+        buildSkinningMatrices(framePose, ModelScale, matrices.data());
+        skinning.skin(matrices.data(), verts);
+        solver.derive(verts, scratch);
+    }
+
+    ModelRenderData::VertexAnimCacheEntry & entry = renderData->vertexAnimCaches[&anim];
+    entry.anim = animRef;
+    entry.cache.reset(new VertexAnimCache{ frameVerts.data(), numFrames, numVertexes });
+}
+
+int AnimatedEntity::updateAnimation(const double elapsedTimeSeconds)
+{
+    if (currAnim == nullptr)
+    {
+        return 0;
+    }
+
+    const int loopCount = advanceAnimation(elapsedTimeSeconds);
+    refreshCurrentPose();
+
+    // Caller can use this to test if the animation has completed.
+    return loopCount;
+}
+
+int AnimatedEntity::advanceAnimation(const double elapsedTimeSeconds)
+{
+    if (currAnim == nullptr)
+    {
+        return 0;
+    }
+
+    animTimeSec += elapsedTimeSeconds;
+    if (blendState != nullptr)
+    {
+        BlendState & blend = *blendState;
+        blend.layerTimeSec += elapsedTimeSeconds;
+        if (blend.fadeAnim != nullptr)
+        {
+            blend.fadeTimeSec    += elapsedTimeSeconds;
+            blend.fadeElapsedSec += elapsedTimeSeconds;
+            if (blend.fadeElapsedSec >= blend.fadeDurationSec)
+            {
+                blend.fadeAnim = nullptr;
+            }
         }
     }
+    return currAnim->locate(animTimeSec, loopMode).loopCount;
+}
+
+void AnimatedEntity::sampleCurrentPose(const bool nlerp)
+{
+    if (currAnim == nullptr)
+    {
+        return;
+    }
+
+    currAnim->sample(animTimeSec, loopMode, currPose, nlerp);
+    currPoseSkipped = false;
+    if (isBlending())
+    {
+        blendCurrentPose(nlerp);
+    }
+}
+
+void AnimatedEntity::refreshCurrentPose(const bool nlerp)
+{
+    // Same test as skinModelPose() for taking the vertex cache.
+    if (currAnim != nullptr && currVertexCache != nullptr && !isBlending() && !usingGpuSkinning())
+    {
+        currPoseSkipped = true;
+        currPoseNlerp   = nlerp;
+        return;
+    }
+    sampleCurrentPose(nlerp);
+}
+
+void AnimatedEntity::sampleSkippedPose()
+{
+    if (currPoseSkipped)
+    {
+        sampleCurrentPose(currPoseNlerp);
+    }
+}
+
+bool AnimatedEntity::updateWithLod(const double elapsedTimeSeconds, const AnimLod lod, const AnimLodPolicy & policy)
+{
+    if (currAnim == nullptr)
+    {
+        return false;
+    }
+
+    advanceAnimation(elapsedTimeSeconds);
+
+    // Frozen entities keep counting, so they are due as soon as they get a level that updates.
+    const AnimLodPolicy::Level & level = policy.levels[static_cast<int>(lod)];
+    if (lodFramesSinceUpdate < INT_MAX)
+    {
+        ++lodFramesSinceUpdate;
+    }
+    if (level.updateInterval <= 0 || (level.updateInterval > 1 && lodFramesSinceUpdate < level.updateInterval))
+    {
+        return false;
+    }
+
+    lodFramesSinceUpdate = 0;
+    refreshCurrentPose(level.nlerp);
+    skinModelPose(level.deriveTangents && !g_bSkinnedTangents);
+    return true;
+}
+
+int AnimatedEntity::nextLodPhase() noexcept
+{
+    // Entities are created on the render thread, so no need for an atomic.
+    static int counter = 0;
+    return -(counter++ & 3);
+}
+
+double AnimatedEntity::getAnimTimeSeconds() const noexcept
+{
+    if (currAnim == nullptr)
+    {
+        return 0.0;
+    }
+    const AnimSamplePoint point = currAnim->locate(animTimeSec, loopMode);
+    return (point.frameA + point.interp) * currAnim->getDurationSeconds();
+}
+
+int AnimatedEntity::getCurrentAnimFrame() const noexcept
+{
+    return (currAnim != nullptr) ? currAnim->locate(animTimeSec, loopMode).frameA : 0;
 }
 
-void AnimatedEntity::setUpInitialVertexArray()
+int AnimatedEntity::getAnimLoopCount() const noexcept
 {
-    const auto & meshes = model.getMeshes();
-    const auto & joints = model.getJoints();
+    return (currAnim != nullptr) ? currAnim->locate(animTimeSec, loopMode).loopCount : 0;
+}
 
-    for (const auto & mesh : meshes)
+BoundingBox AnimatedEntity::getAnimationBounds() const noexcept
+{
+    if (currAnim == nullptr)
     {
-        animateMesh(mesh, joints, &finalVerts, &finalIndexes);
+        return renderData->bindPoseBounds;
     }
 
-    assert(!finalVerts.empty());
-    assert(!finalIndexes.empty());
+    const AnimSamplePoint point = currAnim->locate(animTimeSec, loopMode);
+    const BoundingBox & curr = currAnim->getBoundsForFrame(point.frameA);
+    const BoundingBox & next = currAnim->getBoundsForFrame(point.frameB);
+    const Point3 mins = scale(minPerElem(curr.mins, next.mins), ModelScale);
+    const Point3 maxs = scale(maxPerElem(curr.maxs, next.maxs), ModelScale);
 
-    // Generate the dynamic per-vertex data:
-    deriveNormalsAndTangents(finalVerts.data(),   finalVerts.size(),
-                             finalIndexes.data(), finalIndexes.size(),
-                             finalVerts.data());
+    // Same Y-Z swap as animateMesh().
+    return { Point3{ mins[0], mins[2], mins[1] },
+             Point3{ maxs[0], maxs[2], maxs[1] } };
+}
 
-    // We'll use this to store intermediate joint frames of animation.
-    // The model's skeleton/joint-set remains with the bind pose.
-    currSkeleton = joints;
+bool AnimatedEntity::isInFrustum(const Frustum & frustum, const Mat4 & modelMatrix) const
+{
+    // Box around the transformed box: the center goes through the matrix and the
+    // half extents through the absolute value of its rotation and scale part.
+    const BoundingBox bounds = getAnimationBounds();
+    const Vec3 center  = Vec3{ lerp(0.5f, bounds.mins, bounds.maxs) };
+    const Vec3 extents = (bounds.maxs - bounds.mins) * 0.5f;
 
-    // Set up the static GL vertex array:
-    vertArray.initFromData(finalVerts.data(),   finalVerts.size(),
-                           finalIndexes.data(), finalIndexes.size(),
-                           GL_DYNAMIC_DRAW, GLVertexLayout::Triangles);
+    const Mat3 rotationScale = modelMatrix.getUpper3x3();
+    const Vec3 newCenter  = rotationScale * center + modelMatrix.getTranslation();
+    const Vec3 newExtents = absPerElem(rotationScale) * extents;
+
+    return frustum.testAabb(newCenter - newExtents, newCenter + newExtents);
 }
 
-bool AnimatedEntity::checkAnimationValidity(const AnimInstance & anim) const
+void AnimatedEntity::updateModelPose()
 {
-    const auto & modelJoints = model.getJoints();
-
-    // md5mesh and md5anim must have the same number of joints.
-    if (modelJoints.size() != static_cast<unsigned>(anim.getNumJoints()))
+    if (currAnim == nullptr)
     {
-        return false;
+        return;
     }
 
-    // Only frame[0] of the animation is actually tested, to keep things simple and fast.
-    for (std::size_t i = 0; i < modelJoints.size(); ++i)
-    {
-        // Joints must have the same parent index:
-        if (modelJoints[i].parent != anim.getJointsForFrame(0)[i].parent)
-        {
-            return false;
-        }
-
-        // Joints must have the same name:
-        if (modelJoints[i].name != anim.getJointsForFrame(0)[i].name)
-        {
-            return false;
-        }
-    }
+    skinModelPose();
+    uploadModelPose();
+}
 
-    return true; // Compatible.
+void AnimatedEntity::skinModelPose()
+{
+    skinModelPose(!g_bSkinnedTangents);
 }
 
-void AnimatedEntity::animateMesh(const Mesh & mesh,
-                                 const std::vector<Joint>  & skelJoints,
-                                 std::vector<GLDrawVertex> * vertsOut,
-                                 std::vector<GLDrawIndex>  * indexesOut)
+void AnimatedEntity::skinModelPose(const bool deriveTangents)
 {
-    if (indexesOut != nullptr)
+    if (usingGpuSkinning())
     {
-        indexesOut->clear();
-        indexesOut->reserve(mesh.triangles.size() * 3);
+        // The vertex shader does the rest.
+        sampleSkippedPose();
+        buildSkinningMatrices(currPose, ModelScale, skinningMatrices.data());
+        buildSkinningNormalMatrices(currPose, bindPose, normalMatrices.data());
+        return;
+    }
 
-        // Triangle indexes are copied as is:
-        for (const auto & tri : mesh.triangles)
+    if (currVertexCache != nullptr && !isBlending())
+    {
+        // Baked frames: just a blend, no weights or tangent basis to compute.
+        const AnimSamplePoint point = currAnim->locate(animTimeSec, loopMode);
+        currVertexCache->sample(point.frameA, point.frameB, point.interp, finalVerts.data());
+        return;
+    }
+
+    sampleSkippedPose();
+    const auto & meshes = model->getMeshes();
+    if (g_bSimdSkinning)
+    {
+        buildSkinningMatrices(currPose, ModelScale, skinningMatrices.data());
+        for (std::size_t m = 0; m < meshes.size(); ++m)
         {
-            indexesOut->push_back(tri.index[0]);
-            indexesOut->push_back(tri.index[1]);
-            indexesOut->push_back(tri.index[2]);
+            // Like animateMesh(), each mesh replaces the vertexes. The size only
+            // changes with multiple meshes, so normally there's no reallocation.
+            finalVerts.resize(meshes[m].vertexes.size());
+            renderData->meshSkinning[m].skin(skinningMatrices.data(), finalVerts.data());
         }
     }
-
-    if (vertsOut != nullptr)
+    else
     {
-        vertsOut->clear();
-
-        // Build the final vertex position for the bind pose:
-        for (const auto & vert : mesh.vertexes)
+        for (const auto & mesh : meshes)
         {
-            Point3 finalVertexPos{ 0.0f, 0.0f, 0.0f };
-
-            // Calculate final vertex from joint+weights:
-            for (int w = 0; w < vert.weightCount; ++w)
-            {
-                const auto & weight = mesh.weights[vert.firstWeight + w];
-                const auto & joint  = skelJoints[weight.joint];
-
-                // Calculate transformed vertex for this weight:
-                const auto weightedVertexPos = quaternionRotatePoint(joint.orient, weight.pos);
-
-                // The sum of all weight biases should be 1.0!
-                finalVertexPos[0] += (joint.pos[0] + weightedVertexPos[0]) * weight.bias;
-                finalVertexPos[1] += (joint.pos[1] + weightedVertexPos[1]) * weight.bias;
-                finalVertexPos[2] += (joint.pos[2] + weightedVertexPos[2]) * weight.bias;
-            }
-
-            // Swizzle Y-Z.
-            // idSoftware historically used this different axis layout.
-            GLDrawVertex drawVert;
-            drawVert.px = finalVertexPos[0] * ModelScale;
-            drawVert.py = finalVertexPos[2] * ModelScale;
-            drawVert.pz = finalVertexPos[1] * ModelScale;
-
-            // Texture coordinates:
-            drawVert.u = vert.u;
-            drawVert.v = vert.v;
-
-            // Default color:
-            drawVert.r = 1.0f;
-            drawVert.g = 1.0f;
-            drawVert.b = 1.0f;
-            drawVert.a = 1.0f;
-
-            vertsOut->push_back(drawVert);
+            animateMesh(mesh, currPose, &finalVerts, nullptr);
         }
     }
-}
-
-void AnimatedEntity::interpolateSkeletons(const Joint * skelA, const Joint * skelB,
-                                          const int numJoints, float interp,
-                                          std::vector<Joint> & skelOut)
-{
-    assert(static_cast<unsigned>(numJoints) == skelOut.size());
-
-    // Ensure between [0,1]:
-    interp = clamp(interp, 0.0f, 1.0f);
 
-    for (int j = 0; j < numJoints; ++j)
+    // Generate the dynamic per-vertex data. No WorkerPool here, since
+    // updateCrowd() already runs this for several entities on the pool.
+    if (!deriveTangents)
     {
-        skelOut[j].parent = skelA[j].parent;
-
-        // Linear interpolation for position:
-        skelOut[j].pos = lerp(interp, skelA[j].pos, skelB[j].pos);
-
-        // Spherical Linear interpolation for orientation:
-        skelOut[j].orient = slerp(interp, skelA[j].orient, skelB[j].orient);
+        buildSkinningNormalMatrices(currPose, bindPose, normalMatrices.data());
+        renderData->tangentSolver->skinBindPose(normalMatrices.data(), finalVerts.data());
+    }
+    else
+    {
+        renderData->tangentSolver->derive(finalVerts.data(), tangentScratch);
     }
 }
 
-const AnimInstance * AnimatedEntity::findAnimation(const std::string & animName) const
+void AnimatedEntity::uploadModelPose()
 {
-    auto iter = animations.find(animName);
-    if (iter == std::end(animations))
+    if (usingGpuSkinning())
     {
-        return nullptr;
+        uploadJointMatrices();
+        return;
     }
-    return iter->second.get();
+
+    // We only need to update the vertex buffer this time.
+    vertArray.bindVA();
+    vertArray.bindVB();
+    vertArray.updateRawData(finalVerts.data(), finalVerts.size(), sizeof(GLDrawVertex), nullptr, 0, 0);
+    vertArray.bindNull();
 }
 
-void AnimatedEntity::setAnimation(const std::string & animName)
+std::size_t AnimatedEntity::getPoseUploadBytes() const noexcept
 {
-    const auto anim = findAnimation(animName);
-    if (anim == nullptr)
+    if (usingGpuSkinning())
     {
-        throw std::runtime_error{ "Animation \"" + animName + "\" doesn't belong to this entity!" };
+        return (skinningMatrices.size() + normalMatrices.size()) * sizeof(float);
     }
-    setAnimation(anim);
+    return finalVerts.size() * sizeof(GLDrawVertex);
 }
 
-void AnimatedEntity::setAnimation(const AnimInstance * anim)
+std::size_t AnimatedEntity::getInstanceMemoryBytes() const noexcept
 {
-    // Passing a null animation implicitly restores the bind-pose.
-    if (anim == nullptr)
+    // The GL vertex buffer is assumed to be the same size as its CPU side copy.
+    // The index buffer may be 16-bit while the CPU side indexes are always 32-bit.
+    const std::size_t vertexBytes  = finalVerts.capacity()   * sizeof(GLDrawVertex);
+    const std::size_t indexBytes   = finalIndexes.capacity() * sizeof(GLDrawIndex32);
+    const std::size_t glIndexBytes = vertArray.getIndexCount() * vertArray.getIndexSizeBytes();
+
+    std::size_t blendBytes = 0;
+    if (blendState != nullptr)
     {
-        currSkeleton = model.getJoints();
-        updateModelPose();
+        blendBytes = sizeof(BlendState) +
+                     (blendState->sourcePose.rotations.capacity() + blendState->sourcePose.positions.capacity() +
+                      blendState->layerReference.data.capacity() + blendState->sourceJoints.data.capacity() +
+                      blendState->blendedJoints.data.capacity() + blendState->layerMask.capacity()) * sizeof(float);
     }
 
-    currFrame   = 0;
-    loopCount   = 0;
-    lastTimeSec = 0;
-    currAnim    = anim;
+    return sizeof(*this) + vertexBytes * 2 + indexBytes + glIndexBytes +
+           (currPose.rotations.capacity() + currPose.positions.capacity()) * sizeof(float) +
+           (bindPose.rotations.capacity() + bindPose.positions.capacity()) * sizeof(float) +
+           (skinningMatrices.capacity() + normalMatrices.capacity()) * sizeof(float) +
+           tangentScratch.faceVectors.capacity() * sizeof(float) +
+           jointsBuffer.getSizeInBytes() + blendBytes;
 }
 
-int AnimatedEntity::updateAnimation(const double elapsedTimeSeconds)
+float AnimatedEntity::measureGpuSkinningError()
 {
-    if (currAnim == nullptr)
+    if (!renderData->gpuSkinning)
     {
-        return 0;
+        return -1.0f;
     }
 
-    const auto durationSec = currAnim->getDurationSeconds();
-    const auto numFrames   = currAnim->getNumFrames();
-
-    lastTimeSec += elapsedTimeSeconds;
-
-    // Move to next frame:
-    if (lastTimeSec >= durationSec)
+    // CPU reference: the scalar skinning, with all the weights.
+    sampleSkippedPose();
+    std::vector<GLDrawVertex> reference;
+    animateMesh(model->getMeshes().back(), currPose, &reference, nullptr);
+
+    buildSkinningMatrices(currPose, ModelScale, skinningMatrices.data());
+    buildSkinningNormalMatrices(currPose, bindPose, normalMatrices.data());
+    uploadJointMatrices();
+
+    // Run the vertex shader once per vertex and capture the skinned positions.
+    const int numVerts = renderData->skinnedVertArray.getVertexCount();
+    const GLsizeiptr capturedBytes = numVerts * 3 * sizeof(float);
+
+    GLuint feedbackBuffer = 0;
+    glGenBuffers(1, &feedbackBuffer);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, feedbackBuffer);
+    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, capturedBytes, nullptr, GL_STREAM_READ);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, feedbackBuffer);
+
+    renderData->skinnedProg.bind();
+    jointsBuffer.bindBase(JointsBufferBinding);
+    renderData->skinnedVertArray.bindVA();
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginTransformFeedback(GL_POINTS);
+    renderData->skinnedVertArray.drawUnindexed(GL_POINTS, 0, numVerts);
+    glEndTransformFeedback();
+    glDisable(GL_RASTERIZER_DISCARD);
+    renderData->skinnedVertArray.bindNull();
+
+    float maxError = -1.0f;
+    const auto captured = static_cast<const float *>(
+        glMapBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, capturedBytes, GL_MAP_READ_BIT));
+
+    if (captured != nullptr)
     {
-        lastTimeSec = lastTimeSec - durationSec;
-        ++currFrame;
-
-        if (currFrame >= numFrames)
+        if (static_cast<int>(reference.size()) == numVerts)
         {
-            currFrame = 0;
-            ++loopCount;
+            maxError = 0.0f;
+            for (int v = 0; v < numVerts; ++v)
+            {
+                const Vec3 diff{ captured[v * 3 + 0] - reference[v].px,
+                                 captured[v * 3 + 1] - reference[v].py,
+                                 captured[v * 3 + 2] - reference[v].pz };
+                maxError = std::max(maxError, static_cast<float>(length(diff)));
+            }
         }
+        glUnmapBuffer(GL_TRANSFORM_FEEDBACK_BUFFER);
     }
 
-    int nextFrame = currFrame + 1;
-    if (nextFrame >= numFrames)
-    {
-        nextFrame = numFrames - 1;
-    }
-
-    // Interpolate skeleton joints between two frames:
-    interpolateSkeletons(currAnim->getJointsForFrame(currFrame), currAnim->getJointsForFrame(nextFrame),
-                         currAnim->getNumJoints(), (lastTimeSec * currAnim->getFrameRate()), currSkeleton);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+    glDeleteBuffers(1, &feedbackBuffer);
 
-    // Caller can use this to test if the animation has completed.
-    return loopCount;
+    return maxError;
 }
 
-void AnimatedEntity::updateModelPose()
+void AnimatedEntity::drawWholeModel(const GLenum renderMode, const Mat4 & mvpMatrix, const Point3 eyePosModelSpace,
+                                    const MaterialInstance * material, const LightBase ** lights, const int numLights)
 {
-    if (currAnim == nullptr)
+    // Same uniforms in both programs, at different locations.
+    const bool gpuSkinning = usingGpuSkinning();
+    GLShaderProg & prog = gpuSkinning ? renderData->skinnedProg : renderData->shaderProg;
+    const ShaderUniforms & vars = gpuSkinning ? renderData->skinnedShaderVars : renderData->shaderVars;
+    setDrawUniforms(prog, vars, mvpMatrix, eyePosModelSpace, material, lights, numLights);
+
+    GLVertexArray & va = gpuSkinning ? renderData->skinnedVertArray : vertArray;
+    if (gpuSkinning)
     {
-        return;
+        jointsBuffer.bindBase(JointsBufferBinding);
     }
 
-    const auto & meshes = model.getMeshes();
-    for (const auto & mesh : meshes)
+    va.bindVA();
+    va.draw(renderMode);
+    va.bindNull();
+}
+
+void AnimatedEntity::drawWholeModelInstanced(const GLenum renderMode, const Mat4 & mvpMatrix, const Point3 eyePosModelSpace,
+                                             const MaterialInstance * material, const LightBase ** lights, const int numLights,
+                                             const GLUniformBuffer & instanceBuffer, const int offsetInBytes, const int numInstances)
+{
+    assert(numInstances > 0 && numInstances <= MaxInstancesPerDraw);
+
+    const bool gpuSkinning = usingGpuSkinning();
+    GLShaderProg & prog = gpuSkinning ? renderData->skinnedInstancedProg : renderData->instancedProg;
+    const ShaderUniforms & vars = gpuSkinning ? renderData->skinnedInstancedShaderVars : renderData->instancedShaderVars;
+    setDrawUniforms(prog, vars, mvpMatrix, eyePosModelSpace, material, lights, numLights);
+
+    GLVertexArray & va = gpuSkinning ? renderData->skinnedVertArray : vertArray;
+    if (gpuSkinning)
     {
-        animateMesh(mesh, currSkeleton, &finalVerts, nullptr);
+        jointsBuffer.bindBase(JointsBufferBinding);
     }
 
-    // Generate the dynamic per-vertex data:
-    deriveNormalsAndTangents(finalVerts.data(),   finalVerts.size(),
-                             finalIndexes.data(), finalIndexes.size(),
-                             finalVerts.data());
+    // The whole array declared in the shader is bound; InstancedCrowd pads the buffer for the last draw.
+    instanceBuffer.bindRange(InstanceBufferBinding, offsetInBytes,
+                             MaxInstancesPerDraw * SkinningMatrixFloats * sizeof(float));
 
-    // We only need to update the vertex buffer this time.
-    vertArray.bindVA();
-    vertArray.bindVB();
-    vertArray.updateRawData(finalVerts.data(), finalVerts.size(), sizeof(GLDrawVertex), nullptr, 0, 0);
-    vertArray.bindNull();
+    va.bindVA();
+    va.drawInstanced(renderMode, numInstances);
+    va.bindNull();
 }
 
-void AnimatedEntity::drawWholeModel(const GLenum renderMode, const Mat4 & mvpMatrix, const Point3 eyePosModelSpace,
-                                    const MaterialInstance * material, const LightBase ** lights, int numLights)
+void AnimatedEntity::setDrawUniforms(GLShaderProg & prog, const ShaderUniforms & vars, const Mat4 & mvpMatrix,
+                                     const Point3 & eyePosModelSpace, const MaterialInstance * material,
+                                     const LightBase ** lights, int numLights) const
 {
     if (numLights > MaxLights)
     {
         numLights = MaxLights;
     }
 
-    shaderProg.bind();
-    shaderProg.setUniform1i(shaderVars.numOfLightsLoc, numLights);
-    shaderProg.setUniformMat4(shaderVars.mvpMatrixLoc, mvpMatrix);
-    shaderProg.setUniformPoint3(shaderVars.eyePosModelSpaceLoc, eyePosModelSpace);
+    prog.bind();
+    prog.setUniform1i(vars.numOfLightsLoc, numLights);
+    prog.setUniformMat4(vars.mvpMatrixLoc, mvpMatrix);
+    prog.setUniformPoint3(vars.eyePosModelSpaceLoc, eyePosModelSpace);
 
     if (material == nullptr)
     {
         // Use whatever is the first one available.
-        material = model.getMaterials().begin()->second.get();
+        material = model->getMaterials().begin()->second.get();
     }
 
     material->apply();
-    shaderProg.setUniform1f(shaderVars.shininessLoc,       material->getShininess());
-    shaderProg.setUniformVec4(shaderVars.ambientColorLoc,  material->getAmbientColor());
-    shaderProg.setUniformVec4(shaderVars.diffuseColorLoc,  material->getDiffuseColor());
-    shaderProg.setUniformVec4(shaderVars.specularColorLoc, material->getSpecularColor());
-    shaderProg.setUniformVec4(shaderVars.emissiveColorLoc, material->getEmissiveColor());
+    prog.setUniform1f(vars.shininessLoc,       material->getShininess());
+    prog.setUniformVec4(vars.ambientColorLoc,  material->getAmbientColor());
+    prog.setUniformVec4(vars.diffuseColorLoc,  material->getDiffuseColor());
+    prog.setUniformVec4(vars.specularColorLoc, material->getSpecularColor());
+    prog.setUniformVec4(vars.emissiveColorLoc, material->getEmissiveColor());
 
     for (int l = 0; l < numLights; ++l)
     {
         if (lights[l] != nullptr)
         {
-            applyLight(*lights[l], l);
+            applyLight(*lights[l], l, prog, vars);
         }
     }
-
-    vertArray.bindVA();
-    vertArray.draw(renderMode);
-    vertArray.bindNull();
 }
 
 void AnimatedEntity::drawWholeModelShadow(const Mat4 & shadowMvp, const Point3 & lightPosModelSpace)
@@ -1025,40 +3174,50 @@ void AnimatedEntity::drawWholeModelShadow(const Mat4 & shadowMvp, const Point3 &
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    shadowProg.bind();
-    shadowProg.setUniformMat4(shaderVars.shadowMvpMatrixLoc, shadowMvp);
-    shadowProg.setUniformVec4(shaderVars.shadowParamsLoc, Vec4{ 1.0f / 15.0f, 1.0f, 0.0f, 0.0f });
-    shadowProg.setUniformPoint3(shaderVars.shadowLightPosLoc, lightPosModelSpace);
+    const bool gpuSkinning = usingGpuSkinning();
+    GLShaderProg & prog = gpuSkinning ? renderData->skinnedShadowProg : renderData->shadowProg;
+    const ShaderUniforms & vars = gpuSkinning ? renderData->skinnedShaderVars : renderData->shaderVars;
+    GLVertexArray & va = gpuSkinning ? renderData->skinnedVertArray : vertArray;
 
-    vertArray.bindVA();
-    vertArray.draw(GL_TRIANGLES);
-    vertArray.bindNull();
+    prog.bind();
+    prog.setUniformMat4(vars.shadowMvpMatrixLoc, shadowMvp);
+    prog.setUniformVec4(vars.shadowParamsLoc, Vec4{ 1.0f / 15.0f, 1.0f, 0.0f, 0.0f });
+    prog.setUniformPoint3(vars.shadowLightPosLoc, lightPosModelSpace);
+
+    if (gpuSkinning)
+    {
+        jointsBuffer.bindBase(JointsBufferBinding);
+    }
+
+    va.bindVA();
+    va.draw(GL_TRIANGLES);
+    va.bindNull();
 
     glDisable(GL_BLEND);
     glDepthMask(GL_TRUE);
 }
 
-void AnimatedEntity::applyLight(const LightBase & light, const int index)
+void AnimatedEntity::applyLight(const LightBase & light, const int index, GLShaderProg & prog, const ShaderUniforms & vars)
 {
-    shaderProg.setUniform1i(shaderVars.lightTypeLoc[index], light.getType());
-    shaderProg.setUniformPoint3(shaderVars.lightPosModelSpaceLoc[index], light.getModelSpacePosition());
+    prog.setUniform1i(vars.lightTypeLoc[index], light.getType());
+    prog.setUniformPoint3(vars.lightPosModelSpaceLoc[index], light.getModelSpacePosition());
 
     switch (light.getType())
     {
     case LightBase::PointLight :
         {
             const auto & pointLight = static_cast<const PointLightSource &>(light);
-            shaderProg.setUniform1f(shaderVars.lightAttenConstLoc[index], pointLight.attenConst);
-            shaderProg.setUniform1f(shaderVars.lightAttenLinearLoc[index], pointLight.attenLinear);
-            shaderProg.setUniform1f(shaderVars.lightAttenQuadraticLoc[index], pointLight.attenQuadratic);
-            shaderProg.setUniformVec4(shaderVars.lightColorLoc[index], pointLight.color);
+            prog.setUniform1f(vars.lightAttenConstLoc[index], pointLight.attenConst);
+            prog.setUniform1f(vars.lightAttenLinearLoc[index], pointLight.attenLinear);
+            prog.setUniform1f(vars.lightAttenQuadraticLoc[index], pointLight.attenQuadratic);
+            prog.setUniformVec4(vars.lightColorLoc[index], pointLight.color);
             break;
         }
     case LightBase::Flashlight :
         {
             const auto & flashlight = static_cast<const FlashlightSource &>(light);
-            shaderProg.setUniformMat4(shaderVars.lightProjectionMatrixLoc[index], flashlight.lightProjectionMatrix);
-            shaderProg.setUniformVec4(shaderVars.lightColorLoc[index], flashlight.color);
+            prog.setUniformMat4(vars.lightProjectionMatrixLoc[index], flashlight.lightProjectionMatrix);
+            prog.setUniformVec4(vars.lightColorLoc[index], flashlight.color);
             if (flashlight.lightCookieTexture != nullptr)
             {
                 flashlight.lightCookieTexture->bind();
@@ -1071,16 +3230,22 @@ void AnimatedEntity::applyLight(const LightBase & light, const int index)
 }
 
 void AnimatedEntity::addSkeletonWireFrame(GLBatchLineRenderer  * lineRenderer,
-                                          GLBatchPointRenderer * pointRenderer) const
+                                          GLBatchPointRenderer * pointRenderer)
 {
+    sampleSkippedPose();
+
     constexpr float pointSize = 10.0f;
     const Vec4 pointColor{ 1.0f, 1.0f, 1.0f, 1.0f }; // white
     const Vec4 lineColor { 0.0f, 1.0f, 0.0f, 1.0f }; // green
 
+    const auto & skeleton  = model->getSkeleton();
+    const float * positions = currPose.positions.data();
+
     Point3 p0, p1;
-    for (const auto & joint : currSkeleton)
+    for (int j = 0; j < currPose.getNumJoints(); ++j)
     {
-        p0 = scale(joint.pos, ModelScale);
+        const float * pos = positions + j * 3;
+        p0 = scale(Point3{ pos[0], pos[1], pos[2] }, ModelScale);
         swapYZ(p0); // Joint position is in id's layout. We need to swap Y-Z to draw on GL.
 
         if (pointRenderer != nullptr)
@@ -1088,9 +3253,11 @@ void AnimatedEntity::addSkeletonWireFrame(GLBatchLineRenderer  * lineRenderer,
             pointRenderer->addPoint(p0, pointSize, pointColor);
         }
 
-        if (lineRenderer != nullptr && joint.parent >= 0)
+        const int parent = skeleton.getJointParent(j);
+        if (lineRenderer != nullptr && parent >= 0)
         {
-            p1 = scale(currSkeleton[joint.parent].pos, ModelScale);
+            const float * parentPos = positions + parent * 3;
+            p1 = scale(Point3{ parentPos[0], parentPos[1], parentPos[2] }, ModelScale);
             swapYZ(p1);
 
             lineRenderer->addLine(p0, p1, lineColor);
@@ -1139,6 +3306,283 @@ void AnimatedEntity::addTangentBasis(GLBatchLineRenderer  * lineRenderer,
     }
 }
 
+// ========================================================
+// updateCrowd():
+// ========================================================
+
+CrowdUpdateTimes updateCrowd(AnimatedEntity * const * entities, const int numEntities,
+                             const double elapsedTimeSeconds, WorkerPool & pool)
+{
+    assert(entities != nullptr || numEntities == 0);
+    CrowdUpdateTimes times;
+
+    // One item per entity. A hellknight is a few hundred microseconds of work,
+    // which is plenty to amortize the cost of picking up an item.
+    const auto animateStart = std::chrono::high_resolution_clock::now();
+    pool.parallelFor(numEntities, [entities, elapsedTimeSeconds](const int i)
+    {
+        AnimatedEntity & entity = *entities[i];
+        if (entity.getCurrentAnimation() != nullptr)
+        {
+            entity.updateAnimation(elapsedTimeSeconds);
+            entity.skinModelPose();
+        }
+    });
+    times.animateMs = millisecondsSince(animateStart);
+
+    const auto uploadStart = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numEntities; ++i)
+    {
+        if (entities[i]->getCurrentAnimation() != nullptr)
+        {
+            entities[i]->uploadModelPose();
+            ++times.numUpdated;
+        }
+    }
+    times.uploadMs = millisecondsSince(uploadStart);
+
+    return times;
+}
+
+CrowdUpdateTimes updateCrowd(AnimatedEntity * const * entities, const AnimLod * lods, const int numEntities,
+                             const double elapsedTimeSeconds, const AnimLodPolicy & policy, WorkerPool & pool)
+{
+    assert((entities != nullptr && lods != nullptr) || numEntities == 0);
+    CrowdUpdateTimes times;
+
+    // Which entities need an upload. Each item writes its own flag.
+    FrameArenaScope scratchScope;
+    bool * updated = scratchScope.getArena().allocArray<bool>(numEntities);
+
+    const auto animateStart = std::chrono::high_resolution_clock::now();
+    pool.parallelFor(numEntities, [entities, lods, updated, elapsedTimeSeconds, &policy](const int i)
+    {
+        updated[i] = entities[i]->updateWithLod(elapsedTimeSeconds, lods[i], policy);
+    });
+    times.animateMs = millisecondsSince(animateStart);
+
+    const auto uploadStart = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numEntities; ++i)
+    {
+        if (updated[i])
+        {
+            entities[i]->uploadModelPose();
+            ++times.numUpdated;
+        }
+    }
+    times.uploadMs = millisecondsSince(uploadStart);
+
+    return times;
+}
+
+// ========================================================
+// class InstancedCrowd:
+// ========================================================
+
+InstancedCrowd::InstancedCrowd(GLFWApp & owner, const double timeStepSeconds)
+    : timeStep         { timeStepSeconds }
+    , grouping         { true }
+    , stats            { }
+    , entityCulled     { }
+    , sortedKeys       { }
+    , leaders          { }
+    , draws            { }
+    , instanceMatrices { }
+    , instanceBuffer   { owner }
+{
+    assert(timeStepSeconds >= 0.0);
+}
+
+const InstancedCrowd::Stats & InstancedCrowd::update(AnimatedEntity * const * entities, const Mat4 * modelMatrices,
+                                                     const int numEntities, const double elapsedTimeSeconds,
+                                                     WorkerPool & pool, const Frustum * frustum)
+{
+    assert(entities != nullptr || numEntities == 0);
+    assert(modelMatrices != nullptr || numEntities == 0);
+
+    // Moving the playback time is a few additions, not worth the pool.
+    const auto animateStart = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numEntities; ++i)
+    {
+        entities[i]->advanceAnimation(elapsedTimeSeconds);
+    }
+
+    // After advancing, so the bounds are the ones of the frame about to be drawn.
+    if (frustum != nullptr)
+    {
+        cullEntities(entities, modelMatrices, numEntities, *frustum);
+    }
+    else
+    {
+        entityCulled.clear();
+        stats.numCulled = 0;
+    }
+
+    buildGroups(entities, modelMatrices, numEntities);
+
+    // Bind pose leaders are already skinned.
+    pool.parallelFor(static_cast<int>(leaders.size()), [this](const int g)
+    {
+        AnimatedEntity & leader = *leaders[g];
+        if (leader.getCurrentAnimation() != nullptr)
+        {
+            leader.refreshCurrentPose();
+            leader.skinModelPose();
+        }
+    });
+    stats.animateMs = millisecondsSince(animateStart);
+
+    const auto uploadStart = std::chrono::high_resolution_clock::now();
+    for (AnimatedEntity * leader : leaders)
+    {
+        if (leader->getCurrentAnimation() != nullptr)
+        {
+            leader->uploadModelPose();
+        }
+    }
+    uploadInstanceMatrices();
+    stats.uploadMs = millisecondsSince(uploadStart);
+
+    stats.numEntities = numEntities;
+    stats.numGroups   = static_cast<int>(leaders.size());
+    stats.numDraws    = static_cast<int>(draws.size());
+    return stats;
+}
+
+void InstancedCrowd::cullEntities(AnimatedEntity * const * entities, const Mat4 * modelMatrices,
+                                  const int numEntities, const Frustum & frustum)
+{
+    entityCulled.resize(numEntities);
+    stats.numCulled = 0;
+
+    for (int i = 0; i < numEntities; ++i)
+    {
+        const bool culled = !entities[i]->isInFrustum(frustum, modelMatrices[i]);
+        entityCulled[i] = culled;
+        stats.numCulled += culled;
+    }
+}
+
+void InstancedCrowd::buildGroups(AnimatedEntity * const * entities, const Mat4 * modelMatrices, const int numEntities)
+{
+    sortedKeys.clear();
+    for (int i = 0; i < numEntities; ++i)
+    {
+        if (!entityCulled.empty() && entityCulled[i])
+        {
+            continue;
+        }
+
+        const AnimatedEntity & entity = *entities[i];
+        const double animTime = entity.getAnimTimeSeconds();
+
+        GroupKey key;
+        key.model        = &entity.getModelInstance();
+        key.anim         = entity.getCurrentAnimation();
+        key.timeStep     = (timeStep > 0.0) ? static_cast<std::int64_t>(animTime / timeStep) :
+                                              static_cast<std::int64_t>(animTime * 1000000.0);
+        key.entityIndex  = i;
+        sortedKeys.push_back(key);
+    }
+
+    // Sorting puts the members of a group next to each other.
+    // The entity index keeps the result the same from frame to frame.
+    const auto keyLess = [](const GroupKey & a, const GroupKey & b)
+    {
+        if (a.model    != b.model)    { return std::less<const ModelInstance *>{}(a.model, b.model); }
+        if (a.anim     != b.anim)     { return std::less<const AnimInstance  *>{}(a.anim,  b.anim);  }
+        if (a.timeStep != b.timeStep) { return a.timeStep < b.timeStep; }
+        return a.entityIndex < b.entityIndex;
+    };
+    std::sort(std::begin(sortedKeys), std::end(sortedKeys), keyLess);
+
+    // A draw's matrices start at a multiple of the UBO offset alignment.
+    const int matrixBytes = SkinningMatrixFloats * sizeof(float);
+    const int alignFloats = std::max(GLUniformBuffer::getOffsetAlignment() / static_cast<int>(sizeof(float)), 1);
+
+    leaders.clear();
+    draws.clear();
+    instanceMatrices.clear();
+
+    const int numKeys = static_cast<int>(sortedKeys.size());
+    for (int i = 0; i < numKeys; ++i)
+    {
+        const GroupKey & key = sortedKeys[i];
+        // A blended pose depends on more than the key, so those entities always draw alone.
+        const bool newGroup  = (i == 0) || !grouping ||
+                               key.model    != sortedKeys[i - 1].model ||
+                               key.anim     != sortedKeys[i - 1].anim  ||
+                               key.timeStep != sortedKeys[i - 1].timeStep ||
+                               entities[key.entityIndex]->isBlending() ||
+                               entities[sortedKeys[i - 1].entityIndex]->isBlending();
+
+        if (newGroup)
+        {
+            leaders.push_back(entities[key.entityIndex]);
+        }
+        if (newGroup || draws.back().numInstances == AnimatedEntity::MaxInstancesPerDraw)
+        {
+            const std::size_t alignedSize = (instanceMatrices.size() + alignFloats - 1) / alignFloats * alignFloats;
+            instanceMatrices.resize(alignedSize, 0.0f);
+            draws.push_back({ leaders.back(), static_cast<int>(alignedSize * sizeof(float)), 0 });
+        }
+
+        // 3x4 row-major, like the joint matrices. Mat4 is indexed [column][row].
+        const Mat4 & m = modelMatrices[key.entityIndex];
+        for (int row = 0; row < 3; ++row)
+        {
+            instanceMatrices.push_back(m[0][row]);
+            instanceMatrices.push_back(m[1][row]);
+            instanceMatrices.push_back(m[2][row]);
+            instanceMatrices.push_back(m[3][row]);
+        }
+        ++draws.back().numInstances;
+    }
+
+    // drawWholeModelInstanced() binds a full array for each draw, so pad for the last one.
+    if (!draws.empty())
+    {
+        const std::size_t boundEnd = draws.back().offsetInBytes / sizeof(float) +
+                                     AnimatedEntity::MaxInstancesPerDraw * (matrixBytes / sizeof(float));
+        instanceMatrices.resize(std::max(instanceMatrices.size(), boundEnd), 0.0f);
+    }
+}
+
+void InstancedCrowd::uploadInstanceMatrices()
+{
+    if (instanceMatrices.empty())
+    {
+        return;
+    }
+
+    // Grows in powers of two, so a crowd that changes size doesn't reallocate every frame.
+    const int sizeBytes = static_cast<int>(instanceMatrices.size() * sizeof(float));
+    if (sizeBytes > instanceBuffer.getSizeInBytes())
+    {
+        int newSize = std::max(instanceBuffer.getSizeInBytes(), 4096);
+        while (newSize < sizeBytes)
+        {
+            newSize *= 2;
+        }
+        instanceBuffer.cleanup();
+        instanceBuffer.initWithSize(newSize, nullptr, GL_STREAM_DRAW);
+    }
+
+    instanceBuffer.bind();
+    instanceBuffer.updateRange(0, sizeBytes, instanceMatrices.data());
+    GLUniformBuffer::bindNull();
+}
+
+void InstancedCrowd::draw(const Mat4 & mvpMatrix, const Point3 & eyePosModelSpace,
+                          const LightBase ** lights, const int numLights)
+{
+    for (const Draw & d : draws)
+    {
+        d.leader->drawWholeModelInstanced(GL_TRIANGLES, mvpMatrix, eyePosModelSpace, nullptr, lights, numLights,
+                                          instanceBuffer, d.offsetInBytes, d.numInstances);
+    }
+}
+
 // ========================================================
 // Quaternion math helpers:
 // ========================================================
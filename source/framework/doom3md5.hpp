@@ -15,19 +15,28 @@
 #define DOOM3MD5_HPP
 
 #include "gl_utils.hpp"
+#include "mapped_file.hpp"
+#include "pose_blend.hpp"
+#include "skinning.hpp"
+#include "worker_pool.hpp"
 
+#include <cstdint>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <fstream>
 
+class Frustum;
+
 namespace DOOM3
 {
 
 class MaterialInstance;
 class ModelInstance;
 class AnimInstance;
+class MD5Lexer;
 
 // ========================================================
 // DOOM 3 MD5 model and animation data structures:
@@ -78,6 +87,85 @@ struct Mesh
     std::vector<Weight>   weights;
 };
 
+// ========================================================
+// class Skeleton:
+// ========================================================
+
+//
+// Joint names and hierarchy, shared by a model and its animations.
+//
+// Skeletons are immutable and interned: Skeleton::intern() returns the
+// existing instance if an identical skeleton (same names and parents, in
+// the same order) is alive, so a model and the animations made for it
+// end up pointing to the same object and compatibility is a pointer test.
+//
+class Skeleton final
+{
+public:
+
+    using Ptr = std::shared_ptr<const Skeleton>;
+
+    // Thread-safe; animations are loaded concurrently.
+    static Ptr intern(std::vector<std::string> names, std::vector<int> parents);
+
+    // FNV-1a. Joint names are compared by hash first.
+    static std::uint32_t hashName(const char * name, std::size_t length) noexcept;
+
+    // Copy/assignment is disabled.
+    Skeleton(const Skeleton &) = delete;
+    Skeleton & operator = (const Skeleton &) = delete;
+
+    // Index of the named joint or -1 if not found. Hash table lookup.
+    int findJoint(const std::string & jointName) const;
+
+    // Same joints in the same hierarchy. Pointer comparison for interned skeletons.
+    bool isCompatible(const Skeleton & other) const noexcept;
+
+    int getNumJoints() const noexcept { return static_cast<int>(parents.size()); }
+    int getJointParent(const int index) const noexcept { return parents[index]; }
+    const std::string & getJointName(const int index) const noexcept { return names[index]; }
+    std::uint32_t getJointNameHash(const int index) const noexcept { return nameHashes[index]; }
+    const std::vector<int> & getParents() const noexcept { return parents; }
+
+    std::size_t getMemoryBytes() const noexcept;
+
+private:
+
+    Skeleton(std::vector<std::string> jointNames, std::vector<int> jointParents, std::uint64_t sig);
+
+    std::vector<std::string>   names;
+    std::vector<int>           parents;    // Parents always come before their children.
+    std::vector<std::uint32_t> nameHashes; // hashName() of each joint name.
+    std::vector<int>           hashTable;  // Open addressing, power of two size, joint index or -1.
+    std::uint64_t              signature;  // Hash of all names and parents, for the intern table.
+};
+
+// ========================================================
+// struct Pose:
+// ========================================================
+
+//
+// Joint transforms of a skeleton, in model space, as two tightly packed streams:
+// rotations (quaternion xyzw, 4 floats per joint) and positions (xyz, 3 floats per joint).
+// The names and parents live in the Skeleton.
+//
+struct Pose
+{
+    std::vector<float> rotations;
+    std::vector<float> positions;
+
+    void resize(const int numJoints)
+    {
+        rotations.resize(numJoints * 4);
+        positions.resize(numJoints * 3);
+    }
+
+    int getNumJoints() const noexcept { return static_cast<int>(positions.size() / 3); }
+
+    // Copies the orient/pos of a set of joints.
+    void setFromJoints(const std::vector<Joint> & joints);
+};
+
 // ========================================================
 // class MaterialInstance:
 // ========================================================
@@ -111,6 +199,9 @@ public:
     const GLTexture   & getNormalTexture()   const noexcept { return normalTexture;   }
     const GLTexture   & getSpecularTexture() const noexcept { return specularTexture; }
 
+    // Estimated GL memory of the textures (RGBA8 plus mipmaps).
+    std::size_t getMemoryBytes() const noexcept;
+
     // Shading params:
     float getShininess()            const noexcept { return shininess;     }
     const Vec4 & getAmbientColor()  const noexcept { return ambientColor;  }
@@ -137,8 +228,8 @@ private:
     Vec4 emissiveColor;
 };
 
-// Materials are uniquely indexed by name. The map owns each instance.
-using MaterialMap = std::unordered_map<std::string, std::unique_ptr<const MaterialInstance>>;
+// Materials are uniquely indexed by name. Shared with other models through the ResourceCache.
+using MaterialMap = std::unordered_map<std::string, std::shared_ptr<const MaterialInstance>>;
 
 // ========================================================
 // class ModelInstance:
@@ -149,7 +240,7 @@ class ModelInstance final
 {
 public:
 
-    // Load model from file:
+    // Load model from file. The file is memory mapped and parsed in place.
     ModelInstance(GLFWApp & owner, const std::string & filename);
     ModelInstance(GLFWApp & owner, std::istream & inStr);
 
@@ -161,12 +252,15 @@ public:
     // Pointer belongs to the model, so never attempt to free it.
     const Joint * findJoint(const std::string & jointName) const;
 
+    // Joint names and hierarchy. Shared with the compatible animations.
+    const Skeleton & getSkeleton() const noexcept { return *skeleton; }
+
     // Returns null if material not is present in this model.
     // The returned pointer belongs to the ModelInstance and should never be freed!
     const MaterialInstance * findMaterial(const std::string & matName) const;
 
-    // Creates and register a new material. Tries to find the appropriate textures,
-    // but sets defaults if they are not found. This method always returns a valid material.
+    // Registers a material with the model, getting it from the ResourceCache. Tries to find the
+    // appropriate textures, but sets defaults if they are not found. Always returns a valid material.
     const MaterialInstance * createMaterial(const std::string & matName);
 
     // Read-only accessors:
@@ -174,11 +268,27 @@ public:
     const std::vector<Joint> & getJoints()    const noexcept { return joints;    }
     const MaterialMap        & getMaterials() const noexcept { return materials; }
 
+    // Memory used by the meshes and joints. Materials and the Skeleton are shared, so not included.
+    std::size_t getMemoryBytes() const noexcept;
+
+    // Loading stats (not counting the material textures):
+    std::size_t getSourceSizeBytes() const noexcept { return sourceSizeBytes; }
+    double getLoadTimeMs()           const noexcept { return loadTimeMs;      }
+    bool isFromBakedCache()          const noexcept { return fromBakedCache;  }
+
 private:
 
-    void parseModel(std::istream & inStr);
-    void parseMesh(std::istream & inStr, std::size_t meshIndex);
-    void parseJoints(std::istream & inStr, std::size_t numJoints);
+    // The material names are collected by the parser and the materials
+    // created afterwards, so the texture loads stay out of the parse time.
+    void parseModel(MD5Lexer & lexer, std::vector<std::string> & meshMaterials);
+    void parseMesh(MD5Lexer & lexer, std::size_t meshIndex, std::string & materialName);
+    void parseJoints(MD5Lexer & lexer, std::size_t numJoints);
+    void createSkeleton();
+    void createMeshMaterials(const std::vector<std::string> & meshMaterials);
+
+    // Binary baked cache (see g_bUseBakedCache):
+    bool loadBaked(const std::string & bakedFile, const FileInfo & sourceInfo, std::vector<std::string> & meshMaterials);
+    bool writeBaked(const std::string & bakedFile, const FileInfo & sourceInfo, const std::vector<std::string> & meshMaterials) const;
 
     // Needed to create the material textures.
     GLFWApp & app;
@@ -186,18 +296,39 @@ private:
     std::vector<Mesh>  meshes;    // Sub-meshes with vertex positions, indexes, tex coords.
     std::vector<Joint> joints;    // Joints for skinning. AKA the skeleton. Initially the bind/home pose.
     MaterialMap        materials; // All materials (textures) referenced by this model.
+    Skeleton::Ptr      skeleton;  // Names and parents of 'joints'.
+
+    std::size_t sourceSizeBytes = 0;
+    double      loadTimeMs      = 0.0;
+    bool        fromBakedCache  = false;
 };
 
 // ========================================================
 // class AnimInstance:
 // ========================================================
 
+// How AnimInstance::locate() treats times past the end of the clip.
+enum class AnimLoopMode
+{
+    Loop,  // Starts over from the first frame.
+    Clamp  // Holds the last frame.
+};
+
+// A point in a clip: the two frames to blend and how far between them.
+struct AnimSamplePoint
+{
+    int   frameA;
+    int   frameB;
+    float interp;    // [0,1) from frameA to frameB.
+    int   loopCount; // Full runs of the clip before this point. A clamped clip counts 1 once it reaches the end.
+};
+
 // Animation data loaded from a .md5anim file.
 class AnimInstance final
 {
 public:
 
-    // Load animation data from file:
+    // Load animation data from file. The file is memory mapped and parsed in place.
     explicit AnimInstance(const std::string & filename);
     explicit AnimInstance(std::istream & inStr);
 
@@ -219,12 +350,42 @@ public:
         assert(frameIndex < numFrames);
         return bboxes[frameIndex];
     }
-    const Joint * getJointsForFrame(const int frameIndex) const noexcept
+
+    // Model space pose of a frame, as the rotation (xyzw) and position (xyz)
+    // streams described in Pose. Joint names and parents are in the Skeleton.
+    const float * getFrameRotations(const int frameIndex) const noexcept
     {
         assert(frameIndex >= 0);
         assert(frameIndex < numFrames);
-        return skelFrames[frameIndex].get();
+        return rotationStream + static_cast<std::size_t>(frameIndex) * numJoints * 4;
     }
+    const float * getFramePositions(const int frameIndex) const noexcept
+    {
+        assert(frameIndex >= 0);
+        assert(frameIndex < numFrames);
+        return positionStream + static_cast<std::size_t>(frameIndex) * numJoints * 3;
+    }
+
+    // Joint names and hierarchy. Interned, so usually the same object as the model's.
+    const Skeleton & getSkeleton() const noexcept { return *skeleton; }
+
+    // Random access: the frames at 'timeSeconds' from the start of the clip. Any number
+    // of frames may be skipped, and negative times are the same as zero. The last frame
+    // is held for one frame time before a looping clip starts over.
+    AnimSamplePoint locate(double timeSeconds, AnimLoopMode loopMode) const noexcept;
+
+    // The pose at 'timeSeconds' from the start of the clip, into 'poseOut', which must be
+    // sized for getNumJoints(). Only reads the clip, so any number of threads can sample
+    // it at once. 'nlerp' selects the rotation blending, as in AnimatedEntity::interpolatePoses().
+    void sample(double timeSeconds, AnimLoopMode loopMode, Pose & poseOut, bool nlerp = false) const;
+
+    // Memory used by the pose streams and bounds. The Skeleton is shared, so not included.
+    std::size_t getMemoryBytes() const noexcept;
+
+    // Loading stats (text parse + skeleton frame build, or baked cache load):
+    std::size_t getSourceSizeBytes() const noexcept { return sourceSizeBytes; }
+    double getLoadTimeMs()           const noexcept { return loadTimeMs;      }
+    bool isFromBakedCache()          const noexcept { return fromBakedCache;  }
 
 private:
 
@@ -245,7 +406,7 @@ private:
         int flags;
         int parent;
         int startIndex;
-        char name[64]; // Must also accommodate a '\0' at the end.
+        char name[64]; // Must also accommodate a '\0' at the end. Quotes are stripped by the parser.
     };
 
     // An entry in the 'baseframe' section of a md5anim.
@@ -256,36 +417,137 @@ private:
     };
 
     // File processing helpers:
-    void parseAnim(std::istream & inStr);
-    void parseBounds(std::istream & inStr, int numBounds);
-    static void parseHierarchy(std::istream & inStr, std::vector<HierarchyInfo> & hierarchy, int numJoints);
-    static void parseBaseFrame(std::istream & inStr, std::vector<BaseFrameJointPose> & baseFrame, int numJoints);
-    static void parseFrame(std::istream & inStr, std::vector<float> & frameData, int numAnimatedComponents);
-
-    // Builds a skeleton for a given frame of animation data.
-    // We can then use that skeleton (set of joints) to animate a ModelInstance.
-    static void buildFrameSkeleton(const std::vector<HierarchyInfo> & hierarchy,
-                                   const std::vector<BaseFrameJointPose> & baseFrame,
-                                   const std::vector<float> & frameData,
-                                   Joint * skelJointsOut, int numJoints);
+    void parseAnim(MD5Lexer & lexer);
+    void parseBounds(MD5Lexer & lexer, int numBounds);
+    static void parseHierarchy(MD5Lexer & lexer, std::vector<HierarchyInfo> & hierarchy, int numJoints);
+    static void parseBaseFrame(MD5Lexer & lexer, std::vector<BaseFrameJointPose> & baseFrame, int numJoints);
+    static void parseFrame(MD5Lexer & lexer, std::vector<float> & frameData, int numAnimatedComponents);
+
+    // Binary baked cache (see g_bUseBakedCache):
+    bool loadBaked(const std::string & bakedFile, const FileInfo & sourceInfo);
+    bool writeBaked(const std::string & bakedFile, const FileInfo & sourceInfo) const;
+
+    // Builds the model space pose for a given frame of animation data.
+    // We can then use that pose to animate a ModelInstance.
+    static void buildFramePose(const std::vector<HierarchyInfo> & hierarchy,
+                               const std::vector<BaseFrameJointPose> & baseFrame,
+                               const std::vector<float> & frameData,
+                               float * rotationsOut, float * positionsOut, int numJoints);
 
     // Animation data from the md5anim file:
-    int numFrames;   // Rows in the skelFrames[][] 2D array.
+    int numFrames;   // Rows in the pose streams.
     int numJoints;   // Should match the model's count.
     int frameRate;   // Usually 24 fps, but doesn't have to be.
     double duration; // 1.0/frameRate.
 
-    // Each entry in the vector is a pointer to an array of Joints.
-    // We have skelFrames[numFrames][numJoints].
-    std::vector<std::unique_ptr<Joint[]>> skelFrames;
+    // Pose streams of all frames, [numFrames][numJoints] each, one after the other.
+    // They point either into 'poseData' or directly into the memory mapped baked cache file.
+    const float * rotationStream = nullptr;
+    const float * positionStream = nullptr;
+    std::vector<float> poseData;
+    std::unique_ptr<MappedFile> bakedFileData;
 
-    // The animation file stores the bounds of each frame. Even though we
-    // aren't using them at the moment, they are loaded and saved here.
+    // Shared by all frames.
+    Skeleton::Ptr skeleton;
+
+    // The animation file stores the bounds of each frame, in the md5 model space
+    // (not scaled and Y-Z not swapped). AnimatedEntity culls with them.
     std::vector<BoundingBox> bboxes;
+
+    std::size_t sourceSizeBytes = 0;
+    double      loadTimeMs      = 0.0;
+    bool        fromBakedCache  = false;
 };
 
-// Animations are uniquely indexed by filename. The map owns each instance.
-using AnimMap = std::unordered_map<std::string, std::unique_ptr<const AnimInstance>>;
+// Animations are uniquely indexed by filename. Shared with other entities through the ResourceCache.
+using AnimMap = std::unordered_map<std::string, std::shared_ptr<const AnimInstance>>;
+
+// ========================================================
+// Binary baked cache:
+// ========================================================
+
+//
+// The first time a .md5mesh or .md5anim is loaded, the resulting data is saved
+// to a binary "baked" file, which is then loaded in place of the text on the
+// following runs, skipping the parsing and the skeleton frame building. The file
+// is memory mapped and validated; there's no parsing involved. Model data is copied
+// out, while the animation pose streams are used directly from the mapping.
+//
+// The baked file remembers the size and modification time of its source and is
+// rebuilt automatically when they change. It is also rebuilt if the format version
+// or the data layout changes.
+//
+extern bool g_bUseBakedCache;          // On by default.
+extern std::string g_strBakedCacheDir; // Where to write the baked files. Empty = next to the sources.
+
+// Path of the baked file for the given source file, according to g_strBakedCacheDir.
+std::string getBakedCachePath(const std::string & sourceFile);
+
+// ========================================================
+// class ResourceCache:
+// ========================================================
+
+//
+// Reference counted sharing of the immutable DOOM 3 data: models, animations and
+// materials (textures). Resources are keyed by canonical path (see getCanonicalPath()),
+// so different spellings of the same file share the entry.
+//
+// The cache only holds weak references, same as the Skeleton intern table. A resource
+// is loaded by the first request and freed with the last shared_ptr to it, so the
+// cache itself never keeps anything resident.
+//
+class ResourceCache final
+{
+public:
+
+    struct Stats
+    {
+        int numModels       = 0; // Currently resident, per type.
+        int numAnimations   = 0;
+        int numMaterials    = 0;
+        int numLoads        = 0; // Requests that had to load the resource.
+        int numHits         = 0; // Requests served from a resident resource.
+        int numWastedLoads  = 0; // Loads thrown away for a copy another thread inserted first.
+        std::size_t residentBytes = 0; // getMemoryBytes() of all resident resources.
+    };
+
+    ResourceCache() = default;
+
+    // Copy/assignment is disabled.
+    ResourceCache(const ResourceCache &) = delete;
+    ResourceCache & operator = (const ResourceCache &) = delete;
+
+    // All thread-safe, but models and materials create GL textures, so they
+    // should be requested from the render thread. The load happens outside the
+    // lock; if two threads race on the same file, the first one inserted wins
+    // and the other load counts as wasted, not as a load.
+    // 'wasResident' is optional, set to true on a cache hit or a lost race.
+    std::shared_ptr<const ModelInstance> loadModel(GLFWApp & app, const std::string & filename, bool * wasResident = nullptr);
+    std::shared_ptr<const AnimInstance> loadAnimation(const std::string & filename, bool * wasResident = nullptr);
+    std::shared_ptr<const MaterialInstance> loadMaterial(GLFWApp & app, const std::string & matName, bool * wasResident = nullptr);
+
+    Stats getStats() const;
+
+private:
+
+    template<typename T>
+    using Table = std::unordered_map<std::string, std::weak_ptr<const T>>;
+
+    template<typename T, typename LoadFunc>
+    std::shared_ptr<const T> findOrLoad(Table<T> & table, const std::string & name,
+                                        bool * wasResident, LoadFunc loadFunc);
+
+    mutable std::mutex      mutex;
+    Table<ModelInstance>    models;
+    Table<AnimInstance>     animations;
+    Table<MaterialInstance> materials;
+    int numLoads       = 0;
+    int numHits        = 0;
+    int numWastedLoads = 0;
+};
+
+// Cache used by ModelInstance and AnimatedEntity, created on first use.
+ResourceCache & getResourceCache();
 
 // ========================================================
 // Light helper classes:
@@ -377,19 +639,102 @@ public:
     Type getType() const override { return Flashlight; }
 };
 
+// ========================================================
+// Animation level of detail:
+// ========================================================
+
+enum class AnimLod
+{
+    Full,    // Pose, skinning and tangent basis every frame.
+    Reduced, // Updated every other frame, with cheaper rotation blending.
+    Low,     // Updated every few frames, without deriving the tangent basis.
+    Frozen,  // Off screen. Only the playback time moves.
+    Count
+};
+
+//
+// What each AnimLod level does and when it is picked.
+//
+// A level updates the pose every 'updateInterval' frames and keeps the last
+// skinned pose in between, blends the joint rotations with nlerp instead of
+// slerp and can rotate the bind pose tangent basis instead of deriving it
+// (see TangentSpaceSolver). The playback time always moves, so an entity
+// changing levels or coming back on screen is at the right point of its animation.
+//
+struct AnimLodPolicy
+{
+    struct Level
+    {
+        int  updateInterval; // Frames per pose update. Zero or less never updates.
+        bool nlerp;          // nlerp instead of slerp for the joint rotations.
+        bool deriveTangents; // Derive the tangent basis, or rotate the bind pose one.
+    };
+
+    Level levels[static_cast<int>(AnimLod::Count)] = {
+        { 1, false, true  }, // Full
+        { 2, true,  true  }, // Reduced
+        { 4, true,  false }, // Low
+        { 0, true,  false }  // Frozen
+    };
+
+    // Smallest projected height of the bounding sphere, as a fraction of the
+    // viewport height, for the Full and Reduced levels. Anything smaller is Low.
+    float minScreenSize[2] = { 0.25f, 0.1f };
+
+    //
+    // Picks the level of a sphere in model space, given the model-view and projection
+    // matrices it is drawn with. Frozen if the sphere is outside the view frustum.
+    // Assumes the model-view matrix doesn't scale.
+    //
+    AnimLod select(const Mat4 & modelViewMatrix, const Mat4 & projMatrix,
+                   const Point3 & center, float radius) const;
+};
+
 // ========================================================
 // class AnimatedEntity:
 // ========================================================
 
+// When set, AnimatedEntity loads its animation files concurrently on the shared
+// WorkerPool. The animations are still added and reported in the given order. On by default.
+extern bool g_bParallelAnimLoading;
+
+// When set, updateModelPose() skins the meshes with the SIMD SkinningBatches path
+// instead of animateMesh(). On by default.
+extern bool g_bSimdSkinning;
+
+// When set, entities skin in the vertex shader: only the joint matrices are sent to
+// the GL each frame and the tangent basis is rotated instead of recomputed. Models with
+// more than GpuSkinningMaxJoints joints stay on the CPU path. Off by default.
+extern bool g_bGpuSkinning;
+
+// When set, the CPU skinning path rotates the bind pose tangent basis with the joints
+// (TangentSpaceSolver::skinBindPose()) instead of deriving it from the skinned triangles
+// every frame. Cheaper but approximate. Off by default.
+extern bool g_bSkinnedTangents;
+
 // Encompasses a DOOM 3 MD5 model, its animations and associated render data.
 class AnimatedEntity final
 {
 public:
 
-    // Load the model from a .md5mesh file and the specified set of .md5anim files:
+    // DOOM 3 models use a pretty large scale, so we shrink them down a bit.
+    static constexpr float ModelScale = 0.07f;
+
+    // Size of the instance matrix arrays in the instanced shaders. Must match normalmap_instanced.vert!
+    static constexpr int MaxInstancesPerDraw = 256;
+
+    // Load the model from a .md5mesh file and the specified set of .md5anim files.
+    // The model, animations and materials come from the ResourceCache, and the skinning
+    // data and shaders are shared with the other entities of the same model, so only
+    // the first entity of a model pays for the loading.
     AnimatedEntity(GLFWApp & owner, const std::string & modelFile,
                    const std::vector<std::string> & animFiles);
 
+    // New instance of the same model: shares the model, animation set, skinning data
+    // and shaders of 'prototype', which can be freed before the new entity. Only the
+    // playback state, pose and vertex buffer are per entity, so this is cheap.
+    AnimatedEntity(GLFWApp & owner, const AnimatedEntity & prototype);
+
     // Copy/assignment is disabled.
     AnimatedEntity(const AnimatedEntity &) = delete;
     AnimatedEntity & operator = (const AnimatedEntity &) = delete;
@@ -405,56 +750,194 @@ public:
     // Test if the given animation can be applied to the model this entity has.
     bool checkAnimationValidity(const AnimInstance & anim) const;
 
+    // Smoothly interpolate two poses, given as rotation/position streams. We can
+    // then apply the resulting pose to a model using animateMesh() or GPU skinning.
+    // The rotations use slerp, or the cheaper nlerp (normalized linear blend) if 'nlerp' is set.
+    static void interpolatePoses(const float * rotationsA, const float * positionsA,
+                                 const float * rotationsB, const float * positionsB,
+                                 int numJoints, float interp, Pose & poseOut, bool nlerp = false);
+
     // Perform animation state update, calculating the current and next frames, given a delta time.
     // Returns the current loop count. Every time a full run of the animation is completed, the counter is incremented.
+    // Same as advanceAnimation() followed by refreshCurrentPose().
     int updateAnimation(double elapsedTimeSeconds);
 
+    // The two halves of updateAnimation(): moving the playback time forward
+    // and interpolating the current pose for that time. The playback state is
+    // just a time cursor, so a long frame skips as many frames as it covers.
+    // The pose comes from AnimInstance::sample().
+    int advanceAnimation(double elapsedTimeSeconds);
+    void sampleCurrentPose(bool nlerp = false);
+
+    // Same as sampleCurrentPose(), but skipped when skinModelPose() will play from the
+    // vertex cache, which doesn't need the joints. The skipped pose is sampled on first
+    // use instead: getCurrentPose(), the skeleton wireframe, GPU or live skinning.
+    // updateAnimation() and updateWithLod() sample with this one.
+    void refreshCurrentPose(bool nlerp = false);
+
+    // Moves the time cursor to 'timeSeconds' from the start of the current animation.
+    void seekAnimation(double timeSeconds) noexcept { animTimeSec = timeSeconds; }
+
+    // Whether the animations loop (the default) or hold the last frame. Kept across setAnimation().
+    void setAnimLoopMode(AnimLoopMode mode) noexcept { loopMode = mode; }
+    AnimLoopMode getAnimLoopMode() const noexcept { return loopMode; }
+
+    // Starts 'anim' from the beginning, like setAnimation(), but blends into it from the
+    // current animation over 'fadeSeconds' instead of snapping. The outgoing animation keeps
+    // playing under the fade. Fading again before the fade ends starts from the newer clip.
+    // Same as setAnimation() if nothing is playing, 'anim' is null or the fade is zero.
+    void crossfadeToAnimation(const AnimInstance * anim, double fadeSeconds);
+
+    // Plays 'anim' on top of the other animations as an additive layer: the difference of
+    // each of its frames from its first frame, scaled by 'weight' and the optional per joint
+    // 'jointMask' (see buildJointMask()), is added to the pose in joint space. The layer loops
+    // on its own time cursor and is kept across setAnimation(). Null removes the layer.
+    void setAdditiveLayer(const AnimInstance * anim, float weight, std::vector<float> jointMask = {});
+    const AnimInstance * getAdditiveLayer() const noexcept { return (blendState != nullptr) ? blendState->layerAnim : nullptr; }
+
+    // While a crossfade or an additive layer is active, sampleCurrentPose() converts the
+    // poses to joint space and combines them with the pose_blend kernels. Blended entities
+    // skip the baked vertex caches and never share a pose in an InstancedCrowd.
+    bool isBlending() const noexcept
+    {
+        return blendState != nullptr && (blendState->fadeAnim != nullptr || blendState->layerAnim != nullptr);
+    }
+
+    // Level of detail version of updateAnimation() + skinModelPose(). Always advances the
+    // playback time, but only samples and skins the pose when the update interval of the
+    // level is due, otherwise the last pose is kept. Returns true if the pose was updated
+    // and needs uploadModelPose(). Same threading rules as skinModelPose().
+    // The first update of each entity is delayed by a few frames at the throttled
+    // levels, so the updates of a crowd are spread over frames.
+    bool updateWithLod(double elapsedTimeSeconds, AnimLod lod, const AnimLodPolicy & policy);
+
+    // Plays the animations from baked vertex caches (VertexAnimCache) instead of skinning the
+    // pose, trading memory for CPU time. Enabling it bakes the animations of the model that
+    // have no cache yet, which can take a while, so it's best done at load time. The caches
+    // are shared by all entities of the model. Ignored by GPU skinning. Off by default.
+    void setVertexAnimCache(bool enable);
+    bool isUsingVertexAnimCache() const noexcept { return vertexAnimCaching; }
+
+    // Baked vertexes of an animation of this model, or null if not baked yet.
+    const VertexAnimCache * findVertexAnimCache(const AnimInstance * anim) const;
+
     // Updates each mesh with the current joint skeleton and sends the new data to the GL.
     // This performs "CPU skinning" in the model. Should be called right after updateAnimation().
+    // Same as skinModelPose() followed by uploadModelPose().
     void updateModelPose();
 
+    // The CPU side of updateModelPose(): skinning and tangent basis into the local vertexes.
+    // Only touches this entity and reads the shared data, so different entities can be
+    // updated in parallel, together with updateAnimation(). No GL calls.
+    void skinModelPose();
+
+    // Sends the vertexes from skinModelPose() to the GL vertex buffer. Render thread only.
+    // With GPU skinning, the CPU side only builds the joint matrices and this uploads them.
+    void uploadModelPose();
+
+    // Bytes uploadModelPose() sends to the GL each frame, in the current skinning mode.
+    std::size_t getPoseUploadBytes() const noexcept;
+
+    // Memory owned by this entity alone: playback state, poses, skinned vertexes and its
+    // GL buffers. The model, animations, materials and shared render data are not included.
+    std::size_t getInstanceMemoryBytes() const noexcept;
+
+    // Check of the GPU skinning: skins the current pose in the vertex shader, reads it
+    // back with transform feedback and returns the largest distance to animateMesh().
+    // Returns a negative number if GPU skinning is not available for this model.
+    float measureGpuSkinningError();
+
+    // Applies a pose to the mesh vertexes, generating OpenGL render data from it.
+    // This is the scalar "CPU skinning" reference. See also SkinningBatches.
+    // Indexes are always 32-bit; the vertex arrays store them in 16 bits when they fit.
+    static void animateMesh(const Mesh & mesh,
+                            const Pose & pose,
+                            std::vector<GLDrawVertex>  * vertsOut,
+                            std::vector<GLDrawIndex32> * indexesOut);
+
     // Draw the whole model using a provided material. Will use the current pose,
     // which is the bind pose if no CPU-side animation was applied.
     void drawWholeModel(GLenum renderMode, const Mat4 & mvpMatrix, const Point3 eyePosModelSpace,
                         const MaterialInstance * material, const LightBase ** lights, int numLights);
 
+    // Draws the model 'numInstances' times with the current pose, placed by the 3x4 row-major
+    // matrices (SkinningMatrixFloats each) in 'instanceBuffer', starting at 'offsetInBytes',
+    // which must be a multiple of GLUniformBuffer::getOffsetAlignment(). The MVP, eye and
+    // lights are in the space the instance matrices map to. See InstancedCrowd.
+    void drawWholeModelInstanced(GLenum renderMode, const Mat4 & mvpMatrix, const Point3 eyePosModelSpace,
+                                 const MaterialInstance * material, const LightBase ** lights, int numLights,
+                                 const GLUniformBuffer & instanceBuffer, int offsetInBytes, int numInstances);
+
     // Draws a simple plane-projected shadow of the whole model using a cheap shader.
     void drawWholeModelShadow(const Mat4 & shadowMvp, const Point3 & lightPosModelSpace);
 
     // Visual debugging helper: Adds lines for the skeleton joints, with a point
     // at the position of each joint, if the point renderer is not null.
     void addSkeletonWireFrame(GLBatchLineRenderer  * lineRenderer,
-                              GLBatchPointRenderer * pointRenderer) const;
+                              GLBatchPointRenderer * pointRenderer);
 
     // Visual debugging helper: Adds a line trio for each normal, tangent and bi-tangent.
+    // Shows the CPU skinned vertexes, which GPU skinning doesn't update.
     void addTangentBasis(GLBatchLineRenderer  * lineRenderer,
                          GLBatchPointRenderer * pointRenderer) const;
 
     // Read-only accessors:
-    int getCurrentAnimFrame() const noexcept { return currFrame; }
-    int getAnimLoopCount()    const noexcept { return loopCount; }
-    const ModelInstance & getModelInstance() const noexcept { return model; }
+    int getCurrentAnimFrame() const noexcept;
+    int getAnimLoopCount()    const noexcept;
+    const AnimInstance * getCurrentAnimation() const noexcept { return currAnim; }
+    double getAnimTimeSeconds() const noexcept; // Playback position in the current animation, wrapped if looping.
+    double getAnimCursorSeconds() const noexcept { return animTimeSec; } // Time since setAnimation(), not wrapped.
+    const Pose & getCurrentPose() { sampleSkippedPose(); return currPose; }
+    const ModelInstance & getModelInstance() const noexcept { return *model; }
+    const std::vector<GLDrawVertex> & getSkinnedVertexes() const noexcept { return finalVerts; }
+
+    // Sphere around the model in the bind pose, in the GL draw space (model space of the
+    // draw calls). Padded, since most poses reach a bit further than the bind pose.
+    const Point3 & getBoundsCenter() const noexcept { return renderData->boundsCenter; }
+    float getBoundsRadius() const noexcept { return renderData->boundsRadius; }
+
+    // Box around the current animation frame, in the GL draw space. Merges the bounds
+    // the md5anim stores for the current and next frames, since the pose is sampled
+    // between the two. The bind pose box if there's no animation.
+    BoundingBox getAnimationBounds() const noexcept;
+
+    // Tests getAnimationBounds(), placed by 'modelMatrix', against a frustum in the
+    // space 'modelMatrix' maps to. Entities that fail it only need advanceAnimation()
+    // until they come back into view, their pose and vertexes can be left stale.
+    bool isInFrustum(const Frustum & frustum, const Mat4 & modelMatrix) const;
 
 private:
 
+    // Uniform buffer binding point of the GPU skinning joints and offset of the
+    // normal matrices in it (std140 arrays of GpuSkinningMaxJoints * 3 vec4s).
+    static constexpr GLuint JointsBufferBinding = 0;
+    static constexpr int    JointNormalMatricesOffset = GpuSkinningMaxJoints * SkinningMatrixFloats * sizeof(float);
+
+    // Binding point of the instance matrices of drawWholeModelInstanced().
+    static constexpr GLuint InstanceBufferBinding = 1;
+
+    struct ShaderUniforms;
+    struct ModelRenderData;
+    struct BlendState;
+
     // Internal helpers:
+    void findOrCreateRenderData(GLFWApp & app);
     void loadShaderProgram(GLFWApp & app);
     void loadAnimations(GLFWApp & app, const std::vector<std::string> & animFiles);
-    void setUpInitialVertexArray();
-    void applyLight(const LightBase & light, int index);
-
-    // Applies a set of skeleton joints/frames to the mesh vertexes, generating OpenGL
-    // render data from it. This is our "CPU skinning" variant for quick testing.
-    static void animateMesh(const Mesh & mesh,
-                            const std::vector<Joint>  & skelJoints,
-                            std::vector<GLDrawVertex> * vertsOut,
-                            std::vector<GLDrawIndex>  * indexesOut);
-
-    // Smoothly interpolate two skeletons/joint-sets. We can then apply the
-    // resulting joint-set to a model using animateMesh() or GPU skinning.
-    static void interpolateSkeletons(const Joint * skelA, const Joint * skelB,
-                                     int numJoints, float interp,
-                                     std::vector<Joint> & skelOut);
+    void setUpInitialVertexArray(GLFWApp & app);
+    void setUpGpuSkinning(GLFWApp & app);
+    void uploadJointMatrices();
+    void skinModelPose(bool deriveTangents);
+    void bakeVertexAnimCache(const std::shared_ptr<const AnimInstance> & animRef);
+    void blendCurrentPose(bool nlerp);
+    void sampleSkippedPose();
+    BlendState & getBlendState();
+    static int nextLodPhase() noexcept;
+    bool usingGpuSkinning() const noexcept { return g_bGpuSkinning && renderData->gpuSkinning; }
+    static void loadShaderUniforms(GLFWApp & app, GLShaderProg & prog, GLShaderProg & shadow, ShaderUniforms & vars);
+    static void applyLight(const LightBase & light, int index, GLShaderProg & prog, const ShaderUniforms & vars);
+    void setDrawUniforms(GLShaderProg & prog, const ShaderUniforms & vars, const Mat4 & mvpMatrix, const Point3 & eyePosModelSpace,
+                         const MaterialInstance * material, const LightBase ** lights, int numLights) const;
 
     // Uniform var locations from GL:
     struct ShaderUniforms
@@ -492,32 +975,239 @@ private:
         GLuint shadowParamsLoc;
     };
 
-    // DOOM 3 models use a pretty large scale, so we shrink them down a bit.
-    static constexpr float ModelScale = 0.07f;
+    // Render data derived from the model, shared by all entities using it:
+    struct ModelRenderData
+    {
+        explicit ModelRenderData(GLFWApp & owner);
+
+        // SIMD skinning data, one per mesh.
+        std::vector<SkinningBatches> meshSkinning;
+
+        // Tangent basis updates of the skinned vertexes. Like the GPU skinning
+        // vertexes, set up by the first entity, from the last mesh.
+        std::unique_ptr<TangentSpaceSolver> tangentSolver;
+
+        // Bounding box and sphere of the bind pose. Also from the last mesh.
+        BoundingBox bindPoseBounds;
+        Point3      boundsCenter;
+        float       boundsRadius;
+
+        // Baked vertexes of the animations, see setVertexAnimCache(). Last mesh only.
+        // The ResourceCache frees the clips no entity uses anymore, so each entry
+        // holds a weak reference to its clip. An expired entry never matches, even
+        // if a new clip takes the same address, and is dropped on the next bake.
+        struct VertexAnimCacheEntry
+        {
+            std::weak_ptr<const AnimInstance> anim;
+            std::unique_ptr<VertexAnimCache>  cache;
+        };
+        std::unordered_map<const AnimInstance *, VertexAnimCacheEntry> vertexAnimCaches;
+
+        // CPU skinning shaders:
+        GLShaderProg   shaderProg;
+        GLShaderProg   shadowProg;
+        ShaderUniforms shaderVars;
+
+        // GPU skinning. The static weighted vertexes and the shaders.
+        // 'gpuSkinning' is false if the model can't use it.
+        bool           gpuSkinning;
+        GLVertexArray  skinnedVertArray;
+        GLShaderProg   skinnedProg;
+        GLShaderProg   skinnedShadowProg;
+        ShaderUniforms skinnedShaderVars;
+
+        // Instanced variants of 'shaderProg' and 'skinnedProg'.
+        GLShaderProg   instancedProg;
+        GLShaderProg   skinnedInstancedProg;
+        ShaderUniforms instancedShaderVars;
+        ShaderUniforms skinnedInstancedShaderVars;
+    };
+
+    // Crossfade and additive layer of an entity, see crossfadeToAnimation().
+    struct BlendState
+    {
+        // Animation being faded out, still playing on its own time cursor.
+        const AnimInstance * fadeAnim = nullptr;
+        double fadeTimeSec     = 0.0;
+        double fadeElapsedSec  = 0.0;
+        double fadeDurationSec = 0.0;
+
+        // Additive layer and its first frame in joint space, which the deltas are taken from.
+        const AnimInstance * layerAnim = nullptr;
+        double layerTimeSec = 0.0;
+        float  layerWeight  = 0.0f;
+        std::vector<float> layerMask; // Empty for all joints.
+        BlendPose layerReference;
+
+        // Reused memory of blendCurrentPose().
+        Pose      sourcePose;
+        BlendPose sourceJoints;
+        BlendPose blendedJoints;
+    };
 
-    // The immutable model data:
-    ModelInstance model;
+    // The immutable model data, shared by the instances:
+    std::shared_ptr<const ModelInstance> model;
 
     // Set of registered animations, loaded from md5anim files.
-    AnimMap animations;
+    std::shared_ptr<AnimMap> animations;
 
     // Animation playback states:
-    int currFrame;
-    int loopCount;
-    double lastTimeSec;
+    double animTimeSec; // Time cursor in the current animation.
+    AnimLoopMode loopMode;
+    int lodFramesSinceUpdate; // See updateWithLod().
     const AnimInstance * currAnim;
-    std::vector<Joint> currSkeleton;
+    Pose currPose; // Interpolated pose of the current frame.
+    bool currPoseSkipped; // refreshCurrentPose() left the sampling to sampleSkippedPose().
+    bool currPoseNlerp;   // Rotation blending of the skipped sample.
+    Pose bindPose; // The model's joints, restored by setAnimation(nullptr).
+
+    // Allocated by the first crossfade or additive layer, so entities that don't blend pay nothing.
+    std::unique_ptr<BlendState> blendState;
+
+    // Cache of 'currAnim' if playing from baked vertexes.
+    bool vertexAnimCaching;
+    const VertexAnimCache * currVertexCache;
 
     // GL draw vertexes and indexes after applying an animation.
-    // The contents of these arrays match the OpenGL vertex/index buffers.
-    std::vector<GLDrawVertex> finalVerts;
-    std::vector<GLDrawIndex>  finalIndexes;
-
-    // Aux GL render data:
-    GLVertexArray  vertArray;
-    GLShaderProg   shaderProg;
-    GLShaderProg   shadowProg;
-    ShaderUniforms shaderVars;
+    // The contents of these arrays match the OpenGL vertex/index buffers,
+    // which may have narrowed the indexes to 16 bits.
+    std::vector<GLDrawVertex>  finalVerts;
+    std::vector<GLDrawIndex32> finalIndexes;
+
+    // Skinning data, shaders and GPU skinning vertexes of the model.
+    std::shared_ptr<ModelRenderData> renderData;
+
+    // Joint matrices of the current pose.
+    std::vector<float> skinningMatrices;
+
+    // Reused memory of the tangent basis derivation.
+    TangentSpaceSolver::Scratch tangentScratch;
+
+    // GL vertex buffer of the CPU skinned vertexes.
+    GLVertexArray vertArray;
+
+    // GPU skinning joint matrices of the current pose.
+    GLUniformBuffer    jointsBuffer;
+    std::vector<float> normalMatrices;
+};
+
+// ========================================================
+// Crowd update:
+// ========================================================
+
+// Milliseconds spent in each stage of updateCrowd().
+struct CrowdUpdateTimes
+{
+    double animateMs = 0.0; // updateAnimation() + skinModelPose() of all entities, on the pool.
+    double uploadMs  = 0.0; // uploadModelPose() of all entities, on the calling thread.
+    int    numUpdated = 0;  // Entities whose pose was sampled and skinned.
+};
+
+//
+// Advances a group of entities by the same elapsed time. The pose sampling, skinning
+// and tangent basis of each entity run on the worker pool, then the vertex buffers
+// are all sent to the GL in one pass on the calling thread, which must be the render
+// thread. Each entity should appear only once in the list.
+//
+CrowdUpdateTimes updateCrowd(AnimatedEntity * const * entities, int numEntities,
+                             double elapsedTimeSeconds, WorkerPool & pool);
+
+// Same as above, but each entity updates with AnimatedEntity::updateWithLod() at
+// the level in 'lods' (one per entity), and only the updated ones are uploaded.
+CrowdUpdateTimes updateCrowd(AnimatedEntity * const * entities, const AnimLod * lods, int numEntities,
+                             double elapsedTimeSeconds, const AnimLodPolicy & policy, WorkerPool & pool);
+
+// ========================================================
+// class InstancedCrowd:
+// ========================================================
+
+//
+// Updates and draws a crowd of entities in groups that share a pose.
+//
+// Entities are grouped by model, animation and playback time rounded down to
+// a time step. Only the first entity of each group (the leader) samples its pose
+// and is skinned, the others just advance their playback time. Entities with a
+// crossfade or additive layer (AnimatedEntity::isBlending()) are always a group
+// of their own. Each group is then
+// drawn with one glDrawElementsInstanced() from the leader's vertexes (or joints,
+// with GPU skinning) and the model matrix of every member.
+//
+// The model matrices place each entity in a common space, which is the "model space"
+// of the draw: the MVP, eye and light positions given to draw() are in that space.
+// The pose and vertexes of the entities that are not leaders are not updated.
+//
+class InstancedCrowd final
+{
+public:
+
+    struct Stats
+    {
+        int numEntities  = 0;
+        int numGroups    = 0; // Poses sampled and skinned.
+        int numDraws     = 0; // One per group, unless it has more than MaxInstancesPerDraw.
+        int numCulled    = 0; // Outside the frustum given to update(). Not grouped nor drawn.
+        double animateMs = 0.0; // Playback, grouping and skinning (on the pool).
+        double uploadMs  = 0.0; // Vertexes/joints of the leaders and the instance matrices.
+    };
+
+    // With a zero 'timeStepSeconds', only entities at the same exact time are grouped.
+    InstancedCrowd(GLFWApp & owner, double timeStepSeconds);
+
+    // Copy/assignment is disabled.
+    InstancedCrowd(const InstancedCrowd &) = delete;
+    InstancedCrowd & operator = (const InstancedCrowd &) = delete;
+
+    // When off, every entity gets its own group, skin and draw, for comparison. On by default.
+    void setGrouping(bool enable) noexcept { grouping = enable; }
+    bool isGrouping() const noexcept { return grouping; }
+
+    // Advances all entities by the elapsed time, regroups them, then skins the group
+    // leaders on the worker pool and uploads them. 'modelMatrices' has one per entity,
+    // each entity should appear only once. Render thread only. If 'frustum' is not null,
+    // entities outside it (AnimatedEntity::isInFrustum()) only advance their playback
+    // time and are left out of the groups and draws. The frustum is in the common space.
+    const Stats & update(AnimatedEntity * const * entities, const Mat4 * modelMatrices,
+                         int numEntities, double elapsedTimeSeconds, WorkerPool & pool,
+                         const Frustum * frustum = nullptr);
+
+    // Draws the groups from the last update().
+    void draw(const Mat4 & mvpMatrix, const Point3 & eyePosModelSpace, const LightBase ** lights, int numLights);
+
+    const Stats & getStats() const noexcept { return stats; }
+
+private:
+
+    // One instanced draw: leader to draw and its block of instance matrices.
+    struct Draw
+    {
+        AnimatedEntity * leader;
+        int offsetInBytes;
+        int numInstances;
+    };
+
+    // Sort key of an entity. Entities with equal keys form a group.
+    struct GroupKey
+    {
+        const ModelInstance * model;
+        const AnimInstance  * anim;
+        std::int64_t          timeStep;
+        int                   entityIndex;
+    };
+
+    void buildGroups(AnimatedEntity * const * entities, const Mat4 * modelMatrices, int numEntities);
+    void cullEntities(AnimatedEntity * const * entities, const Mat4 * modelMatrices, int numEntities, const Frustum & frustum);
+    void uploadInstanceMatrices();
+
+    const double timeStep;
+    bool grouping;
+    Stats stats;
+
+    std::vector<std::uint8_t>     entityCulled; // One per entity. Empty if not culling.
+    std::vector<GroupKey>         sortedKeys;
+    std::vector<AnimatedEntity *> leaders;
+    std::vector<Draw>             draws;
+    std::vector<float>            instanceMatrices; // 3x4 per instance, each Draw aligned for bindRange().
+    GLUniformBuffer               instanceBuffer;
 };
 
 // ========================================================
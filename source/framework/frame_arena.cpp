@@ -0,0 +1,216 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: frame_arena.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Per-frame linear (bump) allocator for short-lived temporaries.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+// ========================================================
+// FrameArena implementation:
+// ========================================================
+
+FrameArena::FrameArena(const std::size_t initialCapacityBytes)
+    : chunks          {                      }
+    , currentChunk    { 0                    }
+    , currentOffset   { 0                    }
+    , initialCapacity { initialCapacityBytes }
+    , peakBytesUsed   { 0                    }
+    , overflowCount   { 0                    }
+{
+    // Allocates memory when the first block is requested.
+}
+
+FrameArena::~FrameArena()
+{
+    freeChunks(0);
+}
+
+void * FrameArena::allocate(const std::size_t bytes, const std::size_t alignment)
+{
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "Alignment must be a power of two!");
+
+    for (;;)
+    {
+        if (currentChunk < chunks.size())
+        {
+            const Chunk & chunk = chunks[currentChunk];
+            const auto base     = reinterpret_cast<std::uintptr_t>(chunk.data);
+            const auto aligned  = (base + currentOffset + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+            const std::size_t newOffset = (aligned - base) + bytes;
+
+            if (newOffset <= chunk.size)
+            {
+                currentOffset = newOffset;
+                peakBytesUsed = std::max(peakBytesUsed, getBytesUsed());
+                return reinterpret_cast<void *>(aligned);
+            }
+
+            // Doesn't fit. Move on to the next chunk, if it was already allocated by a previous rewind.
+            if (currentChunk + 1 < chunks.size())
+            {
+                ++currentChunk;
+                currentOffset = 0;
+                continue;
+            }
+        }
+
+        addChunk(bytes + alignment);
+    }
+}
+
+void FrameArena::rewind(const Marker & marker)
+{
+    assert(marker.chunk < currentChunk || (marker.chunk == currentChunk && marker.offset <= currentOffset));
+
+    // Overflow chunks past the marker are kept for reuse until the next reset().
+    currentChunk  = marker.chunk;
+    currentOffset = marker.offset;
+}
+
+void FrameArena::reset()
+{
+    // Overflowed last frame? Merge everything into a single bigger main buffer.
+    if (chunks.size() > 1)
+    {
+        std::size_t totalSize = 0;
+        for (const Chunk & chunk : chunks)
+        {
+            totalSize += chunk.size;
+        }
+
+        freeChunks(0);
+        addChunk(totalSize);
+    }
+
+    currentChunk  = 0;
+    currentOffset = 0;
+}
+
+std::size_t FrameArena::getBytesUsed() const noexcept
+{
+    std::size_t bytes = currentOffset;
+    for (std::size_t c = 0; c < currentChunk && c < chunks.size(); ++c)
+    {
+        bytes += chunks[c].size;
+    }
+    return bytes;
+}
+
+std::size_t FrameArena::getCapacity() const noexcept
+{
+    std::size_t bytes = 0;
+    for (const Chunk & chunk : chunks)
+    {
+        bytes += chunk.size;
+    }
+    return bytes;
+}
+
+void FrameArena::addChunk(const std::size_t minBytes)
+{
+    const bool isOverflow = !chunks.empty();
+    const std::size_t size = std::max(minBytes, initialCapacity);
+
+    chunks.push_back({ static_cast<unsigned char *>(::operator new(size)), size });
+    currentChunk  = chunks.size() - 1;
+    currentOffset = 0;
+
+    if (isOverflow)
+    {
+        ++overflowCount;
+    }
+}
+
+void FrameArena::freeChunks(const std::size_t firstChunk)
+{
+    for (std::size_t c = firstChunk; c < chunks.size(); ++c)
+    {
+        ::operator delete(chunks[c].data);
+    }
+    chunks.resize(firstChunk);
+}
+
+FrameArena & getFrameArena()
+{
+    thread_local FrameArena arena;
+    return arena;
+}
+
+// ========================================================
+// Debug heap allocation tracking:
+// ========================================================
+
+#if DEBUG
+
+static thread_local bool t_bTrackFrameHeap   = false;
+static thread_local int  t_nFrameHeapAllocs  = 0;
+
+void beginFrameHeapTracking()
+{
+    t_nFrameHeapAllocs = 0;
+    t_bTrackFrameHeap  = true;
+}
+
+int endFrameHeapTracking()
+{
+    t_bTrackFrameHeap = false;
+    return t_nFrameHeapAllocs;
+}
+
+// Global allocation functions replaced to count the allocations made inside a frame.
+// The array forms end up calling these in the standard library. The nothrow forms
+// are replaced as well, since some runtimes (e.g. AddressSanitizer's) don't forward
+// them, which would pair their allocations with the delete below.
+void * operator new(const std::size_t size, const std::nothrow_t &) noexcept
+{
+    if (t_bTrackFrameHeap)
+    {
+        ++t_nFrameHeapAllocs;
+    }
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void * operator new(const std::size_t size)
+{
+    void * ptr = operator new(size, std::nothrow);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc{};
+    }
+    return ptr;
+}
+
+void operator delete(void * ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void * ptr, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+#else // !DEBUG
+
+void beginFrameHeapTracking()
+{
+}
+
+int endFrameHeapTracking()
+{
+    return 0;
+}
+
+#endif // DEBUG
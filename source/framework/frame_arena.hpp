@@ -0,0 +1,214 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: frame_arena.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Per-frame linear (bump) allocator for short-lived temporaries.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef FRAME_ARENA_HPP
+#define FRAME_ARENA_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ========================================================
+// class FrameArena:
+// ========================================================
+
+//
+// Linear allocator for temporaries that don't outlive the frame.
+//
+// Allocation is a pointer bump; there is no individual free. GLFWApp::runMainLoop()
+// resets the main thread's arena at the start of each frame, so anything allocated
+// from it is gone by the next frame. FrameArenaScope can be used to release the
+// temporaries of a function as soon as it returns instead.
+//
+// If a frame needs more than the capacity, extra chunks are taken from the heap
+// and the main buffer grows to the peak size on the next reset(), so a steady
+// state workload stops hitting the heap after the first few frames.
+//
+// Each thread has its own arena (see getFrameArena()). Only the main thread's is
+// reset by the main loop, so other threads should always wrap their allocations
+// in a FrameArenaScope.
+//
+class FrameArena final
+{
+public:
+
+    // Position in the arena, to rewind to.
+    struct Marker
+    {
+        std::size_t chunk;
+        std::size_t offset;
+    };
+
+    static constexpr std::size_t DefaultCapacity = 1024 * 1024;
+
+    explicit FrameArena(std::size_t initialCapacity = DefaultCapacity);
+    ~FrameArena();
+
+    // Not copyable.
+    FrameArena(const FrameArena &) = delete;
+    FrameArena & operator = (const FrameArena &) = delete;
+
+    // Uninitialized memory, valid until reset() or a rewind() to an earlier marker.
+    void * allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t));
+
+    template<typename T>
+    T * allocArray(const int count)
+    {
+        assert(count >= 0);
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // Releases everything allocated after the marker.
+    Marker getMarker() const noexcept { return { currentChunk, currentOffset }; }
+    void rewind(const Marker & marker);
+
+    // Releases everything. Called once per frame by the main loop.
+    void reset();
+
+    // Miscellaneous queries:
+    std::size_t getBytesUsed()     const noexcept;
+    std::size_t getPeakBytesUsed() const noexcept { return peakBytesUsed; }
+    std::size_t getCapacity()      const noexcept;
+    int getOverflowCount()         const noexcept { return overflowCount; }
+
+private:
+
+    struct Chunk
+    {
+        unsigned char * data;
+        std::size_t     size;
+    };
+
+    void addChunk(std::size_t minBytes);
+    void freeChunks(std::size_t firstChunk);
+
+    std::vector<Chunk> chunks;    // [0] is the main buffer; the others are overflow.
+    std::size_t currentChunk;
+    std::size_t currentOffset;
+    std::size_t initialCapacity;
+    std::size_t peakBytesUsed;
+    int overflowCount;            // Number of times a chunk had to be added since construction.
+};
+
+// The calling thread's arena. Allocated on first use.
+FrameArena & getFrameArena();
+
+// ========================================================
+// class FrameArenaScope:
+// ========================================================
+
+//
+// Rewinds the arena on scope exit, releasing the temporaries of a function
+// or loop iteration without waiting for the end of the frame.
+//
+class FrameArenaScope final
+{
+public:
+
+    explicit FrameArenaScope(FrameArena & frameArena = getFrameArena())
+        : arena  { frameArena             }
+        , marker { frameArena.getMarker() }
+    { }
+
+    ~FrameArenaScope()
+    {
+        arena.rewind(marker);
+    }
+
+    FrameArenaScope(const FrameArenaScope &) = delete;
+    FrameArenaScope & operator = (const FrameArenaScope &) = delete;
+
+    FrameArena & getArena() const noexcept { return arena; }
+
+private:
+
+    FrameArena & arena;
+    const FrameArena::Marker marker;
+};
+
+// ========================================================
+// template class FrameAllocator<T>:
+// ========================================================
+
+//
+// STL allocator adapter over a FrameArena. deallocate() is a no-op,
+// the memory is only reclaimed when the arena is reset or rewound.
+// Not final, since the standard containers may derive from their allocator.
+//
+template<typename T>
+class FrameAllocator
+{
+public:
+
+    using value_type = T;
+
+    FrameAllocator() noexcept
+        : arena{ &getFrameArena() }
+    { }
+
+    explicit FrameAllocator(FrameArena & frameArena) noexcept
+        : arena{ &frameArena }
+    { }
+
+    template<typename U>
+    FrameAllocator(const FrameAllocator<U> & other) noexcept
+        : arena{ other.getArena() }
+    { }
+
+    T * allocate(const std::size_t count)
+    {
+        return static_cast<T *>(arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t) noexcept
+    {
+        // Freed in bulk by the arena.
+    }
+
+    FrameArena * getArena() const noexcept { return arena; }
+
+private:
+
+    FrameArena * arena;
+};
+
+template<typename T, typename U>
+bool operator == (const FrameAllocator<T> & a, const FrameAllocator<U> & b) noexcept
+{
+    return a.getArena() == b.getArena();
+}
+
+template<typename T, typename U>
+bool operator != (const FrameAllocator<T> & a, const FrameAllocator<U> & b) noexcept
+{
+    return a.getArena() != b.getArena();
+}
+
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+// ========================================================
+// Debug heap allocation tracking:
+// ========================================================
+
+//
+// In debug builds (DEBUG defined), the framework replaces the global operator new
+// to count the heap allocations made by the main thread while a frame is running.
+// The main loop brackets each frame with these and reports frames that allocated.
+// In release builds the functions do nothing and the count is always zero.
+//
+void beginFrameHeapTracking();
+int  endFrameHeapTracking(); // Returns the number of heap allocations since the begin call.
+
+#endif // FRAME_ARENA_HPP
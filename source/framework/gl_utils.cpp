@@ -12,9 +12,12 @@
 // ================================================================================================
 
 #include "gl_utils.hpp"
+#include "frame_arena.hpp"
 
 #include <iostream>
+#include <algorithm>
 #include <climits>
+#include <cstddef>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
@@ -302,6 +305,7 @@ std::string GLShaderProg::glslVersionDirective{};
 GLShaderProg::GLShaderProg(GLFWApp & owner)
     : app{ owner }
     , handle{ 0 }
+    , feedbackVaryings{ }
 {
     // Leave uninitialized.
 }
@@ -389,6 +393,18 @@ void GLShaderProg::initFromFiles(const std::string & vsFile,
     glCompileShader(glFsHandle);
     glAttachShader(glProgHandle, glFsHandle);
 
+    // Transform feedback outputs must be known before linking.
+    if (!feedbackVaryings.empty())
+    {
+        std::vector<const char *> varyingNames;
+        for (const auto & name : feedbackVaryings)
+        {
+            varyingNames.push_back(name.c_str());
+        }
+        glTransformFeedbackVaryings(glProgHandle, static_cast<GLsizei>(varyingNames.size()),
+                                    varyingNames.data(), GL_INTERLEAVED_ATTRIBS);
+    }
+
     // Link the Shader Program then check and print the info logs, if any.
     glLinkProgram(glProgHandle);
     checkShaderInfoLogs(glProgHandle, glVsHandle, glFsHandle);
@@ -412,6 +428,15 @@ void GLShaderProg::initFromFiles(const std::string & vsFile,
                vsFile.c_str(), fsFile.c_str());
 }
 
+void GLShaderProg::setFeedbackVaryings(std::vector<std::string> varyingNames)
+{
+    if (isInitialized())
+    {
+        app.printF("WARNING! Feedback varyings set after the program was linked will be ignored!");
+    }
+    feedbackVaryings = std::move(varyingNames);
+}
+
 void GLShaderProg::cleanup() noexcept
 {
     if (isInitialized())
@@ -518,11 +543,16 @@ std::unique_ptr<char[]> GLShaderProg::loadShaderFile(const char * filename) cons
 
 GLint GLShaderProg::getUniformLocation(const std::string & uniformName) const noexcept
 {
-    if (uniformName.empty() || handle == 0)
+    return getUniformLocation(uniformName.c_str());
+}
+
+GLint GLShaderProg::getUniformLocation(const char * uniformName) const noexcept
+{
+    if (uniformName == nullptr || *uniformName == '\0' || handle == 0)
     {
         return -1;
     }
-    return glGetUniformLocation(handle, uniformName.c_str());
+    return glGetUniformLocation(handle, uniformName);
 }
 
 void GLShaderProg::setUniform1i(const GLint loc, const int val) noexcept
@@ -585,6 +615,20 @@ void GLShaderProg::setUniformPoint3(GLint loc, const Point3 & v) noexcept
     glUniform3f(loc, v.getX(), v.getY(), v.getZ());
 }
 
+bool GLShaderProg::setUniformBlockBinding(const char * blockName, const GLuint bindingIndex) noexcept
+{
+    assert(blockName != nullptr);
+
+    const GLuint blockIndex = glGetUniformBlockIndex(handle, blockName);
+    if (blockIndex == GL_INVALID_INDEX)
+    {
+        app.printF("setUniformBlockBinding: Uniform block '%s' not found!", blockName);
+        return false;
+    }
+    glUniformBlockBinding(handle, blockIndex, bindingIndex);
+    return true;
+}
+
 // ========================================================
 // class GLVertexArray:
 // ========================================================
@@ -595,8 +639,10 @@ GLVertexArray::GLVertexArray(GLFWApp & owner)
     , vbHandle   { 0 }
     , ibHandle   { 0 }
     , dataUsage  { 0 }
+    , indexType  { GLDrawIndexType }
     , vertexCount{ 0 }
     , indexCount { 0 }
+    , meshlets   { }
 {
 }
 
@@ -616,6 +662,51 @@ GLVertexArray::~GLVertexArray()
 void GLVertexArray::initFromData(const GLDrawVertex * verts, const int vertCount,
                                  const GLDrawIndex * indexes, const int idxCount,
                                  const GLenum usage, const GLVertexLayout vertLayout)
+{
+    initBuffers(verts, vertCount, indexes, idxCount, GLDrawIndexType, usage, vertLayout);
+}
+
+void GLVertexArray::initFromData(const GLDrawVertex * verts, const int vertCount,
+                                 const GLDrawIndex32 * indexes, const int idxCount,
+                                 const GLenum usage, const GLVertexLayout vertLayout)
+{
+    if (indexes == nullptr || idxCount <= 0)
+    {
+        initBuffers(verts, vertCount, nullptr, 0, GLDrawIndexType, usage, vertLayout);
+        return;
+    }
+
+    // Half the index memory when every index fits in 16 bits.
+    const GLDrawIndex32 maxIndex = *std::max_element(indexes, indexes + idxCount);
+    if (maxIndex < GLMaxIndex16Vertexes)
+    {
+        std::vector<GLDrawIndex> indexes16(indexes, indexes + idxCount);
+        initBuffers(verts, vertCount, indexes16.data(), idxCount, GLDrawIndexType, usage, vertLayout);
+    }
+    else
+    {
+        initBuffers(verts, vertCount, indexes, idxCount, GLDrawIndex32Type, usage, vertLayout);
+    }
+}
+
+void GLVertexArray::initFromMesh(const GLIndexedMesh & mesh, const GLenum usage, const GLVertexLayout vertLayout)
+{
+    if (mesh.isUsing32BitIndexes())
+    {
+        initBuffers(mesh.vertexes.data(), static_cast<int>(mesh.vertexes.size()),
+                    mesh.indexes32.data(), mesh.getIndexCount(), GLDrawIndex32Type, usage, vertLayout);
+    }
+    else
+    {
+        initBuffers(mesh.vertexes.data(), static_cast<int>(mesh.vertexes.size()),
+                    mesh.indexes16.data(), mesh.getIndexCount(), GLDrawIndexType, usage, vertLayout);
+    }
+    meshlets = mesh.meshlets;
+}
+
+void GLVertexArray::initBuffers(const GLDrawVertex * verts, const int vertCount, const void * indexes,
+                                const int idxCount, const GLenum idxType, const GLenum usage,
+                                const GLVertexLayout vertLayout)
 {
     if (isInitialized())
     {
@@ -639,7 +730,8 @@ void GLVertexArray::initFromData(const GLDrawVertex * verts, const int vertCount
     {
         glGenBuffers(1, &ibHandle);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxCount * sizeof(GLDrawIndex), indexes, usage);
+        const std::size_t idxSizeBytes = (idxType == GLDrawIndex32Type) ? sizeof(GLDrawIndex32) : sizeof(GLDrawIndex);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxCount * idxSizeBytes, indexes, usage);
     }
     else
     {
@@ -662,19 +754,33 @@ void GLVertexArray::initFromData(const GLDrawVertex * verts, const int vertCount
         setGLPointsVertexLayout();
         break;
 
+    case GLVertexLayout::SkinnedTriangles :
+        setGLSkinnedTrianglesVertexLayout();
+        break;
+
     default :
         app.errorF("Invalid GLVertexLayout enum!");
     } // switch (vertLayout)
 
     // Save these for later:
     dataUsage   = usage;
+    indexType   = idxType;
     vertexCount = vertCount;
     indexCount  = idxCount;
+    meshlets.clear();
 
     // VAOs can be a pain in the neck if left enabled...
     bindNull();
 
-    app.printF("New vertex array created: %d verts, %d indexes.", vertexCount, indexCount);
+    if (isIndexed())
+    {
+        app.printF("New vertex array created: %d verts, %d indexes (%d-bit).",
+                   vertexCount, indexCount, getIndexSizeBytes() * 8);
+    }
+    else
+    {
+        app.printF("New vertex array created: %d verts, %d indexes.", vertexCount, indexCount);
+    }
 }
 
 void GLVertexArray::cleanup() noexcept
@@ -731,7 +837,8 @@ void GLVertexArray::bindNull() noexcept
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-void GLVertexArray::setGLTrianglesVertexLayout() noexcept
+// Attributes 0 to 5, shared by the GLDrawVertex and GLSkinnedVertex layouts.
+static void setDrawVertexAttribPointers(const GLsizei stride) noexcept
 {
     std::size_t offset = 0;
 
@@ -742,7 +849,7 @@ void GLVertexArray::setGLTrianglesVertexLayout() noexcept
         /* size      = */ 3,
         /* type      = */ GL_FLOAT,
         /* normalize = */ GL_FALSE,
-        /* stride    = */ sizeof(GLDrawVertex),
+        /* stride    = */ stride,
         /* offset    = */ reinterpret_cast<GLvoid *>(offset));
     offset += sizeof(float) * 3;
 
@@ -753,7 +860,7 @@ void GLVertexArray::setGLTrianglesVertexLayout() noexcept
         /* size      = */ 3,
         /* type      = */ GL_FLOAT,
         /* normalize = */ GL_FALSE,
-        /* stride    = */ sizeof(GLDrawVertex),
+        /* stride    = */ stride,
         /* offset    = */ reinterpret_cast<GLvoid *>(offset));
     offset += sizeof(float) * 3;
 
@@ -764,7 +871,7 @@ void GLVertexArray::setGLTrianglesVertexLayout() noexcept
         /* size      = */ 4,
         /* type      = */ GL_FLOAT,
         /* normalize = */ GL_FALSE,
-        /* stride    = */ sizeof(GLDrawVertex),
+        /* stride    = */ stride,
         /* offset    = */ reinterpret_cast<GLvoid *>(offset));
     offset += sizeof(float) * 4;
 
@@ -775,7 +882,7 @@ void GLVertexArray::setGLTrianglesVertexLayout() noexcept
         /* size      = */ 2,
         /* type      = */ GL_FLOAT,
         /* normalize = */ GL_FALSE,
-        /* stride    = */ sizeof(GLDrawVertex),
+        /* stride    = */ stride,
         /* offset    = */ reinterpret_cast<GLvoid *>(offset));
     offset += sizeof(float) * 2;
 
@@ -786,7 +893,7 @@ void GLVertexArray::setGLTrianglesVertexLayout() noexcept
         /* size      = */ 3,
         /* type      = */ GL_FLOAT,
         /* normalize = */ GL_FALSE,
-        /* stride    = */ sizeof(GLDrawVertex),
+        /* stride    = */ stride,
         /* offset    = */ reinterpret_cast<GLvoid *>(offset));
     offset += sizeof(float) * 3;
 
@@ -797,9 +904,43 @@ void GLVertexArray::setGLTrianglesVertexLayout() noexcept
         /* size      = */ 3,
         /* type      = */ GL_FLOAT,
         /* normalize = */ GL_FALSE,
-        /* stride    = */ sizeof(GLDrawVertex),
+        /* stride    = */ stride,
         /* offset    = */ reinterpret_cast<GLvoid *>(offset));
     /*offset += sizeof(float) * 3;*/
+}
+
+void GLVertexArray::setGLTrianglesVertexLayout() noexcept
+{
+    setDrawVertexAttribPointers(sizeof(GLDrawVertex));
+    CHECK_GL_ERRORS(&app);
+}
+
+void GLVertexArray::setGLSkinnedTrianglesVertexLayout() noexcept
+{
+    // The bind pose vertex:
+    setDrawVertexAttribPointers(sizeof(GLSkinnedVertex));
+
+    // Joint indexes (integer attribute):
+    glEnableVertexAttribArray(6);
+    glVertexAttribIPointer(
+        /* index     = */ 6,
+        /* size      = */ 4,
+        /* type      = */ GL_UNSIGNED_BYTE,
+        /* stride    = */ sizeof(GLSkinnedVertex),
+        /* offset    = */ reinterpret_cast<GLvoid *>(offsetof(GLSkinnedVertex, joints)));
+
+    // One vec4 per weight:
+    for (int w = 0; w < GLSkinnedVertex::MaxWeights; ++w)
+    {
+        glEnableVertexAttribArray(7 + w);
+        glVertexAttribPointer(
+            /* index     = */ 7 + w,
+            /* size      = */ 4,
+            /* type      = */ GL_FLOAT,
+            /* normalize = */ GL_FALSE,
+            /* stride    = */ sizeof(GLSkinnedVertex),
+            /* offset    = */ reinterpret_cast<GLvoid *>(offsetof(GLSkinnedVertex, weights) + sizeof(float) * 4 * w));
+    }
 
     CHECK_GL_ERRORS(&app);
 }
@@ -879,10 +1020,11 @@ void GLVertexArray::updateRawData(const void * vertData, const int vertCount, co
     if (idxData != nullptr && idxCount > 0)
     {
         assert(ibHandle != 0);
-        assert(idxSizeBytes > 0);
+        assert(idxSizeBytes == sizeof(GLDrawIndex) || idxSizeBytes == sizeof(GLDrawIndex32));
 
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxCount * idxSizeBytes, idxData, dataUsage);
         indexCount = idxCount;
+        indexType  = (idxSizeBytes == sizeof(GLDrawIndex32)) ? GLDrawIndex32Type : GLDrawIndexType;
     }
 }
 
@@ -946,7 +1088,14 @@ void GLVertexArray::unMapIB() noexcept
 
 void GLVertexArray::draw(const GLenum renderMode) const noexcept
 {
-    if (isIndexed())
+    if (!meshlets.empty())
+    {
+        for (const GLMeshlet & meshlet : meshlets)
+        {
+            drawIndexedBaseVertex(renderMode, meshlet.firstIndex, meshlet.indexCount, meshlet.baseVertex);
+        }
+    }
+    else if (isIndexed())
     {
         drawIndexed(renderMode, 0, indexCount);
     }
@@ -966,8 +1115,8 @@ void GLVertexArray::drawIndexed(const GLenum renderMode,
     assert(idxCount > 0);
     assert(idxCount <= indexCount);
 
-    const std::uintptr_t offsetBytes = firstIndex * sizeof(GLDrawIndex);
-    glDrawElements(renderMode, idxCount, GLDrawIndexType,
+    const std::uintptr_t offsetBytes = firstIndex * getIndexSizeBytes();
+    glDrawElements(renderMode, idxCount, indexType,
                    reinterpret_cast<const GLvoid *>(offsetBytes));
 }
 
@@ -983,6 +1132,31 @@ void GLVertexArray::drawUnindexed(const GLenum renderMode,
     glDrawArrays(renderMode, firstVertex, vertCount);
 }
 
+void GLVertexArray::drawInstanced(const GLenum renderMode, const int instanceCount) const noexcept
+{
+    assert(isInitialized());
+    assert(instanceCount > 0);
+
+    if (!meshlets.empty())
+    {
+        for (const GLMeshlet & meshlet : meshlets)
+        {
+            const std::uintptr_t offsetBytes = meshlet.firstIndex * getIndexSizeBytes();
+            glDrawElementsInstancedBaseVertex(renderMode, meshlet.indexCount, indexType,
+                                              reinterpret_cast<const GLvoid *>(offsetBytes),
+                                              instanceCount, meshlet.baseVertex);
+        }
+    }
+    else if (isIndexed())
+    {
+        glDrawElementsInstanced(renderMode, indexCount, indexType, nullptr, instanceCount);
+    }
+    else
+    {
+        glDrawArraysInstanced(renderMode, 0, vertexCount, instanceCount);
+    }
+}
+
 void GLVertexArray::drawIndexedBaseVertex(const GLenum renderMode,
                                           const int firstIndex,
                                           const int idxCount,
@@ -994,11 +1168,114 @@ void GLVertexArray::drawIndexedBaseVertex(const GLenum renderMode,
     assert(idxCount > 0);
     assert(idxCount <= indexCount);
 
-    const std::uintptr_t offsetBytes = firstIndex * sizeof(GLDrawIndex);
-    glDrawElementsBaseVertex(renderMode, idxCount, GLDrawIndexType,
+    const std::uintptr_t offsetBytes = firstIndex * getIndexSizeBytes();
+    glDrawElementsBaseVertex(renderMode, idxCount, indexType,
                              reinterpret_cast<const GLvoid *>(offsetBytes), baseVert);
 }
 
+// ========================================================
+// class GLUniformBuffer:
+// ========================================================
+
+GLUniformBuffer::GLUniformBuffer(GLFWApp & owner)
+    : app        { owner }
+    , handle     { 0 }
+    , sizeInBytes{ 0 }
+{
+}
+
+GLUniformBuffer::~GLUniformBuffer()
+{
+    cleanup();
+}
+
+void GLUniformBuffer::initWithSize(const int sizeBytes, const void * data, const GLenum usage)
+{
+    assert(sizeBytes > 0);
+
+    if (isInitialized())
+    {
+        app.errorF("Uniform Buffer already initialized! Call cleanup() first!");
+    }
+
+    glGenBuffers(1, &handle);
+    glBindBuffer(GL_UNIFORM_BUFFER, handle);
+    glBufferData(GL_UNIFORM_BUFFER, sizeBytes, data, usage);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    CHECK_GL_ERRORS(&app);
+    sizeInBytes = sizeBytes;
+}
+
+void GLUniformBuffer::updateRange(const int offsetInBytes, const int sizeBytes, const void * data) noexcept
+{
+    assert(isInitialized());
+    assert(data != nullptr);
+    assert(offsetInBytes >= 0 && offsetInBytes + sizeBytes <= sizeInBytes);
+
+    glBufferSubData(GL_UNIFORM_BUFFER, offsetInBytes, sizeBytes, data);
+}
+
+void GLUniformBuffer::cleanup() noexcept
+{
+    if (handle != 0)
+    {
+        bindNull();
+        glDeleteBuffers(1, &handle);
+        handle = 0;
+    }
+    sizeInBytes = 0;
+}
+
+void GLUniformBuffer::bind() const noexcept
+{
+    if (handle == 0)
+    {
+        app.printF("Trying to bind a null UBO!");
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, handle);
+}
+
+void GLUniformBuffer::bindNull() noexcept
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void GLUniformBuffer::bindBase(const GLuint bindingIndex) const noexcept
+{
+    if (handle == 0)
+    {
+        app.printF("Trying to bind a null UBO!");
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, bindingIndex, handle);
+}
+
+void GLUniformBuffer::bindRange(const GLuint bindingIndex, const int offsetInBytes, const int sizeBytes) const noexcept
+{
+    assert(offsetInBytes % getOffsetAlignment() == 0);
+    assert(offsetInBytes >= 0 && offsetInBytes + sizeBytes <= sizeInBytes);
+
+    if (handle == 0)
+    {
+        app.printF("Trying to bind a null UBO!");
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, bindingIndex, handle, offsetInBytes, sizeBytes);
+}
+
+int GLUniformBuffer::getOffsetAlignment() noexcept
+{
+    static GLint alignment = 0;
+    if (alignment == 0)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        if (alignment <= 0)
+        {
+            alignment = 256; // Largest value in common use.
+        }
+    }
+    return alignment;
+}
+
 // ========================================================
 // class GLBatchLineRenderer:
 // ========================================================
@@ -1182,6 +1459,7 @@ GLBatchTextRenderer::GLBatchTextRenderer(GLFWApp & owner, const int initialBatch
     if (initialBatchSize > 0)
     {
         textStrings.reserve(initialBatchSize);
+        textChars.reserve(initialBatchSize * 64);
         glyphsVerts.reserve(initialBatchSize * 6 * 64); // 6 verts per glyph, ~64 glyph per string average
     }
 
@@ -1220,8 +1498,7 @@ void GLBatchTextRenderer::addText(const float x, const float y, const float scal
     {
         return;
     }
-    textStrings.emplace_back(x, y, scaling, color, text);
-    needGLUpdate = true;
+    pushString(x, y, scaling, color, text, std::strlen(text));
 }
 
 void GLBatchTextRenderer::addTextF(const float x, const float y, const float scaling,
@@ -1241,11 +1518,23 @@ void GLBatchTextRenderer::addTextF(const float x, const float y, const float sca
 
     if (result > 0 && result < arrayLength(buffer))
     {
-        textStrings.emplace_back(x, y, scaling, color, buffer);
-        needGLUpdate = true;
+        pushString(x, y, scaling, color, buffer, result);
     }
 }
 
+void GLBatchTextRenderer::pushString(const float x, const float y, const float scaling,
+                                     const Vec4 & color, const char * const text, const int length)
+{
+    // Copied into the shared character buffer, which keeps its capacity
+    // across clear() calls, so there are no per-string allocations.
+    const int offset = textChars.size();
+    textChars.insert(textChars.end(), text, text + length);
+    textChars.push_back('\0');
+
+    textStrings.emplace_back(x, y, scaling, color, offset);
+    needGLUpdate = true;
+}
+
 void GLBatchTextRenderer::drawText(const int scrWidth, const int scrHeight)
 {
     if (textStrings.empty())
@@ -1261,7 +1550,7 @@ void GLBatchTextRenderer::drawText(const int scrWidth, const int scrHeight)
         for (const TextString & str : textStrings)
         {
             // Left-aligned
-            pushStringGlyphs(str.posX, str.posY, str.scaling, str.color, str.text.c_str());
+            pushStringGlyphs(str.posX, str.posY, str.scaling, str.color, &textChars[str.textOffset]);
         }
 
         glyphsVA.bindVB();
@@ -1295,6 +1584,7 @@ void GLBatchTextRenderer::clear()
     }
 
     textStrings.clear();
+    textChars.clear();
     glyphsVerts.clear();
     needGLUpdate = false;
 }
@@ -1424,10 +1714,11 @@ GLError::~GLError() { }
 
 GLFWApp::GLFWApp(const int winWidth, const int winHeight,
                  const float * clearColor, std::string title)
-    : windowWidth   { winWidth  }
-    , windowHeight  { winHeight }
-    , glfwWindowPtr { nullptr   }
-    , windowTitle   { std::move(title) }
+    : windowWidth     { winWidth  }
+    , windowHeight    { winHeight }
+    , glfwWindowPtr   { nullptr   }
+    , windowTitle     { std::move(title) }
+    , frameHeapAllocs { 0         }
 {
     if (clearColor != nullptr)
     {
@@ -1622,15 +1913,36 @@ void GLFWApp::runMainLoop()
 
     std::int64_t t0, t1;
     std::int64_t deltaTime = 33; // Assume an initial ~30fps.
+    std::int64_t frameNumber = 0;
+    int lastReportedHeapAllocs = 0;
+
+    FrameArena & frameArena = getFrameArena();
 
     while (!glfwWindowShouldClose(glfwWindowPtr))
     {
         t0 = getTimeMilliseconds();
 
+        // Temporaries from the previous frame are released here.
+        frameArena.reset();
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        beginFrameHeapTracking();
         onFrameUpdate(t0, deltaTime);
         onFrameRender(t0, deltaTime);
+        frameHeapAllocs = endFrameHeapTracking();
+
+        // Only report when the count changes, to avoid flooding the log every frame.
+        if (frameHeapAllocs != lastReportedHeapAllocs)
+        {
+            if (frameHeapAllocs != 0)
+            {
+                printF("Frame %lld made %i heap allocation(s)! Consider using the frame arena.",
+                       static_cast<long long>(frameNumber), frameHeapAllocs);
+            }
+            lastReportedHeapAllocs = frameHeapAllocs;
+        }
+        ++frameNumber;
 
         glfwSwapBuffers(glfwWindowPtr);
         glfwPollEvents();
@@ -1804,9 +2116,10 @@ static float toggleSignBit(float f, std::uint32_t signBit)
     return f2i.asFloat;
 }
 
-void deriveNormalsAndTangents(const GLDrawVertex * vertsIn,   const int vertCount,
-                              const GLDrawIndex  * indexesIn, const int indexCount,
-                              GLDrawVertex * vertsOut)
+template<typename IndexType>
+static void deriveNormalsAndTangentsImpl(const GLDrawVertex * vertsIn,   const int vertCount,
+                                         const IndexType    * indexesIn, const int indexCount,
+                                         GLDrawVertex * vertsOut)
 {
     assert(vertsIn   != nullptr);
     assert(indexesIn != nullptr);
@@ -1814,10 +2127,17 @@ void deriveNormalsAndTangents(const GLDrawVertex * vertsIn,   const int vertCoun
     assert(vertCount  > 0);
     assert(indexCount > 0);
 
+    // Scratch arrays come from the frame arena, since this runs every frame for animated models.
+    FrameArenaScope scratchScope;
+    FrameArena & scratch = scratchScope.getArena();
+
     const Vec3 vZero{ 0.0f, 0.0f, 0.0f };
-    std::vector<Vec3> vertexNormals(vertCount, vZero);
-    std::vector<Vec3> vertexTangents(vertCount, vZero);
-    std::vector<Vec3> vertexBitangents(vertCount, vZero);
+    Vec3 * vertexNormals    = scratch.allocArray<Vec3>(vertCount);
+    Vec3 * vertexTangents   = scratch.allocArray<Vec3>(vertCount);
+    Vec3 * vertexBitangents = scratch.allocArray<Vec3>(vertCount);
+    std::uninitialized_fill_n(vertexNormals,    vertCount, vZero);
+    std::uninitialized_fill_n(vertexTangents,   vertCount, vZero);
+    std::uninitialized_fill_n(vertexBitangents, vertCount, vZero);
 
     for (int i = 0; i < indexCount; i += 3)
     {
@@ -1926,3 +2246,109 @@ void deriveNormalsAndTangents(const GLDrawVertex * vertsIn,   const int vertCoun
         vertsOut[i].bz = vertexBitangents[i][2];
     }
 }
+
+void deriveNormalsAndTangents(const GLDrawVertex * vertsIn,   const int vertCount,
+                              const GLDrawIndex  * indexesIn, const int indexCount,
+                              GLDrawVertex * vertsOut)
+{
+    deriveNormalsAndTangentsImpl(vertsIn, vertCount, indexesIn, indexCount, vertsOut);
+}
+
+void deriveNormalsAndTangents(const GLDrawVertex  * vertsIn,   const int vertCount,
+                              const GLDrawIndex32 * indexesIn, const int indexCount,
+                              GLDrawVertex * vertsOut)
+{
+    deriveNormalsAndTangentsImpl(vertsIn, vertCount, indexesIn, indexCount, vertsOut);
+}
+
+// ========================================================
+// buildIndexedMesh():
+// ========================================================
+
+void buildIndexedMesh(const GLDrawVertex * verts, const int vertCount,
+                      const GLDrawIndex32 * indexes, const int idxCount,
+                      const GLLargeMeshPolicy policy, GLIndexedMesh * meshOut)
+{
+    assert(verts    != nullptr);
+    assert(indexes  != nullptr);
+    assert(meshOut  != nullptr);
+    assert(vertCount > 0);
+    assert(idxCount  > 0 && (idxCount % 3) == 0);
+
+    meshOut->vertexes.clear();
+    meshOut->indexes16.clear();
+    meshOut->indexes32.clear();
+    meshOut->meshlets.clear();
+
+    // Small enough for 16-bit indexes as it is.
+    if (vertCount <= GLMaxIndex16Vertexes)
+    {
+        meshOut->vertexes.assign(verts, verts + vertCount);
+        meshOut->indexes16.assign(indexes, indexes + idxCount);
+        return;
+    }
+
+    if (policy == GLLargeMeshPolicy::Index32)
+    {
+        meshOut->vertexes.assign(verts, verts + vertCount);
+        meshOut->indexes32.assign(indexes, indexes + idxCount);
+        return;
+    }
+
+    //
+    // Meshlets: walk the triangles in order, giving each source vertex a local
+    // index the first time the current meshlet uses it. A triangle that would
+    // take the meshlet past the 16-bit limit starts a new one instead.
+    //
+    std::vector<int> localIndexes(vertCount, -1); // Local index of each source vertex in the current meshlet.
+    std::vector<int> meshletSourceVerts;          // Source vertexes of the current meshlet, for resetting the above.
+    meshletSourceVerts.reserve(GLMaxIndex16Vertexes);
+
+    meshOut->vertexes.reserve(vertCount);
+    meshOut->indexes16.reserve(idxCount);
+
+    GLMeshlet meshlet{ 0, 0, 0 };
+    for (int i = 0; i < idxCount; i += 3)
+    {
+        int newVerts = 0;
+        for (int v = 0; v < 3; ++v)
+        {
+            const GLDrawIndex32 index = indexes[i + v];
+            assert(static_cast<int>(index) < vertCount);
+
+            // A vertex repeated within the triangle only counts once.
+            if (localIndexes[index] < 0 && (v == 0 || index != indexes[i]) && (v != 2 || index != indexes[i + 1]))
+            {
+                ++newVerts;
+            }
+        }
+
+        if (static_cast<int>(meshletSourceVerts.size()) + newVerts > GLMaxIndex16Vertexes)
+        {
+            meshOut->meshlets.push_back(meshlet);
+            meshlet.firstIndex = static_cast<int>(meshOut->indexes16.size());
+            meshlet.indexCount = 0;
+            meshlet.baseVertex = static_cast<int>(meshOut->vertexes.size());
+
+            for (const int sourceVert : meshletSourceVerts)
+            {
+                localIndexes[sourceVert] = -1;
+            }
+            meshletSourceVerts.clear();
+        }
+
+        for (int v = 0; v < 3; ++v)
+        {
+            const GLDrawIndex32 index = indexes[i + v];
+            if (localIndexes[index] < 0)
+            {
+                localIndexes[index] = static_cast<int>(meshletSourceVerts.size());
+                meshletSourceVerts.push_back(index);
+                meshOut->vertexes.push_back(verts[index]);
+            }
+            meshOut->indexes16.push_back(static_cast<GLDrawIndex>(localIndexes[index]));
+        }
+        meshlet.indexCount += 3;
+    }
+    meshOut->meshlets.push_back(meshlet);
+}
@@ -18,6 +18,7 @@
 #include <GLFW/glfw3.h>
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <stdexcept>
 #include <utility>
@@ -130,6 +131,15 @@ struct GLDrawVertex final
     float bx, by, bz; // Bi-tangent vector
 };
 
+struct GLSkinnedVertex final
+{
+    static constexpr int MaxWeights = 4;
+
+    GLDrawVertex bindPose;                  // Vertex and tangent basis in the bind pose
+    std::uint8_t joints[MaxWeights];        // Joint index of each weight
+    float        weights[MaxWeights][4];    // xyz=joint space position * bias, w=bias. Zero if unused
+};
+
 struct GLLineVertex final
 {
     GLLineVertex() = default;
@@ -166,22 +176,79 @@ struct GLPointVertex final
     float r, g, b, a;
 };
 
-// Type used for vertex indexing:
-using GLDrawIndex = std::uint16_t;
-constexpr GLenum GLDrawIndexType = GL_UNSIGNED_SHORT;
+// Types used for vertex indexing. The index width is a property of each GLVertexArray:
+// 16 bits whenever the indexes fit, which is most meshes, and 32 bits for the rest.
+using GLDrawIndex   = std::uint16_t;
+using GLDrawIndex32 = std::uint32_t;
+constexpr GLenum GLDrawIndexType   = GL_UNSIGNED_SHORT;
+constexpr GLenum GLDrawIndex32Type = GL_UNSIGNED_INT;
+
+// Number of vertexes a 16-bit index can address.
+constexpr int GLMaxIndex16Vertexes = 65536;
 
 // Supported vertex layouts/formats:
 enum class GLVertexLayout
 {
-    Triangles, // GLDrawVertex layout
-    Lines,     // GLLineVertex layout (for GLBatchLineRenderer)
-    Points     // GLPointVertex layout (for GLBatchPointRenderer)
+    Triangles,       // GLDrawVertex layout
+    Lines,           // GLLineVertex layout (for GLBatchLineRenderer)
+    Points,          // GLPointVertex layout (for GLBatchPointRenderer)
+    SkinnedTriangles // GLSkinnedVertex layout (for GPU skinning)
 };
 
 // Helper to compute model normals, tangents and bi-tangents for normal-mapping.
 void deriveNormalsAndTangents(const GLDrawVertex * vertsIn,   int vertCount,
                               const GLDrawIndex  * indexesIn, int indexCount,
                               GLDrawVertex * vertsOut);
+void deriveNormalsAndTangents(const GLDrawVertex  * vertsIn,   int vertCount,
+                              const GLDrawIndex32 * indexesIn, int indexCount,
+                              GLDrawVertex * vertsOut);
+
+// ========================================================
+// Large mesh indexing:
+// ========================================================
+
+// How buildIndexedMesh() lays out a mesh with more vertexes than 16-bit indexes can address.
+enum class GLLargeMeshPolicy
+{
+    Index32, // Vertexes as they are, one 32-bit index buffer and a single draw call.
+    Meshlets // Triangles split into meshlets of up to GLMaxIndex16Vertexes vertexes, each
+             // with 16-bit indexes and drawn with GLVertexArray::drawIndexedBaseVertex().
+};
+
+// A range of the index buffer drawn with its own base vertex.
+struct GLMeshlet
+{
+    int firstIndex;
+    int indexCount;
+    int baseVertex;
+};
+
+// Triangle list laid out for GLVertexArray::initFromMesh() by buildIndexedMesh().
+struct GLIndexedMesh
+{
+    std::vector<GLDrawVertex>  vertexes;
+    std::vector<GLDrawIndex>   indexes16; // Only one of the index arrays is used.
+    std::vector<GLDrawIndex32> indexes32;
+    std::vector<GLMeshlet>     meshlets;  // Empty if the mesh is drawn with a single call.
+
+    bool isUsing32BitIndexes() const noexcept { return !indexes32.empty(); }
+    int getIndexCount() const noexcept { return static_cast<int>(indexes16.size() + indexes32.size()); }
+    int getDrawCount()  const noexcept { return meshlets.empty() ? 1 : static_cast<int>(meshlets.size()); }
+
+    std::size_t getVertexBytes() const noexcept { return vertexes.size() * sizeof(GLDrawVertex); }
+    std::size_t getIndexBytes()  const noexcept { return indexes16.size() * sizeof(GLDrawIndex) + indexes32.size() * sizeof(GLDrawIndex32); }
+};
+
+//
+// Lays out a triangle list with the narrowest indexes that work: 16-bit if all the
+// vertexes fit, otherwise as 'policy' says. A meshlet gets a copy of the vertexes
+// its triangles use, in order of first use, so vertexes shared across a meshlet
+// boundary are duplicated. The triangles keep their order with both policies, but
+// the meshlet vertexes don't, so meshlets only suit static meshes.
+//
+void buildIndexedMesh(const GLDrawVertex * verts, int vertCount,
+                      const GLDrawIndex32 * indexes, int idxCount,
+                      GLLargeMeshPolicy policy, GLIndexedMesh * meshOut);
 
 // ========================================================
 // class GLTexture: Simple OGL texture handle wrapper
@@ -300,6 +367,10 @@ public:
     // Prints the shader/program info log to the GLFWApp debug output.
     void initFromFiles(const std::string & vsFile, const std::string & fsFile);
 
+    // Vertex shader outputs to capture with transform feedback (interleaved).
+    // Only applied when the program is linked, so call it before initFromFiles().
+    void setFeedbackVaryings(std::vector<std::string> varyingNames);
+
     // This frees the underlaying program handle, but leaves this object intact.
     void cleanup() noexcept;
 
@@ -317,6 +388,7 @@ public:
 
     // Get the shader uniform handle (AKA location):
     GLint getUniformLocation(const std::string & uniformName) const noexcept;
+    GLint getUniformLocation(const char * uniformName) const noexcept;
 
     // Set uniform values (shader program should be already bound):
     void setUniform1i(GLint loc, int   val) noexcept;
@@ -326,6 +398,9 @@ public:
     void setUniformMat4(GLint loc, const Mat4 & m) noexcept;
     void setUniformPoint3(GLint loc, const Point3 & v) noexcept;
 
+    // Assigns a uniform block to a GLUniformBuffer binding point. Returns false if not found.
+    bool setUniformBlockBinding(const char * blockName, GLuint bindingIndex) noexcept;
+
 private:
 
     void checkShaderInfoLogs(GLuint progHandle, GLuint vsHandle, GLuint fsHandle) const;
@@ -333,6 +408,7 @@ private:
 
     GLFWApp & app;
     GLuint handle;
+    std::vector<std::string> feedbackVaryings;
 
     // Shared by all programs. Set when the first shader is loaded.
     static std::string glslVersionDirective;
@@ -363,12 +439,28 @@ public:
                       const GLDrawIndex * indexes, int idxCount,
                       GLenum usage, GLVertexLayout vertLayout);
 
+    // Same as above with 32-bit indexes, which are stored in 16 bits if they all fit.
+    void initFromData(const GLDrawVertex * verts, int vertCount,
+                      const GLDrawIndex32 * indexes, int idxCount,
+                      GLenum usage, GLVertexLayout vertLayout);
+
+    // Unindexed data, with a null pointer literal for the indexes.
+    void initFromData(const GLDrawVertex * verts, int vertCount, std::nullptr_t, int,
+                      GLenum usage, GLVertexLayout vertLayout)
+    {
+        initFromData(verts, vertCount, static_cast<const GLDrawIndex *>(nullptr), 0, usage, vertLayout);
+    }
+
+    // Mesh from buildIndexedMesh(). draw() and drawInstanced() issue one call per meshlet.
+    void initFromMesh(const GLIndexedMesh & mesh, GLenum usage, GLVertexLayout vertLayout);
+
     // Built-ins:
     void initWithBoxMesh(GLenum usage, float width, float height, float depth, const float * color);
     void initWithTeapotMesh(GLenum usage, float scale, const float * color);
     void initWithQuadMesh(GLenum usage, float scale, const float * color);
 
     // Raw data upload on an already initialized vertex array.
+    // 'idxSizeBytes' also sets the index width: 2 or 4 bytes.
     void updateRawData(const void * vertData, int vertCount, int vertSizeBytes,
                        const void * idxData,  int idxCount,  int idxSizeBytes);
 
@@ -391,6 +483,9 @@ public:
     void setGLLinesVertexLayout() noexcept;
     void setGLPointsVertexLayout() noexcept;
 
+    // GLDrawVertex attributes plus the joints (6) and weights (7 to 10) of GLSkinnedVertex.
+    void setGLSkinnedTrianglesVertexLayout() noexcept;
+
     // Calls cleanup().
     ~GLVertexArray();
 
@@ -410,10 +505,11 @@ public:
     // Draw calls (must bind first):
     //
 
-    void draw(GLenum renderMode) const noexcept; // => Draws the whole array, indexed or not.
+    void draw(GLenum renderMode) const noexcept; // => Draws the whole array, indexed or not, meshlets included.
     void drawIndexed(GLenum renderMode, int firstIndex, int idxCount) const noexcept;
     void drawUnindexed(GLenum renderMode, int firstVertex, int vertCount) const noexcept;
     void drawIndexedBaseVertex(GLenum renderMode, int firstIndex, int idxCount, int baseVert) const noexcept;
+    void drawInstanced(GLenum renderMode, int instanceCount) const noexcept; // => Whole array, 'instanceCount' times.
 
     //
     // Misc accessors:
@@ -426,15 +522,78 @@ public:
     int getIndexCount()  const noexcept { return indexCount;  }
     int getVertexCount() const noexcept { return vertexCount; }
 
+    GLenum getIndexType()    const noexcept { return indexType; } // GLDrawIndexType or GLDrawIndex32Type.
+    int getIndexSizeBytes()  const noexcept { return (indexType == GLDrawIndex32Type) ? sizeof(GLDrawIndex32) : sizeof(GLDrawIndex); }
+    int getDrawCount()       const noexcept { return meshlets.empty() ? 1 : static_cast<int>(meshlets.size()); }
+    const std::vector<GLMeshlet> & getMeshlets() const noexcept { return meshlets; }
+
 private:
 
+    void initBuffers(const GLDrawVertex * verts, int vertCount, const void * indexes,
+                     int idxCount, GLenum idxType, GLenum usage, GLVertexLayout vertLayout);
+
     GLFWApp & app;
     GLuint    vaHandle;
     GLuint    vbHandle;
     GLuint    ibHandle;
     GLenum    dataUsage;
+    GLenum    indexType;
     int       vertexCount;
     int       indexCount;
+
+    // Set by initFromMesh() for the meshes split into meshlets.
+    std::vector<GLMeshlet> meshlets;
+};
+
+// ========================================================
+// class GLUniformBuffer: OGL Uniform Buffer Object (UBO)
+// ========================================================
+
+class GLUniformBuffer final
+{
+public:
+
+    // Copy/assignment is disabled.
+    GLUniformBuffer(const GLUniformBuffer &) = delete;
+    GLUniformBuffer & operator = (const GLUniformBuffer &) = delete;
+
+    // Construct a null/zero/empty UBO.
+    explicit GLUniformBuffer(GLFWApp & owner);
+
+    // Allocates the buffer storage. 'data' is optional and may be null.
+    void initWithSize(int sizeInBytes, const void * data, GLenum usage);
+
+    // Replaces a range of the buffer contents with glBufferSubData(). Must bind first.
+    void updateRange(int offsetInBytes, int sizeInBytes, const void * data) noexcept;
+
+    // This frees the underlaying handle, but leaves this object intact.
+    void cleanup() noexcept;
+
+    // Bind to GL_UNIFORM_BUFFER for updates / to an indexed binding point for drawing.
+    void bind() const noexcept;
+    void bindBase(GLuint bindingIndex) const noexcept;
+
+    // Binds part of the buffer to a binding point. 'offsetInBytes' must be
+    // a multiple of getOffsetAlignment().
+    void bindRange(GLuint bindingIndex, int offsetInBytes, int sizeInBytes) const noexcept;
+
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. Queried on the first call.
+    static int getOffsetAlignment() noexcept;
+
+    // Binds 0 to GL_UNIFORM_BUFFER.
+    static void bindNull() noexcept;
+
+    // Calls cleanup().
+    ~GLUniformBuffer();
+
+    bool isInitialized()  const noexcept { return handle != 0; }
+    int getSizeInBytes()  const noexcept { return sizeInBytes; }
+
+private:
+
+    GLFWApp & app;
+    GLuint    handle;
+    int       sizeInBytes;
 };
 
 // ========================================================
@@ -590,25 +749,28 @@ private:
 
     struct TextString final
     {
-        float       posX;
-        float       posY;
-        float       scaling;
-        Vec4        color;
-        std::string text;
-
-        TextString(float x, float y, float s, const Vec4 & c, const char * str)
-            : posX    { x }
-            , posY    { y }
-            , scaling { s }
-            , color   { c }
-            , text    { str }
+        float posX;
+        float posY;
+        float scaling;
+        Vec4  color;
+        int   textOffset; // Into 'textChars'. Strings are null terminated.
+
+        TextString(float x, float y, float s, const Vec4 & c, int offset)
+            : posX       { x      }
+            , posY       { y      }
+            , scaling    { s      }
+            , color      { c      }
+            , textOffset { offset }
         { }
     };
 
+    void pushString(float x, float y, float scaling, const Vec4 & color, const char * text, int length);
+
     void pushStringGlyphs(float x, float y, float scaling, const Vec4 & color, const char * text);
     void pushGlyphVerts(const GLDrawVertex verts[4]);
 
     std::vector<TextString>   textStrings;
+    std::vector<char>         textChars; // Storage for all strings, reused across frames.
     std::vector<GLDrawVertex> glyphsVerts;
     GLTexture                 glyphsTexture;
     GLVertexArray             glyphsVA;
@@ -716,6 +878,9 @@ public:
     const std::string & getWindowTitle() const noexcept { return windowTitle;   }
     const float * getClearScrColor()     const noexcept { return clearScrColor; }
 
+    // Heap allocations made by the last frame's update+render (debug builds only, zero otherwise).
+    int getFrameHeapAllocCount()         const noexcept { return frameHeapAllocs; }
+
     void setWindowTitle(std::string title)      noexcept;
     void setClearScrColor(const float color[4]) noexcept;
 
@@ -734,6 +899,7 @@ private:
     float        clearScrColor[4];
     GLFWwindow * glfwWindowPtr;
     std::string  windowTitle;
+    int          frameHeapAllocs;
 };
 
 // ========================================================
@@ -0,0 +1,171 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: mapped_file.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Read-only memory mapped file and small file system helpers.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool getFileInfo(const std::string & filename, FileInfo * info)
+{
+    struct stat fileInfo;
+    if (stat(filename.c_str(), &fileInfo) != 0)
+    {
+        return false;
+    }
+
+    info->sizeBytes = static_cast<std::uint64_t>(fileInfo.st_size);
+    info->modTime   = static_cast<std::int64_t>(fileInfo.st_mtime);
+    return true;
+}
+
+std::string getCanonicalPath(const std::string & path)
+{
+    if (char * resolved = realpath(path.c_str(), nullptr))
+    {
+        std::string result{ resolved };
+        std::free(resolved);
+        return result;
+    }
+
+    std::string fullPath;
+    if (path.empty() || path[0] != '/')
+    {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) != nullptr)
+        {
+            fullPath = cwd;
+        }
+    }
+    fullPath += '/';
+    fullPath += path;
+
+    // Rebuild it one path component at a time, dropping the empty and
+    // "." components and backing up a level on each "..".
+    std::string result;
+    std::size_t start = 0;
+    while (start < fullPath.size())
+    {
+        std::size_t end = fullPath.find_first_of("/\\", start);
+        if (end == std::string::npos)
+        {
+            end = fullPath.size();
+        }
+
+        const std::size_t length = end - start;
+        if (length == 2 && fullPath.compare(start, 2, "..") == 0)
+        {
+            result.erase(std::min(result.find_last_of('/'), result.size()));
+        }
+        else if (length != 0 && !(length == 1 && fullPath[start] == '.'))
+        {
+            result += '/';
+            result.append(fullPath, start, length);
+        }
+        start = end + 1;
+    }
+    return result.empty() ? std::string{ "/" } : result;
+}
+
+bool createDirectory(const std::string & dirName)
+{
+    if (mkdir(dirName.c_str(), 0755) == 0)
+    {
+        return true;
+    }
+
+    struct stat fileInfo;
+    return errno == EEXIST && stat(dirName.c_str(), &fileInfo) == 0 && S_ISDIR(fileInfo.st_mode);
+}
+
+bool writeFileAtomic(const std::string & filename, const void * data, const std::size_t sizeBytes)
+{
+    // Unique per process and thread, so concurrent writers don't clobber each other's temporary.
+    const std::string tempName = filename + ".tmp" + std::to_string(getpid()) + "_" +
+                                 std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    std::FILE * file = std::fopen(tempName.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    const bool written = (std::fwrite(data, 1, sizeBytes, file) == sizeBytes);
+    if (std::fclose(file) != 0 || !written || std::rename(tempName.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tempName.c_str());
+        return false;
+    }
+    return true;
+}
+
+// ========================================================
+// MappedFile implementation:
+// ========================================================
+
+MappedFile::MappedFile(const std::string & filename)
+    : data   { nullptr }
+    , size   { 0       }
+    , opened { false   }
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0)
+    {
+        close(fd);
+        return;
+    }
+
+    // An empty file is fine, but can't be mapped.
+    if (fileInfo.st_size > 0)
+    {
+        void * mapping = mmap(nullptr, static_cast<std::size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+
+        // The file is read front to back by the parsers.
+        madvise(mapping, static_cast<std::size_t>(fileInfo.st_size), MADV_SEQUENTIAL);
+
+        data = static_cast<const char *>(mapping);
+        size = static_cast<std::size_t>(fileInfo.st_size);
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    opened = true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data != nullptr)
+    {
+        munmap(const_cast<char *>(data), size);
+    }
+}
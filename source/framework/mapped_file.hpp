@@ -0,0 +1,76 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: mapped_file.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Read-only memory mapped file and small file system helpers.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Size and last modification time of a file on disk.
+struct FileInfo
+{
+    std::uint64_t sizeBytes = 0;
+    std::int64_t  modTime   = 0; // Seconds since the epoch.
+};
+
+// Returns false if the file doesn't exist or can't be accessed.
+bool getFileInfo(const std::string & filename, FileInfo * info);
+
+// Absolute path with the symbolic links, "." and ".." resolved, for use as a unique key.
+// Paths that don't exist on disk (like material names, which have no extension) are
+// made absolute and normalized by name only.
+std::string getCanonicalPath(const std::string & path);
+
+// Creates a single directory level. Returns true if it was created or already exists.
+bool createDirectory(const std::string & dirName);
+
+// Writes the whole file to a temporary next to it, then renames it over the destination,
+// so readers never see a partially written file, even with several writers at once.
+bool writeFileAtomic(const std::string & filename, const void * data, std::size_t sizeBytes);
+
+// ========================================================
+// class MappedFile:
+// ========================================================
+
+//
+// Maps a whole file into memory for reading, so that parsers can work
+// directly on the file contents without copying them into a stream
+// buffer first. The data is NOT null terminated! Use getSize().
+//
+// Check isOpen() after construction, like with a std::ifstream.
+//
+class MappedFile final
+{
+public:
+
+    explicit MappedFile(const std::string & filename);
+    ~MappedFile(); // Unmaps the file.
+
+    // Not copyable.
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator = (const MappedFile &) = delete;
+
+    bool isOpen()          const noexcept { return opened; }
+    const char * getData() const noexcept { return data;   }
+    std::size_t getSize()  const noexcept { return size;   }
+
+private:
+
+    const char * data;
+    std::size_t  size;
+    bool         opened;
+};
+
+#endif // MAPPED_FILE_HPP
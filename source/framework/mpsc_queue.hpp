@@ -0,0 +1,181 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: mpsc_queue.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Lock-free intrusive multi-producer/single-consumer queue.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef MPSC_QUEUE_HPP
+#define MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+
+// ========================================================
+// struct MPSCQueueNode:
+// ========================================================
+
+//
+// Link embedded in the items of an MPSCQueue.
+// Items must inherit from it (see MPSCQueue<T>).
+//
+struct MPSCQueueNode
+{
+    std::atomic<MPSCQueueNode *> queueNext{ nullptr };
+};
+
+// ========================================================
+// template class MPSCQueue<T>:
+// ========================================================
+
+//
+// Type T must inherit from MPSCQueueNode:
+//
+// struct T : public MPSCQueueNode
+// {
+//     ...
+// };
+//
+// Any number of threads may push() at the same time, but only one thread,
+// the consumer, may call pop(), drain() and empty(). This is the way finished
+// work is handed from the worker threads back to the main/GL thread without
+// taking a lock.
+//
+// push() is wait-free: one atomic exchange and one store, no retry loops.
+// pop() is lock-free but may return null while a push is halfway done, in
+// which case the item becomes visible to the consumer on the next pop().
+// Items come out in FIFO order for each producer.
+//
+// This is Dmitry Vyukov's intrusive MPSC queue. The queue does not own
+// the items, like the LinkedList. Note: Items can only be in one queue at
+// a time, and must not be pushed again before they were popped!
+//
+template<class T>
+class MPSCQueue final
+{
+public:
+
+    MPSCQueue() noexcept
+        : back        { &stub }
+        , backPadding {       }
+        , front       { &stub }
+        , stub        {       }
+    { }
+
+    // Not copyable.
+    MPSCQueue(const MPSCQueue &) = delete;
+    MPSCQueue & operator = (const MPSCQueue &) = delete;
+
+    //
+    // Producer side, any thread. Node must not be null!
+    //
+    void push(T * node) noexcept
+    {
+        assert(node != nullptr);
+        pushNode(node);
+    }
+
+    //
+    // Consumer side. Removes the oldest item, without destroying the object.
+    // Returns null if the queue is empty (or the next item is still being pushed).
+    //
+    T * pop() noexcept
+    {
+        MPSCQueueNode * first = front;
+        MPSCQueueNode * next  = first->queueNext.load(std::memory_order_acquire);
+
+        // Skip the stub node, it is not an item.
+        if (first == &stub)
+        {
+            if (next == nullptr)
+            {
+                return nullptr;
+            }
+            front = next;
+            first = next;
+            next  = next->queueNext.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr)
+        {
+            front = next;
+            return static_cast<T *>(first);
+        }
+
+        // 'first' is the last node. If a producer already swapped in a new back but
+        // hasn't linked it yet, we have to wait for it to finish; try again next time.
+        if (first != back.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+
+        // Put the stub back behind the last node, so that it can be unlinked.
+        pushNode(&stub);
+
+        next = first->queueNext.load(std::memory_order_acquire);
+        if (next != nullptr)
+        {
+            front = next;
+            return static_cast<T *>(first);
+        }
+        return nullptr;
+    }
+
+    //
+    // Consumer side. Pops up to 'maxCount' items, calling 'func(T*)' for each one,
+    // in queue order. Returns the number of items removed.
+    //
+    template<typename Func>
+    int drain(Func && func, const int maxCount = INT_MAX)
+    {
+        int count = 0;
+        while (count < maxCount)
+        {
+            T * node = pop();
+            if (node == nullptr)
+            {
+                break;
+            }
+
+            ++count;
+            func(node);
+        }
+        return count;
+    }
+
+    //
+    // Consumer side. Pushes that are still in progress may not be seen.
+    //
+    bool empty() const noexcept
+    {
+        return front == &stub && stub.queueNext.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+
+    void pushNode(MPSCQueueNode * node) noexcept
+    {
+        node->queueNext.store(nullptr, std::memory_order_relaxed);
+
+        // Between the exchange and the store the node is not reachable from the
+        // front yet. That's the window where pop() can miss it.
+        MPSCQueueNode * prev = back.exchange(node, std::memory_order_acq_rel);
+        prev->queueNext.store(node, std::memory_order_release);
+    }
+
+    // Producers write 'back', the consumer reads 'front'. Kept on separate
+    // cache lines, so the consumer doesn't contend with the producers.
+    std::atomic<MPSCQueueNode *> back;
+    char backPadding[64];
+    MPSCQueueNode * front;
+    MPSCQueueNode   stub;
+};
+
+#endif // MPSC_QUEUE_HPP
@@ -0,0 +1,199 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: page_allocator.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Virtual memory page allocator used as optional backing store for the pools.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "page_allocator.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+    #define MAP_ANONYMOUS MAP_ANON
+#endif // MAP_ANONYMOUS
+
+#ifndef MAP_NORESERVE
+    #define MAP_NORESERVE 0
+#endif // MAP_NORESERVE
+
+// Size of a transparent huge page on x86-64 Linux. The reserved range is aligned to it.
+static constexpr std::size_t hugePageSize = 2 * 1024 * 1024;
+
+static std::size_t alignUp(const std::size_t value, const std::size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// ========================================================
+// PageAllocator implementation:
+// ========================================================
+
+std::size_t PageAllocator::getSystemPageSize()
+{
+    static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+PageAllocator::PageAllocator(const Options & opts)
+    : options            { opts                }
+    , pageSize           { getSystemPageSize() }
+    , mappingStart       { nullptr             }
+    , mappingSize        { 0                   }
+    , reservedStart      { nullptr             }
+    , reservedSize       { 0                   }
+    , bumpOffset         { 0                   }
+    , committedBytes     { 0                   }
+    , peakCommittedBytes { 0                   }
+    , hugePagesEnabled   { false               }
+    , freeSpans          {                     }
+{
+    assert(options.reserveBytes != 0);
+
+    // Over-reserve by one huge page so the usable range can start at a 2MB boundary.
+    reservedSize = alignUp(options.reserveBytes, hugePageSize);
+    mappingSize  = reservedSize + hugePageSize;
+
+    // Address space only. No physical memory or swap is committed until the pages are touched.
+    void * mapping = mmap(nullptr, mappingSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::bad_alloc{};
+    }
+
+    mappingStart  = static_cast<unsigned char *>(mapping);
+    reservedStart = reinterpret_cast<unsigned char *>(
+        alignUp(reinterpret_cast<std::uintptr_t>(mappingStart), hugePageSize));
+
+    #ifdef MADV_HUGEPAGE
+    if (options.useHugePages && !options.useGuardPages)
+    {
+        hugePagesEnabled = (madvise(reservedStart, reservedSize, MADV_HUGEPAGE) == 0);
+    }
+    #endif // MADV_HUGEPAGE
+}
+
+PageAllocator::~PageAllocator()
+{
+    if (mappingStart != nullptr)
+    {
+        munmap(mappingStart, mappingSize);
+    }
+}
+
+std::size_t PageAllocator::getSpanSize(const std::size_t bytes) const noexcept
+{
+    // Usable pages plus the trailing guard page, if enabled.
+    return alignUp(bytes, pageSize) + (options.useGuardPages ? pageSize : 0);
+}
+
+void * PageAllocator::allocate(const std::size_t bytes, const std::size_t alignment)
+{
+    assert(bytes != 0);
+    assert(alignment != 0 && alignment <= pageSize);
+
+    const std::size_t spanSize   = getSpanSize(bytes);
+    const std::size_t usableSize = alignUp(bytes, pageSize);
+    unsigned char * spanStart    = nullptr;
+
+    // First fit among the released spans. The tail of a span left over
+    // still ends with the original guard page, so it stays protected.
+    for (std::size_t i = 0; i < freeSpans.size(); ++i)
+    {
+        if (freeSpans[i].size >= spanSize)
+        {
+            spanStart = freeSpans[i].start;
+            freeSpans[i].start += spanSize;
+            freeSpans[i].size  -= spanSize;
+            if (freeSpans[i].size == 0)
+            {
+                freeSpans[i] = freeSpans.back();
+                freeSpans.pop_back();
+            }
+            break;
+        }
+    }
+
+    // Otherwise take fresh pages from the end of the range.
+    if (spanStart == nullptr)
+    {
+        if (bumpOffset + spanSize > reservedSize)
+        {
+            throw std::bad_alloc{};
+        }
+        spanStart   = reservedStart + bumpOffset;
+        bumpOffset += spanSize;
+    }
+
+    // Commit. The guard page after the span is left inaccessible.
+    if (mprotect(spanStart, usableSize, PROT_READ | PROT_WRITE) != 0)
+    {
+        throw std::bad_alloc{};
+    }
+
+    committedBytes += usableSize;
+    if (committedBytes > peakCommittedBytes)
+    {
+        peakCommittedBytes = committedBytes;
+    }
+
+    // With guard pages, the allocation is pushed to the end of the span (as far as the
+    // alignment allows), so that even a small overrun runs into the guard page.
+    if (options.useGuardPages)
+    {
+        return spanStart + (usableSize - bytes) / alignment * alignment;
+    }
+    return spanStart;
+}
+
+void PageAllocator::deallocate(void * ptr, const std::size_t bytes)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    // Back to the start of the span if the allocation was moved against the guard page.
+    // Either way, the allocation ends in the last usable page of its span.
+    const std::size_t usableSize = alignUp(bytes, pageSize);
+    const std::uintptr_t allocEnd = reinterpret_cast<std::uintptr_t>(ptr) + bytes;
+    auto spanStart = reinterpret_cast<unsigned char *>(alignUp(allocEnd, pageSize) - usableSize);
+    assert(spanStart >= reservedStart && spanStart < reservedStart + bumpOffset);
+
+    // Give the physical pages back to the system. With guard pages we also
+    // revoke access, so that stale pointers into the span fault as well.
+    madvise(spanStart, usableSize, MADV_DONTNEED);
+    if (options.useGuardPages)
+    {
+        mprotect(spanStart, usableSize, PROT_NONE);
+    }
+
+    assert(committedBytes >= usableSize);
+    committedBytes -= usableSize;
+
+    freeSpans.push_back({ spanStart, getSpanSize(bytes) });
+}
+
+void PageAllocator::reset()
+{
+    if (bumpOffset != 0)
+    {
+        madvise(reservedStart, bumpOffset, MADV_DONTNEED);
+        mprotect(reservedStart, bumpOffset, PROT_NONE);
+    }
+
+    bumpOffset     = 0;
+    committedBytes = 0;
+    freeSpans.clear();
+}
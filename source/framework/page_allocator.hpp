@@ -0,0 +1,106 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: page_allocator.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Virtual memory page allocator used as optional backing store for the pools.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef PAGE_ALLOCATOR_HPP
+#define PAGE_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <vector>
+
+// ========================================================
+// class PageAllocator:
+// ========================================================
+
+//
+// Reserves one large range of virtual address space up front and hands out
+// page-aligned spans from it, committing the pages only as they are requested.
+//
+// - Huge pages: the range is aligned to 2MB and flagged with MADV_HUGEPAGE
+//   (Linux only) so that the kernel can back it with transparent huge pages,
+//   cutting the TLB misses when walking a large pool of objects.
+//
+// - Guard pages: optionally, each span is followed by an inaccessible page,
+//   so that an overrun past the end of a pool block faults right away.
+//   Guard pages split the mapping, so they defeat the huge pages. They are
+//   meant for debug builds.
+//
+// - Freed spans are given back to the OS with madvise(MADV_DONTNEED) but keep
+//   their address range, which is reused by later allocations of equal or
+//   smaller size. reset() releases everything in one call.
+//
+class PageAllocator final
+{
+public:
+
+    struct Options
+    {
+        std::size_t reserveBytes  = std::size_t(1) << 30; // Virtual range reserved. Not memory in use!
+        bool        useHugePages  = true;
+        #if DEBUG
+        bool        useGuardPages = true;
+        #else // !DEBUG
+        bool        useGuardPages = false;
+        #endif // DEBUG
+    };
+
+    explicit PageAllocator(const Options & opts);
+    ~PageAllocator(); // Unmaps the whole range.
+
+    // Not copyable.
+    PageAllocator(const PageAllocator &) = delete;
+    PageAllocator & operator = (const PageAllocator &) = delete;
+
+    // Commits a span of at least 'bytes' and returns a pointer to it. The pointer is
+    // page aligned, or, with guard pages, 'alignment' aligned and placed so the allocation
+    // ends right before the guard page. Throws std::bad_alloc if the reserved range is exhausted.
+    void * allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t));
+
+    // Releases the physical pages of a span allocated with the same size.
+    void deallocate(void * ptr, std::size_t bytes);
+
+    // Releases all spans, returning the allocator to its initial state.
+    void reset();
+
+    // Miscellaneous queries:
+    const Options & getOptions()      const noexcept { return options; }
+    std::size_t getReservedBytes()    const noexcept { return reservedSize; }
+    std::size_t getCommittedBytes()   const noexcept { return committedBytes; }
+    std::size_t getPeakCommittedBytes() const noexcept { return peakCommittedBytes; }
+    bool hasHugePages()               const noexcept { return hugePagesEnabled; }
+
+    static std::size_t getSystemPageSize();
+
+private:
+
+    struct FreeSpan
+    {
+        unsigned char * start;
+        std::size_t     size; // Whole span, guard page included (see getSpanSize()).
+    };
+
+    std::size_t getSpanSize(std::size_t bytes) const noexcept;
+
+    const Options     options;
+    const std::size_t pageSize;
+    unsigned char *   mappingStart;       // What we got from mmap, before the 2MB alignment.
+    std::size_t       mappingSize;
+    unsigned char *   reservedStart;      // Start of the usable (aligned) range.
+    std::size_t       reservedSize;
+    std::size_t       bumpOffset;         // Everything before this offset was handed out at some point.
+    std::size_t       committedBytes;
+    std::size_t       peakCommittedBytes;
+    bool              hugePagesEnabled;
+    std::vector<FreeSpan> freeSpans;      // Released spans available for reuse.
+};
+
+#endif // PAGE_ALLOCATOR_HPP
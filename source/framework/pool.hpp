@@ -14,11 +14,50 @@
 #ifndef POOL_HPP
 #define POOL_HPP
 
+#include "framework/page_allocator.hpp"
+
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstring>
+#include <new>
 #include <utility>
 #include <memory>
+#include <vector>
+
+// ========================================================
+// Pool growth policy and memory stats:
+// ========================================================
+
+struct PoolGrowthPolicy final
+{
+    // Each new block holds this many times the objects of the previous one.
+    // The first block always holds 'Granularity' objects. 1 = fixed-size blocks.
+    float growthFactor = 1.0f;
+
+    // Upper bound for the size in objects of a block. 0 = no limit.
+    int maxBlockObjects = 0;
+};
+
+struct PoolMemoryStats final
+{
+    std::size_t bytesReserved     = 0; // Size of all blocks, including the block headers.
+    std::size_t bytesLive         = 0; // Bytes used by the objects currently alive.
+    std::size_t bytesReclaimable  = 0; // Size of the blocks with no live objects (what shrink() would free).
+    std::size_t peakBytesReserved = 0; // High-water marks since construction or the last drain().
+    std::size_t peakBytesLive     = 0;
+
+    int objectsAlive     = 0;
+    int peakObjectsAlive = 0;
+    int objectsFree      = 0; // Free slots in all blocks.
+    int blockCount       = 0;
+    int emptyBlocks      = 0; // No live objects.
+    int partialBlocks    = 0; // Some live objects.
+    int fullBlocks       = 0; // No free slots.
+
+    float utilization    = 0.0f; // bytesLive / bytesReserved.
+    float fragmentation  = 0.0f; // Fraction of the free slots stuck in partially used blocks, which shrink() can't reclaim.
+};
 
 // ========================================================
 // template class Pool<T, Granularity>:
@@ -30,13 +69,21 @@
 // This pool allocator operates as a linked list of small arrays.
 // Each array is a pool of blocks with the size of 'T' template parameter.
 // Template parameter 'Granularity' defines the size in objects of type 'T'
-// of such arrays.
+// of such arrays. With a growth policy set, each new array can be larger
+// than the previous one, which cuts the number of blocks for big pools.
+//
+// Blocks come from the global heap by default. usePageStorage() switches
+// the pool to a PageAllocator, which can back big pools with huge pages
+// and put guard pages between blocks in debug builds.
 //
 // allocate() will return an uninitialized memory block.
 // The user is responsible for calling construct() on it to run class
 // constructors if necessary, and destroy() to call class destructor
 // before deallocating the block.
 //
+// Not thread-safe. See ConcurrentPool in concurrent_pool.hpp for
+// a variant that can be shared by multiple threads.
+//
 template
 <
     typename T,
@@ -49,6 +96,9 @@ public:
      Pool(); // Empty pool; no allocation until first use.
     ~Pool(); // Drains the pool.
 
+    // Empty pool with geometric block growth.
+    explicit Pool(const PoolGrowthPolicy & policy);
+
     // Not copyable.
     Pool(const Pool &) = delete;
     Pool & operator = (const Pool &) = delete;
@@ -66,11 +116,31 @@ public:
     // alive that was previously allocated from this pool.
     void drain();
 
+    // Frees the blocks that have no live objects, keeping the objects still alive
+    // where they are. Returns the number of bytes given back. This has to find the
+    // owning block of every free object, so it is not meant to be called every frame.
+    std::size_t shrink();
+
+    // Only affects the blocks allocated after the call.
+    void setGrowthPolicy(const PoolGrowthPolicy & policy);
+    const PoolGrowthPolicy & getGrowthPolicy() const noexcept;
+
+    // Allocates the blocks from a virtual memory range reserved by the pool
+    // instead of the heap. Can only be called while the pool holds no blocks.
+    void usePageStorage(const PageAllocator::Options & opts);
+    const PageAllocator * getPageStorage() const noexcept;
+
+    // Full memory report, with per-block usage. Walks the free list, so it's not free either.
+    PoolMemoryStats getMemoryStats() const;
+
     // Miscellaneous stats queries:
     int getTotalAllocs()  const noexcept;
     int getTotalFrees()   const noexcept;
     int getObjectsAlive() const noexcept;
+    int getPeakObjectsAlive() const noexcept;
     int getSize()         const noexcept;
+    int getCapacity()     const noexcept;
+    std::size_t getBytesReserved() const noexcept;
 
     static std::size_t getGranularity() noexcept;
     static std::size_t getObjectSize()  noexcept;
@@ -91,17 +161,54 @@ private:
         PoolObj * next;
     };
 
+    // Block header. The array of objects follows it in memory.
     struct PoolBlock
     {
-        PoolObj objects[Granularity];
         PoolBlock * next;
+        int objectCount;
+
+        static std::size_t getHeaderSize() noexcept
+        {
+            return (sizeof(PoolBlock) + alignof(PoolObj) - 1) / alignof(PoolObj) * alignof(PoolObj);
+        }
+        static std::size_t getSizeBytes(const int numObjects) noexcept
+        {
+            return getHeaderSize() + numObjects * sizeof(PoolObj);
+        }
+        PoolObj * getObjects() noexcept
+        {
+            return reinterpret_cast<PoolObj *>(reinterpret_cast<unsigned char *>(this) + getHeaderSize());
+        }
+        bool contains(const PoolObj * obj) noexcept
+        {
+            return obj >= getObjects() && obj < getObjects() + objectCount;
+        }
+    };
+
+    // Free slot count of each block, sorted by block address.
+    struct BlockUsage
+    {
+        PoolBlock * block;
+        int freeCount;
     };
 
-    PoolBlock * blockList; // List of all blocks/pools.
-    PoolObj   * freeList;  // List of free objects that can be recycled.
-    int allocCount;        // Total calls to 'allocate()'.
-    int objectCount;       // User objects ('T' instances) currently active.
-    int poolBlockCount;    // Size in blocks of the 'blockList'.
+    void * allocBlockMemory(std::size_t bytes);
+    void freeBlockMemory(PoolBlock * block);
+    void computeBlockUsage(std::vector<BlockUsage> * outUsage) const;
+    static BlockUsage * findBlockUsage(std::vector<BlockUsage> & usage, const PoolObj * obj);
+
+    PoolBlock * blockList;         // List of all blocks/pools.
+    PoolObj   * freeList;          // List of free objects that can be recycled.
+    int allocCount;                // Total calls to 'allocate()'.
+    int objectCount;               // User objects ('T' instances) currently active.
+    int peakObjectCount;           // High-water mark of 'objectCount'.
+    int poolBlockCount;            // Size in blocks of the 'blockList'.
+    int reservedObjects;           // Sum of the object counts of all blocks.
+    int nextBlockObjects;          // Size in objects of the next block allocated.
+    std::size_t reservedBytes;     // Sum of the sizes of all blocks.
+    std::size_t peakReservedBytes; // High-water mark of 'reservedBytes'.
+    PoolGrowthPolicy growthPolicy;
+    std::unique_ptr<PageAllocator> pageStorage; // Null if the blocks come from the heap.
 };
 
 // ========================================================
@@ -110,15 +217,29 @@ private:
 
 template<typename T, int Granularity>
 Pool<T, Granularity>::Pool()
-    : blockList      { nullptr }
-    , freeList       { nullptr }
-    , allocCount     { 0 }
-    , objectCount    { 0 }
-    , poolBlockCount { 0 }
+    : blockList         { nullptr     }
+    , freeList          { nullptr     }
+    , allocCount        { 0           }
+    , objectCount       { 0           }
+    , peakObjectCount   { 0           }
+    , poolBlockCount    { 0           }
+    , reservedObjects   { 0           }
+    , nextBlockObjects  { Granularity }
+    , reservedBytes     { 0           }
+    , peakReservedBytes { 0           }
+    , growthPolicy      {             }
+    , pageStorage       { nullptr     }
 {
     // Allocates memory when the first object is requested.
 }
 
+template<typename T, int Granularity>
+Pool<T, Granularity>::Pool(const PoolGrowthPolicy & policy)
+    : Pool{}
+{
+    setGrowthPolicy(policy);
+}
+
 template<typename T, int Granularity>
 Pool<T, Granularity>::~Pool()
 {
@@ -130,23 +251,47 @@ T * Pool<T, Granularity>::allocate()
 {
     if (freeList == nullptr)
     {
-        auto newBlock  = new PoolBlock{};
+        const int newBlockObjects = nextBlockObjects;
+        const std::size_t newBlockBytes = PoolBlock::getSizeBytes(newBlockObjects);
+
+        auto newBlock  = static_cast<PoolBlock *>(allocBlockMemory(newBlockBytes));
         newBlock->next = blockList;
-        blockList      = newBlock;
+        newBlock->objectCount = newBlockObjects;
+        blockList = newBlock;
 
         ++poolBlockCount;
+        reservedObjects += newBlockObjects;
+        reservedBytes   += newBlockBytes;
+        peakReservedBytes = std::max(peakReservedBytes, reservedBytes);
 
         // All objects in the new pool block are appended
         // to the free list, since they are ready to be used.
-        for (int i = 0; i < Granularity; ++i)
+        PoolObj * objects = newBlock->getObjects();
+        for (int i = 0; i < newBlockObjects; ++i)
+        {
+            objects[i].next = freeList;
+            freeList = &objects[i];
+        }
+
+        // Geometric growth for the next one, if enabled.
+        if (growthPolicy.growthFactor > 1.0f)
         {
-            newBlock->objects[i].next = freeList;
-            freeList = &newBlock->objects[i];
+            int grown = static_cast<int>(nextBlockObjects * growthPolicy.growthFactor);
+            if (grown <= nextBlockObjects)
+            {
+                grown = nextBlockObjects + 1;
+            }
+            if (growthPolicy.maxBlockObjects > 0 && grown > growthPolicy.maxBlockObjects)
+            {
+                grown = std::max(growthPolicy.maxBlockObjects, Granularity);
+            }
+            nextBlockObjects = grown;
         }
     }
 
     ++allocCount;
     ++objectCount;
+    peakObjectCount = std::max(peakObjectCount, objectCount);
 
     // Fetch one from the free list's head:
     PoolObj * object = freeList;
@@ -187,18 +332,230 @@ void Pool<T, Granularity>::deallocate(void * ptr)
 template<typename T, int Granularity>
 void Pool<T, Granularity>::drain()
 {
-    while (blockList != nullptr)
+    if (pageStorage != nullptr)
+    {
+        // All blocks released to the system in one go.
+        pageStorage->reset();
+    }
+    else
+    {
+        while (blockList != nullptr)
+        {
+            PoolBlock * block = blockList;
+            blockList = blockList->next;
+            ::operator delete(block);
+        }
+    }
+
+    blockList         = nullptr;
+    freeList          = nullptr;
+    allocCount        = 0;
+    objectCount       = 0;
+    peakObjectCount   = 0;
+    poolBlockCount    = 0;
+    reservedObjects   = 0;
+    nextBlockObjects  = Granularity;
+    reservedBytes     = 0;
+    peakReservedBytes = 0;
+}
+
+template<typename T, int Granularity>
+std::size_t Pool<T, Granularity>::shrink()
+{
+    if (blockList == nullptr || freeList == nullptr)
+    {
+        return 0;
+    }
+
+    std::vector<BlockUsage> usage;
+    computeBlockUsage(&usage);
+
+    // Drop the free objects that belong to empty blocks from the free list.
+    PoolObj ** link = &freeList;
+    while (*link != nullptr)
+    {
+        const BlockUsage * owner = findBlockUsage(usage, *link);
+        assert(owner != nullptr);
+
+        if (owner->freeCount == owner->block->objectCount)
+        {
+            *link = (*link)->next;
+        }
+        else
+        {
+            link = &(*link)->next;
+        }
+    }
+
+    // Then unlink and free the empty blocks themselves.
+    std::size_t bytesFreed = 0;
+    PoolBlock ** blockLink = &blockList;
+    while (*blockLink != nullptr)
+    {
+        PoolBlock * block = *blockLink;
+        const BlockUsage * blockUsage = findBlockUsage(usage, block->getObjects());
+
+        if (blockUsage->freeCount == block->objectCount)
+        {
+            *blockLink = block->next;
+
+            const std::size_t blockBytes = PoolBlock::getSizeBytes(block->objectCount);
+            bytesFreed      += blockBytes;
+            reservedBytes   -= blockBytes;
+            reservedObjects -= block->objectCount;
+            --poolBlockCount;
+
+            freeBlockMemory(block);
+        }
+        else
+        {
+            blockLink = &block->next;
+        }
+    }
+
+    // Start over from the base size if the pool went back to empty.
+    if (poolBlockCount == 0)
+    {
+        nextBlockObjects = Granularity;
+    }
+
+    return bytesFreed;
+}
+
+template<typename T, int Granularity>
+void * Pool<T, Granularity>::allocBlockMemory(const std::size_t bytes)
+{
+    if (pageStorage != nullptr)
+    {
+        return pageStorage->allocate(bytes, alignof(PoolBlock) > alignof(PoolObj) ? alignof(PoolBlock) : alignof(PoolObj));
+    }
+    return ::operator new(bytes);
+}
+
+template<typename T, int Granularity>
+void Pool<T, Granularity>::freeBlockMemory(PoolBlock * block)
+{
+    if (pageStorage != nullptr)
+    {
+        pageStorage->deallocate(block, PoolBlock::getSizeBytes(block->objectCount));
+    }
+    else
+    {
+        ::operator delete(block);
+    }
+}
+
+template<typename T, int Granularity>
+void Pool<T, Granularity>::computeBlockUsage(std::vector<BlockUsage> * outUsage) const
+{
+    assert(outUsage != nullptr);
+    outUsage->clear();
+    outUsage->reserve(poolBlockCount);
+
+    for (PoolBlock * block = blockList; block != nullptr; block = block->next)
+    {
+        outUsage->push_back({ block, 0 });
+    }
+
+    std::sort(outUsage->begin(), outUsage->end(),
+              [](const BlockUsage & a, const BlockUsage & b) { return a.block < b.block; });
+
+    for (const PoolObj * obj = freeList; obj != nullptr; obj = obj->next)
+    {
+        BlockUsage * owner = findBlockUsage(*outUsage, obj);
+        assert(owner != nullptr && "Free object doesn't belong to this pool!");
+        ++owner->freeCount;
+    }
+}
+
+template<typename T, int Granularity>
+typename Pool<T, Granularity>::BlockUsage *
+Pool<T, Granularity>::findBlockUsage(std::vector<BlockUsage> & usage, const PoolObj * obj)
+{
+    // Last block starting at or before the object.
+    auto iter = std::upper_bound(usage.begin(), usage.end(), obj,
+                                 [](const PoolObj * o, const BlockUsage & u)
+                                 { return reinterpret_cast<const void *>(o) < reinterpret_cast<const void *>(u.block); });
+    if (iter == usage.begin())
+    {
+        return nullptr;
+    }
+
+    --iter;
+    return iter->block->contains(obj) ? &(*iter) : nullptr;
+}
+
+template<typename T, int Granularity>
+void Pool<T, Granularity>::setGrowthPolicy(const PoolGrowthPolicy & policy)
+{
+    assert(policy.growthFactor >= 1.0f);
+    assert(policy.maxBlockObjects >= 0);
+    growthPolicy = policy;
+}
+
+template<typename T, int Granularity>
+const PoolGrowthPolicy & Pool<T, Granularity>::getGrowthPolicy() const noexcept
+{
+    return growthPolicy;
+}
+
+template<typename T, int Granularity>
+void Pool<T, Granularity>::usePageStorage(const PageAllocator::Options & opts)
+{
+    assert(blockList == nullptr && "Pool must be empty to change its storage!");
+    pageStorage.reset(new PageAllocator{ opts });
+}
+
+template<typename T, int Granularity>
+const PageAllocator * Pool<T, Granularity>::getPageStorage() const noexcept
+{
+    return pageStorage.get();
+}
+
+template<typename T, int Granularity>
+PoolMemoryStats Pool<T, Granularity>::getMemoryStats() const
+{
+    PoolMemoryStats stats;
+    stats.bytesReserved     = reservedBytes;
+    stats.bytesLive         = objectCount * sizeof(T);
+    stats.peakBytesReserved = peakReservedBytes;
+    stats.peakBytesLive     = peakObjectCount * sizeof(T);
+    stats.objectsAlive      = objectCount;
+    stats.peakObjectsAlive  = peakObjectCount;
+    stats.objectsFree       = reservedObjects - objectCount;
+    stats.blockCount        = poolBlockCount;
+
+    std::vector<BlockUsage> usage;
+    computeBlockUsage(&usage);
+
+    int strandedFree = 0;
+    for (const BlockUsage & u : usage)
     {
-        PoolBlock * block = blockList;
-        blockList = blockList->next;
-        delete block;
+        if (u.freeCount == u.block->objectCount)
+        {
+            ++stats.emptyBlocks;
+            stats.bytesReclaimable += PoolBlock::getSizeBytes(u.block->objectCount);
+        }
+        else if (u.freeCount == 0)
+        {
+            ++stats.fullBlocks;
+        }
+        else
+        {
+            ++stats.partialBlocks;
+            strandedFree += u.freeCount;
+        }
     }
 
-    blockList      = nullptr;
-    freeList       = nullptr;
-    allocCount     = 0;
-    objectCount    = 0;
-    poolBlockCount = 0;
+    if (stats.bytesReserved != 0)
+    {
+        stats.utilization = static_cast<float>(stats.bytesLive) / stats.bytesReserved;
+    }
+    if (stats.objectsFree != 0)
+    {
+        stats.fragmentation = static_cast<float>(strandedFree) / stats.objectsFree;
+    }
+    return stats;
 }
 
 template<typename T, int Granularity>
@@ -219,12 +576,30 @@ int Pool<T, Granularity>::getObjectsAlive() const noexcept
     return objectCount;
 }
 
+template<typename T, int Granularity>
+int Pool<T, Granularity>::getPeakObjectsAlive() const noexcept
+{
+    return peakObjectCount;
+}
+
 template<typename T, int Granularity>
 int Pool<T, Granularity>::getSize() const noexcept
 {
     return poolBlockCount;
 }
 
+template<typename T, int Granularity>
+int Pool<T, Granularity>::getCapacity() const noexcept
+{
+    return reservedObjects;
+}
+
+template<typename T, int Granularity>
+std::size_t Pool<T, Granularity>::getBytesReserved() const noexcept
+{
+    return reservedBytes;
+}
+
 template<typename T, int Granularity>
 std::size_t Pool<T, Granularity>::getGranularity() noexcept
 {
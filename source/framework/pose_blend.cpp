@@ -0,0 +1,651 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pose_blend.cpp
+// Author: Guilherme R. Lampert
+// Created on: 17/10/26
+// Brief: Structure-of-arrays pose blending: crossfades, additive layers and joint masks.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "pose_blend.hpp"
+#include "doom3md5.hpp"
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__SSE__)
+    #include <xmmintrin.h>
+#endif // __SSE__
+
+namespace DOOM3
+{
+
+// ========================================================
+// struct BlendPose:
+// ========================================================
+
+void BlendPose::resize(const int jointCount)
+{
+    assert(jointCount >= 0);
+
+    numJoints = jointCount;
+    stride    = (jointCount + BlendLanes - 1) / BlendLanes * BlendLanes;
+    data.assign(static_cast<std::size_t>(stride) * NumComponents, 0.0f);
+
+    // Identity rotations, so the padding lanes stay well defined through the kernels.
+    std::fill_n(component(RotW), stride, 1.0f);
+}
+
+// ========================================================
+// Per lane quaternion math:
+// ========================================================
+
+//
+// Each operation comes in a one joint version (suffix 1) and a four joint SSE
+// version (suffix 4), with the same math, component by component. Quaternions
+// are (x, y, z, w) and compose like mulQuat(): a * b applies b first.
+//
+
+static inline void mulQuat1(const float * a, const float * b, float * out)
+{
+    const float x = (a[3] * b[0]) + (a[0] * b[3]) + (a[1] * b[2]) - (a[2] * b[1]);
+    const float y = (a[3] * b[1]) - (a[0] * b[2]) + (a[1] * b[3]) + (a[2] * b[0]);
+    const float z = (a[3] * b[2]) + (a[0] * b[1]) - (a[1] * b[0]) + (a[2] * b[3]);
+    const float w = (a[3] * b[3]) - (a[0] * b[0]) - (a[1] * b[1]) - (a[2] * b[2]);
+    out[0] = x; out[1] = y; out[2] = z; out[3] = w;
+}
+
+// v + 2w * (q.xyz x v) + q.xyz x (2 * (q.xyz x v))
+static inline void rotatePoint1(const float * q, const float * v, float * out)
+{
+    const float tx = 2.0f * ((q[1] * v[2]) - (q[2] * v[1]));
+    const float ty = 2.0f * ((q[2] * v[0]) - (q[0] * v[2]));
+    const float tz = 2.0f * ((q[0] * v[1]) - (q[1] * v[0]));
+    const float x  = v[0] + (q[3] * tx) + ((q[1] * tz) - (q[2] * ty));
+    const float y  = v[1] + (q[3] * ty) + ((q[2] * tx) - (q[0] * tz));
+    const float z  = v[2] + (q[3] * tz) + ((q[0] * ty) - (q[1] * tx));
+    out[0] = x; out[1] = y; out[2] = z;
+}
+
+static inline void normalizeQuat1(const float * q, float * out)
+{
+    const float invLength = 1.0f / std::sqrt(std::max((q[0] * q[0]) + (q[1] * q[1]) + (q[2] * q[2]) + (q[3] * q[3]), 1e-20f));
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = q[i] * invLength;
+    }
+}
+
+static inline void nlerpQuat1(const float * a, const float * b, const float t, float * out)
+{
+    const float d = (a[0] * b[0]) + (a[1] * b[1]) + (a[2] * b[2]) + (a[3] * b[3]);
+    const float s = (d < 0.0f) ? -1.0f : 1.0f;
+
+    float q[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        q[i] = a[i] + (b[i] * s - a[i]) * t;
+    }
+
+    normalizeQuat1(q, out);
+}
+
+#if defined(__SSE__)
+
+static inline void mulQuat4(const __m128 * a, const __m128 * b, __m128 * out)
+{
+    const __m128 x = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a[3], b[0]), _mm_mul_ps(a[0], b[3])), _mm_mul_ps(a[1], b[2])), _mm_mul_ps(a[2], b[1]));
+    const __m128 y = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(a[3], b[1]), _mm_mul_ps(a[0], b[2])), _mm_mul_ps(a[1], b[3])), _mm_mul_ps(a[2], b[0]));
+    const __m128 z = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(a[3], b[2]), _mm_mul_ps(a[0], b[1])), _mm_mul_ps(a[1], b[0])), _mm_mul_ps(a[2], b[3]));
+    const __m128 w = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(a[3], b[3]), _mm_mul_ps(a[0], b[0])), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+    out[0] = x; out[1] = y; out[2] = z; out[3] = w;
+}
+
+static inline void rotatePoint4(const __m128 * q, const __m128 * v, __m128 * out)
+{
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 tx  = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(q[1], v[2]), _mm_mul_ps(q[2], v[1])));
+    const __m128 ty  = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(q[2], v[0]), _mm_mul_ps(q[0], v[2])));
+    const __m128 tz  = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(q[0], v[1]), _mm_mul_ps(q[1], v[0])));
+    const __m128 x   = _mm_add_ps(_mm_add_ps(v[0], _mm_mul_ps(q[3], tx)), _mm_sub_ps(_mm_mul_ps(q[1], tz), _mm_mul_ps(q[2], ty)));
+    const __m128 y   = _mm_add_ps(_mm_add_ps(v[1], _mm_mul_ps(q[3], ty)), _mm_sub_ps(_mm_mul_ps(q[2], tx), _mm_mul_ps(q[0], tz)));
+    const __m128 z   = _mm_add_ps(_mm_add_ps(v[2], _mm_mul_ps(q[3], tz)), _mm_sub_ps(_mm_mul_ps(q[0], ty), _mm_mul_ps(q[1], tx)));
+    out[0] = x; out[1] = y; out[2] = z;
+}
+
+// Approximate reciprocal square root refined with one Newton-Raphson step,
+// which brings it to about float precision. Lengths are clamped away from zero.
+static inline __m128 reciprocalSqrt(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(1e-20f));
+    const __m128 r = _mm_rsqrt_ps(x);
+    return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(x, r), r)));
+}
+
+static inline void normalizeQuat4(const __m128 * q, __m128 * out)
+{
+    const __m128 lengthSqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q[0], q[0]), _mm_mul_ps(q[1], q[1])),
+                                        _mm_add_ps(_mm_mul_ps(q[2], q[2]), _mm_mul_ps(q[3], q[3])));
+    const __m128 invLength = reciprocalSqrt(lengthSqr);
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = _mm_mul_ps(q[i], invLength);
+    }
+}
+
+static inline void nlerpQuat4(const __m128 * a, const __m128 * b, const __m128 t, __m128 * out)
+{
+    // Shortest arc: flip 'b' where the dot product is negative by copying its sign bit.
+    const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])),
+                                _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+    const __m128 sign = _mm_and_ps(d, _mm_set1_ps(-0.0f));
+
+    __m128 q[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        q[i] = _mm_add_ps(a[i], _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(b[i], sign), a[i]), t));
+    }
+
+    normalizeQuat4(q, out);
+}
+
+static inline void loadRotations4(const BlendPose & pose, const int j, __m128 * out)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = _mm_loadu_ps(pose.component(static_cast<BlendPose::Component>(BlendPose::RotX + i)) + j);
+    }
+}
+
+static inline void loadPositions4(const BlendPose & pose, const int j, __m128 * out)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = _mm_loadu_ps(pose.component(static_cast<BlendPose::Component>(BlendPose::PosX + i)) + j);
+    }
+}
+
+static inline void storeRotations4(BlendPose & pose, const int j, const __m128 * in)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        _mm_storeu_ps(pose.component(static_cast<BlendPose::Component>(BlendPose::RotX + i)) + j, in[i]);
+    }
+}
+
+static inline void storePositions4(BlendPose & pose, const int j, const __m128 * in)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        _mm_storeu_ps(pose.component(static_cast<BlendPose::Component>(BlendPose::PosX + i)) + j, in[i]);
+    }
+}
+
+static inline __m128 loadWeights4(const float weight, const float * jointWeights, const int j)
+{
+    const __m128 w = _mm_set1_ps(weight);
+    return (jointWeights != nullptr) ? _mm_mul_ps(w, _mm_loadu_ps(jointWeights + j)) : w;
+}
+
+#endif // __SSE__
+
+// One joint of the component arrays, for the scalar loops and the conversions.
+static inline void loadRotation1(const BlendPose & pose, const int j, float * out)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = pose.component(static_cast<BlendPose::Component>(BlendPose::RotX + i))[j];
+    }
+}
+
+static inline void loadPosition1(const BlendPose & pose, const int j, float * out)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = pose.component(static_cast<BlendPose::Component>(BlendPose::PosX + i))[j];
+    }
+}
+
+static inline void storeRotation1(BlendPose & pose, const int j, const float * in)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        pose.component(static_cast<BlendPose::Component>(BlendPose::RotX + i))[j] = in[i];
+    }
+}
+
+static inline void storePosition1(BlendPose & pose, const int j, const float * in)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        pose.component(static_cast<BlendPose::Component>(BlendPose::PosX + i))[j] = in[i];
+    }
+}
+
+static inline float jointWeight(const float weight, const float * jointWeights, const int j)
+{
+    return (jointWeights != nullptr) ? weight * jointWeights[j] : weight;
+}
+
+static inline void checkSameLayout(const BlendPose & a, const BlendPose & b)
+{
+    (void)a; (void)b;
+    assert(a.numJoints == b.numJoints);
+    assert(a.stride == b.stride);
+    assert(a.data.size() == b.data.size());
+}
+
+// ========================================================
+// Space conversions:
+// ========================================================
+
+void poseToJointSpace(const Pose & modelPose, const Skeleton & skeleton, BlendPose & poseOut)
+{
+    const int numJoints = modelPose.getNumJoints();
+    assert(numJoints == skeleton.getNumJoints());
+
+    if (poseOut.numJoints != numJoints)
+    {
+        poseOut.resize(numJoints);
+    }
+
+    // Transpose the pose into the output arrays and the parent of each joint
+    // into a scratch pose. Roots get an identity parent.
+    FrameArenaScope scope;
+    const int stride = poseOut.stride;
+    float * parents  = scope.getArena().allocArray<float>(stride * BlendPose::NumComponents);
+    std::fill_n(parents, stride * BlendPose::NumComponents, 0.0f);
+    std::fill_n(parents + BlendPose::RotW * stride, stride, 1.0f);
+
+    const float * rotations = modelPose.rotations.data();
+    const float * positions = modelPose.positions.data();
+    for (int j = 0; j < numJoints; ++j)
+    {
+        storeRotation1(poseOut, j, rotations + j * 4);
+        storePosition1(poseOut, j, positions + j * 3);
+
+        const int parent = skeleton.getJointParent(j);
+        if (parent >= 0)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                parents[(BlendPose::RotX + i) * stride + j] = rotations[parent * 4 + i];
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                parents[(BlendPose::PosX + i) * stride + j] = positions[parent * 3 + i];
+            }
+        }
+    }
+
+    // local rotation = conjugate(parent) * rotation
+    // local position = conjugate(parent) applied to (position - parent position)
+    // The pose streams are normalized with an approximate reciprocal square root, and
+    // the conjugate is only the inverse of a unit quaternion, so both are renormalized.
+    // Otherwise the length error would pile up down the hierarchy in poseToModelSpace().
+    int j = 0;
+#if defined(__SSE__)
+    const __m128 negate = _mm_set1_ps(-0.0f);
+    for (; j < stride; j += BlendPose::BlendLanes)
+    {
+        __m128 q[4], p[3], pq[4], pp[3];
+        loadRotations4(poseOut, j, q);
+        loadPositions4(poseOut, j, p);
+        for (int i = 0; i < 4; ++i)
+        {
+            pq[i] = _mm_loadu_ps(parents + (BlendPose::RotX + i) * stride + j);
+        }
+        normalizeQuat4(q, q);
+        normalizeQuat4(pq, pq);
+        for (int i = 0; i < 3; ++i)
+        {
+            pp[i] = _mm_loadu_ps(parents + (BlendPose::PosX + i) * stride + j);
+            pq[i] = _mm_xor_ps(pq[i], negate);
+            p[i]  = _mm_sub_ps(p[i], pp[i]);
+        }
+
+        __m128 localRot[4], localPos[3];
+        mulQuat4(pq, q, localRot);
+        rotatePoint4(pq, p, localPos);
+        storeRotations4(poseOut, j, localRot);
+        storePositions4(poseOut, j, localPos);
+    }
+#endif // __SSE__
+    for (; j < stride; ++j)
+    {
+        float q[4], p[3], pq[4];
+        loadRotation1(poseOut, j, q);
+        loadPosition1(poseOut, j, p);
+        for (int i = 0; i < 4; ++i)
+        {
+            pq[i] = parents[(BlendPose::RotX + i) * stride + j] * ((i < 3) ? -1.0f : 1.0f);
+        }
+        normalizeQuat1(q, q);
+        normalizeQuat1(pq, pq);
+        for (int i = 0; i < 3; ++i)
+        {
+            p[i] -= parents[(BlendPose::PosX + i) * stride + j];
+        }
+
+        float localRot[4], localPos[3];
+        mulQuat1(pq, q, localRot);
+        rotatePoint1(pq, p, localPos);
+        storeRotation1(poseOut, j, localRot);
+        storePosition1(poseOut, j, localPos);
+    }
+}
+
+void poseToModelSpace(const BlendPose & jointPose, const Skeleton & skeleton, Pose & poseOut)
+{
+    const int numJoints = jointPose.numJoints;
+    assert(numJoints == skeleton.getNumJoints());
+
+    if (poseOut.getNumJoints() != numJoints)
+    {
+        poseOut.resize(numJoints);
+    }
+
+    // Same as AnimInstance::buildFramePose(): parents always come before their children,
+    // so they are already in model space when a child is converted.
+    float * rotationsOut = poseOut.rotations.data();
+    float * positionsOut = poseOut.positions.data();
+
+    for (int j = 0; j < numJoints; ++j)
+    {
+        float q[4], p[3];
+        loadRotation1(jointPose, j, q);
+        loadPosition1(jointPose, j, p);
+
+        const int parent = skeleton.getJointParent(j);
+        if (parent >= 0)
+        {
+            const float * parentRot = rotationsOut + parent * 4;
+            const float * parentPos = positionsOut + parent * 3;
+
+            float rotated[3];
+            mulQuat1(parentRot, q, q);
+            rotatePoint1(parentRot, p, rotated);
+            for (int i = 0; i < 3; ++i)
+            {
+                p[i] = rotated[i] + parentPos[i];
+            }
+        }
+
+        std::copy_n(q, 4, rotationsOut + j * 4);
+        std::copy_n(p, 3, positionsOut + j * 3);
+    }
+}
+
+// ========================================================
+// Blend kernels:
+// ========================================================
+
+void blendPoses(const BlendPose & a, const BlendPose & b, const float weight,
+                const float * jointWeights, BlendPose & poseOut)
+{
+    checkSameLayout(a, b);
+    checkSameLayout(a, poseOut);
+
+    const int stride = a.stride;
+    int j = 0;
+#if defined(__SSE__)
+    for (; j < stride; j += BlendPose::BlendLanes)
+    {
+        const __m128 t = loadWeights4(weight, jointWeights, j);
+
+        __m128 qa[4], qb[4], pa[3], pb[3];
+        loadRotations4(a, j, qa);
+        loadRotations4(b, j, qb);
+        loadPositions4(a, j, pa);
+        loadPositions4(b, j, pb);
+
+        __m128 q[4], p[3];
+        nlerpQuat4(qa, qb, t, q);
+        for (int i = 0; i < 3; ++i)
+        {
+            p[i] = _mm_add_ps(pa[i], _mm_mul_ps(_mm_sub_ps(pb[i], pa[i]), t));
+        }
+
+        storeRotations4(poseOut, j, q);
+        storePositions4(poseOut, j, p);
+    }
+#endif // __SSE__
+    for (; j < stride; ++j)
+    {
+        const float t = jointWeight(weight, jointWeights, j);
+
+        float qa[4], qb[4], pa[3], pb[3];
+        loadRotation1(a, j, qa);
+        loadRotation1(b, j, qb);
+        loadPosition1(a, j, pa);
+        loadPosition1(b, j, pb);
+
+        float q[4], p[3];
+        nlerpQuat1(qa, qb, t, q);
+        for (int i = 0; i < 3; ++i)
+        {
+            p[i] = pa[i] + (pb[i] - pa[i]) * t;
+        }
+
+        storeRotation1(poseOut, j, q);
+        storePosition1(poseOut, j, p);
+    }
+}
+
+void makeAdditivePose(const BlendPose & pose, const BlendPose & reference, BlendPose & deltaOut)
+{
+    checkSameLayout(pose, reference);
+    checkSameLayout(pose, deltaOut);
+
+    const int stride = pose.stride;
+    int j = 0;
+#if defined(__SSE__)
+    const __m128 negate = _mm_set1_ps(-0.0f);
+    for (; j < stride; j += BlendPose::BlendLanes)
+    {
+        __m128 q[4], r[4], p[3], rp[3];
+        loadRotations4(pose, j, q);
+        loadRotations4(reference, j, r);
+        loadPositions4(pose, j, p);
+        loadPositions4(reference, j, rp);
+
+        __m128 dq[4], dp[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            r[i]  = _mm_xor_ps(r[i], negate);
+            dp[i] = _mm_sub_ps(p[i], rp[i]);
+        }
+        mulQuat4(q, r, dq);
+
+        storeRotations4(deltaOut, j, dq);
+        storePositions4(deltaOut, j, dp);
+    }
+#endif // __SSE__
+    for (; j < stride; ++j)
+    {
+        float q[4], r[4], p[3], rp[3];
+        loadRotation1(pose, j, q);
+        loadRotation1(reference, j, r);
+        loadPosition1(pose, j, p);
+        loadPosition1(reference, j, rp);
+
+        float dq[4], dp[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            r[i]  = -r[i];
+            dp[i] = p[i] - rp[i];
+        }
+        mulQuat1(q, r, dq);
+
+        storeRotation1(deltaOut, j, dq);
+        storePosition1(deltaOut, j, dp);
+    }
+}
+
+void addPoseLayer(const BlendPose & base, const BlendPose & delta, const float weight,
+                  const float * jointWeights, BlendPose & poseOut)
+{
+    checkSameLayout(base, delta);
+    checkSameLayout(base, poseOut);
+
+    const int stride = base.stride;
+    int j = 0;
+#if defined(__SSE__)
+    const __m128 identity[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_set1_ps(1.0f) };
+    for (; j < stride; j += BlendPose::BlendLanes)
+    {
+        const __m128 t = loadWeights4(weight, jointWeights, j);
+
+        __m128 qb[4], qd[4], pb[3], pd[3];
+        loadRotations4(base, j, qb);
+        loadRotations4(delta, j, qd);
+        loadPositions4(base, j, pb);
+        loadPositions4(delta, j, pd);
+
+        __m128 scaledDelta[4], q[4], p[3];
+        nlerpQuat4(identity, qd, t, scaledDelta);
+        mulQuat4(scaledDelta, qb, q);
+        for (int i = 0; i < 3; ++i)
+        {
+            p[i] = _mm_add_ps(pb[i], _mm_mul_ps(pd[i], t));
+        }
+
+        storeRotations4(poseOut, j, q);
+        storePositions4(poseOut, j, p);
+    }
+#endif // __SSE__
+    const float identity1[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    for (; j < stride; ++j)
+    {
+        const float t = jointWeight(weight, jointWeights, j);
+
+        float qb[4], qd[4], pb[3], pd[3];
+        loadRotation1(base, j, qb);
+        loadRotation1(delta, j, qd);
+        loadPosition1(base, j, pb);
+        loadPosition1(delta, j, pd);
+
+        float scaledDelta[4], q[4], p[3];
+        nlerpQuat1(identity1, qd, t, scaledDelta);
+        mulQuat1(scaledDelta, qb, q);
+        for (int i = 0; i < 3; ++i)
+        {
+            p[i] = pb[i] + pd[i] * t;
+        }
+
+        storeRotation1(poseOut, j, q);
+        storePosition1(poseOut, j, p);
+    }
+}
+
+// ========================================================
+// Scalar references:
+// ========================================================
+
+static inline Quat getJointRotation(const BlendPose & pose, const int j)
+{
+    return Quat{ pose.component(BlendPose::RotX)[j], pose.component(BlendPose::RotY)[j],
+                 pose.component(BlendPose::RotZ)[j], pose.component(BlendPose::RotW)[j] };
+}
+
+static inline Point3 getJointPosition(const BlendPose & pose, const int j)
+{
+    return Point3{ pose.component(BlendPose::PosX)[j], pose.component(BlendPose::PosY)[j], pose.component(BlendPose::PosZ)[j] };
+}
+
+static inline void setJoint(BlendPose & pose, const int j, const Quat & rotation, const Point3 & position)
+{
+    pose.component(BlendPose::RotX)[j] = rotation.getX();
+    pose.component(BlendPose::RotY)[j] = rotation.getY();
+    pose.component(BlendPose::RotZ)[j] = rotation.getZ();
+    pose.component(BlendPose::RotW)[j] = rotation.getW();
+    pose.component(BlendPose::PosX)[j] = position.getX();
+    pose.component(BlendPose::PosY)[j] = position.getY();
+    pose.component(BlendPose::PosZ)[j] = position.getZ();
+}
+
+// The vectormath normalize() uses an approximate reciprocal square root, so this one divides by the real length.
+static inline Quat nlerpReference(const float t, const Quat & a, const Quat & b)
+{
+    const Quat target = (static_cast<float>(dot(a, b)) < 0.0f) ? -b : b;
+    const Quat blended = lerp(t, a, target);
+    return blended * (1.0f / std::sqrt(static_cast<float>(norm(blended))));
+}
+
+void blendPosesReference(const BlendPose & a, const BlendPose & b, const float weight,
+                         const float * jointWeights, BlendPose & poseOut)
+{
+    checkSameLayout(a, b);
+    checkSameLayout(a, poseOut);
+
+    for (int j = 0; j < a.stride; ++j)
+    {
+        const float t = jointWeight(weight, jointWeights, j);
+        setJoint(poseOut, j, nlerpReference(t, getJointRotation(a, j), getJointRotation(b, j)),
+                 lerp(t, getJointPosition(a, j), getJointPosition(b, j)));
+    }
+}
+
+void makeAdditivePoseReference(const BlendPose & pose, const BlendPose & reference, BlendPose & deltaOut)
+{
+    checkSameLayout(pose, reference);
+    checkSameLayout(pose, deltaOut);
+
+    for (int j = 0; j < pose.stride; ++j)
+    {
+        const Vec3 offset = getJointPosition(pose, j) - getJointPosition(reference, j);
+        setJoint(deltaOut, j, getJointRotation(pose, j) * conj(getJointRotation(reference, j)), Point3{ offset });
+    }
+}
+
+void addPoseLayerReference(const BlendPose & base, const BlendPose & delta, const float weight,
+                           const float * jointWeights, BlendPose & poseOut)
+{
+    checkSameLayout(base, delta);
+    checkSameLayout(base, poseOut);
+
+    for (int j = 0; j < base.stride; ++j)
+    {
+        const float t = jointWeight(weight, jointWeights, j);
+        const Quat scaledDelta = nlerpReference(t, Quat::identity(), getJointRotation(delta, j));
+        const Vec3 offset = Vec3{ getJointPosition(delta, j) } * t;
+        setJoint(poseOut, j, scaledDelta * getJointRotation(base, j), getJointPosition(base, j) + offset);
+    }
+}
+
+// ========================================================
+// Joint masks:
+// ========================================================
+
+std::vector<float> buildJointMask(const Skeleton & skeleton, const std::string & rootJoint)
+{
+    const int root = skeleton.findJoint(rootJoint);
+    if (root < 0)
+    {
+        throw std::runtime_error{ "Joint \"" + rootJoint + "\" not found for the joint mask!" };
+    }
+
+    const int numJoints = skeleton.getNumJoints();
+    std::vector<float> mask((numJoints + BlendPose::BlendLanes - 1) / BlendPose::BlendLanes * BlendPose::BlendLanes, 0.0f);
+
+    // Parents come before their children, so one pass marks the whole subtree.
+    mask[root] = 1.0f;
+    for (int j = root + 1; j < numJoints; ++j)
+    {
+        const int parent = skeleton.getJointParent(j);
+        if (parent >= 0 && mask[parent] != 0.0f)
+        {
+            mask[j] = 1.0f;
+        }
+    }
+    return mask;
+}
+
+} // namespace DOOM3 {}
@@ -0,0 +1,142 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pose_blend.hpp
+// Author: Guilherme R. Lampert
+// Created on: 17/10/26
+// Brief: Structure-of-arrays pose blending: crossfades, additive layers and joint masks.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef POSE_BLEND_HPP
+#define POSE_BLEND_HPP
+
+#include <string>
+#include <vector>
+
+namespace DOOM3
+{
+
+class Skeleton;
+struct Pose;
+
+// ========================================================
+// struct BlendPose:
+// ========================================================
+
+//
+// A pose in joint space (each joint relative to its parent), laid out as
+// structure-of-arrays: one array per component, so the blend kernels load
+// the same component of four joints into a SIMD register with a single load.
+//
+// The arrays are padded to a multiple of BlendLanes joints, with identity
+// rotations and zero positions, so the kernels never need a scalar tail.
+// All the component arrays live in one allocation, 'stride' floats apart.
+//
+struct BlendPose
+{
+    static constexpr int BlendLanes = 4;
+
+    enum Component
+    {
+        RotX, RotY, RotZ, RotW,
+        PosX, PosY, PosZ,
+        NumComponents
+    };
+
+    std::vector<float> data;
+    int numJoints = 0;
+    int stride    = 0; // numJoints rounded up to BlendLanes.
+
+    void resize(int jointCount);
+
+    float * component(const Component c) noexcept { return data.data() + c * stride; }
+    const float * component(const Component c) const noexcept { return data.data() + c * stride; }
+
+    int getNumJoints() const noexcept { return numJoints; }
+};
+
+// ========================================================
+// Space conversions:
+// ========================================================
+
+//
+// Model space Pose (the AnimInstance streams) to joint space. The parent of each
+// joint is gathered into scratch arrays first, so the conversion itself is one
+// quaternion multiply and rotation per joint, four joints at a time. The rotations
+// are renormalized on the way, so the joint space ones are unit length.
+//
+void poseToJointSpace(const Pose & modelPose, const Skeleton & skeleton, BlendPose & poseOut);
+
+//
+// Joint space back to a model space Pose. Each joint needs its parent in model
+// space first, so this walks the hierarchy one joint at a time; it's the only
+// scalar step of a blend.
+//
+void poseToModelSpace(const BlendPose & jointPose, const Skeleton & skeleton, Pose & poseOut);
+
+// ========================================================
+// Blend kernels:
+// ========================================================
+
+//
+// The blend kernels run over the component arrays of whole poses, four joints
+// per iteration with SSE, or a scalar loop for other targets. The output may be
+// the same object as any of the inputs, and all the poses must have the same
+// number of joints.
+//
+// 'jointWeights' is an optional per joint mask (see buildJointMask()), with at
+// least 'stride' entries; each joint uses 'weight * jointWeights[j]'. Null means
+// 'weight' for every joint.
+//
+
+//
+// Crossfade: positions are linearly blended and rotations take the normalized
+// linear blend (nlerp) along the shortest arc, from 'a' (weight 0) to 'b' (weight 1).
+//
+void blendPoses(const BlendPose & a, const BlendPose & b, float weight,
+                const float * jointWeights, BlendPose & poseOut);
+
+//
+// Difference of 'pose' from 'reference', for the additive layers:
+// rotation = pose * conjugate(reference), position = pose - reference.
+//
+void makeAdditivePose(const BlendPose & pose, const BlendPose & reference, BlendPose & deltaOut);
+
+//
+// Applies an additive delta from makeAdditivePose() on top of 'base', scaled by the
+// weights: the delta rotation is blended from identity, then applied before the base
+// rotation, and the scaled delta position is added. A delta applied at full weight
+// to its own reference pose gives back the pose it was made from.
+//
+void addPoseLayer(const BlendPose & base, const BlendPose & delta, float weight,
+                  const float * jointWeights, BlendPose & poseOut);
+
+//
+// Scalar reference versions of the kernels above, one joint at a time with the
+// vectormath Quat and Point3 operations (lerp, conj and friends).
+// Same results to about float precision, for checking and timing the kernels.
+//
+void blendPosesReference(const BlendPose & a, const BlendPose & b, float weight,
+                         const float * jointWeights, BlendPose & poseOut);
+void makeAdditivePoseReference(const BlendPose & pose, const BlendPose & reference, BlendPose & deltaOut);
+void addPoseLayerReference(const BlendPose & base, const BlendPose & delta, float weight,
+                           const float * jointWeights, BlendPose & poseOut);
+
+// ========================================================
+// Joint masks:
+// ========================================================
+
+//
+// Per joint weights for the blend kernels: 1 for 'rootJoint' and all of its
+// descendants, 0 for every other joint and the padding. Sized for a BlendPose
+// of the skeleton. Throws std::runtime_error if the joint is not found.
+//
+std::vector<float> buildJointMask(const Skeleton & skeleton, const std::string & rootJoint);
+
+} // namespace DOOM3 {}
+
+#endif // POSE_BLEND_HPP
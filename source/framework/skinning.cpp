@@ -0,0 +1,1211 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: skinning.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: SIMD CPU skinning and GPU skinning data for the DOOM 3 MD5 meshes.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "skinning.hpp"
+#include "doom3md5.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__SSE__)
+    #include <xmmintrin.h>
+#endif // __AVX__ || __SSE2__ || __SSE__
+
+namespace DOOM3
+{
+
+// ========================================================
+// Skinning matrices:
+// ========================================================
+
+// Rotation matrix of a joint quaternion (x, y, z, w).
+static void quaternionToMatrix(const float * q, float rot[3][3])
+{
+    const float x = q[0], y = q[1], z = q[2], w = q[3];
+
+    // Dividing by the squared length gives a pure rotation even if the
+    // quaternion is slightly off unit length (the poses are normalized
+    // with an approximate reciprocal square root).
+    const float lengthSqr = (x * x) + (y * y) + (z * z) + (w * w);
+    const float s = (lengthSqr > 0.0f) ? (2.0f / lengthSqr) : 0.0f;
+
+    rot[0][0] = 1.0f - s * (y * y + z * z);
+    rot[0][1] = s * (x * y - w * z);
+    rot[0][2] = s * (x * z + w * y);
+    rot[1][0] = s * (x * y + w * z);
+    rot[1][1] = 1.0f - s * (x * x + z * z);
+    rot[1][2] = s * (y * z - w * x);
+    rot[2][0] = s * (x * z - w * y);
+    rot[2][1] = s * (y * z + w * x);
+    rot[2][2] = 1.0f - s * (x * x + y * y);
+}
+
+// GL axis order: idSoftware's Z is our Y.
+static const int glAxisOrder[3] = { 0, 2, 1 };
+
+void buildSkinningMatrices(const Pose & pose, const float scale, float * matricesOut)
+{
+    assert(matricesOut != nullptr);
+
+    const int numJoints = pose.getNumJoints();
+    for (int j = 0; j < numJoints; ++j)
+    {
+        const float * p = &pose.positions[j * 3];
+
+        float rot[3][3];
+        quaternionToMatrix(&pose.rotations[j * 4], rot);
+
+        // Rows in GL order. The columns stay in id's order, same as the weight positions.
+        float * m = matricesOut + j * SkinningMatrixFloats;
+        for (int row = 0; row < 3; ++row)
+        {
+            const int src = glAxisOrder[row];
+            m[row * 4 + 0] = rot[src][0] * scale;
+            m[row * 4 + 1] = rot[src][1] * scale;
+            m[row * 4 + 2] = rot[src][2] * scale;
+            m[row * 4 + 3] = p[src] * scale;
+        }
+    }
+}
+
+void buildSkinningNormalMatrices(const Pose & pose, const Pose & bindPose, float * matricesOut)
+{
+    assert(matricesOut != nullptr);
+    assert(pose.getNumJoints() == bindPose.getNumJoints());
+
+    const int numJoints = pose.getNumJoints();
+    for (int j = 0; j < numJoints; ++j)
+    {
+        float rot[3][3];
+        float bindRot[3][3];
+        quaternionToMatrix(&pose.rotations[j * 4], rot);
+        quaternionToMatrix(&bindPose.rotations[j * 4], bindRot);
+
+        // rot * transpose(bindRot), with rows and columns in GL order,
+        // since the bind pose tangent basis is already in the GL space.
+        float * m = matricesOut + j * SkinningMatrixFloats;
+        for (int row = 0; row < 3; ++row)
+        {
+            const int r = glAxisOrder[row];
+            for (int col = 0; col < 3; ++col)
+            {
+                const int c = glAxisOrder[col];
+                m[row * 4 + col] = (rot[r][0] * bindRot[c][0]) +
+                                   (rot[r][1] * bindRot[c][1]) +
+                                   (rot[r][2] * bindRot[c][2]);
+            }
+            m[row * 4 + 3] = 0.0f;
+        }
+    }
+}
+
+int buildGpuSkinningVertexes(const Mesh & mesh, const Pose & bindPose, const GLDrawVertex * bindPoseVerts,
+                             std::vector<GLSkinnedVertex> * vertsOut)
+{
+    assert(bindPoseVerts != nullptr);
+    assert(vertsOut      != nullptr);
+
+    constexpr int MaxWeights = GLSkinnedVertex::MaxWeights;
+    int numReduced = 0;
+    std::vector<int> order;
+
+    vertsOut->clear();
+    vertsOut->reserve(mesh.vertexes.size());
+
+    for (std::size_t v = 0; v < mesh.vertexes.size(); ++v)
+    {
+        const Vertex & vert = mesh.vertexes[v];
+
+        // Heaviest weights first.
+        const int weightCount = std::max(vert.weightCount, 0);
+        order.resize(weightCount);
+        std::iota(std::begin(order), std::end(order), vert.firstWeight);
+        std::stable_sort(std::begin(order), std::end(order),
+                         [&mesh](const int a, const int b)
+                         {
+                             return mesh.weights[a].bias > mesh.weights[b].bias;
+                         });
+
+        GLSkinnedVertex skinnedVert;
+        std::memset(&skinnedVert, 0, sizeof(skinnedVert));
+        skinnedVert.bindPose = bindPoseVerts[v];
+
+        for (int w = 0; w < std::min(weightCount, MaxWeights); ++w)
+        {
+            const Weight & weight = mesh.weights[order[w]];
+            skinnedVert.joints[w]     = static_cast<std::uint8_t>(weight.joint);
+            skinnedVert.weights[w][0] = weight.pos[0] * weight.bias;
+            skinnedVert.weights[w][1] = weight.pos[1] * weight.bias;
+            skinnedVert.weights[w][2] = weight.pos[2] * weight.bias;
+            skinnedVert.weights[w][3] = weight.bias;
+        }
+
+        // Weights that don't fit are moved to the heaviest joint: their bind pose
+        // position is brought to its joint space and added with the same bias.
+        // Exact in the bind pose and close while the two joints move together.
+        if (weightCount > MaxWeights)
+        {
+            const Weight & target = mesh.weights[order[0]];
+            const float * targetPos = &bindPose.positions[target.joint * 3];
+
+            float targetRot[3][3];
+            quaternionToMatrix(&bindPose.rotations[target.joint * 4], targetRot);
+
+            for (int w = MaxWeights; w < weightCount; ++w)
+            {
+                const Weight & weight = mesh.weights[order[w]];
+                const float * jointPos = &bindPose.positions[weight.joint * 3];
+
+                float jointRot[3][3];
+                quaternionToMatrix(&bindPose.rotations[weight.joint * 4], jointRot);
+
+                // Model space position of the weight, relative to the target joint:
+                float offset[3];
+                for (int i = 0; i < 3; ++i)
+                {
+                    offset[i] = (jointRot[i][0] * weight.pos[0]) +
+                                (jointRot[i][1] * weight.pos[1]) +
+                                (jointRot[i][2] * weight.pos[2]) + jointPos[i] - targetPos[i];
+                }
+
+                // Inverse rotation (transpose) to the target joint space:
+                for (int i = 0; i < 3; ++i)
+                {
+                    const float local = (targetRot[0][i] * offset[0]) +
+                                        (targetRot[1][i] * offset[1]) +
+                                        (targetRot[2][i] * offset[2]);
+                    skinnedVert.weights[0][i] += local * weight.bias;
+                }
+                skinnedVert.weights[0][3] += weight.bias;
+            }
+            ++numReduced;
+        }
+
+        vertsOut->push_back(skinnedVert);
+    }
+
+    return numReduced;
+}
+
+// ========================================================
+// SIMD helpers:
+// ========================================================
+
+#if defined(__AVX__)
+
+// Loads a matrix row for two lanes: 'a' in the low 128 bits and 'b' in the high 128 bits.
+static inline __m256 loadRowPair(const float * a, const float * b)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(a)), _mm_loadu_ps(b), 1);
+}
+
+// Same as _MM_TRANSPOSE4_PS, done in each 128 bit half. The AVX unpacks and
+// shuffles don't cross halves, so this transposes lanes 0-3 and 4-7 side by side.
+static inline void transposeHalves(__m256 & r0, __m256 & r1, __m256 & r2, __m256 & r3)
+{
+    const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    const __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+    const __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+    const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+#endif // __AVX__
+
+// ========================================================
+// class SkinningBatches:
+// ========================================================
+
+constexpr int SkinningBatches::BatchSize;
+
+SkinningBatches::SkinningBatches(const Mesh & mesh)
+    : batches       { }
+    , vertexIndexes { }
+    , texCoords     { }
+    , slotJoints    { }
+    , slotWeights   { }
+    , numVertexes   { static_cast<int>(mesh.vertexes.size()) }
+    , numWeights    { 0 }
+{
+    // Sorting by weight count keeps the padding down to the few batches where the count changes.
+    std::vector<std::int32_t> order(numVertexes);
+    std::iota(std::begin(order), std::end(order), 0);
+    std::stable_sort(std::begin(order), std::end(order),
+                     [&mesh](const std::int32_t a, const std::int32_t b)
+                     {
+                         return mesh.vertexes[a].weightCount < mesh.vertexes[b].weightCount;
+                     });
+
+    const int numBatches = (numVertexes + BatchSize - 1) / BatchSize;
+    batches.reserve(numBatches);
+    vertexIndexes.assign(numBatches * BatchSize, -1);
+    texCoords.assign(numBatches * BatchSize * 2, 0.0f);
+
+    for (int b = 0; b < numBatches; ++b)
+    {
+        const int first = b * BatchSize;
+        const int count = std::min(BatchSize, numVertexes - first);
+
+        Batch batch;
+        batch.firstSlot = static_cast<std::uint32_t>(slotJoints.size() / BatchSize);
+        batch.numSlots  = 0;
+        for (int lane = 0; lane < count; ++lane)
+        {
+            const auto weightCount = static_cast<std::uint32_t>(std::max(mesh.vertexes[order[first + lane]].weightCount, 0));
+            batch.numSlots = std::max(batch.numSlots, weightCount);
+        }
+
+        // Padding weights have zero bias and point to joint 0, so they add nothing.
+        slotJoints.resize(slotJoints.size() + batch.numSlots * BatchSize, 0);
+        slotWeights.resize(slotWeights.size() + batch.numSlots * BatchSize * 4, 0.0f);
+
+        for (int lane = 0; lane < count; ++lane)
+        {
+            const std::int32_t vertIndex = order[first + lane];
+            const Vertex & vert = mesh.vertexes[vertIndex];
+
+            vertexIndexes[first + lane]      = vertIndex;
+            texCoords[(first + lane) * 2]     = vert.u;
+            texCoords[(first + lane) * 2 + 1] = vert.v;
+
+            for (int w = 0; w < vert.weightCount; ++w)
+            {
+                const Weight & weight = mesh.weights[vert.firstWeight + w];
+                const std::uint32_t slot = batch.firstSlot + w;
+
+                float * lanes = &slotWeights[slot * BatchSize * 4];
+                lanes[lane]                 = weight.pos[0] * weight.bias;
+                lanes[lane + BatchSize]     = weight.pos[1] * weight.bias;
+                lanes[lane + BatchSize * 2] = weight.pos[2] * weight.bias;
+                lanes[lane + BatchSize * 3] = weight.bias;
+                slotJoints[slot * BatchSize + lane] = weight.joint;
+            }
+            numWeights += vert.weightCount;
+        }
+
+        batches.push_back(batch);
+    }
+}
+
+void SkinningBatches::skin(const float * matrices, GLDrawVertex * vertsOut) const
+{
+    assert(matrices != nullptr);
+    assert(vertsOut != nullptr);
+
+    float xyz[3 * BatchSize];
+    const std::int32_t * indexes = vertexIndexes.data();
+    const float        * uvs     = texCoords.data();
+
+    for (const Batch & batch : batches)
+    {
+        skinBatch(batch, matrices, xyz);
+
+        // Only the last batch can have padding, which comes after the real vertexes.
+        for (int lane = 0; lane < BatchSize && indexes[lane] >= 0; ++lane)
+        {
+            GLDrawVertex & vert = vertsOut[indexes[lane]];
+            vert.px = xyz[lane];
+            vert.py = xyz[lane + BatchSize];
+            vert.pz = xyz[lane + BatchSize * 2];
+            vert.u  = uvs[lane * 2];
+            vert.v  = uvs[lane * 2 + 1];
+            vert.r  = 1.0f;
+            vert.g  = 1.0f;
+            vert.b  = 1.0f;
+            vert.a  = 1.0f;
+        }
+
+        indexes += BatchSize;
+        uvs     += BatchSize * 2;
+    }
+}
+
+void SkinningBatches::skinBatch(const Batch & batch, const float * matrices, float * xyzOut) const
+{
+    const std::int32_t * joints  = &slotJoints[batch.firstSlot * BatchSize];
+    const float        * weights = &slotWeights[batch.firstSlot * BatchSize * 4];
+
+#if defined(__AVX__)
+
+    // All 8 lanes at once. For each slot, the 3x4 matrices of the 8 joints are
+    // transposed into one register per matrix element, then it's a plain
+    // multiply-add of the element registers by the weight registers.
+    __m256 acc[3] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+
+    for (std::uint32_t s = 0; s < batch.numSlots; ++s, joints += BatchSize, weights += BatchSize * 4)
+    {
+        const __m256 wx = _mm256_loadu_ps(weights);
+        const __m256 wy = _mm256_loadu_ps(weights + BatchSize);
+        const __m256 wz = _mm256_loadu_ps(weights + BatchSize * 2);
+        const __m256 wb = _mm256_loadu_ps(weights + BatchSize * 3);
+
+        const float * m[BatchSize];
+        for (int lane = 0; lane < BatchSize; ++lane)
+        {
+            m[lane] = matrices + joints[lane] * SkinningMatrixFloats;
+        }
+
+        for (int row = 0; row < 3; ++row)
+        {
+            const int offset = row * 4;
+            __m256 c0 = loadRowPair(m[0] + offset, m[4] + offset);
+            __m256 c1 = loadRowPair(m[1] + offset, m[5] + offset);
+            __m256 c2 = loadRowPair(m[2] + offset, m[6] + offset);
+            __m256 c3 = loadRowPair(m[3] + offset, m[7] + offset);
+            transposeHalves(c0, c1, c2, c3);
+
+            const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c0, wx), _mm256_mul_ps(c1, wy)),
+                                             _mm256_add_ps(_mm256_mul_ps(c2, wz), _mm256_mul_ps(c3, wb)));
+            acc[row] = _mm256_add_ps(acc[row], sum);
+        }
+    }
+
+    _mm256_storeu_ps(xyzOut,                 acc[0]);
+    _mm256_storeu_ps(xyzOut + BatchSize,     acc[1]);
+    _mm256_storeu_ps(xyzOut + BatchSize * 2, acc[2]);
+
+#elif defined(__SSE__)
+
+    // Same as the AVX path, for each half of the batch.
+    for (int half = 0; half < BatchSize; half += 4)
+    {
+        __m128 acc[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+
+        const std::int32_t * slotJoint  = joints  + half;
+        const float        * slotWeight = weights + half;
+
+        for (std::uint32_t s = 0; s < batch.numSlots; ++s, slotJoint += BatchSize, slotWeight += BatchSize * 4)
+        {
+            const __m128 wx = _mm_loadu_ps(slotWeight);
+            const __m128 wy = _mm_loadu_ps(slotWeight + BatchSize);
+            const __m128 wz = _mm_loadu_ps(slotWeight + BatchSize * 2);
+            const __m128 wb = _mm_loadu_ps(slotWeight + BatchSize * 3);
+
+            const float * m0 = matrices + slotJoint[0] * SkinningMatrixFloats;
+            const float * m1 = matrices + slotJoint[1] * SkinningMatrixFloats;
+            const float * m2 = matrices + slotJoint[2] * SkinningMatrixFloats;
+            const float * m3 = matrices + slotJoint[3] * SkinningMatrixFloats;
+
+            for (int row = 0; row < 3; ++row)
+            {
+                const int offset = row * 4;
+                __m128 c0 = _mm_loadu_ps(m0 + offset);
+                __m128 c1 = _mm_loadu_ps(m1 + offset);
+                __m128 c2 = _mm_loadu_ps(m2 + offset);
+                __m128 c3 = _mm_loadu_ps(m3 + offset);
+                _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+                const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, wx), _mm_mul_ps(c1, wy)),
+                                              _mm_add_ps(_mm_mul_ps(c2, wz), _mm_mul_ps(c3, wb)));
+                acc[row] = _mm_add_ps(acc[row], sum);
+            }
+        }
+
+        _mm_storeu_ps(xyzOut + half,                 acc[0]);
+        _mm_storeu_ps(xyzOut + half + BatchSize,     acc[1]);
+        _mm_storeu_ps(xyzOut + half + BatchSize * 2, acc[2]);
+    }
+
+#else // !__AVX__ && !__SSE__
+
+    for (int lane = 0; lane < BatchSize; ++lane)
+    {
+        float acc[3] = { 0.0f, 0.0f, 0.0f };
+        for (std::uint32_t s = 0; s < batch.numSlots; ++s)
+        {
+            const float * w = weights + s * BatchSize * 4 + lane;
+            const float * m = matrices + joints[s * BatchSize + lane] * SkinningMatrixFloats;
+            for (int row = 0; row < 3; ++row)
+            {
+                acc[row] += (m[row * 4 + 0] * w[0])             + (m[row * 4 + 1] * w[BatchSize]) +
+                            (m[row * 4 + 2] * w[BatchSize * 2]) + (m[row * 4 + 3] * w[BatchSize * 3]);
+            }
+        }
+        xyzOut[lane]                 = acc[0];
+        xyzOut[lane + BatchSize]     = acc[1];
+        xyzOut[lane + BatchSize * 2] = acc[2];
+    }
+
+#endif // __AVX__ || __SSE__
+}
+
+// ========================================================
+// class TangentSpaceSolver:
+// ========================================================
+
+// Normal, tangent and bi-tangent of a triangle, each padded to 4 floats.
+static constexpr int FaceFloats = 12;
+
+#if defined(__SSE__)
+
+// 1/sqrt(x), from the SSE approximation refined with one Newton-Raphson step.
+// About 22 bits of precision, for a fraction of the cost of a sqrt and a divide.
+static inline __m128 reciprocalSqrt(const __m128 x)
+{
+    const __m128 y = _mm_rsqrt_ps(x);
+    return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y),
+                      _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(x, y), y)));
+}
+
+// Dot products of four vectors held as one register per component.
+static inline __m128 dot3(const __m128 * a, const __m128 * b)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+}
+
+#endif // __SSE__
+
+// Same math as deriveNormalsAndTangents(), for one triangle.
+static void deriveFace(const GLDrawVertex & a, const GLDrawVertex & b, const GLDrawVertex & c, float * faceOut)
+{
+    const float d0[5]{ b.px - a.px, b.py - a.py, b.pz - a.pz, b.u - a.u, b.v - a.v };
+    const float d1[5]{ c.px - a.px, c.py - a.py, c.pz - a.pz, c.u - a.u, c.v - a.v };
+
+    const float normal[3]{ (d1[1] * d0[2]) - (d1[2] * d0[1]),
+                           (d1[2] * d0[0]) - (d1[0] * d0[2]),
+                           (d1[0] * d0[1]) - (d1[1] * d0[0]) };
+
+    const float tangent[3]{ (d0[0] * d1[4]) - (d0[4] * d1[0]),
+                            (d0[1] * d1[4]) - (d0[4] * d1[1]),
+                            (d0[2] * d1[4]) - (d0[4] * d1[2]) };
+
+    const float bitangent[3]{ (d0[3] * d1[0]) - (d0[0] * d1[3]),
+                              (d0[3] * d1[1]) - (d0[1] * d1[3]),
+                              (d0[3] * d1[2]) - (d0[2] * d1[3]) };
+
+    // The tangent and bi-tangent flip with the sign of the texture area.
+    const float area = (d0[3] * d1[4]) - (d0[4] * d1[3]);
+    const float sign = std::signbit(area) ? -1.0f : 1.0f;
+
+    const float f0 = 1.0f / std::sqrt((normal[0] * normal[0]) + (normal[1] * normal[1]) + (normal[2] * normal[2]));
+    const float f1 = sign / std::sqrt((tangent[0] * tangent[0]) + (tangent[1] * tangent[1]) + (tangent[2] * tangent[2]));
+    const float f2 = sign / std::sqrt((bitangent[0] * bitangent[0]) + (bitangent[1] * bitangent[1]) + (bitangent[2] * bitangent[2]));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        faceOut[i]     = -(normal[i] * f0); // Flipped, see deriveNormalsAndTangents().
+        faceOut[i + 4] = tangent[i]   * f1;
+        faceOut[i + 8] = bitangent[i] * f2;
+    }
+    faceOut[3] = faceOut[7] = faceOut[11] = 0.0f;
+}
+
+TangentSpaceSolver::TangentSpaceSolver(const Mesh & mesh, const GLDrawVertex * bindPoseVerts,
+                                       const GLDrawIndex32 * indexes, const int indexCount)
+    : numVertexes         { static_cast<int>(mesh.vertexes.size()) }
+    , numTriangles        { indexCount / 3 }
+    , triangleIndexes     ( indexes, indexes + numTriangles * 3 )
+    , vertexFirstTriangle ( numVertexes + 1, 0 )
+    , vertexTriangles     ( numTriangles * 3 )
+    , bindPoseBasis       ( numVertexes * 9 )
+    , vertexFirstWeight   ( numVertexes + 1, 0 )
+    , weightJoints        { }
+    , weightBiases        { }
+{
+    assert(bindPoseVerts != nullptr);
+    assert(indexes       != nullptr);
+
+    // Vertex to triangle adjacency. A triangle is listed once per corner,
+    // so degenerate ones count twice for a vertex, same as summing in order.
+    for (const std::int32_t index : triangleIndexes)
+    {
+        assert(index < numVertexes);
+        ++vertexFirstTriangle[index + 1];
+    }
+    std::partial_sum(std::begin(vertexFirstTriangle), std::end(vertexFirstTriangle), std::begin(vertexFirstTriangle));
+
+    std::vector<std::int32_t> cursors(std::begin(vertexFirstTriangle), std::end(vertexFirstTriangle) - 1);
+    for (int t = 0; t < numTriangles; ++t)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            vertexTriangles[cursors[triangleIndexes[t * 3 + corner]]++] = t;
+        }
+    }
+
+    // Weights of each vertex, for skinBindPose().
+    for (int v = 0; v < numVertexes; ++v)
+    {
+        const Vertex & vert = mesh.vertexes[v];
+        for (int w = 0; w < vert.weightCount; ++w)
+        {
+            const Weight & weight = mesh.weights[vert.firstWeight + w];
+            weightJoints.push_back(weight.joint);
+            weightBiases.push_back(weight.bias);
+        }
+        vertexFirstWeight[v + 1] = static_cast<std::int32_t>(weightJoints.size());
+    }
+
+    // Bind pose basis:
+    std::vector<GLDrawVertex> verts(bindPoseVerts, bindPoseVerts + numVertexes);
+    Scratch scratch;
+    derive(verts.data(), scratch);
+
+    for (int v = 0; v < numVertexes; ++v)
+    {
+        float * basis = &bindPoseBasis[v * 9];
+        basis[0] = verts[v].nx; basis[1] = verts[v].ny; basis[2] = verts[v].nz;
+        basis[3] = verts[v].tx; basis[4] = verts[v].ty; basis[5] = verts[v].tz;
+        basis[6] = verts[v].bx; basis[7] = verts[v].by; basis[8] = verts[v].bz;
+    }
+}
+
+void TangentSpaceSolver::derive(GLDrawVertex * verts, Scratch & scratch, WorkerPool * pool) const
+{
+    assert(verts != nullptr);
+
+    // Only allocates the first time.
+    scratch.faceVectors.resize(numTriangles * FaceFloats);
+    float * faces = scratch.faceVectors.data();
+
+    if (pool == nullptr || pool->getNumThreads() == 1 || numTriangles < MinParallelTriangles)
+    {
+        deriveFaces(0, numTriangles, verts, faces);
+        sumVertexes(0, numVertexes, faces, verts);
+        return;
+    }
+
+    // A few chunks per thread, so uneven progress evens out.
+    const int numChunks = pool->getNumThreads() * 4;
+
+    pool->parallelFor(numChunks, [this, verts, faces, numChunks](const int chunk)
+    {
+        deriveFaces(numTriangles * chunk / numChunks, numTriangles * (chunk + 1) / numChunks, verts, faces);
+    });
+    pool->parallelFor(numChunks, [this, verts, faces, numChunks](const int chunk)
+    {
+        sumVertexes(numVertexes * chunk / numChunks, numVertexes * (chunk + 1) / numChunks, faces, verts);
+    });
+}
+
+void TangentSpaceSolver::deriveFaces(const int firstTriangle, const int lastTriangle,
+                                     const GLDrawVertex * verts, float * facesOut) const
+{
+    int t = firstTriangle;
+
+#if defined(__SSE__)
+
+    // Four triangles per iteration. The corners are gathered into one register
+    // per component, then the result registers are transposed back to one row
+    // per triangle. Same math as deriveFace(), except for reciprocalSqrt().
+    const __m128 one      = _mm_set1_ps(1.0f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    for (; t + 4 <= lastTriangle; t += 4)
+    {
+        // The xyz and uv of each corner are loaded as rows and transposed.
+        // The extra lanes (nx, tx and ty) are ignored.
+        __m128 corners[3][5];
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            const GLDrawVertex & v0 = verts[triangleIndexes[(t + 0) * 3 + corner]];
+            const GLDrawVertex & v1 = verts[triangleIndexes[(t + 1) * 3 + corner]];
+            const GLDrawVertex & v2 = verts[triangleIndexes[(t + 2) * 3 + corner]];
+            const GLDrawVertex & v3 = verts[triangleIndexes[(t + 3) * 3 + corner]];
+
+            __m128 xyz0 = _mm_loadu_ps(&v0.px);
+            __m128 xyz1 = _mm_loadu_ps(&v1.px);
+            __m128 xyz2 = _mm_loadu_ps(&v2.px);
+            __m128 xyz3 = _mm_loadu_ps(&v3.px);
+            _MM_TRANSPOSE4_PS(xyz0, xyz1, xyz2, xyz3);
+
+            __m128 uv0 = _mm_loadu_ps(&v0.u);
+            __m128 uv1 = _mm_loadu_ps(&v1.u);
+            __m128 uv2 = _mm_loadu_ps(&v2.u);
+            __m128 uv3 = _mm_loadu_ps(&v3.u);
+            _MM_TRANSPOSE4_PS(uv0, uv1, uv2, uv3);
+
+            // After the transposes, xyz0..2 hold x, y and z and uv0..1 hold u and v.
+            corners[corner][0] = xyz0;
+            corners[corner][1] = xyz1;
+            corners[corner][2] = xyz2;
+            corners[corner][3] = uv0;
+            corners[corner][4] = uv1;
+        }
+
+        __m128 d0[5], d1[5];
+        for (int i = 0; i < 5; ++i)
+        {
+            d0[i] = _mm_sub_ps(corners[1][i], corners[0][i]);
+            d1[i] = _mm_sub_ps(corners[2][i], corners[0][i]);
+        }
+
+        __m128 n[4] = { _mm_sub_ps(_mm_mul_ps(d1[1], d0[2]), _mm_mul_ps(d1[2], d0[1])),
+                        _mm_sub_ps(_mm_mul_ps(d1[2], d0[0]), _mm_mul_ps(d1[0], d0[2])),
+                        _mm_sub_ps(_mm_mul_ps(d1[0], d0[1]), _mm_mul_ps(d1[1], d0[0])),
+                        _mm_setzero_ps() };
+
+        __m128 tan[4] = { _mm_sub_ps(_mm_mul_ps(d0[0], d1[4]), _mm_mul_ps(d0[4], d1[0])),
+                          _mm_sub_ps(_mm_mul_ps(d0[1], d1[4]), _mm_mul_ps(d0[4], d1[1])),
+                          _mm_sub_ps(_mm_mul_ps(d0[2], d1[4]), _mm_mul_ps(d0[4], d1[2])),
+                          _mm_setzero_ps() };
+
+        __m128 bitan[4] = { _mm_sub_ps(_mm_mul_ps(d0[3], d1[0]), _mm_mul_ps(d0[0], d1[3])),
+                            _mm_sub_ps(_mm_mul_ps(d0[3], d1[1]), _mm_mul_ps(d0[1], d1[3])),
+                            _mm_sub_ps(_mm_mul_ps(d0[3], d1[2]), _mm_mul_ps(d0[2], d1[3])),
+                            _mm_setzero_ps() };
+
+        const __m128 area = _mm_sub_ps(_mm_mul_ps(d0[3], d1[4]), _mm_mul_ps(d0[4], d1[3]));
+        const __m128 sign = _mm_or_ps(_mm_and_ps(area, signMask), one);
+
+        const __m128 f0 = reciprocalSqrt(dot3(n, n));
+        const __m128 f1 = _mm_mul_ps(sign, reciprocalSqrt(dot3(tan, tan)));
+        const __m128 f2 = _mm_mul_ps(sign, reciprocalSqrt(dot3(bitan, bitan)));
+
+        for (int i = 0; i < 3; ++i)
+        {
+            n[i]     = _mm_xor_ps(_mm_mul_ps(n[i], f0), signMask);
+            tan[i]   = _mm_mul_ps(tan[i], f1);
+            bitan[i] = _mm_mul_ps(bitan[i], f2);
+        }
+
+        _MM_TRANSPOSE4_PS(n[0], n[1], n[2], n[3]);
+        _MM_TRANSPOSE4_PS(tan[0], tan[1], tan[2], tan[3]);
+        _MM_TRANSPOSE4_PS(bitan[0], bitan[1], bitan[2], bitan[3]);
+
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            float * face = facesOut + (t + lane) * FaceFloats;
+            _mm_storeu_ps(face,     n[lane]);
+            _mm_storeu_ps(face + 4, tan[lane]);
+            _mm_storeu_ps(face + 8, bitan[lane]);
+        }
+    }
+
+#endif // __SSE__
+
+    // Remaining triangles, or all of them without SSE.
+    for (; t < lastTriangle; ++t)
+    {
+        const std::int32_t * tri = &triangleIndexes[t * 3];
+        deriveFace(verts[tri[0]], verts[tri[1]], verts[tri[2]], facesOut + t * FaceFloats);
+    }
+}
+
+void TangentSpaceSolver::sumVertexes(const int firstVertex, const int lastVertex,
+                                     const float * faces, GLDrawVertex * verts) const
+{
+    int v = firstVertex;
+
+#if defined(__SSE__)
+
+    // Four vertexes per iteration: the sums are transposed to one register
+    // per component and the projection and normalization run on all four.
+    for (; v + 4 <= lastVertex; v += 4)
+    {
+        __m128 sums[3][4];
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            __m128 normalSum    = _mm_setzero_ps();
+            __m128 tangentSum   = _mm_setzero_ps();
+            __m128 bitangentSum = _mm_setzero_ps();
+
+            const std::int32_t * tri    = &vertexTriangles[0] + vertexFirstTriangle[v + lane];
+            const std::int32_t * triEnd = &vertexTriangles[0] + vertexFirstTriangle[v + lane + 1];
+            for (; tri != triEnd; ++tri)
+            {
+                const float * face = faces + (*tri) * FaceFloats;
+                normalSum    = _mm_add_ps(normalSum,    _mm_loadu_ps(face));
+                tangentSum   = _mm_add_ps(tangentSum,   _mm_loadu_ps(face + 4));
+                bitangentSum = _mm_add_ps(bitangentSum, _mm_loadu_ps(face + 8));
+            }
+
+            sums[0][lane] = normalSum;
+            sums[1][lane] = tangentSum;
+            sums[2][lane] = bitangentSum;
+        }
+
+        __m128 * n = sums[0];
+        __m128 * t = sums[1];
+        __m128 * b = sums[2];
+        _MM_TRANSPOSE4_PS(n[0], n[1], n[2], n[3]);
+        _MM_TRANSPOSE4_PS(t[0], t[1], t[2], t[3]);
+        _MM_TRANSPOSE4_PS(b[0], b[1], b[2], b[3]);
+
+        const __m128 normalScale = reciprocalSqrt(dot3(n, n));
+        for (int i = 0; i < 3; ++i)
+        {
+            n[i] = _mm_mul_ps(n[i], normalScale);
+        }
+
+        const __m128 tangentDot   = dot3(t, n);
+        const __m128 bitangentDot = dot3(b, n);
+        for (int i = 0; i < 3; ++i)
+        {
+            t[i] = _mm_sub_ps(t[i], _mm_mul_ps(tangentDot,   n[i]));
+            b[i] = _mm_sub_ps(b[i], _mm_mul_ps(bitangentDot, n[i]));
+        }
+
+        const __m128 tangentScale   = reciprocalSqrt(dot3(t, t));
+        const __m128 bitangentScale = reciprocalSqrt(dot3(b, b));
+
+        alignas(16) float basis[9][4];
+        for (int i = 0; i < 3; ++i)
+        {
+            _mm_store_ps(basis[i],     n[i]);
+            _mm_store_ps(basis[i + 3], _mm_mul_ps(t[i], tangentScale));
+            _mm_store_ps(basis[i + 6], _mm_mul_ps(b[i], bitangentScale));
+        }
+
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            GLDrawVertex & vert = verts[v + lane];
+            vert.nx = basis[0][lane]; vert.ny = basis[1][lane]; vert.nz = basis[2][lane];
+            vert.tx = basis[3][lane]; vert.ty = basis[4][lane]; vert.tz = basis[5][lane];
+            vert.bx = basis[6][lane]; vert.by = basis[7][lane]; vert.bz = basis[8][lane];
+        }
+    }
+
+#endif // __SSE__
+
+    // Remaining vertexes, or all of them without SSE.
+    for (; v < lastVertex; ++v)
+    {
+        Vec3 normal{ 0.0f, 0.0f, 0.0f };
+        Vec3 tangent{ 0.0f, 0.0f, 0.0f };
+        Vec3 bitangent{ 0.0f, 0.0f, 0.0f };
+
+        for (int tri = vertexFirstTriangle[v]; tri < vertexFirstTriangle[v + 1]; ++tri)
+        {
+            const float * face = faces + vertexTriangles[tri] * FaceFloats;
+            normal    += Vec3{ face[0], face[1], face[2]  };
+            tangent   += Vec3{ face[4], face[5], face[6]  };
+            bitangent += Vec3{ face[8], face[9], face[10] };
+        }
+
+        // Same projection onto the normal plane as deriveNormalsAndTangents().
+        normal    *= 1.0f / std::sqrt(dot(normal, normal));
+        tangent   -= dot(tangent,   normal) * normal;
+        bitangent -= dot(bitangent, normal) * normal;
+        tangent   *= 1.0f / std::sqrt(dot(tangent,   tangent));
+        bitangent *= 1.0f / std::sqrt(dot(bitangent, bitangent));
+
+        GLDrawVertex & vert = verts[v];
+        vert.nx = normal[0];    vert.ny = normal[1];    vert.nz = normal[2];
+        vert.tx = tangent[0];   vert.ty = tangent[1];   vert.tz = tangent[2];
+        vert.bx = bitangent[0]; vert.by = bitangent[1]; vert.bz = bitangent[2];
+    }
+}
+
+void TangentSpaceSolver::skinBindPose(const float * normalMatrices, GLDrawVertex * verts) const
+{
+    assert(normalMatrices != nullptr);
+    assert(verts          != nullptr);
+
+    for (int v = 0; v < numVertexes; ++v)
+    {
+        const float * basis = &bindPoseBasis[v * 9];
+        GLDrawVertex & vert = verts[v];
+
+#if defined(__SSE__)
+
+        // Weighted sum of the joint rotations, one register per row.
+        __m128 rot[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        for (int w = vertexFirstWeight[v]; w < vertexFirstWeight[v + 1]; ++w)
+        {
+            const float * m = normalMatrices + weightJoints[w] * SkinningMatrixFloats;
+            const __m128 bias = _mm_set1_ps(weightBiases[w]);
+            rot[0] = _mm_add_ps(rot[0], _mm_mul_ps(_mm_loadu_ps(m),     bias));
+            rot[1] = _mm_add_ps(rot[1], _mm_mul_ps(_mm_loadu_ps(m + 4), bias));
+            rot[2] = _mm_add_ps(rot[2], _mm_mul_ps(_mm_loadu_ps(m + 8), bias));
+        }
+
+        // To columns, so each rotated vector is a sum of three scaled columns.
+        _MM_TRANSPOSE4_PS(rot[0], rot[1], rot[2], rot[3]);
+
+        __m128 rotated[4];
+        for (int vec = 0; vec < 3; ++vec)
+        {
+            rotated[vec] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rot[0], _mm_set1_ps(basis[vec * 3])),
+                                                 _mm_mul_ps(rot[1], _mm_set1_ps(basis[vec * 3 + 1]))),
+                                      _mm_mul_ps(rot[2], _mm_set1_ps(basis[vec * 3 + 2])));
+        }
+        rotated[3] = _mm_setzero_ps();
+
+        // The blend of several rotations is slightly shorter, so renormalize.
+        // Transposed, the three vectors are normalized at once.
+        _MM_TRANSPOSE4_PS(rotated[0], rotated[1], rotated[2], rotated[3]);
+        const __m128 lengthSqr = dot3(rotated, rotated);
+        const __m128 scale = _mm_and_ps(reciprocalSqrt(lengthSqr), _mm_cmpgt_ps(lengthSqr, _mm_setzero_ps()));
+
+        alignas(16) float xyz[3][4];
+        _mm_store_ps(xyz[0], _mm_mul_ps(rotated[0], scale));
+        _mm_store_ps(xyz[1], _mm_mul_ps(rotated[1], scale));
+        _mm_store_ps(xyz[2], _mm_mul_ps(rotated[2], scale));
+
+        vert.nx = xyz[0][0]; vert.ny = xyz[1][0]; vert.nz = xyz[2][0];
+        vert.tx = xyz[0][1]; vert.ty = xyz[1][1]; vert.tz = xyz[2][1];
+        vert.bx = xyz[0][2]; vert.by = xyz[1][2]; vert.bz = xyz[2][2];
+
+#else // !__SSE__
+
+        // Weighted sum of the joint rotations.
+        float rot[3][3] = { };
+        for (int w = vertexFirstWeight[v]; w < vertexFirstWeight[v + 1]; ++w)
+        {
+            const float * m = normalMatrices + weightJoints[w] * SkinningMatrixFloats;
+            const float bias = weightBiases[w];
+            for (int row = 0; row < 3; ++row)
+            {
+                rot[row][0] += m[row * 4 + 0] * bias;
+                rot[row][1] += m[row * 4 + 1] * bias;
+                rot[row][2] += m[row * 4 + 2] * bias;
+            }
+        }
+
+        // The blend of several rotations is slightly shorter, so renormalize.
+        float rotated[9];
+        for (int vec = 0; vec < 9; vec += 3)
+        {
+            float lengthSqr = 0.0f;
+            for (int row = 0; row < 3; ++row)
+            {
+                rotated[vec + row] = (rot[row][0] * basis[vec]) + (rot[row][1] * basis[vec + 1]) + (rot[row][2] * basis[vec + 2]);
+                lengthSqr += rotated[vec + row] * rotated[vec + row];
+            }
+
+            const float scale = (lengthSqr > 0.0f) ? (1.0f / std::sqrt(lengthSqr)) : 0.0f;
+            rotated[vec + 0] *= scale;
+            rotated[vec + 1] *= scale;
+            rotated[vec + 2] *= scale;
+        }
+
+        vert.nx = rotated[0]; vert.ny = rotated[1]; vert.nz = rotated[2];
+        vert.tx = rotated[3]; vert.ty = rotated[4]; vert.tz = rotated[5];
+        vert.bx = rotated[6]; vert.by = rotated[7]; vert.bz = rotated[8];
+
+#endif // __SSE__
+    }
+}
+
+std::size_t TangentSpaceSolver::getMemoryBytes() const noexcept
+{
+    return sizeof(*this) +
+           (triangleIndexes.capacity() + vertexFirstTriangle.capacity() + vertexTriangles.capacity() +
+            vertexFirstWeight.capacity() + weightJoints.capacity()) * sizeof(std::int32_t) +
+           (bindPoseBasis.capacity() + weightBiases.capacity()) * sizeof(float);
+}
+
+// ========================================================
+// class VertexAnimCache:
+// ========================================================
+
+// Octahedral encoding of a unit vector: projected onto the octahedron
+// |x| + |y| + |z| = 1, with the lower half folded over the upper one.
+static void octahedralEncode(const float x, const float y, const float z, std::int16_t * out)
+{
+    const float invLength = 1.0f / (std::fabs(x) + std::fabs(y) + std::fabs(z));
+    float ox = x * invLength;
+    float oy = y * invLength;
+    if (z < 0.0f)
+    {
+        const float fx = (1.0f - std::fabs(oy)) * (ox >= 0.0f ? 1.0f : -1.0f);
+        const float fy = (1.0f - std::fabs(ox)) * (oy >= 0.0f ? 1.0f : -1.0f);
+        ox = fx;
+        oy = fy;
+    }
+    out[0] = static_cast<std::int16_t>(std::lround(clamp(ox, -1.0f, 1.0f) * 32767.0f));
+    out[1] = static_cast<std::int16_t>(std::lround(clamp(oy, -1.0f, 1.0f) * 32767.0f));
+}
+
+// Back to a point on the octahedron. Not unit length, the caller normalizes.
+static inline void octahedralDecode(const std::int16_t * in, float * out)
+{
+    const float x = in[0] * (1.0f / 32767.0f);
+    const float y = in[1] * (1.0f / 32767.0f);
+    const float z = 1.0f - std::fabs(x) - std::fabs(y);
+    if (z < 0.0f)
+    {
+        out[0] = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        out[1] = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
+    else
+    {
+        out[0] = x;
+        out[1] = y;
+    }
+    out[2] = z;
+}
+
+#if defined(__SSE2__)
+
+// The low or high four 16-bit lanes of 'x' as floats, signed or unsigned.
+static inline __m128 int16LoToFloat(const __m128i x)  { return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)); }
+static inline __m128 int16HiToFloat(const __m128i x)  { return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)); }
+static inline __m128 uint16LoToFloat(const __m128i x) { return _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, _mm_setzero_si128())); }
+static inline __m128 uint16HiToFloat(const __m128i x) { return _mm_cvtepi32_ps(_mm_unpackhi_epi16(x, _mm_setzero_si128())); }
+
+// Transposes four packed vertexes of eight 16-bit lanes each. Every output register
+// holds two fields of the four vertexes, the first in the low lanes and the second in
+// the high ones: position x and y, position z and handedness, normal, tangent.
+static inline void transposePackedVertexes(const void * verts, __m128i * out)
+{
+    const __m128i * src = static_cast<const __m128i *>(verts);
+    const __m128i r0 = _mm_loadu_si128(src + 0);
+    const __m128i r1 = _mm_loadu_si128(src + 1);
+    const __m128i r2 = _mm_loadu_si128(src + 2);
+    const __m128i r3 = _mm_loadu_si128(src + 3);
+
+    const __m128i lo01 = _mm_unpacklo_epi16(r0, r1);
+    const __m128i lo23 = _mm_unpacklo_epi16(r2, r3);
+    const __m128i hi01 = _mm_unpackhi_epi16(r0, r1);
+    const __m128i hi23 = _mm_unpackhi_epi16(r2, r3);
+
+    out[0] = _mm_unpacklo_epi32(lo01, lo23);
+    out[1] = _mm_unpackhi_epi32(lo01, lo23);
+    out[2] = _mm_unpacklo_epi32(hi01, hi23);
+    out[3] = _mm_unpackhi_epi32(hi01, hi23);
+}
+
+// octahedralDecode() of four vectors, from the two 16-bit lanes of each in 'packed'.
+static inline void octahedralDecode4(const __m128i packed, __m128 * out)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 one      = _mm_set1_ps(1.0f);
+    const __m128 x = _mm_mul_ps(int16LoToFloat(packed), _mm_set1_ps(1.0f / 32767.0f));
+    const __m128 y = _mm_mul_ps(int16HiToFloat(packed), _mm_set1_ps(1.0f / 32767.0f));
+
+    const __m128 absX = _mm_andnot_ps(signMask, x);
+    const __m128 absY = _mm_andnot_ps(signMask, y);
+    const __m128 z    = _mm_sub_ps(_mm_sub_ps(one, absX), absY);
+
+    const __m128 folded = _mm_cmplt_ps(z, _mm_setzero_ps());
+    const __m128 foldX  = _mm_or_ps(_mm_sub_ps(one, absY), _mm_and_ps(x, signMask));
+    const __m128 foldY  = _mm_or_ps(_mm_sub_ps(one, absX), _mm_and_ps(y, signMask));
+
+    out[0] = _mm_or_ps(_mm_and_ps(folded, foldX), _mm_andnot_ps(folded, x));
+    out[1] = _mm_or_ps(_mm_and_ps(folded, foldY), _mm_andnot_ps(folded, y));
+    out[2] = z;
+}
+
+// Blends four vectors from 'a' to 'b' and normalizes them into 'out'.
+static inline void blendAndNormalize4(const __m128 * a, const __m128 * b, const __m128 interp, __m128 * out)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = _mm_add_ps(a[i], _mm_mul_ps(_mm_sub_ps(b[i], a[i]), interp));
+    }
+
+    // The blend of two unit vectors is only near zero if they are almost opposite.
+    const __m128 scale = reciprocalSqrt(_mm_max_ps(dot3(out, out), _mm_set1_ps(1e-20f)));
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = _mm_mul_ps(out[i], scale);
+    }
+}
+
+#endif // __SSE2__
+
+// Normalizes 'v' into 'out'. Zero vectors stay zero.
+static inline void normalize3(const float * v, float * out)
+{
+    const float lengthSqr = (v[0] * v[0]) + (v[1] * v[1]) + (v[2] * v[2]);
+    const float invLength = (lengthSqr > 0.0f) ? (1.0f / std::sqrt(lengthSqr)) : 0.0f;
+    out[0] = v[0] * invLength;
+    out[1] = v[1] * invLength;
+    out[2] = v[2] * invLength;
+}
+
+VertexAnimCache::VertexAnimCache(const GLDrawVertex * frameVerts, const int frameCount, const int vertexCount)
+    : numFrames     { frameCount  }
+    , numVertexes   { vertexCount }
+    , positionMins  { }
+    , positionScale { }
+    , vertexes      ( )
+{
+    assert(frameVerts != nullptr);
+    assert(frameCount > 0 && vertexCount > 0);
+
+    const std::size_t totalVerts = static_cast<std::size_t>(numFrames) * numVertexes;
+
+    // One box for the whole clip, so a vertex blends between frames in the quantized space.
+    float mins[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+    float maxs[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (std::size_t v = 0; v < totalVerts; ++v)
+    {
+        const float pos[3] = { frameVerts[v].px, frameVerts[v].py, frameVerts[v].pz };
+        for (int i = 0; i < 3; ++i)
+        {
+            mins[i] = std::min(mins[i], pos[i]);
+            maxs[i] = std::max(maxs[i], pos[i]);
+        }
+    }
+
+    float invScale[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const float extent = std::max(maxs[i] - mins[i], 1e-6f);
+        positionMins[i]  = mins[i];
+        positionScale[i] = extent / 65535.0f;
+        invScale[i]      = 65535.0f / extent;
+    }
+
+    vertexes.resize(totalVerts);
+    for (std::size_t v = 0; v < totalVerts; ++v)
+    {
+        const GLDrawVertex & src = frameVerts[v];
+        PackedVertex & dest = vertexes[v];
+
+        const float pos[3] = { src.px, src.py, src.pz };
+        for (int i = 0; i < 3; ++i)
+        {
+            dest.position[i] = static_cast<std::uint16_t>(std::lround(clamp((pos[i] - mins[i]) * invScale[i], 0.0f, 65535.0f)));
+        }
+
+        octahedralEncode(src.nx, src.ny, src.nz, dest.normal);
+        octahedralEncode(src.tx, src.ty, src.tz, dest.tangent);
+
+        // Same winding as the derived bi-tangent?
+        const float cx = (src.ny * src.tz) - (src.nz * src.ty);
+        const float cy = (src.nz * src.tx) - (src.nx * src.tz);
+        const float cz = (src.nx * src.ty) - (src.ny * src.tx);
+        dest.handedness = ((cx * src.bx) + (cy * src.by) + (cz * src.bz) < 0.0f) ? -1 : 1;
+    }
+}
+
+void VertexAnimCache::sample(const int frameA, const int frameB, float interp, GLDrawVertex * vertsOut) const
+{
+    assert(frameA >= 0 && frameA < numFrames);
+    assert(frameB >= 0 && frameB < numFrames);
+    assert(vertsOut != nullptr);
+
+    interp = clamp(interp, 0.0f, 1.0f);
+    const PackedVertex * vertsA = vertexes.data() + static_cast<std::size_t>(frameA) * numVertexes;
+    const PackedVertex * vertsB = vertexes.data() + static_cast<std::size_t>(frameB) * numVertexes;
+
+    int v = 0;
+
+#if defined(__SSE2__)
+
+    // Four vertexes per iteration, transposed to one register per component.
+    const __m128 blend = _mm_set1_ps(interp);
+    for (; v + 4 <= numVertexes; v += 4)
+    {
+        __m128i a[4];
+        __m128i b[4];
+        transposePackedVertexes(vertsA + v, a);
+        transposePackedVertexes(vertsB + v, b);
+
+        const __m128 quantA[3] = { uint16LoToFloat(a[0]), uint16HiToFloat(a[0]), uint16LoToFloat(a[1]) };
+        const __m128 quantB[3] = { uint16LoToFloat(b[0]), uint16HiToFloat(b[0]), uint16LoToFloat(b[1]) };
+
+        __m128 pos[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            const __m128 q = _mm_add_ps(quantA[i], _mm_mul_ps(_mm_sub_ps(quantB[i], quantA[i]), blend));
+            pos[i] = _mm_add_ps(_mm_set1_ps(positionMins[i]), _mm_mul_ps(q, _mm_set1_ps(positionScale[i])));
+        }
+
+        __m128 na[3], nb[3], ta[3], tb[3];
+        octahedralDecode4(a[2], na);
+        octahedralDecode4(b[2], nb);
+        octahedralDecode4(a[3], ta);
+        octahedralDecode4(b[3], tb);
+
+        __m128 n[3], t[3];
+        blendAndNormalize4(na, nb, blend, n);
+        blendAndNormalize4(ta, tb, blend, t);
+
+        const __m128 sign = int16HiToFloat(a[1]);
+        __m128 c[3] =
+        {
+            _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(n[1], t[2]), _mm_mul_ps(n[2], t[1])), sign),
+            _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(n[2], t[0]), _mm_mul_ps(n[0], t[2])), sign),
+            _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(n[0], t[1]), _mm_mul_ps(n[1], t[0])), sign)
+        };
+        const __m128 bitangentScale = reciprocalSqrt(_mm_max_ps(dot3(c, c), _mm_set1_ps(1e-20f)));
+
+        alignas(16) float out[12][4];
+        for (int i = 0; i < 3; ++i)
+        {
+            _mm_store_ps(out[i],     pos[i]);
+            _mm_store_ps(out[i + 3], n[i]);
+            _mm_store_ps(out[i + 6], t[i]);
+            _mm_store_ps(out[i + 9], _mm_mul_ps(c[i], bitangentScale));
+        }
+
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            GLDrawVertex & dest = vertsOut[v + lane];
+            dest.px = out[0][lane]; dest.py = out[1][lane];  dest.pz = out[2][lane];
+            dest.nx = out[3][lane]; dest.ny = out[4][lane];  dest.nz = out[5][lane];
+            dest.tx = out[6][lane]; dest.ty = out[7][lane];  dest.tz = out[8][lane];
+            dest.bx = out[9][lane]; dest.by = out[10][lane]; dest.bz = out[11][lane];
+        }
+    }
+
+#endif // __SSE2__
+
+    // Remaining vertexes, or all of them without SSE2.
+    for (; v < numVertexes; ++v)
+    {
+        const PackedVertex & a = vertsA[v];
+        const PackedVertex & b = vertsB[v];
+        GLDrawVertex & dest = vertsOut[v];
+
+        float pos[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            const float q = a.position[i] + (static_cast<float>(b.position[i]) - a.position[i]) * interp;
+            pos[i] = positionMins[i] + q * positionScale[i];
+        }
+        dest.px = pos[0];
+        dest.py = pos[1];
+        dest.pz = pos[2];
+
+        float na[3], nb[3], ta[3], tb[3];
+        octahedralDecode(a.normal,  na);
+        octahedralDecode(b.normal,  nb);
+        octahedralDecode(a.tangent, ta);
+        octahedralDecode(b.tangent, tb);
+
+        float n[3], t[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            na[i] += (nb[i] - na[i]) * interp;
+            ta[i] += (tb[i] - ta[i]) * interp;
+        }
+        normalize3(na, n);
+        normalize3(ta, t);
+
+        const float sign = a.handedness;
+        const float c[3] = { ((n[1] * t[2]) - (n[2] * t[1])) * sign,
+                             ((n[2] * t[0]) - (n[0] * t[2])) * sign,
+                             ((n[0] * t[1]) - (n[1] * t[0])) * sign };
+        float bt[3];
+        normalize3(c, bt);
+
+        dest.nx = n[0];  dest.ny = n[1];  dest.nz = n[2];
+        dest.tx = t[0];  dest.ty = t[1];  dest.tz = t[2];
+        dest.bx = bt[0]; dest.by = bt[1]; dest.bz = bt[2];
+    }
+}
+
+std::size_t VertexAnimCache::getMemoryBytes() const noexcept
+{
+    return sizeof(*this) + vertexes.capacity() * sizeof(PackedVertex);
+}
+
+} // namespace DOOM3 {}
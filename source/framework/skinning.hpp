@@ -0,0 +1,284 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: skinning.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: CPU/GPU skinning, tangent basis updates and baked vertex animation for the DOOM 3 MD5 meshes.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef SKINNING_HPP
+#define SKINNING_HPP
+
+#include "gl_utils.hpp"
+
+#include <cstdint>
+#include <vector>
+
+class WorkerPool;
+
+namespace DOOM3
+{
+
+struct Mesh;
+struct Pose;
+
+// Floats per joint matrix (3 rows of 4, row-major).
+constexpr int SkinningMatrixFloats = 12;
+
+//
+// Converts a pose to one 3x4 matrix per joint, written to 'matricesOut'
+// (pose.getNumJoints() * SkinningMatrixFloats floats). The matrices map weight
+// positions directly to the GL draw space: scaled by 'scale' and with Y-Z swapped,
+// same as AnimatedEntity::animateMesh().
+//
+void buildSkinningMatrices(const Pose & pose, float scale, float * matricesOut);
+
+// ========================================================
+// GPU skinning:
+// ========================================================
+
+// Size of the joint arrays in the GPU skinning shaders. Must match normalmap_skinned.vert!
+constexpr int GpuSkinningMaxJoints = 128;
+
+//
+// Rotations from the bind pose to 'pose', one per joint, as 3x4 matrices with
+// a zero W column (same layout as buildSkinningMatrices()). They rotate the bind
+// pose normal, tangent and bi-tangent, which are in the GL draw space.
+//
+void buildSkinningNormalMatrices(const Pose & pose, const Pose & bindPose, float * matricesOut);
+
+//
+// Builds the static vertexes for GPU skinning: the bind pose GLDrawVertex
+// plus up to GLSkinnedVertex::MaxWeights weights, in the weight format of
+// SkinningBatches (position * bias, bias). Vertexes with more weights keep
+// the heaviest ones and the rest are merged into the heaviest joint, which
+// is exact in 'bindPose' but approximate as the joints move apart. Returns
+// how many vertexes had weights merged.
+//
+int buildGpuSkinningVertexes(const Mesh & mesh, const Pose & bindPose, const GLDrawVertex * bindPoseVerts,
+                             std::vector<GLSkinnedVertex> * vertsOut);
+
+// ========================================================
+// class SkinningBatches:
+// ========================================================
+
+//
+// Vertex weights of a Mesh, rearranged for SIMD skinning.
+//
+// Vertexes are sorted by weight count and grouped in batches of BatchSize.
+// Each batch stores its weights as structure-of-arrays "slots": slot N
+// holds the Nth weight of every vertex in the batch, as BatchSize joint
+// indexes followed by BatchSize x, y, z and bias values. A vertex with fewer
+// weights than the batch maximum is padded with zero bias weights.
+//
+// The weight position is premultiplied by the bias and the bias goes in the
+// W component, so a weight is a single matrix * vector: (M * pos + t) * bias.
+//
+// skin() uses AVX when the build enables it (-mavx), otherwise SSE, with
+// a scalar loop for other targets. The layout is the same for all three.
+//
+class SkinningBatches final
+{
+public:
+
+    static constexpr int BatchSize = 8;
+
+    explicit SkinningBatches(const Mesh & mesh);
+
+    //
+    // Skins every vertex with the matrices from buildSkinningMatrices(). 'vertsOut'
+    // must have getNumVertexes() entries. Writes the position, texture coordinates
+    // and the default white color of each vertex, in the original vertex order.
+    // The normal and tangent basis are left untouched.
+    //
+    void skin(const float * matrices, GLDrawVertex * vertsOut) const;
+
+    // Read-only accessors:
+    int getNumVertexes()  const noexcept { return numVertexes; }
+    int getNumBatches()   const noexcept { return static_cast<int>(batches.size()); }
+    int getNumWeights()   const noexcept { return numWeights; }
+    int getNumSlotLanes() const noexcept { return static_cast<int>(slotJoints.size()); } // Weights plus padding.
+
+private:
+
+    struct Batch
+    {
+        std::uint32_t firstSlot;
+        std::uint32_t numSlots; // Largest weight count in the batch.
+    };
+
+    void skinBatch(const Batch & batch, const float * matrices, float * xyzOut) const;
+
+    std::vector<Batch>         batches;
+    std::vector<std::int32_t>  vertexIndexes; // BatchSize per batch. -1 for the padding at the end.
+    std::vector<float>         texCoords;     // u and v, same order as vertexIndexes.
+    std::vector<std::int32_t>  slotJoints;    // BatchSize per slot.
+    std::vector<float>         slotWeights;   // 4 * BatchSize per slot: x, y, z and bias lanes.
+
+    int numVertexes;
+    int numWeights;
+};
+
+// ========================================================
+// class TangentSpaceSolver:
+// ========================================================
+
+//
+// Persistent version of deriveNormalsAndTangents() for a mesh whose triangles
+// never change, so the skinned vertexes can get a new tangent basis every
+// frame without allocating or redoing the topology work.
+//
+// The constructor builds the vertex to triangle adjacency. derive() then
+// runs in two passes: the normal, tangent and bi-tangent of each triangle
+// go to a scratch buffer, then each vertex sums the vectors of its triangles,
+// in the same order as deriveNormalsAndTangents(). Both passes do four
+// triangles or vertexes at a time with SSE, using an approximate reciprocal
+// square root, so the results match to about 1e-6. Neither pass writes to
+// shared data, so both can be split across a WorkerPool.
+//
+// skinBindPose() is the cheaper alternative: the bind pose basis of each
+// vertex is rotated by the weighted joint rotations, like the GPU skinning
+// shader does. No triangles involved, but the basis doesn't follow the
+// surface stretching as the pose moves away from the bind pose.
+//
+class TangentSpaceSolver final
+{
+public:
+
+    // Per caller scratch memory for derive(). Sized on the first call and
+    // reused after that. Each thread calling derive() needs its own.
+    struct Scratch
+    {
+        std::vector<float> faceVectors;
+    };
+
+    // Meshes with fewer triangles than this ignore the WorkerPool in derive().
+    static constexpr int MinParallelTriangles = 8192;
+
+    //
+    // 'bindPoseVerts' must be the vertexes of 'mesh' in the bind pose,
+    // in the same order. Their tangent basis is derived for skinBindPose().
+    //
+    TangentSpaceSolver(const Mesh & mesh, const GLDrawVertex * bindPoseVerts,
+                       const GLDrawIndex32 * indexes, int indexCount);
+
+    // Copy/assignment is disabled.
+    TangentSpaceSolver(const TangentSpaceSolver &) = delete;
+    TangentSpaceSolver & operator = (const TangentSpaceSolver &) = delete;
+
+    //
+    // Replaces the normal, tangent and bi-tangent of 'verts' (getNumVertexes()
+    // entries) with the ones derived from the positions and texture coordinates.
+    // Uses the pool if not null and the mesh is big enough. Must not be called
+    // from inside a parallelFor() of the same pool.
+    //
+    void derive(GLDrawVertex * verts, Scratch & scratch, WorkerPool * pool = nullptr) const;
+
+    //
+    // Replaces the normal, tangent and bi-tangent of 'verts' with the bind pose
+    // basis rotated by the joint matrices from buildSkinningNormalMatrices().
+    //
+    void skinBindPose(const float * normalMatrices, GLDrawVertex * verts) const;
+
+    // Read-only accessors:
+    int getNumVertexes()  const noexcept { return numVertexes;  }
+    int getNumTriangles() const noexcept { return numTriangles; }
+    std::size_t getMemoryBytes() const noexcept;
+
+private:
+
+    void deriveFaces(int firstTriangle, int lastTriangle, const GLDrawVertex * verts, float * facesOut) const;
+    void sumVertexes(int firstVertex, int lastVertex, const float * faces, GLDrawVertex * verts) const;
+
+    int numVertexes;
+    int numTriangles;
+
+    std::vector<std::int32_t> triangleIndexes;     // 3 per triangle.
+    std::vector<std::int32_t> vertexFirstTriangle; // Into vertexTriangles. numVertexes + 1 entries.
+    std::vector<std::int32_t> vertexTriangles;     // Triangles using each vertex, in ascending order.
+
+    // skinBindPose() data:
+    std::vector<float>        bindPoseBasis;      // Normal, tangent and bi-tangent per vertex.
+    std::vector<std::int32_t> vertexFirstWeight;  // Into weightJoints/weightBiases. numVertexes + 1 entries.
+    std::vector<std::int32_t> weightJoints;
+    std::vector<float>        weightBiases;
+};
+
+// ========================================================
+// class VertexAnimCache:
+// ========================================================
+
+//
+// Every frame of an animation clip skinned ahead of time and packed, for
+// entities that can spend memory to save CPU. Playing the clip is then a
+// blend of two cached frames, with no weights or triangles involved.
+//
+// Each vertex takes 16 bytes per frame:
+//  - The position in 3 x 16 bits, normalized to the box of all frames.
+//  - The normal and tangent in 2 x 16 bits each, with octahedral encoding
+//    (the unit sphere unfolded into a square).
+//  - The handedness of the bi-tangent, which is rebuilt from the cross
+//    product of the normal and tangent.
+//
+// The texture coordinates and color are the same in every frame, so they
+// are not stored and sample() leaves them untouched.
+//
+class VertexAnimCache final
+{
+public:
+
+    // Bytes per vertex per frame.
+    static constexpr int PackedVertexSize = 16;
+
+    //
+    // 'frameVerts' has frameCount * vertexCount entries: all the vertexes of
+    // frame 0, then frame 1, and so on, with their tangent basis.
+    //
+    VertexAnimCache(const GLDrawVertex * frameVerts, int frameCount, int vertexCount);
+
+    // Copy/assignment is disabled.
+    VertexAnimCache(const VertexAnimCache &) = delete;
+    VertexAnimCache & operator = (const VertexAnimCache &) = delete;
+
+    //
+    // Replaces the position, normal, tangent and bi-tangent of 'vertsOut'
+    // (getNumVertexes() entries) with the ones of 'frameA' blended towards
+    // 'frameB' by 'interp', which is clamped to [0,1]. The vectors are
+    // linearly blended and renormalized.
+    //
+    void sample(int frameA, int frameB, float interp, GLDrawVertex * vertsOut) const;
+
+    // Read-only accessors:
+    int getNumFrames()   const noexcept { return numFrames;   }
+    int getNumVertexes() const noexcept { return numVertexes; }
+    std::size_t getMemoryBytes() const noexcept;
+
+private:
+
+    struct PackedVertex
+    {
+        std::uint16_t position[3];
+        std::int16_t  handedness; // Sign of the bi-tangent: +1 or -1.
+        std::int16_t  normal[2];
+        std::int16_t  tangent[2];
+    };
+    static_assert(sizeof(PackedVertex) == PackedVertexSize, "Unexpected padding in PackedVertex!");
+
+    int numFrames;
+    int numVertexes;
+
+    // Dequantized position = positionMins + position * positionScale.
+    float positionMins[3];
+    float positionScale[3];
+
+    std::vector<PackedVertex> vertexes; // numVertexes per frame.
+};
+
+} // namespace DOOM3 {}
+
+#endif // SKINNING_HPP
@@ -0,0 +1,760 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: spatial_index.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Pluggable spatial acceleration structures (BSP, BVH, loose octree) for world rendering.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "spatial_index.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+
+namespace World
+{
+
+// ========================================================
+// Local helpers:
+// ========================================================
+
+namespace
+{
+
+using Clock = std::chrono::high_resolution_clock;
+
+double millisecondsSince(const Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct TriangleBounds final
+{
+    float mins[3];
+    float maxs[3];
+    float centroid[3];
+};
+
+void computeTriangleBounds(const RenderData & world, const std::vector<const Polygon *> & polys,
+                           std::vector<TriangleBounds> * outBounds)
+{
+    outBounds->resize(polys.size());
+    for (std::size_t p = 0; p < polys.size(); ++p)
+    {
+        TriangleBounds & tb = (*outBounds)[p];
+        for (int i = 0; i < 3; ++i)
+        {
+            tb.mins[i] =  FLT_MAX;
+            tb.maxs[i] = -FLT_MAX;
+        }
+        for (int v = 0; v < polys[p]->vertexCount; ++v)
+        {
+            const GLDrawVertex & dv = world.vertexes[polys[p]->firstVertex + v];
+            const float pos[3] = { dv.px, dv.py, dv.pz };
+            for (int i = 0; i < 3; ++i)
+            {
+                tb.mins[i] = std::min(tb.mins[i], pos[i]);
+                tb.maxs[i] = std::max(tb.maxs[i], pos[i]);
+            }
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            tb.centroid[i] = (tb.mins[i] + tb.maxs[i]) * 0.5f;
+        }
+    }
+}
+
+float distanceSquared(const Vec3 & eye, const float point[3])
+{
+    const float dx = point[0] - eye[0];
+    const float dy = point[1] - eye[1];
+    const float dz = point[2] - eye[2];
+    return (dx * dx) + (dy * dy) + (dz * dz);
+}
+
+// ========================================================
+// class BspIndex:
+// ========================================================
+
+//
+// Thin wrapper over the BSP tree and portals the world loader already built,
+// so the Quake-style PVS can be compared with the other indexes.
+//
+class BspIndex final
+    : public SpatialIndex
+{
+public:
+
+    void build(const RenderData & world) override
+    {
+        // The tree itself is built with the world, we only take its numbers.
+        bspWorld     = &world;
+        buildTimeMs  = world.buildStats.buildTimeMs;
+        polygonCount = 0;
+        for (const BspNode * leaf : world.bspLeafNodes)
+        {
+            polygonCount += leaf->polygons.size();
+        }
+    }
+
+    void queryVisible(const Vec3 & eye, const Frustum & frustum,
+                      const bool frontToBack, VisibleSet * outSet) const override
+    {
+        assert(bspWorld != nullptr);
+        assert(outSet   != nullptr);
+
+        outSet->clear();
+        if (!bspWorld->hasBspTree())
+        {
+            return;
+        }
+
+        BspNode * currentLeaf = findLeafRecursive(eye, bspWorld->bspRoot);
+        computePotentiallyVisibleSet(eye, frustum, currentLeaf);
+
+        if (frontToBack)
+        {
+            gatherOrderedRecursive(eye, bspWorld->bspRoot, outSet);
+        }
+        else
+        {
+            for (const BspNode * leaf : bspWorld->bspLeafNodes)
+            {
+                gatherLeaf(leaf, outSet);
+            }
+        }
+    }
+
+    SpatialIndexType getType() const noexcept override
+    {
+        return SpatialIndexType::Bsp;
+    }
+
+    std::size_t getMemoryFootprint() const noexcept override
+    {
+        if (bspWorld == nullptr)
+        {
+            return 0;
+        }
+
+        // Nodes and portals. The polygons are shared by all indexes.
+        std::size_t bytes = 0;
+        bytes += bspWorld->bspPartitionNodes.capacity() * sizeof(BspNode *);
+        bytes += bspWorld->bspLeafNodes.capacity() * sizeof(BspNode *);
+        bytes += bspWorld->bspNodePoolAlloc.getBytesReserved();
+        bytes += bspWorld->portalPoolAlloc.getBytesReserved();
+        return bytes;
+    }
+
+    int getNodeCount() const noexcept override
+    {
+        return (bspWorld != nullptr ? bspWorld->bspLeafCount + bspWorld->bspPartitionCount : 0);
+    }
+
+private:
+
+    static void gatherLeaf(const BspNode * leaf, VisibleSet * outSet)
+    {
+        ++outSet->nodesVisited;
+        if (leaf->visFrame != g_nFrameNumber)
+        {
+            ++outSet->nodesCulled;
+            return;
+        }
+
+        const Polygon * poly = leaf->polygons.first();
+        for (int i = leaf->polygons.size(); i--; poly = poly->next)
+        {
+            outSet->polygons.push_back(poly);
+        }
+    }
+
+    static void gatherOrderedRecursive(const Vec3 & eye, const BspNode * node, VisibleSet * outSet)
+    {
+        if (node->isLeaf)
+        {
+            gatherLeaf(node, outSet);
+            return;
+        }
+
+        // Reverse of the painter's order used by renderBspTreeRecursive().
+        if (node->partition.classifyPoint(eye) == FrontSide)
+        {
+            gatherOrderedRecursive(eye, node->frontNode, outSet);
+            gatherOrderedRecursive(eye, node->backNode,  outSet);
+        }
+        else
+        {
+            gatherOrderedRecursive(eye, node->backNode,  outSet);
+            gatherOrderedRecursive(eye, node->frontNode, outSet);
+        }
+    }
+
+    const RenderData * bspWorld = nullptr;
+};
+
+// ========================================================
+// class BvhIndex:
+// ========================================================
+
+//
+// Bounding Volume Hierarchy over the world triangles, built top-down
+// with the Surface Area Heuristic (SAH) evaluated over binned centroids.
+// Nodes are stored depth-first in a flat array, children of an interior
+// node are always adjacent.
+//
+class BvhIndex final
+    : public SpatialIndex
+{
+public:
+
+    static constexpr int MaxLeafPolys = 4;
+    static constexpr int NumBins      = 16;
+
+    void build(const RenderData & world) override
+    {
+        const auto buildStartTime = Clock::now();
+
+        gatherWorldPolygons(world, &polys);
+        computeTriangleBounds(world, polys, &triBounds);
+        polygonCount = polys.size();
+
+        nodes.clear();
+        if (!polys.empty())
+        {
+            // Worst case is one leaf per triangle.
+            nodes.reserve(polys.size() * 2);
+            nodes.emplace_back();
+            buildRecursive(0, 0, polys.size());
+        }
+
+        // Bounds were only needed for the build.
+        std::vector<TriangleBounds>().swap(triBounds);
+        nodes.shrink_to_fit();
+        buildTimeMs = millisecondsSince(buildStartTime);
+    }
+
+    void queryVisible(const Vec3 & eye, const Frustum & frustum,
+                      const bool frontToBack, VisibleSet * outSet) const override
+    {
+        assert(outSet != nullptr);
+
+        outSet->clear();
+        if (nodes.empty())
+        {
+            return;
+        }
+
+        int stack[64];
+        int stackTop = 0;
+        stack[stackTop++] = 0;
+
+        while (stackTop > 0)
+        {
+            const Node & node = nodes[stack[--stackTop]];
+            ++outSet->nodesVisited;
+
+            if (!frustum.testAabb(Vec3{ node.mins[0], node.mins[1], node.mins[2] },
+                                  Vec3{ node.maxs[0], node.maxs[1], node.maxs[2] }))
+            {
+                ++outSet->nodesCulled;
+                continue;
+            }
+
+            if (node.polyCount > 0)
+            {
+                for (int p = 0; p < node.polyCount; ++p)
+                {
+                    outSet->polygons.push_back(polys[node.firstChildOrPoly + p]);
+                }
+                continue;
+            }
+
+            // Push the farther child first so that the nearer one is popped next.
+            int nearChild = node.firstChildOrPoly;
+            int farChild  = node.firstChildOrPoly + 1;
+            if (frontToBack)
+            {
+                float nearCenter[3];
+                float farCenter[3];
+                nodes[nearChild].getCenter(nearCenter);
+                nodes[farChild].getCenter(farCenter);
+
+                if (distanceSquared(eye, farCenter) < distanceSquared(eye, nearCenter))
+                {
+                    std::swap(nearChild, farChild);
+                }
+            }
+
+            assert(stackTop + 2 <= arrayLength(stack));
+            stack[stackTop++] = farChild;
+            stack[stackTop++] = nearChild;
+        }
+    }
+
+    SpatialIndexType getType() const noexcept override
+    {
+        return SpatialIndexType::Bvh;
+    }
+
+    std::size_t getMemoryFootprint() const noexcept override
+    {
+        return (nodes.capacity() * sizeof(Node)) + (polys.capacity() * sizeof(const Polygon *));
+    }
+
+    int getNodeCount() const noexcept override
+    {
+        return nodes.size();
+    }
+
+private:
+
+    struct Node final
+    {
+        float mins[3];
+        float maxs[3];
+        int   firstChildOrPoly; // Index of the first child if interior, first polygon if leaf.
+        int   polyCount;        // Zero for interior nodes.
+
+        // Only used for ordering, so recomputing is cheaper than storing it.
+        void getCenter(float outCenter[3]) const
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                outCenter[i] = (mins[i] + maxs[i]) * 0.5f;
+            }
+        }
+    };
+
+    struct Bin final
+    {
+        float mins[3];
+        float maxs[3];
+        int   count;
+    };
+
+    static float surfaceArea(const float mins[3], const float maxs[3])
+    {
+        const float dx = maxs[0] - mins[0];
+        const float dy = maxs[1] - mins[1];
+        const float dz = maxs[2] - mins[2];
+        return 2.0f * ((dx * dy) + (dy * dz) + (dz * dx));
+    }
+
+    static void growBounds(float mins[3], float maxs[3], const float otherMins[3], const float otherMaxs[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            mins[i] = std::min(mins[i], otherMins[i]);
+            maxs[i] = std::max(maxs[i], otherMaxs[i]);
+        }
+    }
+
+    static void clearBounds(float mins[3], float maxs[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            mins[i] =  FLT_MAX;
+            maxs[i] = -FLT_MAX;
+        }
+    }
+
+    void buildRecursive(const int nodeIndex, const int first, const int count)
+    {
+        // Node bounds and centroid bounds:
+        float centroidMins[3];
+        float centroidMaxs[3];
+        clearBounds(nodes[nodeIndex].mins, nodes[nodeIndex].maxs);
+        clearBounds(centroidMins, centroidMaxs);
+
+        for (int p = first; p < first + count; ++p)
+        {
+            const TriangleBounds & tb = triBounds[p];
+            growBounds(nodes[nodeIndex].mins, nodes[nodeIndex].maxs, tb.mins, tb.maxs);
+            growBounds(centroidMins, centroidMaxs, tb.centroid, tb.centroid);
+        }
+
+        // Split along the axis of largest centroid extent:
+        int axis = 0;
+        for (int i = 1; i < 3; ++i)
+        {
+            if ((centroidMaxs[i] - centroidMins[i]) > (centroidMaxs[axis] - centroidMins[axis]))
+            {
+                axis = i;
+            }
+        }
+
+        const float extent = centroidMaxs[axis] - centroidMins[axis];
+        if (count <= MaxLeafPolys || extent <= 0.0f)
+        {
+            makeLeaf(nodeIndex, first, count);
+            return;
+        }
+
+        Bin bins[NumBins];
+        for (Bin & bin : bins)
+        {
+            clearBounds(bin.mins, bin.maxs);
+            bin.count = 0;
+        }
+
+        const float binScale = NumBins / extent;
+        auto binIndexFor = [&](const TriangleBounds & tb)
+        {
+            const int b = static_cast<int>((tb.centroid[axis] - centroidMins[axis]) * binScale);
+            return std::min(b, NumBins - 1);
+        };
+
+        for (int p = first; p < first + count; ++p)
+        {
+            Bin & bin = bins[binIndexFor(triBounds[p])];
+            growBounds(bin.mins, bin.maxs, triBounds[p].mins, triBounds[p].maxs);
+            ++bin.count;
+        }
+
+        // Sweep from the right to get the area and count of every right side,
+        // then from the left evaluating the SAH cost of each split plane.
+        float rightAreas[NumBins - 1];
+        int   rightCounts[NumBins - 1];
+        float sweepMins[3], sweepMaxs[3];
+        clearBounds(sweepMins, sweepMaxs);
+        int sweepCount = 0;
+
+        for (int b = NumBins - 1; b > 0; --b)
+        {
+            growBounds(sweepMins, sweepMaxs, bins[b].mins, bins[b].maxs);
+            sweepCount += bins[b].count;
+            rightAreas[b - 1]  = (sweepCount > 0 ? surfaceArea(sweepMins, sweepMaxs) : 0.0f);
+            rightCounts[b - 1] = sweepCount;
+        }
+
+        int   bestSplit = -1;
+        float bestCost  = FLT_MAX;
+        clearBounds(sweepMins, sweepMaxs);
+        sweepCount = 0;
+
+        for (int b = 0; b < NumBins - 1; ++b)
+        {
+            growBounds(sweepMins, sweepMaxs, bins[b].mins, bins[b].maxs);
+            sweepCount += bins[b].count;
+            if (sweepCount == 0 || rightCounts[b] == 0)
+            {
+                continue;
+            }
+
+            const float cost = (surfaceArea(sweepMins, sweepMaxs) * sweepCount) + (rightAreas[b] * rightCounts[b]);
+            if (cost < bestCost)
+            {
+                bestCost  = cost;
+                bestSplit = b;
+            }
+        }
+
+        // Splitting must be cheaper than intersecting all the triangles (traversal cost of 1).
+        const float leafCost = surfaceArea(nodes[nodeIndex].mins, nodes[nodeIndex].maxs) * count;
+        if (bestSplit < 0 || (bestCost + surfaceArea(nodes[nodeIndex].mins, nodes[nodeIndex].maxs)) >= leafCost)
+        {
+            makeLeaf(nodeIndex, first, count);
+            return;
+        }
+
+        // Partition the triangles and their bounds in place:
+        int left  = first;
+        int right = first + count - 1;
+        while (left <= right)
+        {
+            if (binIndexFor(triBounds[left]) <= bestSplit)
+            {
+                ++left;
+            }
+            else
+            {
+                std::swap(triBounds[left], triBounds[right]);
+                std::swap(polys[left], polys[right]);
+                --right;
+            }
+        }
+
+        const int leftCount = left - first;
+        assert(leftCount > 0 && leftCount < count);
+
+        const int leftChild = nodes.size();
+        nodes[nodeIndex].firstChildOrPoly = leftChild;
+        nodes[nodeIndex].polyCount        = 0;
+        nodes.emplace_back();
+        nodes.emplace_back();
+
+        buildRecursive(leftChild,     first,        leftCount);
+        buildRecursive(leftChild + 1, left, count - leftCount);
+    }
+
+    void makeLeaf(const int nodeIndex, const int first, const int count)
+    {
+        nodes[nodeIndex].firstChildOrPoly = first;
+        nodes[nodeIndex].polyCount        = count;
+    }
+
+    std::vector<Node>            nodes;
+    std::vector<const Polygon *> polys;     // Reordered so that each leaf references a contiguous range.
+    std::vector<TriangleBounds>  triBounds; // Build-time only.
+};
+
+// ========================================================
+// class OctreeIndex:
+// ========================================================
+
+//
+// Loose octree with a looseness factor of 2, so each node's bounds extend
+// half of its size past the tight cell. A triangle is stored in the deepest
+// node whose loose bounds fully contain it, selected directly from its size
+// and centroid, so insertion never needs to test against node bounds.
+//
+class OctreeIndex final
+    : public SpatialIndex
+{
+public:
+
+    static constexpr int MaxDepth = 8;
+
+    void build(const RenderData & world) override
+    {
+        const auto buildStartTime = Clock::now();
+
+        std::vector<const Polygon *> worldPolys;
+        std::vector<TriangleBounds>  worldTriBounds;
+        gatherWorldPolygons(world, &worldPolys);
+        computeTriangleBounds(world, worldPolys, &worldTriBounds);
+        polygonCount = worldPolys.size();
+
+        nodes.clear();
+        polys.clear();
+        if (worldPolys.empty())
+        {
+            buildTimeMs = millisecondsSince(buildStartTime);
+            return;
+        }
+
+        // Root is a cube enclosing the world bounds:
+        const Vec3 worldSize = world.bounds.maxs - world.bounds.mins;
+        const float rootHalfSize = std::max(std::max(worldSize[0], worldSize[1]), worldSize[2]) * 0.5f + Plane::Epsilon;
+        const Vec3 rootCenter = (world.bounds.mins + world.bounds.maxs) * 0.5f;
+
+        nodes.emplace_back();
+        nodes[0].center[0] = rootCenter[0];
+        nodes[0].center[1] = rootCenter[1];
+        nodes[0].center[2] = rootCenter[2];
+        nodes[0].halfSize  = rootHalfSize;
+
+        // Insert every triangle, collecting per-node lists first:
+        std::vector<std::vector<int>> nodePolys(1);
+        for (std::size_t p = 0; p < worldPolys.size(); ++p)
+        {
+            const int nodeIndex = insert(worldTriBounds[p]);
+            if (nodeIndex >= static_cast<int>(nodePolys.size()))
+            {
+                nodePolys.resize(nodes.size());
+            }
+            nodePolys[nodeIndex].push_back(p);
+        }
+        nodePolys.resize(nodes.size());
+
+        // Then flatten the lists into one contiguous array:
+        polys.reserve(worldPolys.size());
+        for (std::size_t n = 0; n < nodes.size(); ++n)
+        {
+            nodes[n].firstPoly = polys.size();
+            nodes[n].polyCount = nodePolys[n].size();
+            for (const int p : nodePolys[n])
+            {
+                polys.push_back(worldPolys[p]);
+            }
+        }
+
+        nodes.shrink_to_fit();
+        buildTimeMs = millisecondsSince(buildStartTime);
+    }
+
+    void queryVisible(const Vec3 & eye, const Frustum & frustum,
+                      const bool frontToBack, VisibleSet * outSet) const override
+    {
+        assert(outSet != nullptr);
+
+        outSet->clear();
+        if (!nodes.empty())
+        {
+            queryRecursive(0, eye, frustum, frontToBack, outSet);
+        }
+    }
+
+    SpatialIndexType getType() const noexcept override
+    {
+        return SpatialIndexType::Octree;
+    }
+
+    std::size_t getMemoryFootprint() const noexcept override
+    {
+        return (nodes.capacity() * sizeof(Node)) + (polys.capacity() * sizeof(const Polygon *));
+    }
+
+    int getNodeCount() const noexcept override
+    {
+        return nodes.size();
+    }
+
+private:
+
+    struct Node final
+    {
+        float center[3]   = { 0.0f, 0.0f, 0.0f };
+        float halfSize    = 0.0f; // Of the tight cell. Loose bounds are twice that.
+        int   children[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+        int   firstPoly   = 0;
+        int   polyCount   = 0;
+    };
+
+    int insert(const TriangleBounds & tb)
+    {
+        float radius = 0.0f;
+        for (int i = 0; i < 3; ++i)
+        {
+            radius = std::max(radius, (tb.maxs[i] - tb.mins[i]) * 0.5f);
+        }
+
+        // Descend while the triangle still fits the loose bounds of the child.
+        // With a looseness of 2 that's whenever its extent is under the child's half size.
+        int nodeIndex = 0;
+        for (int depth = 0; depth < MaxDepth; ++depth)
+        {
+            const float childHalfSize = nodes[nodeIndex].halfSize * 0.5f;
+            if (radius > childHalfSize)
+            {
+                break;
+            }
+
+            int octant = 0;
+            float childCenter[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                if (tb.centroid[i] >= nodes[nodeIndex].center[i])
+                {
+                    octant |= (1 << i);
+                    childCenter[i] = nodes[nodeIndex].center[i] + childHalfSize;
+                }
+                else
+                {
+                    childCenter[i] = nodes[nodeIndex].center[i] - childHalfSize;
+                }
+            }
+
+            if (nodes[nodeIndex].children[octant] < 0)
+            {
+                const int childIndex = nodes.size();
+                nodes.emplace_back();
+                nodes[childIndex].center[0] = childCenter[0];
+                nodes[childIndex].center[1] = childCenter[1];
+                nodes[childIndex].center[2] = childCenter[2];
+                nodes[childIndex].halfSize  = childHalfSize;
+                nodes[nodeIndex].children[octant] = childIndex;
+            }
+            nodeIndex = nodes[nodeIndex].children[octant];
+        }
+
+        return nodeIndex;
+    }
+
+    void queryRecursive(const int nodeIndex, const Vec3 & eye, const Frustum & frustum,
+                        const bool frontToBack, VisibleSet * outSet) const
+    {
+        const Node & node = nodes[nodeIndex];
+        ++outSet->nodesVisited;
+
+        const float looseHalfSize = node.halfSize * 2.0f;
+        const Vec3 center{ node.center[0], node.center[1], node.center[2] };
+        const Vec3 extent{ looseHalfSize, looseHalfSize, looseHalfSize };
+        if (!frustum.testAabb(center - extent, center + extent))
+        {
+            ++outSet->nodesCulled;
+            return;
+        }
+
+        for (int p = 0; p < node.polyCount; ++p)
+        {
+            outSet->polygons.push_back(polys[node.firstPoly + p]);
+        }
+
+        int childCount = 0;
+        int order[8];
+        float distances[8];
+        for (int c = 0; c < 8; ++c)
+        {
+            if (node.children[c] >= 0)
+            {
+                order[childCount] = node.children[c];
+                distances[childCount] = (frontToBack ? distanceSquared(eye, nodes[node.children[c]].center) : 0.0f);
+                ++childCount;
+            }
+        }
+
+        if (frontToBack)
+        {
+            // Insertion sort, at most 8 entries.
+            for (int i = 1; i < childCount; ++i)
+            {
+                for (int j = i; j > 0 && distances[j] < distances[j - 1]; --j)
+                {
+                    std::swap(distances[j], distances[j - 1]);
+                    std::swap(order[j], order[j - 1]);
+                }
+            }
+        }
+
+        for (int c = 0; c < childCount; ++c)
+        {
+            queryRecursive(order[c], eye, frustum, frontToBack, outSet);
+        }
+    }
+
+    std::vector<Node>            nodes;
+    std::vector<const Polygon *> polys; // Each node references a contiguous range.
+};
+
+} // namespace {}
+
+// ========================================================
+// SpatialIndex:
+// ========================================================
+
+const char * spatialIndexTypeToString(const SpatialIndexType type)
+{
+    switch (type)
+    {
+    case SpatialIndexType::Bsp    : return "BSP";
+    case SpatialIndexType::Bvh    : return "BVH";
+    case SpatialIndexType::Octree : return "Octree";
+    default                       : return "???";
+    } // switch (type)
+}
+
+SpatialIndex::~SpatialIndex()
+{
+    // Anchors the vtable to this file.
+}
+
+SpatialIndex::Ptr SpatialIndex::create(const SpatialIndexType type)
+{
+    switch (type)
+    {
+    case SpatialIndexType::Bsp    : return Ptr{ new BspIndex{}    };
+    case SpatialIndexType::Bvh    : return Ptr{ new BvhIndex{}    };
+    case SpatialIndexType::Octree : return Ptr{ new OctreeIndex{} };
+    default                       : assert(false); return nullptr;
+    } // switch (type)
+}
+
+} // namespace World {}
@@ -0,0 +1,105 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: spatial_index.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Pluggable spatial acceleration structures (BSP, BVH, loose octree) for world rendering.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef SPATIAL_INDEX_HPP
+#define SPATIAL_INDEX_HPP
+
+#include "framework/world_rendering.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace World
+{
+
+// ========================================================
+// Visibility query results:
+// ========================================================
+
+struct VisibleSet final
+{
+    // Polygons that passed culling. Front-to-back when the query was ordered.
+    std::vector<const Polygon *> polygons;
+
+    // Stats for comparing the backends:
+    int nodesVisited = 0;
+    int nodesCulled  = 0;
+
+    void clear()
+    {
+        polygons.clear();
+        nodesVisited = 0;
+        nodesCulled  = 0;
+    }
+};
+
+// ========================================================
+// class SpatialIndex:
+// ========================================================
+
+enum class SpatialIndexType
+{
+    Bsp,    // The BSP tree and portals built by the world loader.
+    Bvh,    // Bounding Volume Hierarchy built with the Surface Area Heuristic.
+    Octree, // Loose octree.
+
+    // Number of entries in this enum - internal use.
+    Count
+};
+
+const char * spatialIndexTypeToString(SpatialIndexType type);
+
+//
+// Common interface for the spatial index of a world. All indexes are built over
+// the same set of polygons (the fragments owned by the world's polygon pool),
+// so an index must be rebuilt whenever the world geometry changes.
+//
+class SpatialIndex
+{
+public:
+
+    using Ptr = std::unique_ptr<SpatialIndex>;
+    static Ptr create(SpatialIndexType type);
+
+    SpatialIndex() = default;
+    virtual ~SpatialIndex();
+
+    // Not copyable.
+    SpatialIndex(const SpatialIndex &) = delete;
+    SpatialIndex & operator = (const SpatialIndex &) = delete;
+
+    // Builds the index over the current polygons of the world. The world must outlive the index.
+    virtual void build(const RenderData & world) = 0;
+
+    // Gathers the polygons potentially visible from 'eye' inside the view frustum.
+    // If 'frontToBack' is set, the polygons are ordered by approximate distance to the eye
+    // (at node granularity), which is the traversal order used for rendering.
+    virtual void queryVisible(const Vec3 & eye, const Frustum & frustum,
+                              bool frontToBack, VisibleSet * outSet) const = 0;
+
+    // Miscellaneous queries:
+    virtual SpatialIndexType getType() const noexcept = 0;
+    virtual std::size_t getMemoryFootprint() const noexcept = 0;
+    virtual int getNodeCount() const noexcept = 0;
+    int getPolygonCount() const noexcept { return polygonCount; }
+    double getBuildTimeMs() const noexcept { return buildTimeMs; }
+
+protected:
+
+    int    polygonCount = 0;
+    double buildTimeMs  = 0.0;
+};
+
+} // namespace World {}
+
+#endif // SPATIAL_INDEX_HPP
@@ -0,0 +1,132 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: worker_pool.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Small pool of persistent worker threads for data-parallel loops.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+// ========================================================
+// WorkerPool implementation:
+// ========================================================
+
+WorkerPool::WorkerPool(const int numWorkers)
+    : workers       { }
+    , dispatchMutex { }
+    , mutex         { }
+    , jobAvailable  { }
+    , jobDone       { }
+    , jobFunc       { nullptr }
+    , jobContext    { nullptr }
+    , jobCount      { 0 }
+    , busyWorkers   { 0 }
+    , jobSerial     { 0 }
+    , quitWorkers   { false }
+    , nextItem      { 0 }
+{
+    assert(numWorkers >= 0);
+    workers.reserve(numWorkers);
+
+    for (int w = 0; w < numWorkers; ++w)
+    {
+        workers.emplace_back(&WorkerPool::workerThreadMain, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        quitWorkers = true;
+    }
+
+    jobAvailable.notify_all();
+    for (auto & worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void WorkerPool::runJob(const JobFunc func, void * context, const int count)
+{
+    std::lock_guard<std::mutex> dispatchLock{ dispatchMutex };
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        jobFunc     = func;
+        jobContext  = context;
+        jobCount    = count;
+        busyWorkers = static_cast<int>(workers.size());
+        nextItem.store(0, std::memory_order_relaxed);
+        ++jobSerial;
+    }
+
+    jobAvailable.notify_all();
+
+    // The calling thread helps instead of just waiting.
+    runItems();
+
+    // Every worker must be done with the job before the caller's locals go away.
+    std::unique_lock<std::mutex> lock{ mutex };
+    jobDone.wait(lock, [this]() { return busyWorkers == 0; });
+}
+
+void WorkerPool::runItems()
+{
+    for (;;)
+    {
+        const int index = nextItem.fetch_add(1, std::memory_order_relaxed);
+        if (index >= jobCount)
+        {
+            return;
+        }
+        jobFunc(jobContext, index);
+    }
+}
+
+void WorkerPool::workerThreadMain()
+{
+    unsigned lastSerial = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock{ mutex };
+            jobAvailable.wait(lock, [this, lastSerial]() { return quitWorkers || jobSerial != lastSerial; });
+
+            if (quitWorkers)
+            {
+                return;
+            }
+            lastSerial = jobSerial;
+        }
+
+        runItems();
+
+        std::lock_guard<std::mutex> lock{ mutex };
+        if (--busyWorkers == 0)
+        {
+            jobDone.notify_one();
+        }
+    }
+}
+
+int g_nWorkerPoolSize = -1;
+
+WorkerPool & getWorkerPool()
+{
+    // hardware_concurrency() may return zero if unknown.
+    static WorkerPool pool{ (g_nWorkerPoolSize >= 0) ? g_nWorkerPoolSize :
+                            std::max(static_cast<int>(std::thread::hardware_concurrency()) - 1, 0) };
+    return pool;
+}
@@ -0,0 +1,112 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: worker_pool.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Small pool of persistent worker threads for data-parallel loops.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// ========================================================
+// class WorkerPool:
+// ========================================================
+
+//
+// A fixed set of threads that sleep until a parallelFor() is issued. Each
+// call is split into items that the workers and the calling thread pick up
+// one at a time. The call returns once every item is done, so the loop body
+// may freely reference locals of the caller.
+//
+// Items are started in index order but may finish in any order. The loop body
+// must not throw (catch and store errors per item instead) and must not call
+// parallelFor() on the same pool, since only one loop runs at a time.
+//
+class WorkerPool final
+{
+public:
+
+    // With zero workers, parallelFor() just runs the loop on the calling thread.
+    explicit WorkerPool(int numWorkers);
+    ~WorkerPool(); // Joins the workers.
+
+    // Not copyable.
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool & operator = (const WorkerPool &) = delete;
+
+    // Calls func(i) for every i in [0, count). Blocks until all calls returned.
+    template<typename Func>
+    void parallelFor(const int count, Func && func)
+    {
+        using FuncType = typename std::remove_reference<Func>::type;
+
+        if (workers.empty() || count <= 1)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                func(i);
+            }
+            return;
+        }
+
+        runJob(&invokeJob<FuncType>, &func, count);
+    }
+
+    // Workers plus the calling thread.
+    int getNumThreads() const noexcept { return static_cast<int>(workers.size()) + 1; }
+
+private:
+
+    using JobFunc = void (*)(void * context, int index);
+
+    template<typename FuncType>
+    static void invokeJob(void * context, const int index)
+    {
+        (*static_cast<FuncType *>(context))(index);
+    }
+
+    void runJob(JobFunc func, void * context, int count);
+    void runItems();
+    void workerThreadMain();
+
+    std::vector<std::thread> workers;
+
+    // One parallelFor() at a time, in case the pool is shared by several threads.
+    std::mutex dispatchMutex;
+
+    // Guards the job fields below and the wake/done signaling.
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobDone;
+
+    JobFunc jobFunc;
+    void *  jobContext;
+    int     jobCount;
+    int     busyWorkers;   // Workers that haven't finished the current job yet.
+    unsigned jobSerial;    // Incremented for each job, so workers can tell a new one arrived.
+    bool    quitWorkers;
+
+    std::atomic<int> nextItem;
+};
+
+// Number of workers in the shared pool. Negative means one per extra hardware
+// thread (the calling thread makes up the last one). Only read when the pool is created.
+extern int g_nWorkerPoolSize;
+
+// Shared pool, created on first use.
+WorkerPool & getWorkerPool();
+
+#endif // WORKER_POOL_HPP
@@ -0,0 +1,518 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: world_cache.cpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Resident world cache with background loading of BSP world maps.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#include "world_cache.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace World
+{
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double millisecondsSince(const Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static std::size_t worldMemoryBytes(const RenderData & world)
+{
+    // System memory plus the GPU copy of the vertexes.
+    return world.getMemoryFootprint() + world.getVertexCount() * sizeof(GLDrawVertex);
+}
+
+// ========================================================
+// WorldCache implementation:
+// ========================================================
+
+WorldCache::WorldCache(GLFWApp & owner, const std::size_t memoryBudgetBytes, const int uploadBytesPerFrameLimit)
+    : app                 { owner }
+    , memoryBudget        { memoryBudgetBytes }
+    , uploadBytesPerFrame { uploadBytesPerFrameLimit }
+    , frameCounter        { 0 }
+    , quitWorker          { false }
+{
+    worker = std::thread{ &WorldCache::workerThreadMain, this };
+}
+
+WorldCache::~WorldCache()
+{
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        quitWorker = true;
+        jobQueue.clear();
+    }
+
+    workAvailable.notify_all();
+    worker.join();
+
+    // Worlds are freed here, on the main thread, after the worker is gone.
+    entries.clear();
+}
+
+void WorldCache::preload(const std::string & filename, const float scale)
+{
+    if (findEntry(filename, g_bBuildBspTree) == nullptr)
+    {
+        queueEntry(filename, scale);
+    }
+}
+
+RenderData * WorldCache::find(const std::string & filename)
+{
+    Entry * entry = findEntry(filename, g_bBuildBspTree);
+    if (entry == nullptr)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (entry->state != State::Resident)
+    {
+        return nullptr;
+    }
+
+    entry->lastUsedFrame = frameCounter;
+    return entry->world.get();
+}
+
+RenderData * WorldCache::loadNow(const std::string & filename, const float scale)
+{
+    Entry * entry = findEntry(filename, g_bBuildBspTree);
+    if (entry == nullptr)
+    {
+        entry = queueEntry(filename, scale);
+    }
+
+    // Wait for the worker to get to it and finish the build:
+    {
+        std::unique_lock<std::mutex> lock{ mutex };
+        workDone.wait(lock, [entry]() {
+            return entry->state != State::Queued && entry->state != State::Building;
+        });
+
+        if (entry->state == State::Failed)
+        {
+            lock.unlock();
+            removeEntry(entry);
+            return nullptr;
+        }
+
+        if (entry->state == State::Built)
+        {
+            entry->state = State::Uploading;
+        }
+    }
+
+    // Finish all the GL uploads right now:
+    if (entry->uploadStep != UploadStep::Done)
+    {
+        const auto uploadStartTime = Clock::now();
+
+        int unlimitedBudget = INT_MAX;
+        while (!advanceUpload(entry, &unlimitedBudget))
+        {
+        }
+
+        const double uploadMs = millisecondsSince(uploadStartTime);
+        entry->report.uploadTimeMs += uploadMs;
+        entry->report.worstFrameMs  = std::max(entry->report.worstFrameMs, uploadMs);
+        entry->report.uploadFrames += 1;
+        entry->report.requestToReadyMs = millisecondsSince(entry->requestTime);
+        lastLoadReport = entry->report;
+
+        std::lock_guard<std::mutex> lock{ mutex };
+        entry->state = State::Resident;
+    }
+
+    entry->lastUsedFrame = frameCounter;
+    return entry->world.get();
+}
+
+bool WorldCache::checkFailed(const std::string & filename)
+{
+    Entry * entry = findEntry(filename, g_bBuildBspTree);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        if (entry->state != State::Failed)
+        {
+            return false;
+        }
+    }
+
+    removeEntry(entry);
+    return true;
+}
+
+void WorldCache::update(const RenderData * activeWorld)
+{
+    ++frameCounter;
+
+    // Pick up the worlds finished by the worker. This doesn't take the lock,
+    // so a frame with nothing to upload never contends with the worker thread.
+    builtQueue.drain([this](Entry * entry) { uploadList.push_back(entry); });
+
+    int uploadBudget = uploadBytesPerFrame;
+    std::size_t i = 0;
+
+    while (i < uploadList.size() && uploadBudget > 0)
+    {
+        Entry * entry = uploadList[i];
+
+        // Might have been uploaded by loadNow() in the meantime.
+        if (entry->uploadStep == UploadStep::Done)
+        {
+            uploadList.erase(uploadList.begin() + i);
+            continue;
+        }
+
+        if (entry->state == State::Built)
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            entry->state = State::Uploading;
+        }
+
+        // Only this thread touches an entry in the Uploading state.
+        const auto sliceStartTime = Clock::now();
+        const bool uploadDone = advanceUpload(entry, &uploadBudget);
+        const double sliceMs = millisecondsSince(sliceStartTime);
+
+        entry->report.uploadTimeMs += sliceMs;
+        entry->report.worstFrameMs  = std::max(entry->report.worstFrameMs, sliceMs);
+        entry->report.uploadFrames += 1;
+
+        if (uploadDone)
+        {
+            entry->report.requestToReadyMs = millisecondsSince(entry->requestTime);
+            entry->lastUsedFrame = frameCounter;
+            lastLoadReport = entry->report;
+
+            app.printF("World \"%s\" resident: build %.2fms (worker), GL upload %.2fms over %d frame(s), "
+                       "worst frame %.3fms, request-to-ready %.2fms, %.2f KB.",
+                       entry->filename.c_str(), entry->report.buildTimeMs, entry->report.uploadTimeMs,
+                       entry->report.uploadFrames, entry->report.worstFrameMs, entry->report.requestToReadyMs,
+                       entry->memoryBytes / 1024.0);
+
+            {
+                std::lock_guard<std::mutex> lock{ mutex };
+                entry->state = State::Resident;
+            }
+
+            uploadList.erase(uploadList.begin() + i);
+            continue;
+        }
+
+        ++i; // Out of budget. Resume next frame.
+    }
+
+    evictOverBudget(activeWorld);
+}
+
+void WorldCache::updateMemoryBytes(const RenderData * world)
+{
+    assert(world != nullptr);
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    for (const auto & entry : entries)
+    {
+        if (entry->world.get() == world && entry->state == State::Resident)
+        {
+            entry->memoryBytes = worldMemoryBytes(*world);
+            return;
+        }
+    }
+}
+
+std::size_t WorldCache::getResidentBytes() const noexcept
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    std::size_t totalBytes = 0;
+    for (const auto & entry : entries)
+    {
+        if (entry->state == State::Built || entry->state == State::Uploading || entry->state == State::Resident)
+        {
+            totalBytes += entry->memoryBytes;
+        }
+    }
+    return totalBytes;
+}
+
+int WorldCache::getResidentCount() const noexcept
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    int count = 0;
+    for (const auto & entry : entries)
+    {
+        if (entry->state == State::Resident)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+int WorldCache::getPendingCount() const noexcept
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    int count = 0;
+    for (const auto & entry : entries)
+    {
+        if (entry->state != State::Resident && entry->state != State::Failed)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+WorldCache::Entry * WorldCache::findEntry(const std::string & filename, const bool buildBspTree) const
+{
+    for (const auto & entry : entries)
+    {
+        if (entry->filename == filename && entry->buildBspTree == buildBspTree)
+        {
+            return entry.get();
+        }
+    }
+    return nullptr;
+}
+
+WorldCache::Entry * WorldCache::queueEntry(const std::string & filename, const float scale)
+{
+    std::unique_ptr<Entry> newEntry{ new Entry{} };
+    newEntry->filename     = filename;
+    newEntry->scale        = scale;
+    newEntry->buildBspTree = g_bBuildBspTree;
+    newEntry->requestTime  = Clock::now();
+    newEntry->world.reset(new RenderData{ app });
+    newEntry->report.filename = filename;
+
+    Entry * entry = newEntry.get();
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        entries.push_back(std::move(newEntry));
+        jobQueue.push_back(entry);
+    }
+
+    workAvailable.notify_one();
+    return entry;
+}
+
+bool WorldCache::advanceUpload(Entry * entry, int * uploadBudgetBytes)
+{
+    assert(entry != nullptr);
+    assert(uploadBudgetBytes != nullptr);
+
+    RenderData * world = entry->world.get();
+    const int vertexCount = world->getVertexCount();
+
+    while ((*uploadBudgetBytes) > 0 && entry->uploadStep != UploadStep::Done)
+    {
+        switch (entry->uploadStep)
+        {
+        case UploadStep::CreateBuffers :
+            // Allocate the GL storage only. Data goes in next, a slice per frame.
+            world->vertexArray.initFromData(nullptr, vertexCount, nullptr, 0,
+                                            GL_STATIC_DRAW, GLVertexLayout::Triangles);
+            entry->uploadStep = UploadStep::VertexData;
+            break;
+
+        case UploadStep::VertexData :
+            {
+                const int vertsLeft = vertexCount - entry->uploadedVerts;
+                const int vertsThisSlice = std::min(vertsLeft, std::max(1, (*uploadBudgetBytes) / static_cast<int>(sizeof(GLDrawVertex))));
+
+                if (vertsThisSlice > 0)
+                {
+                    const int offsetBytes = entry->uploadedVerts * sizeof(GLDrawVertex);
+                    const int sizeBytes   = vertsThisSlice * sizeof(GLDrawVertex);
+
+                    world->vertexArray.bindVA();
+                    world->vertexArray.bindVB();
+
+                    // The buffer was never drawn with, so there's no need to synchronize.
+                    void * dest = world->vertexArray.mapVBRange(offsetBytes, sizeBytes,
+                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+                    if (dest != nullptr)
+                    {
+                        std::memcpy(dest, &world->vertexes[entry->uploadedVerts], sizeBytes);
+                        world->vertexArray.unMapVB();
+                    }
+                    else
+                    {
+                        app.printF("WARNING! Failed to map world vertex buffer range for \"%s\"!", entry->filename.c_str());
+                    }
+
+                    world->vertexArray.bindNull();
+                    entry->uploadedVerts += vertsThisSlice;
+                    (*uploadBudgetBytes) -= sizeBytes;
+                }
+
+                if (entry->uploadedVerts >= vertexCount)
+                {
+                    entry->uploadStep = UploadStep::Textures;
+                }
+                break;
+            }
+
+        case UploadStep::Textures :
+            world->loadTextures();
+            (*uploadBudgetBytes) -= 64 * 64 * 4; // Size of the debug checker texture.
+            entry->uploadStep = UploadStep::Shaders;
+            break;
+
+        case UploadStep::Shaders :
+            // Shader compilation is the most expensive step, give it a frame of its own.
+            world->loadShaders();
+            (*uploadBudgetBytes) = 0;
+            entry->uploadStep = UploadStep::Done;
+            break;
+
+        default :
+            assert(false);
+            break;
+        } // switch (entry->uploadStep)
+    }
+
+    CHECK_GL_ERRORS(&app);
+    return entry->uploadStep == UploadStep::Done;
+}
+
+void WorldCache::evictOverBudget(const RenderData * activeWorld)
+{
+    std::size_t residentBytes = getResidentBytes();
+
+    while (residentBytes > memoryBudget)
+    {
+        // Find the least recently used resident world that is not in use:
+        Entry * lruEntry = nullptr;
+        for (const auto & entry : entries)
+        {
+            if (entry->state != State::Resident || entry->world.get() == activeWorld)
+            {
+                continue;
+            }
+            if (lruEntry == nullptr || entry->lastUsedFrame < lruEntry->lastUsedFrame)
+            {
+                lruEntry = entry.get();
+            }
+        }
+
+        if (lruEntry == nullptr)
+        {
+            break; // Only the active world or pending loads left.
+        }
+
+        app.printF("Evicting world \"%s\" from the cache (%.2f KB).",
+                   lruEntry->filename.c_str(), lruEntry->memoryBytes / 1024.0);
+
+        residentBytes -= lruEntry->memoryBytes;
+        removeEntry(lruEntry);
+    }
+}
+
+void WorldCache::removeEntry(Entry * entry)
+{
+    assert(entry != nullptr);
+
+    // Never called for entries the worker might still be touching.
+    std::unique_ptr<Entry> removed;
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        assert(entry->state != State::Queued && entry->state != State::Building);
+
+        auto iter = std::find_if(std::begin(entries), std::end(entries),
+                                 [entry](const std::unique_ptr<Entry> & e) { return e.get() == entry; });
+        assert(iter != std::end(entries));
+
+        removed = std::move(*iter);
+        entries.erase(iter);
+    }
+
+    // Could still be waiting in the upload list if loadNow() finished it.
+    uploadList.erase(std::remove(std::begin(uploadList), std::end(uploadList), entry), std::end(uploadList));
+
+    // GL cleanup and pool drains outside the lock.
+    removed->world->cleanup();
+}
+
+void WorldCache::workerThreadMain()
+{
+    std::vector<Triangle> worldPolys;
+
+    for (;;)
+    {
+        Entry * entry;
+        {
+            std::unique_lock<std::mutex> lock{ mutex };
+            workAvailable.wait(lock, [this]() { return quitWorker || !jobQueue.empty(); });
+
+            if (quitWorker)
+            {
+                return;
+            }
+
+            entry = jobQueue.front();
+            jobQueue.pop_front();
+            entry->state = State::Building;
+        }
+
+        // No GL calls in here! Only the CPU-side world data is built.
+        bool succeeded = false;
+        try
+        {
+            if (loadDatafilePolygons(entry->filename.c_str(), entry->scale, &worldPolys))
+            {
+                buildFromPolygons(entry->world.get(), worldPolys.data(), worldPolys.size(), entry->buildBspTree);
+                entry->report.poolBytesFreed = entry->world->shrinkPools();
+                succeeded = true;
+            }
+        }
+        catch (...)
+        {
+            succeeded = false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            if (succeeded)
+            {
+                entry->memoryBytes = worldMemoryBytes(*entry->world);
+                entry->report.buildTimeMs = entry->world->buildStats.buildTimeMs;
+                entry->state = State::Built;
+
+                // Pushed while still holding the lock, so that once loadNow() sees
+                // the Built state, the next drain in update() is sure to see the entry.
+                builtQueue.push(entry);
+            }
+            else
+            {
+                entry->state = State::Failed;
+            }
+        }
+
+        workDone.notify_all();
+    }
+}
+
+} // namespace World {}
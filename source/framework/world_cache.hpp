@@ -0,0 +1,182 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: world_cache.hpp
+// Author: Guilherme R. Lampert
+// Created on: 16/10/26
+// Brief: Resident world cache with background loading of BSP world maps.
+//
+// This source code is released under the MIT license.
+// See the accompanying LICENSE file for details.
+//
+// ================================================================================================
+
+#ifndef WORLD_CACHE_HPP
+#define WORLD_CACHE_HPP
+
+#include "framework/world_rendering.hpp"
+#include "framework/mpsc_queue.hpp"
+
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace World
+{
+
+// ========================================================
+// class WorldCache:
+// ========================================================
+
+//
+// Keeps a set of world maps resident in memory and loads new ones in the background.
+//
+// The file parsing, BSP tree, portals and vertex setup run on a worker thread.
+// Only the GL resource creation happens on the main thread, inside update(), and
+// it is split across several frames so that switching maps never stalls rendering
+// for more than a small time slice (see 'uploadBytesPerFrame').
+//
+// Recently used maps stay resident until the total memory in use goes over
+// the budget, at which point the least recently used ones are evicted.
+//
+// Maps are looked up by file name and the g_bBuildBspTree setting of the
+// request, so after toggling the setting the same file loads into a new
+// entry built the new way. The old entry stays until it gets evicted.
+//
+class WorldCache final
+{
+public:
+
+    // Stats about the last completed map load, for display/reporting.
+    struct LoadReport
+    {
+        std::string filename;
+        double buildTimeMs      = 0.0; // Worker thread time (parse + BSP + portals).
+        double uploadTimeMs     = 0.0; // Total main thread time spent on GL uploads.
+        double worstFrameMs     = 0.0; // Largest single-frame main thread cost (the hitch).
+        double requestToReadyMs = 0.0; // Latency from the request to the world being usable.
+        int    uploadFrames     = 0;   // Number of frames the GL upload was spread over.
+        std::size_t poolBytesFreed = 0; // Empty pool blocks given back after the build.
+    };
+
+    WorldCache(GLFWApp & owner, std::size_t memoryBudgetBytes, int uploadBytesPerFrameLimit = 256 * 1024);
+    ~WorldCache(); // Stops the worker thread and frees all worlds.
+
+    // Not copyable.
+    WorldCache(const WorldCache &) = delete;
+    WorldCache & operator = (const WorldCache &) = delete;
+
+    // Queues the map for background loading. No-op if already resident or loading.
+    // g_bBuildBspTree is sampled now, so toggling it later won't affect this load.
+    void preload(const std::string & filename, float scale = 1.0f);
+
+    // Returns the world if it is fully loaded and uploaded, null otherwise.
+    // A non-null return marks the world as the most recently used.
+    RenderData * find(const std::string & filename);
+
+    // Loads the map synchronously if it is not already resident. Blocks until the
+    // world is ready to render. Returns null if the map failed to load.
+    RenderData * loadNow(const std::string & filename, float scale = 1.0f);
+
+    // True if the map failed to load. The failed entry is dropped by this call,
+    // so a subsequent preload() will retry.
+    bool checkFailed(const std::string & filename);
+
+    // Recomputes the memory size of a resident world after it was changed in
+    // place (edits, pool shrinks), so that eviction goes by its current size.
+    void updateMemoryBytes(const RenderData * world);
+
+    // Must be called once per frame from the main thread.
+    // Advances pending GL uploads and evicts least recently used worlds if over budget.
+    // 'activeWorld' is never evicted.
+    void update(const RenderData * activeWorld);
+
+    // Miscellaneous queries:
+    std::size_t getMemoryBudget()   const noexcept { return memoryBudget; }
+    std::size_t getResidentBytes()  const noexcept;
+    int getResidentCount()          const noexcept;
+    int getPendingCount()           const noexcept;
+    const LoadReport & getLastLoadReport() const noexcept { return lastLoadReport; }
+
+private:
+
+    enum class State
+    {
+        Queued,    // Waiting for the worker.
+        Building,  // Worker is building the BSP/portals.
+        Built,     // CPU data ready, waiting for the GL upload.
+        Uploading, // Main thread is creating the GL resources.
+        Resident,  // Ready to render.
+        Failed     // Failed to load the file.
+    };
+
+    // GL upload steps, one or more per frame:
+    enum class UploadStep
+    {
+        CreateBuffers,
+        VertexData,
+        Textures,
+        Shaders,
+        Done
+    };
+
+    struct Entry
+        : public MPSCQueueNode
+    {
+        using Clock = std::chrono::high_resolution_clock;
+
+        std::string       filename;
+        float             scale         = 1.0f;
+        bool              buildBspTree  = true;
+        State             state         = State::Queued; // Guarded by 'mutex' while the worker may touch the entry.
+        UploadStep        uploadStep    = UploadStep::CreateBuffers;
+        int               uploadedVerts = 0;
+        std::size_t       memoryBytes   = 0;
+        std::int64_t      lastUsedFrame = 0;
+        Clock::time_point requestTime;
+        LoadReport        report;
+
+        // Allocated and freed on the main thread only, since the
+        // destructors of the GL objects in it will issue GL calls.
+        std::unique_ptr<RenderData> world;
+    };
+
+    Entry * findEntry(const std::string & filename, bool buildBspTree) const;
+    Entry * queueEntry(const std::string & filename, float scale);
+    bool advanceUpload(Entry * entry, int * uploadBudgetBytes);
+    void evictOverBudget(const RenderData * activeWorld);
+    void removeEntry(Entry * entry);
+    void workerThreadMain();
+
+    GLFWApp & app;
+    const std::size_t memoryBudget;
+    const int uploadBytesPerFrame;
+    std::int64_t frameCounter;
+    LoadReport lastLoadReport;
+
+    // All entries, in any state. Only the main thread adds/removes entries.
+    std::vector<std::unique_ptr<Entry>> entries;
+
+    // Built worlds handed from the worker to the main thread, which moves
+    // them to the upload list. The list is only touched by the main thread.
+    MPSCQueue<Entry> builtQueue;
+    std::vector<Entry *> uploadList;
+
+    // Worker thread and its job queue:
+    mutable std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+    std::deque<Entry *> jobQueue;
+    bool quitWorker;
+    std::thread worker;
+};
+
+} // namespace World {}
+
+#endif // WORLD_CACHE_HPP
@@ -12,8 +12,10 @@
 // ================================================================================================
 
 #include "world_rendering.hpp"
+#include "frame_arena.hpp"
 
 #include <cstdio>
+#include <chrono>
 #include <algorithm>
 
 //
@@ -202,6 +204,7 @@ RenderData::RenderData(GLFWApp & owner)
     , bspPortalCount                  { 0       }
     , bspLeafCount                    { 0       }
     , bspPartitionCount               { 0       }
+    , nextPolygonId                   { 0       }
 { }
 
 void RenderData::cleanup()
@@ -220,8 +223,10 @@ void RenderData::cleanup()
     bspPortalCount                  = 0;
     bspLeafCount                    = 0;
     bspPartitionCount               = 0;
+    nextPolygonId                   = 0;
     bounds.mins                     = Vec3{ 0.0f, 0.0f, 0.0f };
     bounds.maxs                     = Vec3{ 0.0f, 0.0f, 0.0f };
+    buildStats                      = BuildStats{};
 
     vertexArray.cleanup();
     mainShader.cleanup();
@@ -245,6 +250,15 @@ void RenderData::submitGLVertexArray()
                              GLVertexLayout::Triangles);
 }
 
+void RenderData::updateGLVertexArray()
+{
+    // Vertex count might have changed, so reallocate the whole buffer.
+    vertexArray.bindVA();
+    vertexArray.bindVB();
+    vertexArray.updateRawData(vertexes.data(), vertexes.size(), sizeof(GLDrawVertex), nullptr, 0, 0);
+    vertexArray.bindNull();
+}
+
 void RenderData::loadShaders()
 {
     // Main shader used by the level geometry:
@@ -271,6 +285,43 @@ void RenderData::loadTextures()
                                         0, GLTexture::WrapMode::Repeat);
 }
 
+std::size_t RenderData::getMemoryFootprint() const noexcept
+{
+    std::size_t bytes = 0;
+    bytes += vertexes.capacity() * sizeof(GLDrawVertex);
+    bytes += bspPartitionNodes.capacity() * sizeof(BspNode *);
+    bytes += bspLeafNodes.capacity() * sizeof(BspNode *);
+    bytes += polygonPoolAlloc.getBytesReserved();
+    bytes += bspNodePoolAlloc.getBytesReserved();
+    bytes += portalPoolAlloc.getBytesReserved();
+    return bytes;
+}
+
+PoolStats RenderData::getPoolStats() const
+{
+    PoolStats stats;
+    stats.polygons = polygonPoolAlloc.getMemoryStats();
+    stats.bspNodes = bspNodePoolAlloc.getMemoryStats();
+    stats.portals  = portalPoolAlloc.getMemoryStats();
+    return stats;
+}
+
+void RenderData::usePageBackedPools(const PageAllocator::Options & opts)
+{
+    polygonPoolAlloc.usePageStorage(opts);
+    bspNodePoolAlloc.usePageStorage(opts);
+    portalPoolAlloc.usePageStorage(opts);
+}
+
+std::size_t RenderData::shrinkPools()
+{
+    std::size_t bytesFreed = 0;
+    bytesFreed += polygonPoolAlloc.shrink();
+    bytesFreed += bspNodePoolAlloc.shrink();
+    bytesFreed += portalPoolAlloc.shrink();
+    return bytesFreed;
+}
+
 void RenderData::computeBounds()
 {
     if (vertexes.empty())
@@ -663,10 +714,21 @@ void invertSinglePortal(Portal * portal)
     portal->plane.fromPoints(portal->verts[0], portal->verts[1], portal->verts[2]);
 }
 
-void invertNodePortals(const RenderData & world, BspNode * node)
+Portal * getNthPortal(const PortalList & portals, const int n)
 {
-    Portal * portal = node->portals.first();
-    for (int i = node->portals.size(); i--; portal = portal->next)
+    assert(n >= 0 && n <= portals.size());
+    Portal * portal = portals.first();
+    for (int i = 0; i < n; ++i)
+    {
+        portal = portal->next;
+    }
+    return portal;
+}
+
+void invertNodePortals(const RenderData & world, BspNode * node, const int firstPortal)
+{
+    Portal * portal = getNthPortal(node->portals, firstPortal);
+    for (int i = node->portals.size() - firstPortal; i--; portal = portal->next)
     {
         const Polygon * poly = node->polygons.first();
         for (int j = node->polygons.size(); j--; poly = poly->next)
@@ -733,59 +795,69 @@ void countPortalsRecursive(const BspNode * node, int * outCount)
     countPortalsRecursive(node->backNode,  outCount);
 }
 
-void findTruePortalsRecursive(RenderData * world, BspNode * node)
+void findTruePortalsInLeaf(RenderData * world, BspNode * node, const int firstPortal)
 {
+    // Portals before 'firstPortal' in the leaf's list are already final.
     assert(world != nullptr);
     assert(node  != nullptr);
+    assert(node->isLeaf);
 
-    if (node->isLeaf)
+    Portal * portal = getNthPortal(node->portals, firstPortal);
+    int portalsLeft = node->portals.size() - firstPortal;
+    while (portalsLeft > 0)
     {
-        Portal * portal = node->portals.first();
-        int portalsLeft = node->portals.size();
-        while (portalsLeft > 0)
+        int count = 0;
+        checkForSinglePortalsRecursive(world->bspRoot, node, portal, &count);
+        if (count == 0)
         {
-            int count = 0;
-            checkForSinglePortalsRecursive(world->bspRoot, node, portal, &count);
-            if (count == 0)
-            {
-                Portal * toRemove = portal;
-                portal = portal->next;
-                --portalsLeft;
-
-                node->portals.remove(toRemove);
-                world->freePortal(toRemove);
-                continue;
-            }
-
-            clipPortalToLeaf(portal, portal->frontLeaf);
-            clipPortalToLeaf(portal, portal->backLeaf);
-
+            Portal * toRemove = portal;
             portal = portal->next;
             --portalsLeft;
+
+            node->portals.remove(toRemove);
+            world->freePortal(toRemove);
+            continue;
         }
 
-        // Also inverts the front and back leaf pointers if necessary.
-        invertNodePortals(*world, node);
+        clipPortalToLeaf(portal, portal->frontLeaf);
+        clipPortalToLeaf(portal, portal->backLeaf);
 
-        portal = node->portals.first();
-        portalsLeft = node->portals.size();
-        while (portalsLeft > 0)
-        {
-            const bool shouldRemove = removeExtraPortals(portal);
-            if (shouldRemove)
-            {
-                Portal * toRemove = portal;
-                portal = portal->next;
-                --portalsLeft;
+        portal = portal->next;
+        --portalsLeft;
+    }
 
-                node->portals.remove(toRemove);
-                world->freePortal(toRemove);
-                continue;
-            }
+    // Also inverts the front and back leaf pointers if necessary.
+    invertNodePortals(*world, node, firstPortal);
 
+    portal = getNthPortal(node->portals, firstPortal);
+    portalsLeft = node->portals.size() - firstPortal;
+    while (portalsLeft > 0)
+    {
+        const bool shouldRemove = removeExtraPortals(portal);
+        if (shouldRemove)
+        {
+            Portal * toRemove = portal;
             portal = portal->next;
             --portalsLeft;
+
+            node->portals.remove(toRemove);
+            world->freePortal(toRemove);
+            continue;
         }
+
+        portal = portal->next;
+        --portalsLeft;
+    }
+}
+
+void findTruePortalsRecursive(RenderData * world, BspNode * node)
+{
+    assert(world != nullptr);
+    assert(node  != nullptr);
+
+    if (node->isLeaf)
+    {
+        findTruePortalsInLeaf(world, node, 0);
     }
     else
     {
@@ -794,34 +866,28 @@ void findTruePortalsRecursive(RenderData * world, BspNode * node)
     }
 }
 
-void buildPortals(RenderData * world)
+void makePotentialPortals(RenderData * world, const std::vector<BspNode *> & portalPlaneNodes, PortalList * outPortals)
 {
-    assert(world != nullptr);
-    assert(world->bspRoot != nullptr);
-
-    // Temporary list for the large portals
-    PortalList allPortals;
-
-    // Put the partition nodes and leaf nodes aside:
-    gatherBspNodeLists(world->bspRoot, &world->bspPartitionNodes, &world->bspLeafNodes);
+    assert(world      != nullptr);
+    assert(outPortals != nullptr);
 
     // Create a large/rough portal for each partition:
-    for (const BspNode * node : world->bspPartitionNodes)
+    for (const BspNode * node : portalPlaneNodes)
     {
         Portal * newPortal = world->allocPortal();
         makeLargePortal(world->bounds, node->partition, newPortal);
-        allPortals.push_back(newPortal);
+        outPortals->push_back(newPortal);
     }
 
     Portal * portal;
     Portal * frontPortal = nullptr;
     Portal * backPortal  = nullptr;
 
-    // Now the large portals are split into potential portals:
+    // Now the large portals are split into potential portals by every partition in the tree:
     for (const BspNode * node : world->bspPartitionNodes)
     {
-        portal = allPortals.first();
-        int portalsLeft = allPortals.size();
+        portal = outPortals->first();
+        int portalsLeft = outPortals->size();
 
         while (portalsLeft > 0)
         {
@@ -839,14 +905,14 @@ void buildPortals(RenderData * world)
                 assert(classifyPortal(*frontPortal, node->partition) == FrontSide);
                 assert(classifyPortal(*backPortal,  node->partition) == BackSide);
 
-                allPortals.push_back(frontPortal);
-                allPortals.push_back(backPortal);
+                outPortals->push_back(frontPortal);
+                outPortals->push_back(backPortal);
 
                 Portal * toRemove = portal;
                 portal = portal->next;
                 --portalsLeft;
 
-                allPortals.remove(toRemove);
+                outPortals->remove(toRemove);
                 world->freePortal(toRemove);
 
                 frontPortal = nullptr;
@@ -865,10 +931,25 @@ void buildPortals(RenderData * world)
         world->freePortal(frontPortal);
         world->freePortal(backPortal);
     }
+}
+
+void buildPortals(RenderData * world)
+{
+    assert(world != nullptr);
+    assert(world->bspRoot != nullptr);
+
+    // Temporary list for the large portals
+    PortalList allPortals;
+
+    // Put the partition nodes and leaf nodes aside:
+    gatherBspNodeLists(world->bspRoot, &world->bspPartitionNodes, &world->bspLeafNodes);
+
+    // Large portals for every partition, split into potential portals:
+    makePotentialPortals(world, world->bspPartitionNodes, &allPortals);
 
     // Loop through the portals and assign a unique id to each:
     int portalId = 0;
-    portal = allPortals.first();
+    Portal * portal = allPortals.first();
     for (int i = allPortals.size(); i--; portal = portal->next)
     {
         portal->id = ++portalId;
@@ -882,7 +963,7 @@ void buildPortals(RenderData * world)
     countPortalsRecursive(world->bspRoot, &world->bspPortalCount);
 }
 
-void triangulateConvexPolygon(const Vec3 * verts, const int vertexCount, std::vector<Vec3> * outTriangles)
+void triangulateConvexPolygon(const Vec3 * verts, const int vertexCount, FrameVector<Vec3> * outTriangles)
 {
     outTriangles->clear();
 
@@ -903,15 +984,18 @@ void triangulateConvexPolygon(const Vec3 * verts, const int vertexCount, std::ve
 
 
 void addDebugPortalsRecursive(RenderData * world, const BspNode * node,
-                              int * outPortalVertsAdded, std::vector<int> * outPortalIdsAdded)
+                              int * outPortalVertsAdded, FrameVector<int> * outPortalIdsAdded)
 {
     if (node == nullptr)
     {
         return;
     }
 
+    // Scratch memory from the frame arena, released by addDebugPortals() when
+    // the whole tree is done. Can't rewind per node since 'outPortalIdsAdded'
+    // may grow (reallocate in the arena) inside the recursive calls.
     int nextPortalColor = 0;     // Each portal gets assigned a different color.
-    std::vector<Vec3> triangles; // For portals that need to be triangulated.
+    FrameVector<Vec3> triangles; // For portals that need to be triangulated.
 
     auto addTriangle = [world, &nextPortalColor](const Vec3 & a, const Vec3 & b, const Vec3 & c)
     {
@@ -973,8 +1057,9 @@ void addDebugPortals(RenderData * world)
 {
     assert(world != nullptr);
 
+    FrameArenaScope scratchScope;
     int portalVertsAdded = 0;
-    std::vector<int> portalIdsAdded;
+    FrameVector<int> portalIdsAdded;
 
     world->debugFirstPortalVert = world->getVertexCount();
     addDebugPortalsRecursive(world, world->bspRoot, &portalVertsAdded, &portalIdsAdded);
@@ -1110,13 +1195,15 @@ void splitTriangle(RenderData * world, const Polygon & triangleToSplit, const Pl
     assert(frontCount <= arrayLength(frontPoints));
     assert(backCount  <= arrayLength(backPoints));
 
-    auto makeTriangle = [world](const Vec3 & a, const float aUV[2],
-                                const Vec3 & b, const float bUV[2],
-                                const Vec3 & c, const float cUV[2])
+    const int sourceId = triangleToSplit.sourceId;
+    auto makeTriangle = [world, sourceId](const Vec3 & a, const float aUV[2],
+                                          const Vec3 & b, const float bUV[2],
+                                          const Vec3 & c, const float cUV[2])
     {
         Polygon * triangle    = world->allocPolygon();
         triangle->firstVertex = world->getVertexCount();
         triangle->vertexCount = 3;
+        triangle->sourceId    = sourceId;
         triangle->plane.fromPoints(a, b, c);
 
         const Vec3 n = triangle->plane.normal;
@@ -1317,23 +1404,23 @@ void buildBspTreeRecursive(RenderData * world, BspNode * node)
             {
                 node->frontNode->polygons.push_back(poly);
             }
-            ++g_nPolysOnPlane;
+            ++world->buildStats.polysOnPlane;
             break;
 
         case BackSide :
             node->backNode->polygons.push_back(poly);
-            ++g_nPolysBackSide;
+            ++world->buildStats.polysBackSide;
             break;
 
         case FrontSide :
             node->frontNode->polygons.push_back(poly);
-            ++g_nPolysFrontSide;
+            ++world->buildStats.polysFrontSide;
             break;
 
         case Spanning :
             // Break the triangle into up to 3 new triangles:
             splitTriangle(world, *poly, node->partition, &node->frontNode->polygons, &node->backNode->polygons);
-            ++g_nPolysSpanning;
+            ++world->buildStats.polysSpanning;
             break;
 
         default :
@@ -1347,6 +1434,18 @@ void buildBspTreeRecursive(RenderData * world, BspNode * node)
     buildBspTreeRecursive(world, node->backNode);
 }
 
+int computeBspTreeDepth(const BspNode * node)
+{
+    if (node == nullptr || node->isLeaf)
+    {
+        return 0;
+    }
+
+    const int frontDepth = computeBspTreeDepth(node->frontNode);
+    const int backDepth  = computeBspTreeDepth(node->backNode);
+    return 1 + std::max(frontDepth, backDepth);
+}
+
 // ========================================================
 // PVS computation and BSP Tree rendering:
 // ========================================================
@@ -1554,10 +1653,8 @@ void renderBspTreeRecursive(const RenderData & world, const Vec3 & eyePosition,
     }
 }
 
-void render(RenderData * world, const Vec3 & eyePosition, const Mat4 & viewMatrix, const Mat4 & mvpMatrix)
+void beginRender(RenderData * world, const Mat4 & viewMatrix, const Mat4 & mvpMatrix)
 {
-    assert(world != nullptr);
-
     if (g_bRenderWorldWrireframe && !g_bRenderWorldSolid)
     {
         glEnable(GL_BLEND);
@@ -1571,8 +1668,26 @@ void render(RenderData * world, const Vec3 & eyePosition, const Mat4 & viewMatri
     world->mainShader.setUniform1i(world->mainBaseTextureLocation, 0);
     world->mainShader.setUniformMat4(world->mainMvpMatrixLocation, mvpMatrix);
     world->mainShader.setUniformMat4(world->mainModelViewMatrixLocation, viewMatrix);
+}
 
-    if (g_bBuildBspTree && g_bRenderUseBsp)
+void endRender()
+{
+    if (g_bRenderWorldWrireframe && !g_bRenderWorldSolid)
+    {
+        glDisable(GL_BLEND);
+    }
+
+    ++g_nFrameNumber;
+}
+
+void render(RenderData * world, const Vec3 & eyePosition, const Mat4 & viewMatrix, const Mat4 & mvpMatrix)
+{
+    assert(world != nullptr);
+    beginRender(world, viewMatrix, mvpMatrix);
+
+    // Test the tree itself rather than g_bBuildBspTree, since a cached
+    // world might have been built before the flag was last toggled.
+    if (world->hasBspTree() && g_bRenderUseBsp)
     {
         g_nPolyListsRendered = 0;
         g_nPolysRendered = 0;
@@ -1602,23 +1717,45 @@ void render(RenderData * world, const Vec3 & eyePosition, const Mat4 & viewMatri
         world->vertexArray.bindNull();
     }
 
-    if (g_bRenderWorldWrireframe && !g_bRenderWorldSolid)
+    endRender();
+}
+
+void renderPolygons(RenderData * world, const Polygon * const * polys, const int polyCount,
+                    const Mat4 & viewMatrix, const Mat4 & mvpMatrix)
+{
+    assert(world != nullptr);
+    beginRender(world, viewMatrix, mvpMatrix);
+
+    if (g_bRenderWithDepthTest)
     {
-        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+    }
+    else
+    {
+        glDisable(GL_DEPTH_TEST);
     }
 
-    ++g_nFrameNumber;
+    g_nPolyListsRendered = 1;
+    g_nPolysRendered = 0;
+
+    world->vertexArray.bindVA();
+    for (int p = 0; p < polyCount; ++p)
+    {
+        assert(polys[p]->isTriangle());
+        world->vertexArray.drawUnindexed(GL_TRIANGLES, polys[p]->firstVertex, polys[p]->vertexCount);
+        ++g_nPolysRendered;
+    }
+    world->vertexArray.bindNull();
+
+    endRender();
 }
 
 // ========================================================
 // World loading / geometry setup:
 // ========================================================
 
-void createFromPolygons(RenderData * world, const Triangle * worldPolys, const int worldPolyCount)
+Polygon * addWorldTriangle(RenderData * world, const Triangle & poly, const int sourceId)
 {
-    assert(world      != nullptr);
-    assert(worldPolys != nullptr);
-
     // For the outline drawing using barycentric coords, as described in:
     // http://codeflow.org/entries/2012/aug/02/easy-wireframe-display-with-barycentric-coordinates/
     const float bc[3][3]{
@@ -1627,82 +1764,114 @@ void createFromPolygons(RenderData * world, const Triangle * worldPolys, const i
         { 0.0f, 0.0f, 1.0f }
     };
 
+    // Add a polygon:
+    Polygon * newPoly    = world->allocPolygon();
+    newPoly->firstVertex = world->getVertexCount();
+    newPoly->vertexCount = 3;
+    newPoly->sourceId    = sourceId;
+
+    // Add the vertexes:
+    GLDrawVertex verts[3];
+    for (int v = 0; v < 3; ++v)
+    {
+        verts[v].px = poly.verts[v][0];
+        verts[v].py = poly.verts[v][1];
+        verts[v].pz = poly.verts[v][2];
+        verts[v].r  = bc[v][0];
+        verts[v].g  = bc[v][1];
+        verts[v].b  = bc[v][2];
+        verts[v].a  = 1.0f;
+        verts[v].u  = poly.verts[v][3];
+        verts[v].v  = poly.verts[v][4];
+
+        // Unused for now.
+        verts[v].tx = 0.0f;
+        verts[v].ty = 0.0f;
+        verts[v].tz = 0.0f;
+        verts[v].bx = 0.0f;
+        verts[v].by = 0.0f;
+        verts[v].bz = 0.0f;
+    }
+
+    newPoly->plane.fromPoints(
+            Vec3{ verts[0].px, verts[0].py, verts[0].pz },
+            Vec3{ verts[1].px, verts[1].py, verts[1].pz },
+            Vec3{ verts[2].px, verts[2].py, verts[2].pz });
+
+    // The plane normal is used as the triangle normal for lighting.
+    const Vec3 n = newPoly->plane.normal;
+    for (int v = 0; v < 3; ++v)
+    {
+        verts[v].nx = n[0];
+        verts[v].ny = n[1];
+        verts[v].nz = n[2];
+        world->addVertex(verts[v]);
+    }
+
+    return newPoly;
+}
+
+void buildFromPolygons(RenderData * world, const Triangle * worldPolys,
+                       const int worldPolyCount, const bool buildBspTree)
+{
+    assert(world      != nullptr);
+    assert(worldPolys != nullptr);
+
+    // NOTE: No GL calls in here! This function might be running on a worker thread.
+    const auto buildStartTime = std::chrono::high_resolution_clock::now();
+
     // Polygons are actually triangles for our demo.
     world->preAllocVertexes(worldPolyCount * 3);
     world->bspRoot = world->allocBspNode();
 
     for (int p = 0; p < worldPolyCount; ++p)
     {
-        // Add a polygon:
-        Polygon * newPoly    = world->allocPolygon();
-        newPoly->firstVertex = world->getVertexCount();
-        newPoly->vertexCount = 3;
-        world->bspRoot->polygons.push_back(newPoly);
-
-        // Add the vertexes:
-        GLDrawVertex verts[3];
-        const Triangle & poly = worldPolys[p];
-        for (int v = 0; v < 3; ++v)
-        {
-            verts[v].px = poly.verts[v][0];
-            verts[v].py = poly.verts[v][1];
-            verts[v].pz = poly.verts[v][2];
-            verts[v].r  = bc[v][0];
-            verts[v].g  = bc[v][1];
-            verts[v].b  = bc[v][2];
-            verts[v].a  = 1.0f;
-            verts[v].u  = poly.verts[v][3];
-            verts[v].v  = poly.verts[v][4];
-
-            // Unused for now.
-            verts[v].tx = 0.0f;
-            verts[v].ty = 0.0f;
-            verts[v].tz = 0.0f;
-            verts[v].bx = 0.0f;
-            verts[v].by = 0.0f;
-            verts[v].bz = 0.0f;
-        }
-
-        newPoly->plane.fromPoints(
-                Vec3{ verts[0].px, verts[0].py, verts[0].pz },
-                Vec3{ verts[1].px, verts[1].py, verts[1].pz },
-                Vec3{ verts[2].px, verts[2].py, verts[2].pz });
-
-        // The plane normal is used as the triangle normal for lighting.
-        const Vec3 n = newPoly->plane.normal;
-        for (int v = 0; v < 3; ++v)
-        {
-            verts[v].nx = n[0];
-            verts[v].ny = n[1];
-            verts[v].nz = n[2];
-            world->addVertex(verts[v]);
-        }
+        world->bspRoot->polygons.push_back(addWorldTriangle(world, worldPolys[p], p));
     }
+    world->nextPolygonId = worldPolyCount;
 
     world->computeBounds();
 
-    // Reset debug stats counters:
-    g_nPolysOnPlane   = 0;
-    g_nPolysBackSide  = 0;
-    g_nPolysFrontSide = 0;
-    g_nPolysSpanning  = 0;
+    // Reset build stats counters:
+    world->buildStats = BuildStats{};
 
     // Construct the BSP three:
-    if (g_bBuildBspTree)
+    if (buildBspTree)
     {
         buildBspTreeRecursive(world, world->bspRoot);
         buildPortals(world);
         addDebugPortals(world);
+        world->buildStats.treeDepth = computeBspTreeDepth(world->bspRoot);
     }
 
+    const auto buildEndTime = std::chrono::high_resolution_clock::now();
+    world->buildStats.buildTimeMs = std::chrono::duration<double, std::milli>(buildEndTime - buildStartTime).count();
+}
+
+void setDebugCountersFromBuild(const RenderData & world)
+{
+    g_nPolysOnPlane   = world.buildStats.polysOnPlane;
+    g_nPolysBackSide  = world.buildStats.polysBackSide;
+    g_nPolysFrontSide = world.buildStats.polysFrontSide;
+    g_nPolysSpanning  = world.buildStats.polysSpanning;
+}
+
+void createFromPolygons(RenderData * world, const Triangle * worldPolys, const int worldPolyCount)
+{
+    buildFromPolygons(world, worldPolys, worldPolyCount, g_bBuildBspTree);
+    setDebugCountersFromBuild(*world);
+
     // Send the GL render data to the GPU.
     world->submitGLVertexArray();
     world->loadTextures();
     world->loadShaders();
 }
 
-bool createFromDatafile(RenderData * world, const char * const filename, const float scale)
+bool loadDatafilePolygons(const char * const filename, const float scale, std::vector<Triangle> * outPolys)
 {
+    assert(filename != nullptr);
+    assert(outPolys != nullptr);
+
     FILE * fileIn = std::fopen(filename, "rt");
     if (fileIn == nullptr)
     {
@@ -1718,8 +1887,8 @@ bool createFromDatafile(RenderData * world, const char * const filename, const f
 
     Triangle poly;
     int polysRead;
-    std::vector<Triangle> worldPolys;
-    worldPolys.reserve(polyCount);
+    outPolys->clear();
+    outPolys->reserve(polyCount);
 
     for (polysRead = 0; polysRead < polyCount && !std::feof(fileIn); ++polysRead)
     {
@@ -1740,19 +1909,572 @@ bool createFromDatafile(RenderData * world, const char * const filename, const f
             poly.verts[v][1] *= scale;
             poly.verts[v][2] *= scale;
         }
-        worldPolys.push_back(poly);
+        outPolys->push_back(poly);
     }
     std::fclose(fileIn);
 
-    if (polysRead != polyCount) // Check for a truncated file
+    // Check for a truncated file
+    return polysRead == polyCount;
+}
+
+bool createFromDatafile(RenderData * world, const char * const filename, const float scale)
+{
+    std::vector<Triangle> worldPolys;
+    if (!loadDatafilePolygons(filename, scale, &worldPolys))
     {
         return false;
     }
-    else
+
+    createFromPolygons(world, worldPolys.data(), worldPolys.size());
+    return true;
+}
+
+// ========================================================
+// Incremental BSP editing:
+// ========================================================
+
+template<typename T>
+static bool containsItem(const std::vector<T> & items, const T & item)
+{
+    return std::find(items.begin(), items.end(), item) != items.end();
+}
+
+static double millisecondsSince(const std::chrono::high_resolution_clock::time_point start)
+{
+    const auto now = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(now - start).count();
+}
+
+static bool isInsideBounds(const Bounds & bounds, const Vec3 & point)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        if (point[i] < bounds.mins[i] || point[i] > bounds.maxs[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void insertPolygonRecursive(RenderData * world, Polygon * poly, BspNode * node, std::vector<BspNode *> * outTouchedLeaves)
+{
+    // Same classification buildBspTreeRecursive() does, but the polygon is only
+    // pushed down the existing partitions until it reaches the leaves.
+    if (node->isLeaf)
+    {
+        node->polygons.push_back(poly);
+        if (!containsItem(*outTouchedLeaves, node))
+        {
+            outTouchedLeaves->push_back(node);
+        }
+        return;
+    }
+
+    const auto side = node->partition.classifyPolygon(*poly, world->vertexes);
+    switch (side)
+    {
+    case OnPlane :
+        // Check the direction of the normal vector:
+        if (node->partition.classifyPoint(poly->plane.normal) == BackSide)
+        {
+            insertPolygonRecursive(world, poly, node->backNode, outTouchedLeaves);
+        }
+        else
+        {
+            insertPolygonRecursive(world, poly, node->frontNode, outTouchedLeaves);
+        }
+        ++world->buildStats.polysOnPlane;
+        break;
+
+    case BackSide :
+        insertPolygonRecursive(world, poly, node->backNode, outTouchedLeaves);
+        ++world->buildStats.polysBackSide;
+        break;
+
+    case FrontSide :
+        insertPolygonRecursive(world, poly, node->frontNode, outTouchedLeaves);
+        ++world->buildStats.polysFrontSide;
+        break;
+
+    case Spanning :
+        {
+            PolygonList frontList;
+            PolygonList backList;
+            splitTriangle(world, *poly, node->partition, &frontList, &backList);
+            world->freePolygon(poly);
+            ++world->buildStats.polysSpanning;
+
+            while ((poly = frontList.pop_front()) != nullptr)
+            {
+                insertPolygonRecursive(world, poly, node->frontNode, outTouchedLeaves);
+            }
+            while ((poly = backList.pop_front()) != nullptr)
+            {
+                insertPolygonRecursive(world, poly, node->backNode, outTouchedLeaves);
+            }
+            break;
+        }
+
+    default :
+        assert(false);
+        break;
+    } // switch (side)
+}
+
+void removePolygonsFromList(RenderData * world, PolygonList * polygons, const std::vector<int> & sortedIds, int * outRemoved)
+{
+    Polygon * poly = polygons->first();
+    int polysLeft  = polygons->size();
+    while (polysLeft > 0)
+    {
+        if (!std::binary_search(sortedIds.begin(), sortedIds.end(), poly->sourceId))
+        {
+            poly = poly->next;
+            --polysLeft;
+            continue;
+        }
+
+        // Collapse the vertexes so the unindexed (no-BSP) draw path stops drawing it.
+        // The storage is only reclaimed by a full rebuild.
+        for (int v = 1; v < poly->vertexCount; ++v)
+        {
+            world->vertexes[poly->firstVertex + v] = world->vertexes[poly->firstVertex];
+        }
+
+        Polygon * toRemove = poly;
+        poly = poly->next;
+        --polysLeft;
+
+        polygons->remove(toRemove);
+        world->freePolygon(toRemove);
+        (*outRemoved) += 1;
+    }
+}
+
+bool findNodePathRecursive(BspNode * node, const BspNode * target, std::vector<BspNode *> * outPath)
+{
+    if (node == target)
+    {
+        return true;
+    }
+    if (node->isLeaf)
+    {
+        return false;
+    }
+
+    outPath->push_back(node);
+    if (findNodePathRecursive(node->frontNode, target, outPath) ||
+        findNodePathRecursive(node->backNode,  target, outPath))
     {
-        createFromPolygons(world, worldPolys.data(), worldPolys.size());
         return true;
     }
+    outPath->pop_back();
+    return false;
+}
+
+void freeBspSubtreeRecursive(RenderData * world, BspNode * node, PolygonList * outPolygons)
+{
+    // Frees the nodes and their portals, moving the polygons to 'outPolygons'.
+    if (node == nullptr)
+    {
+        return;
+    }
+
+    freeBspSubtreeRecursive(world, node->frontNode, outPolygons);
+    freeBspSubtreeRecursive(world, node->backNode,  outPolygons);
+
+    Polygon * poly;
+    while ((poly = node->polygons.pop_front()) != nullptr)
+    {
+        outPolygons->push_back(poly);
+    }
+
+    Portal * portal;
+    while ((portal = node->portals.pop_front()) != nullptr)
+    {
+        world->freePortal(portal);
+    }
+
+    world->freeBspNode(node);
+}
+
+void renumberBspNodes(RenderData * world)
+{
+    world->bspPartitionNodes.clear();
+    world->bspLeafNodes.clear();
+    gatherBspNodeLists(world->bspRoot, &world->bspPartitionNodes, &world->bspLeafNodes);
+
+    world->bspPartitionCount = 0;
+    for (BspNode * node : world->bspPartitionNodes)
+    {
+        node->id = ++world->bspPartitionCount;
+    }
+
+    world->bspLeafCount = 0;
+    for (BspNode * node : world->bspLeafNodes)
+    {
+        node->id = ++world->bspLeafCount;
+    }
+}
+
+void rebuildBspTreeFull(RenderData * world)
+{
+    // Used when an incremental update is not possible or the tree got too deep.
+    // Rebuilds from the current polygon fragments and compacts the vertex array.
+    PolygonList allPolygons;
+    freeBspSubtreeRecursive(world, world->bspRoot, &allPolygons);
+
+    std::vector<GLDrawVertex> oldVertexes;
+    oldVertexes.swap(world->vertexes);
+    world->preAllocVertexes(allPolygons.size() * 3);
+
+    world->bspRoot = world->allocBspNode();
+    Polygon * poly;
+    while ((poly = allPolygons.pop_front()) != nullptr)
+    {
+        const int firstVertex = poly->firstVertex;
+        poly->firstVertex = world->getVertexCount();
+        for (int v = 0; v < poly->vertexCount; ++v)
+        {
+            world->addVertex(oldVertexes[firstVertex + v]);
+        }
+        world->bspRoot->polygons.push_back(poly);
+    }
+
+    world->bspPartitionNodes.clear();
+    world->bspLeafNodes.clear();
+    world->bspPartitionCount = 0;
+    world->bspLeafCount      = 0;
+
+    world->computeBounds();
+    buildBspTreeRecursive(world, world->bspRoot);
+    buildPortals(world);
+    addDebugPortals(world);
+    world->buildStats.treeDepth = computeBspTreeDepth(world->bspRoot);
+}
+
+void regeneratePortals(RenderData * world, const std::vector<BspNode *> & rebuiltSubtrees, EditStats * stats)
+{
+    //
+    // Portals can only change on the boundary of the rebuilt subtrees (the partition
+    // planes of their ancestors) and inside of them (their own new partitions), so
+    // those are the only planes that get new large portals. Potential portals that
+    // end up connecting only leaves outside of the rebuilt subtrees are duplicates
+    // of the existing ones and are discarded.
+    //
+    std::vector<BspNode *> portalPlaneNodes;
+    std::vector<bool> leafWasRebuilt(world->bspLeafCount + 1, false);
+
+    for (BspNode * subtreeRoot : rebuiltSubtrees)
+    {
+        std::vector<BspNode *> path;
+        const bool found = findNodePathRecursive(world->bspRoot, subtreeRoot, &path);
+        assert(found); (void)found;
+
+        std::vector<BspNode *> subtreeLeaves;
+        gatherBspNodeLists(subtreeRoot, &path, &subtreeLeaves);
+
+        for (BspNode * node : path)
+        {
+            if (!containsItem(portalPlaneNodes, node))
+            {
+                portalPlaneNodes.push_back(node);
+            }
+        }
+        for (const BspNode * leaf : subtreeLeaves)
+        {
+            leafWasRebuilt[leaf->id] = true;
+        }
+    }
+
+    stats->portalPlanes = portalPlaneNodes.size();
+    if (portalPlaneNodes.empty())
+    {
+        return; // Single leaf tree, no portals.
+    }
+
+    // New ids must not clash with the portals we are keeping.
+    int maxPortalId = 0;
+    std::vector<int> firstNewPortal(world->bspLeafCount + 1, 0);
+    for (const BspNode * leaf : world->bspLeafNodes)
+    {
+        const Portal * portal = leaf->portals.first();
+        for (int i = leaf->portals.size(); i--; portal = portal->next)
+        {
+            maxPortalId = std::max(maxPortalId, portal->id);
+        }
+        firstNewPortal[leaf->id] = leaf->portals.size();
+    }
+
+    PortalList newPortals;
+    makePotentialPortals(world, portalPlaneNodes, &newPortals);
+
+    const int firstNewId = maxPortalId + 1;
+    int portalId = maxPortalId;
+    Portal * portal = newPortals.first();
+    for (int i = newPortals.size(); i--; portal = portal->next)
+    {
+        portal->id = ++portalId;
+    }
+
+    addPortalsToBspLeaves(world, &newPortals);
+
+    // Keep only the ids that touch a rebuilt leaf:
+    std::vector<bool> keepPortalId(portalId - maxPortalId, false);
+    for (const BspNode * leaf : world->bspLeafNodes)
+    {
+        if (!leafWasRebuilt[leaf->id])
+        {
+            continue;
+        }
+        const Portal * newPortal = getNthPortal(leaf->portals, firstNewPortal[leaf->id]);
+        for (int i = leaf->portals.size() - firstNewPortal[leaf->id]; i--; newPortal = newPortal->next)
+        {
+            keepPortalId[newPortal->id - firstNewId] = true;
+        }
+    }
+    for (BspNode * leaf : world->bspLeafNodes)
+    {
+        portal = getNthPortal(leaf->portals, firstNewPortal[leaf->id]);
+        int portalsLeft = leaf->portals.size() - firstNewPortal[leaf->id];
+        while (portalsLeft > 0)
+        {
+            Portal * toCheck = portal;
+            portal = portal->next;
+            --portalsLeft;
+
+            if (!keepPortalId[toCheck->id - firstNewId])
+            {
+                leaf->portals.remove(toCheck);
+                world->freePortal(toCheck);
+            }
+        }
+    }
+
+    // And resolve the survivors just like a full build would:
+    for (BspNode * leaf : world->bspLeafNodes)
+    {
+        const int newCount = leaf->portals.size() - firstNewPortal[leaf->id];
+        if (newCount > 0)
+        {
+            findTruePortalsInLeaf(world, leaf, firstNewPortal[leaf->id]);
+            stats->portalsAdded += leaf->portals.size() - firstNewPortal[leaf->id];
+        }
+    }
+}
+
+void gatherWorldPolygons(const RenderData & world, std::vector<const Polygon *> * outPolys)
+{
+    assert(outPolys != nullptr);
+    outPolys->clear();
+
+    auto addPolygonList = [outPolys](const PolygonList & polygons)
+    {
+        const Polygon * poly = polygons.first();
+        for (int i = polygons.size(); i--; poly = poly->next)
+        {
+            outPolys->push_back(poly);
+        }
+    };
+
+    if (world.hasBspTree())
+    {
+        for (const BspNode * leaf : world.bspLeafNodes)
+        {
+            addPolygonList(leaf->polygons);
+        }
+    }
+    else if (world.bspRoot != nullptr)
+    {
+        addPolygonList(world.bspRoot->polygons);
+    }
+}
+
+void extractTriangles(const RenderData & world, std::vector<Triangle> * outPolys)
+{
+    assert(outPolys != nullptr);
+
+    std::vector<const Polygon *> worldPolys;
+    gatherWorldPolygons(world, &worldPolys);
+
+    outPolys->clear();
+    outPolys->reserve(worldPolys.size());
+
+    for (const Polygon * poly : worldPolys)
+    {
+        Triangle tri;
+        for (int v = 0; v < 3; ++v)
+        {
+            const GLDrawVertex & dv = world.vertexes[poly->firstVertex + v];
+            tri.verts[v][0] = dv.px;
+            tri.verts[v][1] = dv.py;
+            tri.verts[v][2] = dv.pz;
+            tri.verts[v][3] = dv.u;
+            tri.verts[v][4] = dv.v;
+        }
+        outPolys->push_back(tri);
+    }
+}
+
+EditStats applyPolygonEdits(RenderData * world, PolygonEdit * edits, const int editCount, const EditOptions & options)
+{
+    assert(world != nullptr);
+    assert(world->bspRoot != nullptr);
+    assert(edits != nullptr);
+
+    // NOTE: No GL calls in here. Call RenderData::updateGLVertexArray() afterwards.
+    const auto editStartTime = std::chrono::high_resolution_clock::now();
+    EditStats stats;
+
+    // Debug portal vertexes always sit at the end of the vertex array. Drop them now and
+    // re-add after the edit, so new geometry doesn't end up mixed with them.
+    if (world->debugPortalsVertCount > 0)
+    {
+        world->vertexes.resize(world->debugFirstPortalVert);
+        world->debugFirstPortalVert  = 0;
+        world->debugPortalsVertCount = 0;
+    }
+
+    // Removed and modified polygons go first:
+    std::vector<int> removedIds;
+    for (int e = 0; e < editCount; ++e)
+    {
+        if (edits[e].type != PolygonEdit::Insert)
+        {
+            removedIds.push_back(edits[e].polyId);
+        }
+    }
+    std::sort(removedIds.begin(), removedIds.end());
+
+    std::vector<BspNode *> touchedLeaves;
+    if (!removedIds.empty())
+    {
+        if (world->hasBspTree())
+        {
+            for (BspNode * leaf : world->bspLeafNodes)
+            {
+                const int polysRemovedBefore = stats.polysRemoved;
+                removePolygonsFromList(world, &leaf->polygons, removedIds, &stats.polysRemoved);
+                if (stats.polysRemoved != polysRemovedBefore)
+                {
+                    touchedLeaves.push_back(leaf);
+                }
+            }
+        }
+        else
+        {
+            removePolygonsFromList(world, &world->bspRoot->polygons, removedIds, &stats.polysRemoved);
+        }
+    }
+
+    // Then the new geometry is pushed down the existing partitions:
+    bool needFullRebuild = false;
+    for (int e = 0; e < editCount; ++e)
+    {
+        if (edits[e].type == PolygonEdit::Remove)
+        {
+            continue;
+        }
+        if (edits[e].type == PolygonEdit::Insert)
+        {
+            edits[e].polyId = world->nextPolygonId++;
+        }
+
+        Polygon * newPoly = addWorldTriangle(world, edits[e].triangle, edits[e].polyId);
+        ++stats.polysInserted;
+
+        // The existing large portals were sized to the old world bounds.
+        for (int v = 0; v < 3; ++v)
+        {
+            if (!isInsideBounds(world->bounds, newPoly->getVertexCoord(v, world->vertexes)))
+            {
+                needFullRebuild = true;
+            }
+        }
+
+        if (world->hasBspTree())
+        {
+            insertPolygonRecursive(world, newPoly, world->bspRoot, &touchedLeaves);
+        }
+        else
+        {
+            world->bspRoot->polygons.push_back(newPoly);
+        }
+    }
+
+    if (!world->hasBspTree())
+    {
+        // Nothing else to do for the unpartitioned world.
+        world->computeBounds();
+        stats.editTimeMs = millisecondsSince(editStartTime);
+        return stats;
+    }
+
+    stats.leavesTouched = touchedLeaves.size();
+    if (needFullRebuild)
+    {
+        rebuildBspTreeFull(world);
+        stats.fullRebuild = true;
+    }
+    else if (!touchedLeaves.empty())
+    {
+        // Portals pointing to a touched leaf are gone, the ones inside it too.
+        for (BspNode * leaf : world->bspLeafNodes)
+        {
+            const bool isTouched = containsItem(touchedLeaves, leaf);
+
+            Portal * portal = leaf->portals.first();
+            int portalsLeft = leaf->portals.size();
+            while (portalsLeft > 0)
+            {
+                Portal * toCheck = portal;
+                portal = portal->next;
+                --portalsLeft;
+
+                if (isTouched || containsItem(touchedLeaves, toCheck->backLeaf) ||
+                                 containsItem(touchedLeaves, toCheck->frontLeaf))
+                {
+                    leaf->portals.remove(toCheck);
+                    world->freePortal(toCheck);
+                    ++stats.portalsRemoved;
+                }
+            }
+        }
+
+        // Re-split each touched leaf in place. The leaf node becomes the root of a new subtree.
+        for (BspNode * leaf : touchedLeaves)
+        {
+            leaf->isLeaf = false;
+            buildBspTreeRecursive(world, leaf);
+        }
+
+        renumberBspNodes(world);
+
+        const int treeDepth = computeBspTreeDepth(world->bspRoot);
+        if (options.allowRebalance && world->buildStats.treeDepth > 0 &&
+            treeDepth > world->buildStats.treeDepth * options.rebalanceThreshold)
+        {
+            rebuildBspTreeFull(world);
+            stats.fullRebuild = true;
+            stats.rebalanced  = true;
+        }
+        else
+        {
+            regeneratePortals(world, touchedLeaves, &stats);
+            addDebugPortals(world);
+        }
+    }
+    else
+    {
+        addDebugPortals(world);
+    }
+
+    world->bspPortalCount = 0;
+    countPortalsRecursive(world->bspRoot, &world->bspPortalCount);
+
+    stats.editTimeMs = millisecondsSince(editStartTime);
+    return stats;
 }
 
 } // namespace World {}
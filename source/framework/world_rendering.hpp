@@ -100,6 +100,7 @@ struct Polygon final
     //
     int  firstVertex = 0; // First vertex in the world's vertex list.
     int  vertexCount = 0; // Number of verts for this polygon, starting from firstVertex.
+    int  sourceId    = 0; // Index of the input triangle. Fragments produced by splitting share it.
     bool isTriangle() const noexcept { return vertexCount == 3; }
 
     //
@@ -168,6 +169,25 @@ struct BspNode final
 
 using BspNodePool = Pool<BspNode, 256>;
 
+struct BuildStats final
+{
+    // Polygon classification counts gathered while building the BSP tree.
+    int polysOnPlane    = 0;
+    int polysBackSide   = 0;
+    int polysFrontSide  = 0;
+    int polysSpanning   = 0;
+    int treeDepth       = 0;   // Depth of the tree after the last full build. Baseline for rebalancing.
+    double buildTimeMs  = 0.0; // Wall-clock time of the CPU-side build (BSP + portals).
+};
+
+struct PoolStats final
+{
+    // Memory reports of the world's object pools.
+    PoolMemoryStats polygons;
+    PoolMemoryStats bspNodes;
+    PoolMemoryStats portals;
+};
+
 // ========================================================
 // World RenderData:
 // ========================================================
@@ -201,9 +221,11 @@ public:
     int                       bspPortalCount;
     int                       bspLeafCount;
     int                       bspPartitionCount;
+    int                       nextPolygonId;
     std::vector<BspNode *>    bspPartitionNodes;
     std::vector<BspNode *>    bspLeafNodes;
     Bounds                    bounds;
+    BuildStats                buildStats;
 
     explicit RenderData(GLFWApp & owner);
     RenderData(const RenderData & other) = delete; // Not copyable.
@@ -281,16 +303,90 @@ public:
     // Miscellaneous:
     //
     void submitGLVertexArray();
+    void updateGLVertexArray(); // Re-upload after an incremental edit.
     void loadShaders();
     void loadTextures();
     void computeBounds();
     void cleanup();
+
+    // The root node is always allocated, so test the leaves instead.
+    bool hasBspTree() const noexcept { return bspLeafCount > 0; }
+
+    // Approximate system memory held by this world (vertexes, pools and node lists).
+    std::size_t getMemoryFootprint() const noexcept;
+
+    // The BSP and portal builds free many temporary polygons and portals.
+    // shrinkPools() gives the pool blocks left empty back to the system and
+    // returns the number of bytes freed.
+    PoolStats getPoolStats() const;
+    std::size_t shrinkPools();
+
+    // Moves the polygon, node and portal pools to page-backed storage.
+    // Must be called before anything is built (or after cleanup()).
+    void usePageBackedPools(const PageAllocator::Options & opts);
 };
 
 // World loading:
 void createFromPolygons(RenderData * world, const Triangle * worldPolys, int worldPolyCount);
 bool createFromDatafile(RenderData * world, const char * filename, float scale = 1.0f);
 
+// Split loading: The CPU-side build (vertexes, BSP, portals) issues no GL calls and may run on
+// a worker thread. The GL resources must then be created on the main thread with submitGLVertexArray(),
+// loadTextures() and loadShaders(). 'createFromPolygons()' does both steps back-to-back.
+bool loadDatafilePolygons(const char * filename, float scale, std::vector<Triangle> * outPolys);
+void buildFromPolygons(RenderData * world, const Triangle * worldPolys, int worldPolyCount, bool buildBspTree);
+
+// Copies the world's build stats into the global debug counters.
+void setDebugCountersFromBuild(const RenderData & world);
+
+// ========================================================
+// Incremental world editing:
+// ========================================================
+
+struct PolygonEdit final
+{
+    enum Type { Insert, Remove, Modify };
+
+    Type     type     = Insert;
+    int      polyId   = 0;  // Polygon::sourceId. Written back with the new id for an Insert.
+    Triangle triangle = {}; // New geometry. Unused by Remove.
+};
+
+struct EditOptions final
+{
+    // Rebuild the whole tree when its depth grows past 'rebalanceThreshold'
+    // times the depth it had after the last full build.
+    bool  allowRebalance     = true;
+    float rebalanceThreshold = 1.5f;
+};
+
+struct EditStats final
+{
+    int    polysInserted  = 0;
+    int    polysRemoved   = 0; // Fragments, so can be more than the removal count.
+    int    leavesTouched  = 0; // Leaves re-split in place.
+    int    portalPlanes   = 0; // Partition planes that had their portals regenerated.
+    int    portalsRemoved = 0;
+    int    portalsAdded   = 0;
+    bool   fullRebuild    = false; // Bounds grew or the tree was rebalanced.
+    bool   rebalanced     = false;
+    double editTimeMs     = 0.0;
+};
+
+// Inserts, removes or modifies a batch of polygons in an already built world.
+// Only the leaves the edits land in are re-split, and only the portals on their
+// boundary and inside of them are regenerated. The PVS is computed per frame from
+// the portals, so it needs no invalidation. CPU side only, no GL calls; call
+// RenderData::updateGLVertexArray() after it to see the changes.
+EditStats applyPolygonEdits(RenderData * world, PolygonEdit * edits, int editCount,
+                            const EditOptions & options = EditOptions{});
+
+// Gathers all current polygon fragments of the world as triangles.
+void extractTriangles(const RenderData & world, std::vector<Triangle> * outPolys);
+
+// Gathers the polygons of the world. From the BSP leaves if there's a tree, from the root otherwise.
+void gatherWorldPolygons(const RenderData & world, std::vector<const Polygon *> * outPolys);
+
 // Potentially Visible Set (PVS):
 int countVisibleLeaves(const RenderData & world);
 BspNode * findLeafRecursive(const Vec3 & referencePosition, BspNode * node);
@@ -299,6 +395,10 @@ void computePotentiallyVisibleSet(const Vec3 & eye, const Frustum & frustum, Bsp
 // World rendering:
 void render(RenderData * world, const Vec3 & eyePosition, const Mat4 & viewMatrix, const Mat4 & mvpMatrix);
 
+// Renders a list of polygons gathered by some other spatial index, in the given order.
+void renderPolygons(RenderData * world, const Polygon * const * polys, int polyCount,
+                    const Mat4 & viewMatrix, const Mat4 & mvpMatrix);
+
 // ========================================================
 // Global configuration parameters and debug counters:
 // ========================================================
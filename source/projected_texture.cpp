@@ -13,6 +13,8 @@
 
 #include "framework/gl_utils.hpp"
 
+#include <cstdio>
+
 // App constants:
 constexpr int numOfLights      = 2;
 constexpr int initialWinWidth  = 800;
@@ -72,10 +74,14 @@ ProjectedSpotlight::ProjectedSpotlight(GLFWApp & owner, GLShaderProg & shader,
                                     /* mipmaps = */ true,
                                     /* texUnit = */ lightNum + 1); // tmu:0 is already taken by the base texture(s), so +1
 
-    const auto lightNumStr  = std::to_string(lightNum);
-    lightCookieTexLocation  = shaderProg.getUniformLocation("u_ProjectedTexture[" + lightNumStr + "]");
-    lightProjMatrixLocation = shaderProg.getUniformLocation("u_LightProjectionMatrix[" + lightNumStr + "]");
-    lightPosLocation        = shaderProg.getUniformLocation("u_LightPositionModelSpace[" + lightNumStr + "]");
+    // Uniform array element names, formatted in a stack buffer.
+    char uniformName[128];
+    std::snprintf(uniformName, sizeof(uniformName), "u_ProjectedTexture[%i]", lightNum);
+    lightCookieTexLocation  = shaderProg.getUniformLocation(uniformName);
+    std::snprintf(uniformName, sizeof(uniformName), "u_LightProjectionMatrix[%i]", lightNum);
+    lightProjMatrixLocation = shaderProg.getUniformLocation(uniformName);
+    std::snprintf(uniformName, sizeof(uniformName), "u_LightPositionModelSpace[%i]", lightNum);
+    lightPosLocation        = shaderProg.getUniformLocation(uniformName);
 
     // Initial positions:
     lightWorldPosition  = initialPos;
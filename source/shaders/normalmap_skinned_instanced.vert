@@ -0,0 +1,149 @@
+
+/* -------------------------------------------------------------
+ * Normal-mapping GLSL Vertex Shader with GPU skinning and
+ * instancing. Same as normalmap_skinned.vert, with the skinned
+ * vertex placed by the matrix of each instance, like in
+ * normalmap_instanced.vert. All instances share the pose.
+ * ------------------------------------------------------------- */
+
+// NOTE: We have the same constants in the C++ code, so they must match!!!
+const int MaxLights    = 2;
+const int MaxJoints    = 128;
+const int MaxInstances = 256;
+
+// Light types (GLSL lacks enum unfortunately), matching the C++ values:
+const int LightType_Point      = 0;
+const int LightType_Flashlight = 1;
+
+// Vertex inputs/attributes (bind pose):
+layout(location = 0) in vec3 in_Position;
+layout(location = 1) in vec3 in_Normal;
+layout(location = 2) in vec4 in_Color;
+layout(location = 3) in vec2 in_TexCoords;
+layout(location = 4) in vec3 in_Tangent;
+layout(location = 5) in vec3 in_BiTangent;
+
+// Skinning weights. Each is the joint space position * bias in xyz and the bias in w:
+layout(location = 6)  in uvec4 in_Joints;
+layout(location = 7)  in vec4  in_Weight0;
+layout(location = 8)  in vec4  in_Weight1;
+layout(location = 9)  in vec4  in_Weight2;
+layout(location = 10) in vec4  in_Weight3;
+
+// Varyings:
+layout(location = 0) out vec4 v_Color;                           // Forwarded vertex color.
+layout(location = 1) out vec2 v_TexCoords;                       // Forwarded vertex texture coordinates.
+layout(location = 2) out vec3 v_VertexPosModelSpace;             // Vertex position in the space of the instance matrices.
+layout(location = 3) out vec3 v_ViewDirTangentSpace;             // Tangent-space view direction.
+layout(location = 4) out vec3 v_LightDirTangentSpace[MaxLights]; // Tangent-space light direction (slots 4 & 5).
+layout(location = 6) out vec4 v_LightProjTexCoords[MaxLights];   // Takes slots 6 & 7.
+
+// Uniform variables:
+uniform mat4 u_MvpMatrix;
+uniform vec3 u_EyePosModelSpace;
+
+// Light vars:
+uniform int  u_NumOfLights;
+uniform int  u_LightType[MaxLights];
+uniform vec3 u_LightPosModelSpace[MaxLights];
+uniform mat4 u_LightProjectionMatrix[MaxLights];
+
+// Joints of the current pose, 3 rows per joint:
+layout(std140) uniform JointMatrices
+{
+    vec4 u_JointMatrices[MaxJoints * 3];       // Joint space to model space, scale included.
+    vec4 u_JointNormalMatrices[MaxJoints * 3]; // Rotation from the bind pose (w unused).
+};
+
+// Model to "model space" of the draw (where the eye and lights are) of each instance, 3 rows per instance:
+layout(std140) uniform InstanceMatrices
+{
+    vec4 u_InstanceMatrices[MaxInstances * 3];
+};
+
+// ========================================================
+// Skinning helpers:
+// ========================================================
+
+vec3 skinPosition(uint joint, vec4 weight)
+{
+    uint row = joint * 3u;
+    return vec3(dot(u_JointMatrices[row + 0u], weight),
+                dot(u_JointMatrices[row + 1u], weight),
+                dot(u_JointMatrices[row + 2u], weight));
+}
+
+mat3 skinRotation(uint joint, float bias)
+{
+    uint row = joint * 3u;
+    // Rows to GLSL's column-major: transpose.
+    return transpose(mat3(u_JointNormalMatrices[row + 0u].xyz,
+                          u_JointNormalMatrices[row + 1u].xyz,
+                          u_JointNormalMatrices[row + 2u].xyz)) * bias;
+}
+
+// ========================================================
+// main():
+// ========================================================
+
+void main()
+{
+    // Weights are premultiplied by their bias, so the position is just a sum.
+    vec3 position = skinPosition(in_Joints.x, in_Weight0) +
+                    skinPosition(in_Joints.y, in_Weight1) +
+                    skinPosition(in_Joints.z, in_Weight2) +
+                    skinPosition(in_Joints.w, in_Weight3);
+
+    // Tangent basis: the bind pose vectors rotated by the blended joint rotations.
+    mat3 rotation = skinRotation(in_Joints.x, in_Weight0.w) +
+                    skinRotation(in_Joints.y, in_Weight1.w) +
+                    skinRotation(in_Joints.z, in_Weight2.w) +
+                    skinRotation(in_Joints.w, in_Weight3.w);
+
+    // Rows to GLSL's column-major: transpose. The instance matrices are
+    // rotation + translation (+ uniform scale), so they also move the tangent basis.
+    int row = gl_InstanceID * 3;
+    mat4x3 instance = transpose(mat3x4(u_InstanceMatrices[row + 0],
+                                       u_InstanceMatrices[row + 1],
+                                       u_InstanceMatrices[row + 2]));
+
+    position = instance * vec4(position, 1.0);
+    rotation = mat3(instance) * rotation;
+
+    vec3 normal    = normalize(rotation * in_Normal);
+    vec3 tangent   = normalize(rotation * in_Tangent);
+    vec3 biTangent = normalize(rotation * in_BiTangent);
+
+    // Pass on unchanged:
+    v_Color = in_Color;
+    v_TexCoords = in_TexCoords;
+    v_VertexPosModelSpace = position;
+
+    // Transform vertex position to clip-space for GL:
+    gl_Position = u_MvpMatrix * vec4(position, 1.0);
+
+    // Transform view direction into tangent space:
+    vec3 viewDir = u_EyePosModelSpace - position;
+    v_ViewDirTangentSpace = vec3(dot(tangent,   viewDir),
+                                 dot(biTangent, viewDir),
+                                 dot(normal,    viewDir));
+
+    // Set up the light data for each light source:
+    for (int l = 0; l < u_NumOfLights; ++l)
+    {
+        if (u_LightType[l] == LightType_Point)
+        {
+            // Transform light direction into tangent space:
+            vec3 lightDir = u_LightPosModelSpace[l] - position;
+            v_LightDirTangentSpace[l] = vec3(dot(tangent, lightDir),
+                                             dot(biTangent, lightDir),
+                                             dot(normal, lightDir));
+        }
+        else if (u_LightType[l] == LightType_Flashlight)
+        {
+            // Transform vertex position into projective texture space.
+            // This matrix combines the light view, projection and bias matrices.
+            v_LightProjTexCoords[l] = u_LightProjectionMatrix[l] * vec4(position, 1.0);
+        }
+    }
+}
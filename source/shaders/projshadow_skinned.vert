@@ -0,0 +1,54 @@
+
+/* -------------------------------------------------------------
+ * Plane-projected-shadow GLSL Vertex Shader with GPU skinning.
+ * See normalmap_skinned.vert for the skinning inputs.
+ * ------------------------------------------------------------- */
+
+// NOTE: We have the same constant in the C++ code, so they must match!!!
+const int MaxJoints = 128;
+
+layout(location = 6)  in uvec4 in_Joints;
+layout(location = 7)  in vec4  in_Weight0;
+layout(location = 8)  in vec4  in_Weight1;
+layout(location = 9)  in vec4  in_Weight2;
+layout(location = 10) in vec4  in_Weight3;
+
+layout(location = 0) out vec4 v_ShadowColor;
+
+uniform mat4 u_MvpMatrix;
+uniform vec3 u_LightPosModelSpace;
+uniform vec4 u_ShadowParams; // x=shadow falloff; y=shadow opacity; zw=unused.
+
+layout(std140) uniform JointMatrices
+{
+    vec4 u_JointMatrices[MaxJoints * 3];
+    vec4 u_JointNormalMatrices[MaxJoints * 3]; // Not used here.
+};
+
+vec3 skinPosition(uint joint, vec4 weight)
+{
+    uint row = joint * 3u;
+    return vec3(dot(u_JointMatrices[row + 0u], weight),
+                dot(u_JointMatrices[row + 1u], weight),
+                dot(u_JointMatrices[row + 2u], weight));
+}
+
+void main()
+{
+    vec3 position = skinPosition(in_Joints.x, in_Weight0) +
+                    skinPosition(in_Joints.y, in_Weight1) +
+                    skinPosition(in_Joints.z, in_Weight2) +
+                    skinPosition(in_Joints.w, in_Weight3);
+
+    gl_Position = u_MvpMatrix * vec4(position, 1.0);
+
+    // Same idea behind the flashlight falloff effect.
+    // We fade the shadow away based on its distance from the light source.
+    float dist = length(u_LightPosModelSpace - position) * u_ShadowParams.x;
+
+    // Ensure between [0,1]:
+    dist = clamp(dist, 0.0, 1.0);
+
+    v_ShadowColor.xyz = vec3(0.0);
+    v_ShadowColor.w   = u_ShadowParams.y * dist;
+}
@@ -17,9 +17,30 @@
 #include "framework/gl_utils.hpp"
 #include "framework/camera.hpp"
 #include "framework/world_rendering.hpp"
+#include "framework/world_cache.hpp"
+#include "framework/spatial_index.hpp"
+#include "framework/concurrent_pool.hpp"
+#include "framework/frame_arena.hpp"
+#include "framework/mpsc_queue.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif // __linux__
 
 // App constants:
 constexpr int initialWinWidth  = 1024;
@@ -27,6 +48,296 @@ constexpr int initialWinHeight = 768;
 constexpr float defaultClearColor[] { 0.0f, 0.0f, 0.0f, 1.0f };
 const std::string baseWindowTitle   { "World BSP demo" };
 
+// Memory budget of the world cache. Maps stay resident until this is exceeded.
+constexpr std::size_t worldCacheMemoryBudget = 64 * 1024 * 1024;
+
+// ========================================================
+// Allocator benchmark helper:
+// ========================================================
+
+// Runs the same allocate/free pattern on 'threadCount' threads and
+// returns the throughput in millions of operations per second.
+template<typename AllocFunc, typename FreeFunc>
+static double runAllocatorBenchmark(const int threadCount, AllocFunc allocFunc, FreeFunc freeFunc)
+{
+    constexpr int rounds = 2000;
+    constexpr int objectsPerRound = 256;
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&allocFunc, &freeFunc]()
+        {
+            void * objects[objectsPerRound];
+            for (int r = 0; r < rounds; ++r)
+            {
+                for (int i = 0; i < objectsPerRound; ++i)
+                {
+                    objects[i] = allocFunc();
+                    *static_cast<int *>(objects[i]) = i; // Touch the memory.
+                }
+
+                // Free out of allocation order to scramble the free lists a bit.
+                for (int i = 0; i < objectsPerRound; i += 2) { freeFunc(objects[i]); }
+                for (int i = 1; i < objectsPerRound; i += 2) { freeFunc(objects[i]); }
+            }
+        });
+    }
+
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    const double elapsedMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    return (2.0 * threadCount * rounds * objectsPerRound) / (elapsedMs * 1000.0);
+}
+
+// ========================================================
+// Cross-thread queue benchmark helpers:
+// ========================================================
+
+struct QueueBenchmarkItem final
+    : public MPSCQueueNode
+{
+    int producer = 0;
+    int sequence = 0;
+};
+
+// Receives the items on the consumer side and checks that each
+// producer's items arrive in the order they were pushed.
+struct QueueBenchmarkConsumer final
+{
+    std::vector<int> nextSequence;
+    int  received = 0;
+    bool inOrder  = true;
+
+    void operator()(const QueueBenchmarkItem * item)
+    {
+        if (item->sequence != nextSequence[item->producer])
+        {
+            inOrder = false;
+        }
+        nextSequence[item->producer] = item->sequence + 1;
+        ++received;
+    }
+};
+
+// 'producerCount' threads push their items while the calling thread consumes them.
+// Returns the throughput in millions of items per second, or a negative value if
+// items were lost or came out of order.
+template<typename PushFunc, typename DrainFunc>
+static double runQueueHandoffBenchmark(const int producerCount, PushFunc pushFunc, DrainFunc drainFunc)
+{
+    constexpr int itemsPerProducer = 50000;
+    const int totalItems = producerCount * itemsPerProducer;
+
+    std::vector<QueueBenchmarkItem> items(totalItems);
+    QueueBenchmarkConsumer consumer;
+    consumer.nextSequence.assign(producerCount, 0);
+
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producerCount; ++p)
+    {
+        producers.emplace_back([&items, &pushFunc, p]()
+        {
+            for (int i = 0; i < itemsPerProducer; ++i)
+            {
+                QueueBenchmarkItem * item = &items[p * itemsPerProducer + i];
+                item->producer = p;
+                item->sequence = i;
+                pushFunc(item);
+            }
+        });
+    }
+
+    while (consumer.received < totalItems)
+    {
+        if (drainFunc(consumer) == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto & thread : producers)
+    {
+        thread.join();
+    }
+
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    const double elapsedMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+    if (!consumer.inOrder || consumer.received != totalItems)
+    {
+        return -1.0;
+    }
+    return totalItems / (elapsedMs * 1000.0);
+}
+
+// One round of the MPSCQueue stress test: 'producerCount' threads each own a few items
+// and push them over and over, while the calling thread consumes them with a mix of
+// pop(), small drain() batches and empty(). Each consumed item goes back to its producer
+// through a per-producer return queue, with the roles swapped, so the links are reused
+// constantly and the queues stay near empty, where pop() has to deal with the stub node
+// and pushes that are halfway done. Returns false if items were lost or came out of order.
+static bool runQueueStressRound(const int producerCount, const int pushesPerProducer)
+{
+    constexpr int itemsPerProducer = 4;
+
+    std::vector<QueueBenchmarkItem> items(producerCount * itemsPerProducer);
+    std::vector<MPSCQueue<QueueBenchmarkItem>> returnQueues(producerCount);
+    MPSCQueue<QueueBenchmarkItem> queue;
+
+    QueueBenchmarkConsumer consumer;
+    consumer.nextSequence.assign(producerCount, 0);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producerCount; ++p)
+    {
+        producers.emplace_back([&items, &returnQueues, &queue, p, pushesPerProducer]()
+        {
+            int freeItems = itemsPerProducer; // Not pushed yet, at the start of the range.
+            for (int i = 0; i < pushesPerProducer; ++i)
+            {
+                QueueBenchmarkItem * item = nullptr;
+                if (freeItems > 0)
+                {
+                    item = &items[p * itemsPerProducer + (--freeItems)];
+                }
+                else
+                {
+                    while ((item = returnQueues[p].pop()) == nullptr)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+
+                item->producer = p;
+                item->sequence = i;
+                queue.push(item);
+            }
+        });
+    }
+
+    const auto consume = [&consumer, &returnQueues](QueueBenchmarkItem * item)
+    {
+        consumer(item);
+        returnQueues[item->producer].push(item);
+    };
+
+    const int totalItems = producerCount * pushesPerProducer;
+    for (int step = 0; consumer.received < totalItems; ++step)
+    {
+        int count = 0;
+        switch (step % 3)
+        {
+        case 0 :
+            if (QueueBenchmarkItem * item = queue.pop())
+            {
+                consume(item);
+                count = 1;
+            }
+            break;
+        case 1 :
+            count = queue.drain(consume, 3);
+            break;
+        default :
+            count = queue.empty() ? 0 : queue.drain(consume);
+            break;
+        } // switch (step % 3)
+
+        if (count == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto & thread : producers)
+    {
+        thread.join();
+    }
+
+    // Everything pushed was consumed, so nothing is left.
+    return consumer.inOrder && consumer.received == totalItems && queue.empty() && queue.pop() == nullptr;
+}
+
+// ========================================================
+// TLB miss counter for the page storage benchmark:
+// ========================================================
+
+// Counts the data TLB load misses of the calling thread through the Linux
+// perf events interface. Not available on other systems, or if the kernel
+// won't allow it (see /proc/sys/kernel/perf_event_paranoid).
+class TlbMissCounter final
+{
+public:
+
+    TlbMissCounter()
+    {
+        #ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HW_CACHE;
+        attr.config         = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        #endif // __linux__
+    }
+
+    ~TlbMissCounter()
+    {
+        #ifdef __linux__
+        if (fd >= 0) { close(fd); }
+        #endif // __linux__
+    }
+
+    TlbMissCounter(const TlbMissCounter &) = delete;
+    TlbMissCounter & operator = (const TlbMissCounter &) = delete;
+
+    bool isAvailable() const noexcept { return fd >= 0; }
+
+    void start()
+    {
+        #ifdef __linux__
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        #endif // __linux__
+    }
+
+    // Returns the misses since start(), or -1 if the counter is not available.
+    long long stop()
+    {
+        long long count = -1;
+        #ifdef __linux__
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+            {
+                count = -1;
+            }
+        }
+        #endif // __linux__
+        return count;
+    }
+
+private:
+
+    int fd = -1;
+};
+
 // ========================================================
 // class WorldBspApp:
 // ========================================================
@@ -39,10 +350,20 @@ private:
     //
     // World rendering data:
     //
-    World::RenderData world{ *this };
+    World::WorldCache worldCache{ *this, worldCacheMemoryBudget };
+    World::RenderData * world = nullptr; // Owned by the cache.
     GLBatchLineRenderer lineRenderer{ *this, 64 };
 
     int currentWorldMap = 0;
+    int pendingWorldMap = -1; // Map requested with 'n' still loading in the background.
+    int editCount       = 0;  // Incremental edits applied with 'e'.
+    int editPolyId      = -1; // Polygon the edit demo inserted and keeps moving around.
+
+    // Alternate spatial index, selected with 'i'. The BSP uses the regular world render path.
+    World::SpatialIndexType  spatialIndexType = World::SpatialIndexType::Bsp;
+    World::SpatialIndex::Ptr spatialIndex;
+    World::VisibleSet        visibleSet;
+    double                   lastQueryTimeMs = 0.0;
     const char * worldMapNames[2]{ "assets/maps/sample1.txt", "assets/maps/sample2.txt" };
 
     Frustum frustum{};
@@ -90,6 +411,18 @@ public:
     void onKey(int key, int action, int mods) override;
     void onKeyChar(unsigned int chr) override;
     void scrPrintF(const char * format, ...) ATTR_PRINTF_FUNC(2, 3);
+
+private:
+
+    void checkPendingWorldMap();
+    void applyDemoEdit();
+    void runSpatialIndexBenchmark();
+    void runPoolBenchmark();
+    void runQueueBenchmark();
+    void runQueueStressTest();
+    void reportAndShrinkPools();
+    void runPageStorageBenchmark();
+    void setCurrentWorld(World::RenderData * newWorld, int mapIndex, bool cacheHit);
 };
 
 // ========================================================
@@ -107,18 +440,451 @@ void WorldBspApp::onInit()
     // Disable so we can look at the world map from outside.
     glDisable(GL_CULL_FACE);
 
-    if (!World::createFromDatafile(&world, worldMapNames[currentWorldMap]))
+    // The first map has nothing to hide the load behind, so block on it.
+    World::RenderData * firstWorld = worldCache.loadNow(worldMapNames[currentWorldMap]);
+    if (firstWorld == nullptr)
     {
         errorF("Unable to load world geometry from file \"%s\"!", worldMapNames[currentWorldMap]);
     }
+    setCurrentWorld(firstWorld, currentWorldMap, /* cacheHit = */ false);
+
+    // Start loading the next one right away so that 'n' is instantaneous.
+    worldCache.preload(worldMapNames[(currentWorldMap + 1) % arrayLength(worldMapNames)]);
+}
+
+void WorldBspApp::checkPendingWorldMap()
+{
+    if (pendingWorldMap < 0)
+    {
+        return;
+    }
+
+    const char * mapName = worldMapNames[pendingWorldMap];
+    if (World::RenderData * newWorld = worldCache.find(mapName))
+    {
+        setCurrentWorld(newWorld, pendingWorldMap, /* cacheHit = */ false);
+        pendingWorldMap = -1;
+    }
+    else if (worldCache.checkFailed(mapName))
+    {
+        pendingWorldMap = -1;
+        errorF("Unable to load world geometry from file \"%s\"!", mapName);
+    }
+}
+
+void WorldBspApp::setCurrentWorld(World::RenderData * newWorld, const int mapIndex, const bool cacheHit)
+{
+    assert(newWorld != nullptr);
+
+    world = newWorld;
+    currentWorldMap = mapIndex;
+    spatialIndex.reset(); // Rebuilt on demand for the new world.
+
+    // The edit demo polygon id belongs to the previous world. The next 'e' inserts a new one.
+    editPolyId = -1;
+    editCount  = 0;
+    World::setDebugCountersFromBuild(*world);
+
+    if (cacheHit)
+    {
+        printF("World \"%s\" was resident in the cache, switched with no load.", worldMapNames[mapIndex]);
+    }
     else
     {
-        printF("World geometry loaded and BSP Tree built.");
-        setWindowTitle(baseWindowTitle + " => " + worldMapNames[currentWorldMap]);
+        // The worst frame is the hitch we took on the main thread for this map.
+        const auto & report = worldCache.getLastLoadReport();
+        printF("World geometry loaded and BSP Tree built. Switch hitch: %.3fms (build %.2fms on the worker).",
+               report.worstFrameMs, report.buildTimeMs);
+        printF("Reclaimed %.2f KB of empty pool blocks after the build.", report.poolBytesFreed / 1024.0);
+    }
+
+    printF("World cache: %i map(s) resident, %.2f of %.2f MB in use.",
+           worldCache.getResidentCount(), worldCache.getResidentBytes() / 1048576.0,
+           worldCache.getMemoryBudget() / 1048576.0);
+
+    setWindowTitle(baseWindowTitle + " => " + worldMapNames[mapIndex]);
+
+    lineRenderer.clear();
+    lineRenderer.addBoundingBox(Point3{ world->bounds.mins },
+                                Point3{ world->bounds.maxs },
+                                Vec4{ 1.0f, 1.0f, 0.0f, 1.0f });
+}
+
+void WorldBspApp::applyDemoEdit()
+{
+    //
+    // Simulates a level editor change: a small triangle is inserted near the
+    // world center, then moved around by each subsequent edit. The incremental
+    // update is timed against a full rebuild of the same geometry.
+    //
+    const Vec3 center = (world->bounds.mins + world->bounds.maxs) * 0.5f;
+    const Vec3 extent = (world->bounds.maxs - world->bounds.mins) * 0.25f;
+    const float offset = -1.0f + 0.5f * (editCount % 5);
+
+    World::PolygonEdit edit;
+    edit.type   = (editPolyId < 0 ? World::PolygonEdit::Insert : World::PolygonEdit::Modify);
+    edit.polyId = editPolyId;
+
+    const float corners[3][5]{
+        { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+        { 0.5f, 0.0f, 0.0f, 1.0f, 0.0f },
+        { 0.0f, 0.5f, 0.0f, 0.0f, 1.0f }
+    };
+    for (int v = 0; v < 3; ++v)
+    {
+        edit.triangle.verts[v][0] = center[0] + extent[0] * (offset + corners[v][0]);
+        edit.triangle.verts[v][1] = center[1] + extent[1] * (corners[v][1]);
+        edit.triangle.verts[v][2] = center[2] + extent[2] * (offset * 0.5f);
+        edit.triangle.verts[v][3] = corners[v][3];
+        edit.triangle.verts[v][4] = corners[v][4];
+    }
+
+    const auto editStartTime = std::chrono::high_resolution_clock::now();
+    const World::EditStats stats = World::applyPolygonEdits(world, &edit, 1);
+    world->updateGLVertexArray();
+    const auto editEndTime = std::chrono::high_resolution_clock::now();
+
+    editPolyId = edit.polyId;
+    ++editCount;
+    spatialIndex.reset(); // Holds pointers to polygons that might have been freed.
+    World::setDebugCountersFromBuild(*world);
+    worldCache.updateMemoryBytes(world);
+
+    // Same geometry from scratch, for comparison:
+    std::vector<World::Triangle> worldPolys;
+    World::extractTriangles(*world, &worldPolys);
+
+    World::RenderData scratchWorld{ *this };
+    const auto rebuildStartTime = std::chrono::high_resolution_clock::now();
+    World::buildFromPolygons(&scratchWorld, worldPolys.data(), worldPolys.size(), world->hasBspTree());
+    scratchWorld.submitGLVertexArray();
+    const auto rebuildEndTime = std::chrono::high_resolution_clock::now();
+
+    const double editMs    = std::chrono::duration<double, std::milli>(editEndTime - editStartTime).count();
+    const double rebuildMs = std::chrono::duration<double, std::milli>(rebuildEndTime - rebuildStartTime).count();
+
+    printF("Edit #%i: %i leaves re-split, %i portal planes, %i/%i portals removed/added%s.",
+           editCount, stats.leavesTouched, stats.portalPlanes, stats.portalsRemoved, stats.portalsAdded,
+           (stats.rebalanced ? ", rebalanced" : (stats.fullRebuild ? ", full rebuild (bounds grew)" : "")));
+    printF("Edit-to-render: incremental %.3fms (tree %.3fms) vs full rebuild %.3fms.",
+           editMs, stats.editTimeMs, rebuildMs);
+}
+
+void WorldBspApp::runSpatialIndexBenchmark()
+{
+    // Compares the spatial indexes over the same triangles and from the current camera view.
+    constexpr int queryRuns = 100;
+    printF("---- Spatial index benchmark for \"%s\" (%i query runs) ----",
+           worldMapNames[currentWorldMap], queryRuns);
+
+    for (int t = 0; t < static_cast<int>(World::SpatialIndexType::Count); ++t)
+    {
+        const auto type = static_cast<World::SpatialIndexType>(t);
+        if (type == World::SpatialIndexType::Bsp && !world->hasBspTree())
+        {
+            printF("%-6s : world was loaded without a BSP tree.", World::spatialIndexTypeToString(type));
+            continue;
+        }
 
-        lineRenderer.addBoundingBox(Point3{ world.bounds.mins },
-                                    Point3{ world.bounds.maxs },
-                                    Vec4{ 1.0f, 1.0f, 0.0f, 1.0f });
+        auto index = World::SpatialIndex::create(type);
+        index->build(*world);
+
+        World::VisibleSet querySet;
+        const auto queryStartTime = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < queryRuns; ++r)
+        {
+            index->queryVisible(camera.eye, frustum, /* frontToBack = */ true, &querySet);
+        }
+        const auto queryEndTime = std::chrono::high_resolution_clock::now();
+        const double queryMs = std::chrono::duration<double, std::milli>(queryEndTime - queryStartTime).count() / queryRuns;
+
+        const int totalPolys = index->getPolygonCount();
+        const int visiblePolys = querySet.polygons.size();
+        const double culledPercent = (totalPolys > 0 ? 100.0 * (totalPolys - visiblePolys) / totalPolys : 0.0);
+
+        printF("%-6s : build %.3fms, %.2f KB, %i nodes | %i of %i polys visible (%.1f%% culled), "
+               "%i nodes visited (%i culled) | query %.4fms/frame",
+               World::spatialIndexTypeToString(type), index->getBuildTimeMs(),
+               index->getMemoryFootprint() / 1024.0, index->getNodeCount(),
+               visiblePolys, totalPolys, culledPercent, querySet.nodesVisited,
+               querySet.nodesCulled, queryMs);
+    }
+}
+
+void WorldBspApp::runPoolBenchmark()
+{
+    // Compares the pool allocators used by the world data against malloc.
+    // The plain Pool is single-threaded, so it only runs on one thread,
+    // and is wrapped with a mutex for the multi-threaded runs.
+    using SharedPool = ConcurrentPool<World::Polygon, 256>;
+    printF("---- Pool allocator benchmark (%i byte objects, millions of ops/sec) ----",
+           static_cast<int>(sizeof(World::Polygon)));
+
+    const int threadCounts[]{ 1, 2, 4, 8 };
+    for (const int threadCount : threadCounts)
+    {
+        const double mallocMops = runAllocatorBenchmark(threadCount,
+            []() { return std::malloc(sizeof(World::Polygon)); },
+            [](void * ptr) { std::free(ptr); });
+
+        World::PolygonPool lockedPool;
+        std::mutex poolMutex;
+        const double lockedMops = runAllocatorBenchmark(threadCount,
+            [&]() { std::lock_guard<std::mutex> lock{ poolMutex }; return lockedPool.allocate(); },
+            [&](void * ptr) { std::lock_guard<std::mutex> lock{ poolMutex }; lockedPool.deallocate(ptr); });
+
+        SharedPool sharedPool;
+        const double sharedMops = runAllocatorBenchmark(threadCount,
+            [&]() { return sharedPool.allocate(); },
+            [&](void * ptr) { sharedPool.deallocate(ptr); });
+
+        if (threadCount == 1)
+        {
+            World::PolygonPool pool;
+            const double poolMops = runAllocatorBenchmark(threadCount,
+                [&]() { return pool.allocate(); },
+                [&](void * ptr) { pool.deallocate(ptr); });
+
+            printF("%i thread  : Pool %7.1f | malloc %7.1f | Pool+mutex %7.1f | ConcurrentPool %7.1f (%i blocks)",
+                   threadCount, poolMops, mallocMops, lockedMops, sharedMops, sharedPool.getSize());
+        }
+        else
+        {
+            printF("%i threads : Pool %7s | malloc %7.1f | Pool+mutex %7.1f | ConcurrentPool %7.1f (%i blocks)",
+                   threadCount, "-", mallocMops, lockedMops, sharedMops, sharedPool.getSize());
+        }
+    }
+}
+
+void WorldBspApp::runQueueBenchmark()
+{
+    // Hand-off of finished work from N producer threads to one consumer thread,
+    // like the world cache worker handing built maps back to the main thread.
+    // The mutex version swaps the whole deque out under the lock, so both drain in batches.
+    printF("---- Cross-thread queue benchmark (millions of items/sec) ----");
+
+    const int producerCounts[]{ 1, 2, 4, 8, 16 };
+    for (const int producerCount : producerCounts)
+    {
+        std::mutex queueMutex;
+        std::deque<QueueBenchmarkItem *> lockedQueue;
+        std::deque<QueueBenchmarkItem *> consumerBatch;
+
+        const double lockedMops = runQueueHandoffBenchmark(producerCount,
+            [&](QueueBenchmarkItem * item)
+            {
+                std::lock_guard<std::mutex> lock{ queueMutex };
+                lockedQueue.push_back(item);
+            },
+            [&](QueueBenchmarkConsumer & consumer)
+            {
+                {
+                    std::lock_guard<std::mutex> lock{ queueMutex };
+                    consumerBatch.swap(lockedQueue);
+                }
+                const int count = static_cast<int>(consumerBatch.size());
+                for (const QueueBenchmarkItem * item : consumerBatch)
+                {
+                    consumer(item);
+                }
+                consumerBatch.clear();
+                return count;
+            });
+
+        MPSCQueue<QueueBenchmarkItem> mpscQueue;
+        const double mpscMops = runQueueHandoffBenchmark(producerCount,
+            [&](QueueBenchmarkItem * item)
+            {
+                mpscQueue.push(item);
+            },
+            [&](QueueBenchmarkConsumer & consumer)
+            {
+                return mpscQueue.drain([&consumer](const QueueBenchmarkItem * item) { consumer(item); });
+            });
+
+        if (lockedMops < 0.0 || mpscMops < 0.0)
+        {
+            printF("%2i producer(s): items lost or out of order! (mutex+deque %s, MPSCQueue %s)",
+                   producerCount, (lockedMops < 0.0 ? "FAILED" : "ok"), (mpscMops < 0.0 ? "FAILED" : "ok"));
+            continue;
+        }
+
+        printF("%2i producer(s): mutex+deque %7.2f | MPSCQueue %7.2f | %.2fx",
+               producerCount, lockedMops, mpscMops, mpscMops / lockedMops);
+    }
+}
+
+void WorldBspApp::runQueueStressTest()
+{
+    // Correctness rather than speed. Also worth running in a ThreadSanitizer
+    // build (-fsanitize=thread), which checks the memory ordering of the queue.
+    constexpr int rounds            = 20;
+    constexpr int pushesPerProducer = 20000;
+
+    printF("---- MPSCQueue stress test (%i rounds of %i pushes per producer) ----", rounds, pushesPerProducer);
+
+    bool allPassed = true;
+    const int producerCounts[]{ 1, 2, 4, 8 };
+    for (const int producerCount : producerCounts)
+    {
+        const auto startTime = std::chrono::high_resolution_clock::now();
+
+        int failedRounds = 0;
+        for (int r = 0; r < rounds; ++r)
+        {
+            if (!runQueueStressRound(producerCount, pushesPerProducer))
+            {
+                ++failedRounds;
+            }
+        }
+
+        const auto endTime = std::chrono::high_resolution_clock::now();
+        const double elapsedMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+        printF("%i producer(s): %i items in %.1f ms, %s", producerCount, rounds * producerCount * pushesPerProducer,
+               elapsedMs, (failedRounds == 0 ? "OK" : "items lost or out of order!"));
+        allPassed = allPassed && (failedRounds == 0);
+    }
+
+    printF("MPSCQueue stress test %s.", (allPassed ? "passed" : "FAILED"));
+}
+
+void WorldBspApp::reportAndShrinkPools()
+{
+    // Prints how much memory the world pools hold versus what is actually
+    // in use, then gives the empty blocks back to the system.
+    const World::PoolStats stats = world->getPoolStats();
+    const struct { const char * name; const PoolMemoryStats & mem; } pools[]{
+        { "Polygons", stats.polygons },
+        { "BspNodes", stats.bspNodes },
+        { "Portals",  stats.portals  }
+    };
+
+    printF("---- World pool memory for \"%s\" ----", worldMapNames[currentWorldMap]);
+    for (const auto & pool : pools)
+    {
+        printF("%-8s : %i blocks (%i empty, %i partial, %i full) | reserved %.2f KB (peak %.2f) | "
+               "live %.2f KB (peak %.2f) | %.1f%% used | %.2f KB reclaimable | %.1f%% of free slots fragmented",
+               pool.name, pool.mem.blockCount, pool.mem.emptyBlocks, pool.mem.partialBlocks, pool.mem.fullBlocks,
+               pool.mem.bytesReserved / 1024.0, pool.mem.peakBytesReserved / 1024.0,
+               pool.mem.bytesLive / 1024.0, pool.mem.peakBytesLive / 1024.0,
+               pool.mem.utilization * 100.0f, pool.mem.bytesReclaimable / 1024.0,
+               pool.mem.fragmentation * 100.0f);
+    }
+
+    const std::size_t bytesFreed = world->shrinkPools();
+    worldCache.updateMemoryBytes(world);
+    printF("Shrink freed %.2f KB. World cache: %.2f MB in use.", bytesFreed / 1024.0,
+           worldCache.getResidentBytes() / 1048576.0);
+}
+
+void WorldBspApp::runPageStorageBenchmark()
+{
+    // A big synthetic world made of copies of the current map laid out in a grid, built
+    // with heap-backed and page-backed pools. Timing and data TLB misses are taken for the
+    // BSP/portal build and for a walk over all polygons in random order, which is where
+    // the huge pages should help.
+    constexpr int gridSize   = 6;
+    constexpr int walkPasses = 200;
+
+    std::vector<World::Triangle> mapPolys;
+    if (!World::loadDatafilePolygons(worldMapNames[currentWorldMap], 1.0f, &mapPolys) || mapPolys.empty())
+    {
+        printF("Unable to load \"%s\" for the benchmark.", worldMapNames[currentWorldMap]);
+        return;
+    }
+
+    Vec3 mins{ mapPolys[0].verts[0][0], mapPolys[0].verts[0][1], mapPolys[0].verts[0][2] };
+    Vec3 maxs = mins;
+    for (const auto & tri : mapPolys)
+    {
+        for (const auto & v : tri.verts)
+        {
+            const Vec3 pos{ v[0], v[1], v[2] };
+            mins = minPerElem(mins, pos);
+            maxs = maxPerElem(maxs, pos);
+        }
+    }
+    const Vec3 spacing = (maxs - mins) * 1.25f;
+
+    std::vector<World::Triangle> bigWorldPolys;
+    bigWorldPolys.reserve(mapPolys.size() * gridSize * gridSize);
+    for (int gz = 0; gz < gridSize; ++gz)
+    {
+        for (int gx = 0; gx < gridSize; ++gx)
+        {
+            for (World::Triangle tri : mapPolys)
+            {
+                for (auto & v : tri.verts)
+                {
+                    v[0] += spacing[0] * gx;
+                    v[2] += spacing[2] * gz;
+                }
+                bigWorldPolys.push_back(tri);
+            }
+        }
+    }
+
+    printF("---- Pool storage benchmark: %i triangles (%ix%i copies of \"%s\") ----",
+           static_cast<int>(bigWorldPolys.size()), gridSize, gridSize, worldMapNames[currentWorldMap]);
+
+    TlbMissCounter tlbCounter;
+    if (!tlbCounter.isAvailable())
+    {
+        printF("Note: TLB miss counters are not available on this system.");
+    }
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const bool pageBacked = (pass == 1);
+        World::RenderData bigWorld{ *this };
+
+        PageAllocator::Options pageOptions;
+        if (pageBacked)
+        {
+            bigWorld.usePageBackedPools(pageOptions);
+        }
+
+        tlbCounter.start();
+        World::buildFromPolygons(&bigWorld, bigWorldPolys.data(), bigWorldPolys.size(), /* buildBspTree = */ true);
+        const long long buildTlbMisses = tlbCounter.stop();
+
+        // Random order walk over every polygon, reading the data a culling pass would use.
+        std::vector<const World::Polygon *> polys;
+        for (const World::BspNode * leaf : bigWorld.bspLeafNodes)
+        {
+            const World::Polygon * poly = leaf->polygons.first();
+            for (int i = leaf->polygons.size(); i--; poly = poly->next)
+            {
+                polys.push_back(poly);
+            }
+        }
+        std::shuffle(polys.begin(), polys.end(), std::mt19937{ 1234 });
+
+        float checksum = 0.0f;
+        tlbCounter.start();
+        const auto walkStartTime = std::chrono::high_resolution_clock::now();
+        for (int w = 0; w < walkPasses; ++w)
+        {
+            for (const World::Polygon * poly : polys)
+            {
+                checksum += poly->plane.distance + poly->vertexCount;
+            }
+        }
+        const auto walkEndTime = std::chrono::high_resolution_clock::now();
+        const long long walkTlbMisses = tlbCounter.stop();
+        const double walkMs = std::chrono::duration<double, std::milli>(walkEndTime - walkStartTime).count();
+
+        const PageAllocator * polyPages = bigWorld.polygonPoolAlloc.getPageStorage();
+        printF("%-5s : build %.2fms (%lld dTLB misses) | polygon walk x%i %.2fms (%lld dTLB misses) | "
+               "%i polys, %.2f KB in pools, huge pages %s, guard pages %s [%.1f]",
+               (pageBacked ? "Pages" : "Heap"), bigWorld.buildStats.buildTimeMs, buildTlbMisses,
+               walkPasses, walkMs, walkTlbMisses, static_cast<int>(polys.size()),
+               (bigWorld.polygonPoolAlloc.getBytesReserved() + bigWorld.bspNodePoolAlloc.getBytesReserved() +
+                bigWorld.portalPoolAlloc.getBytesReserved()) / 1024.0,
+               (polyPages != nullptr && polyPages->hasHugePages() ? "on" : "off"),
+               (polyPages != nullptr && polyPages->getOptions().useGuardPages ? "on" : "off"),
+               checksum);
     }
 }
 
@@ -126,6 +892,10 @@ void WorldBspApp::onFrameRender(std::int64_t /* currentTimeMillis */, const std:
 {
     const double deltaSeconds = millisToSeconds(elapsedTimeMillis);
 
+    // Keep rendering the current map until the requested one is ready.
+    checkPendingWorldMap();
+    worldCache.update(world);
+
     camera.checkKeyboardMovement(keys.wDown, keys.sDown, keys.aDown, keys.dDown, deltaSeconds);
     if (mouse.leftButtonDown)
     {
@@ -133,21 +903,44 @@ void WorldBspApp::onFrameRender(std::int64_t /* currentTimeMillis */, const std:
     }
     camera.updateMatrices();
 
+    frustum.computeClippingPlanes(camera.viewMatrix, camera.projMatrix);
+
     World::BspNode * currentLeaf = nullptr;
-    if (World::g_bBuildBspTree && World::g_bRenderUseBsp)
+    if (spatialIndexType != World::SpatialIndexType::Bsp)
     {
-        frustum.computeClippingPlanes(camera.viewMatrix, camera.projMatrix);
-        currentLeaf = World::findLeafRecursive(camera.eye, world.bspRoot);
+        if (spatialIndex == nullptr)
+        {
+            spatialIndex = World::SpatialIndex::create(spatialIndexType);
+            spatialIndex->build(*world);
+            printF("%s built in %.3fms.", World::spatialIndexTypeToString(spatialIndexType), spatialIndex->getBuildTimeMs());
+        }
+
+        const auto queryStartTime = std::chrono::high_resolution_clock::now();
+        spatialIndex->queryVisible(camera.eye, frustum, /* frontToBack = */ true, &visibleSet);
+        const auto queryEndTime = std::chrono::high_resolution_clock::now();
+        lastQueryTimeMs = std::chrono::duration<double, std::milli>(queryEndTime - queryStartTime).count();
+    }
+    else if (world->hasBspTree() && World::g_bRenderUseBsp)
+    {
+        currentLeaf = World::findLeafRecursive(camera.eye, world->bspRoot);
         World::computePotentiallyVisibleSet(camera.eye, frustum, currentLeaf);
     }
 
-    const int numVisLeaves = World::countVisibleLeaves(world);
-    World::render(&world, camera.eye, camera.viewMatrix, camera.vpMatrix);
+    const int numVisLeaves = World::countVisibleLeaves(*world);
+    if (spatialIndexType != World::SpatialIndexType::Bsp)
+    {
+        World::renderPolygons(world, visibleSet.polygons.data(), visibleSet.polygons.size(),
+                              camera.viewMatrix, camera.vpMatrix);
+    }
+    else
+    {
+        World::render(world, camera.eye, camera.viewMatrix, camera.vpMatrix);
+    }
 
     lineRenderer.setLinesMvpMatrix(camera.vpMatrix);
     lineRenderer.drawLines();
 
-    scrPrintF("BSP tree built..........: %s\n", (World::g_bBuildBspTree ? "yes" : "no"));
+    scrPrintF("BSP tree built..........: %s\n", (world->hasBspTree() ? "yes" : "no"));
     scrPrintF("BSP tree rendering......: %s\n", (World::g_bRenderUseBsp ? "yes" : "no"));
     scrPrintF("GL Depth test enabled...: %s\n", (World::g_bRenderWithDepthTest ? "yes" : "no"));
     scrPrintF("Polygons <OnPlane>......: %i\n", World::g_nPolysOnPlane);
@@ -156,10 +949,22 @@ void WorldBspApp::onFrameRender(std::int64_t /* currentTimeMillis */, const std:
     scrPrintF("Polygons <Spanning>.....: %i\n", World::g_nPolysSpanning);
     scrPrintF("Polygons rendered.......: %i\n", World::g_nPolysRendered);
     scrPrintF("Polygon lists rendered..: %i\n", World::g_nPolyListsRendered);
-    scrPrintF("Num portals.............: %i\n", world.bspPortalCount);
-    scrPrintF("Num BSP leaves..........: %i\n", world.bspLeafCount);
+    scrPrintF("Num portals.............: %i\n", world->bspPortalCount);
+    scrPrintF("Num BSP leaves..........: %i\n", world->bspLeafCount);
     scrPrintF("Visible BSP leaves......: %i\n", numVisLeaves);
     scrPrintF("Current BSP leaf........: %i\n", (currentLeaf != nullptr ? currentLeaf->id : -1));
+    scrPrintF("Spatial index...........: %s\n", World::spatialIndexTypeToString(spatialIndexType));
+    if (spatialIndex != nullptr)
+    {
+        scrPrintF("Index nodes visited.....: %i (%i culled)\n", visibleSet.nodesVisited, visibleSet.nodesCulled);
+        scrPrintF("Index query time........: %.3fms\n", lastQueryTimeMs);
+    }
+    scrPrintF("Resident world maps.....: %i (%.2f MB)\n", worldCache.getResidentCount(),
+              worldCache.getResidentBytes() / 1048576.0);
+    scrPrintF("Pending world loads.....: %i\n", worldCache.getPendingCount());
+    scrPrintF("Last map switch hitch...: %.3fms\n", worldCache.getLastLoadReport().worstFrameMs);
+    scrPrintF("Frame arena peak........: %.2f KB\n", getFrameArena().getPeakBytesUsed() / 1024.0);
+    scrPrintF("Last frame heap allocs..: %i\n", getFrameHeapAllocCount());
 
     textRenderer.drawText(getWindowWidth(), getWindowHeight());
     textRenderer.clear();
@@ -242,27 +1047,70 @@ void WorldBspApp::onKeyChar(const unsigned int chr)
 {
     if (chr == 'n') // Cycle the available world maps
     {
-        world.cleanup();
-        currentWorldMap = (currentWorldMap + 1) % arrayLength(worldMapNames);
+        // Relative to a pending request, so repeated presses keep cycling.
+        const int baseMap    = (pendingWorldMap >= 0 ? pendingWorldMap : currentWorldMap);
+        const int nextMap    = (baseMap + 1) % arrayLength(worldMapNames);
+        const char * mapName = worldMapNames[nextMap];
 
-        if (!World::createFromDatafile(&world, worldMapNames[currentWorldMap]))
+        if (World::RenderData * newWorld = worldCache.find(mapName))
         {
-            errorF("Unable to load world geometry from file \"%s\"!", worldMapNames[currentWorldMap]);
+            setCurrentWorld(newWorld, nextMap, /* cacheHit = */ true);
+            pendingWorldMap = -1;
         }
         else
         {
-            printF("World geometry loaded and BSP Tree built.");
-            setWindowTitle(baseWindowTitle + " => " + worldMapNames[currentWorldMap]);
-
-            lineRenderer.clear();
-            lineRenderer.addBoundingBox(Point3{ world.bounds.mins },
-                                        Point3{ world.bounds.maxs },
-                                        Vec4{ 1.0f, 1.0f, 0.0f, 1.0f });
+            printF("Loading world \"%s\" in the background...", mapName);
+            worldCache.preload(mapName);
+            pendingWorldMap = nextMap;
         }
+
+        // Also prefetch the map after it.
+        worldCache.preload(worldMapNames[(nextMap + 1) % arrayLength(worldMapNames)]);
+    }
+    else if (chr == 'i') // Cycle the spatial index used for culling
+    {
+        const int next = (static_cast<int>(spatialIndexType) + 1) % static_cast<int>(World::SpatialIndexType::Count);
+        spatialIndexType = static_cast<World::SpatialIndexType>(next);
+        spatialIndex.reset();
+    }
+    else if (chr == 'm') // Compare the spatial indexes
+    {
+        runSpatialIndexBenchmark();
+    }
+    else if (chr == 'c') // Compare the pool allocators
+    {
+        runPoolBenchmark();
+    }
+    else if (chr == 'q') // Compare the cross-thread queues
+    {
+        runQueueBenchmark();
+    }
+    else if (chr == 'x') // Stress test the MPSC queue for lost or reordered items
+    {
+        runQueueStressTest();
+    }
+    else if (chr == 'r') // Report the world pool memory and reclaim the empty blocks
+    {
+        reportAndShrinkPools();
+    }
+    else if (chr == 'g') // Compare heap and page-backed world pools
+    {
+        runPageStorageBenchmark();
+    }
+    else if (chr == 'e') // Incremental edit demo
+    {
+        applyDemoEdit();
     }
     else if (chr == 't')
     {
         World::g_bBuildBspTree = !World::g_bBuildBspTree;
+
+        // The cache keys the worlds by this flag too, so a map still loading
+        // has to be requested again to be built with the new setting.
+        if (pendingWorldMap >= 0)
+        {
+            worldCache.preload(worldMapNames[pendingWorldMap]);
+        }
     }
     else if (chr == 'b')
     {